@@ -151,3 +151,4 @@
 #cmakedefine HAVE_WRITE
 #cmakedefine HAVE_PTHREAD_MUTEXATTR_SETPSHARED
 #cmakedefine HAVE_PTHREAD_CONDATTR_SETPSHARED
+#cmakedefine HAVE_PTHREAD_SETAFFINITY_NP
@@ -176,7 +176,8 @@ typedef enum {
   GRN_CONTENT_TSV,
   GRN_CONTENT_JSON,
   GRN_CONTENT_XML,
-  GRN_CONTENT_MSGPACK
+  GRN_CONTENT_MSGPACK,
+  GRN_CONTENT_COLUMNAR
 } grn_content_type;
 
 typedef struct _grn_obj grn_obj;
@@ -247,15 +248,27 @@ GRN_API long long int grn_ctx_get_match_escalation_threshold(grn_ctx *ctx);
 GRN_API grn_rc grn_ctx_set_match_escalation_threshold(grn_ctx *ctx, long long int threshold);
 GRN_API long long int grn_get_default_match_escalation_threshold(void);
 GRN_API grn_rc grn_set_default_match_escalation_threshold(long long int threshold);
+GRN_API int grn_ctx_get_n_scan_workers(grn_ctx *ctx);
+GRN_API grn_rc grn_ctx_set_n_scan_workers(grn_ctx *ctx, int n_workers);
+GRN_API int grn_get_default_n_scan_workers(void);
+GRN_API grn_rc grn_set_default_n_scan_workers(int n_workers);
 
 GRN_API int grn_get_lock_timeout(void);
 GRN_API grn_rc grn_set_lock_timeout(int timeout);
+GRN_API int grn_get_n_sort_workers(void);
+GRN_API grn_rc grn_set_n_sort_workers(int n_workers);
+GRN_API int grn_get_sort_parallel_threshold(void);
+GRN_API grn_rc grn_set_sort_parallel_threshold(int threshold);
 
 /* cache */
 #define GRN_CACHE_DEFAULT_MAX_N_ENTRIES 100
+#define GRN_CACHE_DEFAULT_MAX_N_BYTES 0
+#define GRN_CACHE_DEFAULT_WAIT_TIMEOUT 10000
 typedef struct _grn_cache grn_cache;
 
 GRN_API grn_cache *grn_cache_open(grn_ctx *ctx);
+GRN_API grn_cache *grn_persistent_cache_open(grn_ctx *ctx,
+                                             const char *base_path);
 GRN_API grn_rc grn_cache_close(grn_ctx *ctx, grn_cache *cache);
 
 GRN_API grn_rc grn_cache_current_set(grn_ctx *ctx, grn_cache *cache);
@@ -266,6 +279,21 @@ GRN_API grn_rc grn_cache_set_max_n_entries(grn_ctx *ctx,
                                            unsigned int n);
 GRN_API unsigned int grn_cache_get_max_n_entries(grn_ctx *ctx,
                                                  grn_cache *cache);
+GRN_API grn_rc grn_cache_set_max_n_bytes(grn_ctx *ctx,
+                                         grn_cache *cache,
+                                         unsigned long long int n);
+GRN_API unsigned long long int grn_cache_get_max_n_bytes(grn_ctx *ctx,
+                                                         grn_cache *cache);
+GRN_API grn_rc grn_cache_set_stale_window(grn_ctx *ctx,
+                                          grn_cache *cache,
+                                          unsigned int seconds);
+GRN_API unsigned int grn_cache_get_stale_window(grn_ctx *ctx,
+                                                grn_cache *cache);
+GRN_API grn_rc grn_cache_set_wait_timeout(grn_ctx *ctx,
+                                          grn_cache *cache,
+                                          unsigned int msec);
+GRN_API unsigned int grn_cache_get_wait_timeout(grn_ctx *ctx,
+                                                grn_cache *cache);
 
 /* grn_encoding */
 
@@ -296,6 +324,8 @@ typedef unsigned short int grn_obj_flags;
 #define GRN_OBJ_COLUMN_VECTOR          (0x01)
 #define GRN_OBJ_COLUMN_INDEX           (0x02)
 
+#define GRN_OBJ_INDEX_SIMD             (0x01<<3)
+
 #define GRN_OBJ_COMPRESS_MASK          (0x07<<4)
 #define GRN_OBJ_COMPRESS_NONE          (0x00<<4)
 #define GRN_OBJ_COMPRESS_ZLIB          (0x01<<4)
@@ -618,6 +648,7 @@ typedef unsigned int grn_table_group_flags;
 #define GRN_TABLE_GROUP_CALC_MIN       (0x01<<5)
 #define GRN_TABLE_GROUP_CALC_SUM       (0x01<<6)
 #define GRN_TABLE_GROUP_CALC_AVG       (0x01<<7)
+#define GRN_TABLE_GROUP_CALC_COUNT_DISTINCT (0x01<<8)
 
 typedef enum {
   GRN_OP_PUSH = 0,
@@ -708,6 +739,7 @@ struct _grn_table_group_result {
   int limit;
   grn_table_group_flags flags;
   grn_operator op;
+  grn_obj *calc_target;
 };
 
 GRN_API grn_rc grn_table_group(grn_ctx *ctx, grn_obj *table,
@@ -740,6 +772,16 @@ GRN_API unsigned int grn_table_size(grn_ctx *ctx, grn_obj *table);
 #define GRN_COLUMN_NAME_SCORE_LEN     (sizeof(GRN_COLUMN_NAME_SCORE) - 1)
 #define GRN_COLUMN_NAME_NSUBRECS      "_nsubrecs"
 #define GRN_COLUMN_NAME_NSUBRECS_LEN  (sizeof(GRN_COLUMN_NAME_NSUBRECS) - 1)
+#define GRN_COLUMN_NAME_MAX           "_max"
+#define GRN_COLUMN_NAME_MAX_LEN       (sizeof(GRN_COLUMN_NAME_MAX) - 1)
+#define GRN_COLUMN_NAME_MIN           "_min"
+#define GRN_COLUMN_NAME_MIN_LEN       (sizeof(GRN_COLUMN_NAME_MIN) - 1)
+#define GRN_COLUMN_NAME_SUM           "_sum"
+#define GRN_COLUMN_NAME_SUM_LEN       (sizeof(GRN_COLUMN_NAME_SUM) - 1)
+#define GRN_COLUMN_NAME_AVG           "_avg"
+#define GRN_COLUMN_NAME_AVG_LEN       (sizeof(GRN_COLUMN_NAME_AVG) - 1)
+#define GRN_COLUMN_NAME_NDISTINCT     "_ndistinct"
+#define GRN_COLUMN_NAME_NDISTINCT_LEN (sizeof(GRN_COLUMN_NAME_NDISTINCT) - 1)
 
 GRN_API grn_obj *grn_column_create(grn_ctx *ctx, grn_obj *table,
                                    const char *name, unsigned int name_size,
@@ -1772,6 +1814,14 @@ GRN_API grn_obj *grn_table_create_for_group(grn_ctx *ctx,
                                             grn_obj *group_key,
                                             grn_obj *value_type,
                                             unsigned int max_n_subrecs);
+GRN_API grn_obj *grn_table_create_for_group_with_calc(grn_ctx *ctx,
+                                                      const char *name,
+                                                      unsigned int name_size,
+                                                      const char *path,
+                                                      grn_obj *group_key,
+                                                      grn_obj *value_type,
+                                                      unsigned int max_n_subrecs,
+                                                      grn_table_group_flags calc_types);
 
 GRN_API unsigned int grn_table_get_subrecs(grn_ctx *ctx, grn_obj *table,
                                            grn_id id, grn_id *subrecbuf,
@@ -1797,6 +1847,9 @@ GRN_API grn_rc grn_load(grn_ctx *ctx, grn_content_type input_type,
 GRN_API grn_rc grn_ctx_connect(grn_ctx *ctx, const char *host, int port, int flags);
 GRN_API unsigned int grn_ctx_send(grn_ctx *ctx, const char *str, unsigned int str_len, int flags);
 GRN_API unsigned int grn_ctx_recv(grn_ctx *ctx, char **str, unsigned int *str_len, int *flags);
+GRN_API const char *grn_ctx_partial_line_end(grn_ctx *ctx,
+                                             const char *start,
+                                             const char *end);
 
 typedef struct _grn_ctx_info grn_ctx_info;
 
@@ -145,6 +145,8 @@ grn_msg_open(grn_ctx *ctx, grn_com *com, grn_com_queue *old)
   msg->qe.next = NULL;
   msg->u.peer = com;
   msg->old = old;
+  msg->ref_body = NULL;
+  msg->ref_body_size = 0;
   memset(&msg->header, 0, sizeof(grn_com_header));
   return (grn_obj *)msg;
 }
@@ -180,6 +182,21 @@ grn_msg_set_property(grn_ctx *ctx, grn_obj *obj,
   return GRN_SUCCESS;
 }
 
+/* Copies ref_body into the body because the msg is sent later. */
+static void
+grn_msg_flatten_ref_body(grn_ctx *ctx, grn_msg *m)
+{
+  grn_obj *msg = (grn_obj *)m;
+  uint32_t size = GRN_BULK_VSIZE(msg);
+  if (!m->ref_body) { return; }
+  if (!grn_bulk_space(ctx, msg, m->ref_body_size)) {
+    memmove(GRN_BULK_HEAD(msg) + m->ref_body_size, GRN_BULK_HEAD(msg), size);
+    memcpy(GRN_BULK_HEAD(msg), m->ref_body, m->ref_body_size);
+  }
+  m->ref_body = NULL;
+  m->ref_body_size = 0;
+}
+
 grn_rc
 grn_msg_send(grn_ctx *ctx, grn_obj *msg, int flags)
 {
@@ -187,11 +204,23 @@ grn_msg_send(grn_ctx *ctx, grn_obj *msg, int flags)
   grn_msg *m = (grn_msg *)msg;
   grn_com *peer = m->u.peer;
   grn_com_header *header = &m->header;
+  const char *bodies[2];
+  uint32_t sizes[2];
+  int n_bodies = 0;
+  if (m->ref_body) {
+    bodies[n_bodies] = m->ref_body;
+    sizes[n_bodies] = m->ref_body_size;
+    n_bodies++;
+  }
+  bodies[n_bodies] = GRN_BULK_HEAD(msg);
+  sizes[n_bodies] = GRN_BULK_VSIZE(msg);
+  n_bodies++;
   if (GRN_COM_QUEUE_EMPTYP(&peer->new_)) {
     switch (header->proto) {
     case GRN_COM_PROTO_HTTP :
       {
         ssize_t ret;
+        grn_msg_flatten_ref_body(ctx, m);
         ret = send(peer->fd, GRN_BULK_HEAD(msg), GRN_BULK_VSIZE(msg), MSG_NOSIGNAL);
         if (ret == -1) { SERR("send"); }
         if (ctx->rc != GRN_OPERATION_WOULD_BLOCK) {
@@ -212,9 +241,10 @@ grn_msg_send(grn_ctx *ctx, grn_obj *msg, int flags)
         header->opaque = 0;
         header->cas = 0;
         //todo : MSG_DONTWAIT
-        rc = grn_com_send(ctx, peer, header,
-                          GRN_BULK_HEAD(msg), GRN_BULK_VSIZE(msg), 0);
+        rc = grn_com_sendv(ctx, peer, header, bodies, sizes, n_bodies, 0);
         if (rc != GRN_OPERATION_WOULD_BLOCK) {
+          m->ref_body = NULL;
+          m->ref_body_size = 0;
           grn_com_queue_enque(ctx, m->old, (grn_com_queue_entry *)msg);
           return rc;
         }
@@ -223,10 +253,11 @@ grn_msg_send(grn_ctx *ctx, grn_obj *msg, int flags)
     case GRN_COM_PROTO_MBREQ :
       return GRN_FUNCTION_NOT_IMPLEMENTED;
     case GRN_COM_PROTO_MBRES :
-      rc = grn_com_send(ctx, peer, header,
-                        GRN_BULK_HEAD(msg), GRN_BULK_VSIZE(msg),
-                        (flags & GRN_CTX_MORE) ? MSG_MORE :0);
+      rc = grn_com_sendv(ctx, peer, header, bodies, sizes, n_bodies,
+                         (flags & GRN_CTX_MORE) ? MSG_MORE :0);
       if (rc != GRN_OPERATION_WOULD_BLOCK) {
+        m->ref_body = NULL;
+        m->ref_body_size = 0;
         grn_com_queue_enque(ctx, m->old, (grn_com_queue_entry *)msg);
         return rc;
       }
@@ -235,6 +266,7 @@ grn_msg_send(grn_ctx *ctx, grn_obj *msg, int flags)
       return GRN_INVALID_ARGUMENT;
     }
   }
+  grn_msg_flatten_ref_body(ctx, m);
   MUTEX_LOCK(peer->ev->mutex);
   rc = grn_com_queue_enque(ctx, &peer->new_, (grn_com_queue_entry *)msg);
   COND_SIGNAL(peer->ev->cond);
@@ -433,7 +465,9 @@ grn_com_event_del(grn_ctx *ctx, grn_com_event *ev, grn_sock fd)
         memset(&e, 0, sizeof(struct epoll_event));
         e.data.fd = fd;
         e.events = c->events;
-        if (epoll_ctl(ev->epfd, EPOLL_CTL_DEL, fd, &e) == -1) {
+        /* A suspended com isn't registered. */
+        if (epoll_ctl(ev->epfd, EPOLL_CTL_DEL, fd, &e) == -1 &&
+            errno != ENOENT) {
           SERR("epoll_ctl");
           return ctx->rc;
         }
@@ -442,7 +476,7 @@ grn_com_event_del(grn_ctx *ctx, grn_com_event *ev, grn_sock fd)
 #ifdef USE_KQUEUE
       struct kevent e;
       EV_SET(&e, (fd), c->events, EV_DELETE, 0, 0, NULL);
-      if (kevent(ev->kqfd, &e, 1, NULL, 0, NULL) == -1) {
+      if (kevent(ev->kqfd, &e, 1, NULL, 0, NULL) == -1 && errno != ENOENT) {
         SERR("kevent");
         return ctx->rc;
       }
@@ -455,6 +489,72 @@ grn_com_event_del(grn_ctx *ctx, grn_com_event *ev, grn_sock fd)
   }
 }
 
+/*
+ * grn_com_event_suspend() stops watching com while a worker thread handles
+ * the received message. com is kept in ev. grn_com_event_resume() starts
+ * watching com again. It doesn't touch ev->hash, so a worker thread can call
+ * it while the event loop is polling.
+ */
+grn_rc
+grn_com_event_suspend(grn_ctx *ctx, grn_com_event *ev, grn_com *com)
+{
+  if (!ev || !com) { return GRN_INVALID_ARGUMENT; }
+#ifdef USE_EPOLL
+  {
+    struct epoll_event e;
+    memset(&e, 0, sizeof(struct epoll_event));
+    e.data.fd = com->fd;
+    e.events = com->events;
+    if (epoll_ctl(ev->epfd, EPOLL_CTL_DEL, com->fd, &e) == -1) {
+      SERR("epoll_ctl");
+      return ctx->rc;
+    }
+  }
+#endif /* USE_EPOLL*/
+#ifdef USE_KQUEUE
+  {
+    struct kevent e;
+    EV_SET(&e, com->fd, com->events, EV_DELETE, 0, 0, NULL);
+    if (kevent(ev->kqfd, &e, 1, NULL, 0, NULL) == -1) {
+      SERR("kevent");
+      return ctx->rc;
+    }
+  }
+#endif /* USE_KQUEUE */
+  com->events = 0;
+  return GRN_SUCCESS;
+}
+
+grn_rc
+grn_com_event_resume(grn_ctx *ctx, grn_com_event *ev, grn_com *com)
+{
+  if (!ev || !com) { return GRN_INVALID_ARGUMENT; }
+  com->events = GRN_COM_POLLIN;
+#ifdef USE_EPOLL
+  {
+    struct epoll_event e;
+    memset(&e, 0, sizeof(struct epoll_event));
+    e.data.fd = com->fd;
+    e.events = GRN_COM_POLLIN;
+    if (epoll_ctl(ev->epfd, EPOLL_CTL_ADD, com->fd, &e) == -1) {
+      SERR("epoll_ctl");
+      return ctx->rc;
+    }
+  }
+#endif /* USE_EPOLL*/
+#ifdef USE_KQUEUE
+  {
+    struct kevent e;
+    EV_SET(&e, com->fd, GRN_COM_POLLIN, EV_ADD, 0, 0, NULL);
+    if (kevent(ev->kqfd, &e, 1, NULL, 0, NULL) == -1) {
+      SERR("kevent");
+      return ctx->rc;
+    }
+  }
+#endif /* USE_KQUEUE */
+  return GRN_SUCCESS;
+}
+
 #define LISTEN_BACKLOG 0x1000
 
 grn_rc
@@ -516,6 +616,8 @@ grn_com_receiver(grn_ctx *ctx, grn_com *com)
     ncs->has_sid = 0;
     ncs->closed = 0;
     ncs->opaque = NULL;
+    ncs->n_requests = 0;
+    ncs->last_active_time = 0;
     GRN_COM_QUEUE_INIT(&ncs->new_);
     // GRN_LOG(ctx, GRN_LOG_NOTICE, "accepted (%d)", fd);
     return;
@@ -598,12 +700,15 @@ grn_com_event_poll(grn_ctx *ctx, grn_com_event *ev, int timeout)
   ctx->errlvl = GRN_OK;
   ctx->rc = GRN_SUCCESS;
   GRN_HASH_EACH(ctx, ev->hash, eh, &pfd, &dummy, &com, {
-    ep->fd = *pfd;
-    //    ep->events =(short) com->events;
-    ep->events = POLLIN;
-    ep->revents = 0;
-    ep++;
-    nfd++;
+    /* skip suspended coms */
+    if (com->events) {
+      ep->fd = *pfd;
+      //    ep->events =(short) com->events;
+      ep->events = POLLIN;
+      ep->revents = 0;
+      ep++;
+      nfd++;
+    }
   });
   nevents = poll(ev->events, nfd, timeout);
   if (nevents < 0) {
@@ -691,53 +796,70 @@ grn_com_send_http(grn_ctx *ctx, grn_com *cs, const char *path, uint32_t path_len
   return ctx->rc;
 }
 
+/* Sends the header and the bodies in one call without joining them. */
 grn_rc
-grn_com_send(grn_ctx *ctx, grn_com *cs,
-             grn_com_header *header, const char *body, uint32_t size, int flags)
+grn_com_sendv(grn_ctx *ctx, grn_com *cs, grn_com_header *header,
+              const char **bodies, const uint32_t *sizes, int n_bodies,
+              int flags)
 {
   grn_rc rc = GRN_SUCCESS;
-  size_t whole_size = sizeof(grn_com_header) + size;
+  uint32_t size = 0;
+  size_t whole_size;
   ssize_t ret;
+  int i, n_buffers = 1;
+#ifdef WIN32
+  WSABUF wsabufs[GRN_COM_MAX_N_BODIES + 1];
+  DWORD n_sent;
+#else /* WIN32 */
+  struct iovec msg_iov[GRN_COM_MAX_N_BODIES + 1];
+  struct msghdr msg;
+#endif /* WIN32 */
+
+  if (n_bodies > GRN_COM_MAX_N_BODIES) {
+    ERR(GRN_INVALID_ARGUMENT, "too many bodies: %d", n_bodies);
+    return ctx->rc;
+  }
+#ifdef WIN32
+  wsabufs[0].buf = (char *)header;
+  wsabufs[0].len = sizeof(grn_com_header);
+#else /* WIN32 */
+  msg_iov[0].iov_base = header;
+  msg_iov[0].iov_len = sizeof(grn_com_header);
+#endif /* WIN32 */
+  for (i = 0; i < n_bodies; i++) {
+    if (!sizes[i]) { continue; }
+#ifdef WIN32
+    wsabufs[n_buffers].buf = (char *)bodies[i];
+    wsabufs[n_buffers].len = sizes[i];
+#else /* WIN32 */
+    msg_iov[n_buffers].iov_base = (char *)bodies[i];
+    msg_iov[n_buffers].iov_len = sizes[i];
+#endif /* WIN32 */
+    n_buffers++;
+    size += sizes[i];
+  }
+  whole_size = sizeof(grn_com_header) + size;
   header->size = htonl(size);
   GRN_LOG(ctx, GRN_LOG_INFO, "send (%d,%x,%d,%02x,%02x,%04x)", size, header->flags, header->proto, header->qtype, header->level, header->status);
 
-  if (size) {
 #ifdef WIN32
-    WSABUF wsabufs[2];
-    DWORD n_sent;
-    wsabufs[0].buf = (char *)header;
-    wsabufs[0].len = sizeof(grn_com_header);
-    wsabufs[1].buf = (char *)body;
-    wsabufs[1].len = size;
-    if (WSASend(cs->fd, wsabufs, 2, &n_sent, 0, NULL, NULL) == SOCKET_ERROR) {
-      SERR("WSASend");
-    }
-    ret = n_sent;
+  if (WSASend(cs->fd, wsabufs, n_buffers, &n_sent, 0, NULL, NULL) == SOCKET_ERROR) {
+    SERR("WSASend");
+  }
+  ret = n_sent;
 #else /* WIN32 */
-    struct iovec msg_iov[2];
-    struct msghdr msg;
-    msg.msg_name = NULL;
-    msg.msg_namelen = 0;
-    msg.msg_iov = msg_iov;
-    msg.msg_iovlen = 2;
-    msg.msg_control = NULL;
-    msg.msg_controllen = 0;
-    msg.msg_flags = 0;
-    msg_iov[0].iov_base = header;
-    msg_iov[0].iov_len = sizeof(grn_com_header);
-    msg_iov[1].iov_base = (char *)body;
-    msg_iov[1].iov_len = size;
-    if ((ret = sendmsg(cs->fd, &msg, MSG_NOSIGNAL|flags)) == -1) {
-      SERR("sendmsg");
-      rc = ctx->rc;
-    }
-#endif /* WIN32 */
-  } else {
-    if ((ret = send(cs->fd, (const void *)header, whole_size, MSG_NOSIGNAL|flags)) == -1) {
-      SERR("send");
-      rc = ctx->rc;
-    }
+  msg.msg_name = NULL;
+  msg.msg_namelen = 0;
+  msg.msg_iov = msg_iov;
+  msg.msg_iovlen = n_buffers;
+  msg.msg_control = NULL;
+  msg.msg_controllen = 0;
+  msg.msg_flags = 0;
+  if ((ret = sendmsg(cs->fd, &msg, MSG_NOSIGNAL|flags)) == -1) {
+    SERR("sendmsg");
+    rc = ctx->rc;
   }
+#endif /* WIN32 */
   if (ret != whole_size) {
     GRN_LOG(ctx, GRN_LOG_ERROR, "sendmsg(%d): %" GRN_FMT_LLD " < %" GRN_FMT_LLU,
             cs->fd, (long long int)ret, (unsigned long long int)whole_size);
@@ -746,6 +868,13 @@ grn_com_send(grn_ctx *ctx, grn_com *cs,
   return rc;
 }
 
+grn_rc
+grn_com_send(grn_ctx *ctx, grn_com *cs,
+             grn_com_header *header, const char *body, uint32_t size, int flags)
+{
+  return grn_com_sendv(ctx, cs, header, &body, &size, 1, flags);
+}
+
 #define RETRY_MAX 10
 
 static const char *
@@ -1083,6 +1212,8 @@ grn_com_sopen(grn_ctx *ctx, grn_com_event *ev,
     ev->msg_handler = func;
     cs->has_sid = 0;
     cs->closed = 0;
+    cs->n_requests = 0;
+    cs->last_active_time = 0;
     cs->opaque = NULL;
     GRN_COM_QUEUE_INIT(&cs->new_);
   } else {
@@ -128,6 +128,9 @@ struct _grn_com {
   grn_com_event *ev;
   void *opaque;
   grn_bool accepting;
+  /* for keep-alive connections */
+  uint32_t n_requests;
+  int64_t last_active_time;
 };
 
 struct _grn_com_event {
@@ -166,6 +169,8 @@ grn_rc grn_com_event_stop_accept(grn_ctx *ctx, grn_com_event *ev);
 grn_rc grn_com_event_add(grn_ctx *ctx, grn_com_event *ev, grn_sock fd, int events, grn_com **com);
 grn_rc grn_com_event_mod(grn_ctx *ctx, grn_com_event *ev, grn_sock fd, int events, grn_com **com);
 GRN_API grn_rc grn_com_event_del(grn_ctx *ctx, grn_com_event *ev, grn_sock fd);
+GRN_API grn_rc grn_com_event_suspend(grn_ctx *ctx, grn_com_event *ev, grn_com *com);
+GRN_API grn_rc grn_com_event_resume(grn_ctx *ctx, grn_com_event *ev, grn_com *com);
 GRN_API grn_rc grn_com_event_poll(grn_ctx *ctx, grn_com_event *ev, int timeout);
 grn_rc grn_com_event_each(grn_ctx *ctx, grn_com_event *ev, grn_com_callback *func);
 
@@ -198,6 +203,12 @@ GRN_API grn_rc grn_com_sopen(grn_ctx *ctx, grn_com_event *ev,
 GRN_API void grn_com_close_(grn_ctx *ctx, grn_com *com);
 GRN_API grn_rc grn_com_close(grn_ctx *ctx, grn_com *com);
 
+#define GRN_COM_MAX_N_BODIES 4
+
+GRN_API grn_rc grn_com_sendv(grn_ctx *ctx, grn_com *cs,
+                             grn_com_header *header,
+                             const char **bodies, const uint32_t *sizes,
+                             int n_bodies, int flags);
 GRN_API grn_rc grn_com_send(grn_ctx *ctx, grn_com *cs,
                             grn_com_header *header, const char *body, uint32_t size, int flags);
 grn_rc grn_com_recv(grn_ctx *ctx, grn_com *cs, grn_com_header *header, grn_obj *buf);
@@ -218,6 +229,9 @@ struct _grn_msg {
   grn_com_header header;
   grn_com_addr edge_id;
   grn_com *acceptor;
+  /* Sent before the body without being copied. The sender owns it. */
+  const char *ref_body;
+  uint32_t ref_body_size;
 };
 
 GRN_API grn_rc grn_msg_send(grn_ctx *ctx, grn_obj *msg, int flags);
@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <time.h>
+#include <sys/stat.h>
 #ifdef HAVE_NETINET_IN_H
 #include <netinet/in.h>
 #endif /* HAVE_NETINET_IN_H */
@@ -55,6 +56,8 @@ int grn_pagesize;
 grn_critical_section grn_glock;
 uint32_t grn_gtick;
 int grn_lock_timeout = GRN_LOCK_TIMEOUT;
+int grn_n_sort_workers = 1;
+int grn_sort_parallel_threshold = 100000;
 
 #ifdef USE_UYIELD
 int grn_uyield_count = 0;
@@ -422,6 +425,8 @@ grn_ctx_loader_clear(grn_ctx *ctx)
 
 #define IMPL_SIZE ((sizeof(struct _grn_ctx_impl) + (grn_pagesize - 1)) & ~(grn_pagesize - 1))
 
+#define GRN_DEFAULT_N_SCAN_WORKERS 1
+
 #ifdef GRN_WITH_MESSAGE_PACK
 static inline int
 grn_msgpack_buffer_write(void *data, const char *buf, unsigned int len)
@@ -491,11 +496,25 @@ grn_ctx_impl_init(grn_ctx *ctx)
       grn_get_default_match_escalation_threshold();
   }
 
+  ctx->impl->match_top_k = 0;
+
+  if (ctx == &grn_gctx) {
+    ctx->impl->n_scan_workers = GRN_DEFAULT_N_SCAN_WORKERS;
+  } else {
+    ctx->impl->n_scan_workers = grn_get_default_n_scan_workers();
+  }
+
   ctx->impl->finalizer = NULL;
+  ctx->impl->dependencies = NULL;
 
   ctx->impl->com = NULL;
   ctx->impl->outbuf = grn_obj_open(ctx, GRN_BULK, 0, 0);
   ctx->impl->output = NULL;
+  ctx->impl->output_ref_enabled = GRN_FALSE;
+  ctx->impl->output_ref = NULL;
+  ctx->impl->output_ref_cache = NULL;
+  ctx->impl->output_chunk_size = 0;
+  ctx->impl->n_output_chunks = 0;
   ctx->impl->data.ptr = NULL;
   ctx->impl->tv.tv_sec = 0;
   ctx->impl->tv.tv_nsec = 0;
@@ -654,6 +673,7 @@ grn_ctx_fin(grn_ctx *ctx)
     GRN_OBJ_FIN(ctx, &ctx->impl->names);
     GRN_OBJ_FIN(ctx, &ctx->impl->levels);
     GRN_OBJ_FIN(ctx, &ctx->impl->query_log_buf);
+    grn_ctx_output_ref_clear(ctx);
     rc = grn_obj_close(ctx, ctx->impl->outbuf);
     {
       grn_hash **vp;
@@ -1216,6 +1236,43 @@ check_grn_ja_skip_same_value_put(grn_ctx *ctx)
   }
 }
 
+static void
+check_grn_n_scan_workers(grn_ctx *ctx)
+{
+  const char *grn_n_scan_workers_env;
+
+  grn_n_scan_workers_env = getenv("GRN_N_SCAN_WORKERS");
+  if (grn_n_scan_workers_env) {
+    int n_workers = atoi(grn_n_scan_workers_env);
+    if (n_workers > 0) {
+      grn_set_default_n_scan_workers(n_workers);
+    }
+  }
+}
+
+static void
+check_grn_sort_workers(grn_ctx *ctx)
+{
+  const char *grn_n_sort_workers_env;
+  const char *grn_sort_parallel_threshold_env;
+
+  grn_n_sort_workers_env = getenv("GRN_N_SORT_WORKERS");
+  if (grn_n_sort_workers_env) {
+    int n_workers = atoi(grn_n_sort_workers_env);
+    if (n_workers > 0) {
+      grn_set_n_sort_workers(n_workers);
+    }
+  }
+
+  grn_sort_parallel_threshold_env = getenv("GRN_SORT_PARALLEL_THRESHOLD");
+  if (grn_sort_parallel_threshold_env) {
+    int threshold = atoi(grn_sort_parallel_threshold_env);
+    if (threshold > 0) {
+      grn_set_sort_parallel_threshold(threshold);
+    }
+  }
+}
+
 grn_rc
 grn_init(void)
 {
@@ -1296,6 +1353,8 @@ grn_init(void)
   GRN_LOG(ctx, GRN_LOG_NOTICE, "grn_init");
   check_overcommit_memory(ctx);
   check_grn_ja_skip_same_value_put(ctx);
+  check_grn_n_scan_workers(ctx);
+  check_grn_sort_workers(ctx);
   return rc;
 }
 
@@ -1349,6 +1408,18 @@ grn_set_default_match_escalation_threshold(long long int threshold)
   return grn_ctx_set_match_escalation_threshold(&grn_gctx, threshold);
 }
 
+int
+grn_get_default_n_scan_workers(void)
+{
+  return grn_ctx_get_n_scan_workers(&grn_gctx);
+}
+
+grn_rc
+grn_set_default_n_scan_workers(int n_workers)
+{
+  return grn_ctx_set_n_scan_workers(&grn_gctx, n_workers);
+}
+
 int
 grn_get_lock_timeout(void)
 {
@@ -1362,6 +1433,38 @@ grn_set_lock_timeout(int timeout)
   return GRN_SUCCESS;
 }
 
+int
+grn_get_n_sort_workers(void)
+{
+  return grn_n_sort_workers;
+}
+
+grn_rc
+grn_set_n_sort_workers(int n_workers)
+{
+  if (n_workers < 1) {
+    return GRN_INVALID_ARGUMENT;
+  }
+  grn_n_sort_workers = n_workers;
+  return GRN_SUCCESS;
+}
+
+int
+grn_get_sort_parallel_threshold(void)
+{
+  return grn_sort_parallel_threshold;
+}
+
+grn_rc
+grn_set_sort_parallel_threshold(int threshold)
+{
+  if (threshold < 0) {
+    return GRN_INVALID_ARGUMENT;
+  }
+  grn_sort_parallel_threshold = threshold;
+  return GRN_SUCCESS;
+}
+
 static int alloc_count = 0;
 
 grn_rc
@@ -1371,6 +1474,7 @@ grn_fin(void)
   if (grn_gctx.stat == GRN_CTX_FIN) { return GRN_INVALID_ARGUMENT; }
   for (ctx = grn_gctx.next; ctx != &grn_gctx; ctx = ctx_) {
     ctx_ = ctx->next;
+    if (ctx->flags & GRN_CTX_FIN_BY_OWNER) { continue; }
     if (ctx->stat != GRN_CTX_FIN) { grn_ctx_fin(ctx); }
     if (ctx->flags & GRN_CTX_ALLOCATED) {
       ctx->next->prev = ctx->prev;
@@ -1473,6 +1577,26 @@ grn_ctx_set_match_escalation_threshold(grn_ctx *ctx, long long int threshold)
   return GRN_SUCCESS;
 }
 
+int
+grn_ctx_get_n_scan_workers(grn_ctx *ctx)
+{
+  if (ctx->impl) {
+    return ctx->impl->n_scan_workers;
+  } else {
+    return GRN_DEFAULT_N_SCAN_WORKERS;
+  }
+}
+
+grn_rc
+grn_ctx_set_n_scan_workers(grn_ctx *ctx, int n_workers)
+{
+  if (n_workers < 1) {
+    return GRN_INVALID_ARGUMENT;
+  }
+  ctx->impl->n_scan_workers = n_workers;
+  return GRN_SUCCESS;
+}
+
 grn_content_type
 grn_get_ctype(grn_obj *var)
 {
@@ -1510,6 +1634,9 @@ get_content_mime_type(grn_ctx *ctx, const char *p, const char *pe)
       if (p + 3 == pe && !memcmp(p, "css", 3)) {
         ctx->impl->output_type = GRN_CONTENT_NONE;
         ctx->impl->mime_type = "text/css";
+      } else if (p + 8 == pe && !memcmp(p, "columnar", 8)) {
+        ctx->impl->output_type = GRN_CONTENT_COLUMNAR;
+        ctx->impl->mime_type = "application/x-groonga-columnar";
       }
       break;
     case 'g' :
@@ -1862,6 +1989,51 @@ exit :
   GRN_API_RETURN(0);
 }
 
+/*
+ * Returns the end of the head of a partial line that can be passed to
+ * grn_ctx_send() for a command waiting for its input (e.g. load) before
+ * the rest of the line is received. The head ends at a character
+ * boundary and the rest doesn't start with ' ', '\t' or '#' because
+ * grn_ctx_send() ignores a chunk that looks like a comment line.
+ * Returns start if nothing can be sent.
+ */
+const char *
+grn_ctx_partial_line_end(grn_ctx *ctx, const char *start, const char *end)
+{
+#define PARTIAL_LINE_MARGIN 8
+  const char *current;
+  const char *partial_end = start;
+
+  if (!ctx || !ctx->impl || ctx->impl->com || !ctx->impl->qe_next) {
+    return start;
+  }
+  if (comment_command_p(start, end - start)) {
+    return start;
+  }
+
+  /* The last bytes may be an incomplete multibyte character. */
+  current = start;
+  while (end - current > PARTIAL_LINE_MARGIN) {
+    int char_length = grn_charlen(ctx, current, end);
+    if (char_length == 0) {
+      char_length = 1;
+    }
+    current += char_length;
+    switch (*current) {
+    case ' ' :
+    case '\t' :
+    case '#' :
+      break;
+    default :
+      partial_end = current;
+      break;
+    }
+  }
+#undef PARTIAL_LINE_MARGIN
+
+  return partial_end;
+}
+
 unsigned int
 grn_ctx_recv(grn_ctx *ctx, char **str, unsigned int *str_len, int *flags)
 {
@@ -1933,9 +2105,61 @@ grn_ctx_recv_handler_set(grn_ctx *ctx, void (*func)(grn_ctx *, int, void *), voi
   if (ctx && ctx->impl) {
     ctx->impl->output = func;
     ctx->impl->data.ptr = func_arg;
+    ctx->impl->output_ref_enabled = GRN_FALSE;
+    ctx->impl->output_chunk_size = 0;
   }
 }
 
+/*
+ * Outputs a cached value. If the output handler sends
+ * ctx->impl->output_ref, the value is referred instead of being copied
+ * to outbuf until the handler calls grn_ctx_output_ref_clear(). It takes
+ * the reference of the value.
+ */
+void
+grn_ctx_output_cache_value(grn_ctx *ctx, grn_cache *cache, grn_obj *value)
+{
+  grn_obj *outbuf = ctx->impl->outbuf;
+  /* The XML envelope rewrites the body of select. */
+  if (ctx->impl->output_ref_enabled &&
+      ctx->impl->output_type != GRN_CONTENT_XML &&
+      !ctx->impl->output_ref &&
+      GRN_BULK_VSIZE(outbuf) == 0) {
+    ctx->impl->output_ref = value;
+    ctx->impl->output_ref_cache = cache;
+    return;
+  }
+  GRN_TEXT_PUT(ctx, outbuf, GRN_TEXT_VALUE(value), GRN_TEXT_LEN(value));
+  grn_cache_unref(ctx, cache, value);
+}
+
+void
+grn_ctx_output_ref_clear(grn_ctx *ctx)
+{
+  if (ctx->impl->output_ref) {
+    grn_cache_unref(ctx, ctx->impl->output_ref_cache, ctx->impl->output_ref);
+    ctx->impl->output_ref = NULL;
+    ctx->impl->output_ref_cache = NULL;
+  }
+}
+
+/* Copies output_ref to the head of outbuf for a handler that needs one buffer. */
+void
+grn_ctx_output_ref_flatten(grn_ctx *ctx)
+{
+  grn_obj *outbuf = ctx->impl->outbuf;
+  grn_obj *ref = ctx->impl->output_ref;
+  unsigned int ref_len, len;
+  if (!ref) { return; }
+  ref_len = GRN_TEXT_LEN(ref);
+  len = GRN_BULK_VSIZE(outbuf);
+  if (!grn_bulk_space(ctx, outbuf, ref_len)) {
+    memmove(GRN_BULK_HEAD(outbuf) + ref_len, GRN_BULK_HEAD(outbuf), len);
+    memcpy(GRN_BULK_HEAD(outbuf), GRN_TEXT_VALUE(ref), ref_len);
+  }
+  grn_ctx_output_ref_clear(ctx);
+}
+
 grn_rc
 grn_ctx_info_get(grn_ctx *ctx, grn_ctx_info *info)
 {
@@ -1956,24 +2180,106 @@ grn_ctx_info_get(grn_ctx *ctx, grn_ctx_info *info)
 
 
 typedef struct _grn_cache_entry grn_cache_entry;
+typedef struct _grn_cache_shard grn_cache_shard;
+typedef struct _grn_cache_value grn_cache_value;
 
-struct _grn_cache {
+/*
+ * The cache is split into GRN_CACHE_N_SHARDS shards by key hash. Each
+ * shard has its own lock and LRU list, so concurrent select commands
+ * rarely wait for each other. The limits are for the whole cache: an
+ * update evicts the LRU entries of its own shard first, then of the
+ * other shards.
+ *
+ * Only one ctx (the filler) computes a missing or stale entry. Other
+ * fetches of the same key wait for it on the shard's condition, or get
+ * the stale value while it is younger than the stale window.
+ *
+ * Each shard has its own ctx for its hash and the objects that it owns,
+ * so that shards don't share the error state of grn_gctx. It is used
+ * only while the shard's mutex is locked.
+ *
+ * A persistent cache also has a file backed store under the shards.
+ * It survives restarts and can be shared by processes that use the same
+ * database. A filler looks it up before computing the entry, and every
+ * update is written through to it.
+ */
+struct _grn_cache_shard {
   grn_cache_entry *next;
   grn_cache_entry *prev;
   grn_hash *hash;
+  grn_ctx ctx;
   grn_mutex mutex;
-  uint32_t max_nentries;
+  grn_cond cond;
+  uint32_t nentries;
+  uint64_t nbytes;
   uint32_t nfetches;
   uint32_t nhits;
+  uint32_t nevictions;
+  uint32_t nstale_hits;
+  uint32_t ncoalesced;
+  uint32_t nwait_timeouts;
+  uint32_t npersistent_hits;
+};
+
+struct _grn_cache {
+  grn_cache_shard shards[GRN_CACHE_N_SHARDS];
+  uint32_t max_nentries;
+  uint64_t max_nbytes;
+  uint32_t stale_window;
+  uint32_t wait_timeout;
+  grn_hash *persistent_keys;
+  grn_ja *persistent_values;
+  uint32_t random_state;
+};
+
+/*
+ * The value of a key in the persistent store. The values store has a
+ * grn_cache_persistent_header, the path of the database, the
+ * dependencies and the cached result with the same ID as the key.
+ */
+typedef struct {
+  grn_timeval tv;
+  int64_t atime;
+} grn_cache_persistent_entry;
+
+/*
+ * The database and the last modified times identify the state that a
+ * result was computed from. A result isn't used with another database or
+ * after the database or one of the tables is replaced, even if the
+ * replacement looks older than the result.
+ */
+typedef struct {
+  uint32_t db_lastmod;
+  uint32_t db_path_len;
+  uint32_t n_dependencies;
+} grn_cache_persistent_header;
+
+typedef struct {
+  grn_id id;
+  uint32_t lastmod;
+} grn_cache_persistent_dependency;
+
+#define GRN_CACHE_PERSISTENT_VALUES_SUFFIX ".values"
+#define GRN_CACHE_PERSISTENT_N_EVICTION_SAMPLES 5
+
+/* A value stays alive until its last reader unrefs it. */
+struct _grn_cache_value {
+  grn_obj value;
+  uint32_t nref;
+  grn_bool is_retired;
+  grn_cache_shard *shard;
 };
 
 struct _grn_cache_entry {
   grn_cache_entry *next;
   grn_cache_entry *prev;
-  grn_obj *value;
+  grn_cache_value *value;
+  grn_obj *dependencies;
   grn_timeval tv;
   grn_id id;
-  uint32_t nref;
+  uint32_t nbytes;
+  grn_ctx *filler;
+  int64_t stale_since;
 };
 
 static grn_cache *grn_cache_current = NULL;
@@ -1982,6 +2288,7 @@ static grn_cache *grn_cache_default = NULL;
 grn_cache *
 grn_cache_open(grn_ctx *ctx)
 {
+  int i;
   grn_cache *cache = NULL;
 
   GRN_API_ENTER;
@@ -1991,33 +2298,169 @@ grn_cache_open(grn_ctx *ctx)
     goto exit;
   }
 
-  cache->next = (grn_cache_entry*)cache;
-  cache->prev = (grn_cache_entry *)cache;
-  cache->hash = grn_hash_create(&grn_gctx, NULL, GRN_TABLE_MAX_KEY_SIZE,
-                                sizeof(grn_cache_entry), GRN_OBJ_KEY_VAR_SIZE);
-  MUTEX_INIT(cache->mutex);
+  for (i = 0; i < GRN_CACHE_N_SHARDS; i++) {
+    grn_cache_shard *shard = &(cache->shards[i]);
+    shard->next = (grn_cache_entry *)shard;
+    shard->prev = (grn_cache_entry *)shard;
+    grn_ctx_init(&(shard->ctx), GRN_CTX_FIN_BY_OWNER);
+    shard->hash = grn_hash_create(&(shard->ctx), NULL, GRN_TABLE_MAX_KEY_SIZE,
+                                  sizeof(grn_cache_entry),
+                                  GRN_OBJ_KEY_VAR_SIZE);
+    MUTEX_INIT(shard->mutex);
+    COND_INIT(shard->cond);
+    shard->nentries = 0;
+    shard->nbytes = 0;
+    shard->nfetches = 0;
+    shard->nhits = 0;
+    shard->nevictions = 0;
+    shard->nstale_hits = 0;
+    shard->ncoalesced = 0;
+    shard->nwait_timeouts = 0;
+    shard->npersistent_hits = 0;
+  }
   cache->max_nentries = GRN_CACHE_DEFAULT_MAX_N_ENTRIES;
-  cache->nfetches = 0;
-  cache->nhits = 0;
+  cache->max_nbytes = GRN_CACHE_DEFAULT_MAX_N_BYTES;
+  cache->stale_window = 0;
+  cache->wait_timeout = GRN_CACHE_DEFAULT_WAIT_TIMEOUT;
+  cache->persistent_keys = NULL;
+  cache->persistent_values = NULL;
+  {
+    grn_timeval tv;
+    grn_timeval_now(ctx, &tv);
+    cache->random_state = (uint32_t)tv.tv_sec ^ (uint32_t)tv.tv_nsec;
+    if (!cache->random_state) { cache->random_state = 1; }
+  }
 
 exit :
   GRN_API_RETURN(cache);
 }
 
+grn_cache *
+grn_persistent_cache_open(grn_ctx *ctx, const char *base_path)
+{
+  grn_cache *cache = NULL;
+  char values_path[PATH_MAX];
+  struct stat s;
+
+  if (!base_path) {
+    ERR(GRN_INVALID_ARGUMENT, "[cache][persistent] base path is missing");
+    return NULL;
+  }
+  if (strlen(base_path) + strlen(GRN_CACHE_PERSISTENT_VALUES_SUFFIX) >=
+      PATH_MAX) {
+    ERR(GRN_FILENAME_TOO_LONG,
+        "[cache][persistent] too long base path: <%s>", base_path);
+    return NULL;
+  }
+  strcpy(values_path, base_path);
+  strcat(values_path, GRN_CACHE_PERSISTENT_VALUES_SUFFIX);
+
+  cache = grn_cache_open(ctx);
+  if (!cache) {
+    return NULL;
+  }
+
+  GRN_API_ENTER;
+  if (stat(base_path, &s)) {
+    cache->persistent_keys =
+      grn_hash_create(&grn_gctx, base_path, GRN_TABLE_MAX_KEY_SIZE,
+                      sizeof(grn_cache_persistent_entry),
+                      GRN_OBJ_KEY_VAR_SIZE);
+    cache->persistent_values =
+      grn_ja_create(&grn_gctx, values_path, 0, 0);
+  } else {
+    cache->persistent_keys = grn_hash_open(&grn_gctx, base_path);
+    if (cache->persistent_keys &&
+        cache->persistent_keys->value_size !=
+        sizeof(grn_cache_persistent_entry)) {
+      grn_hash_close(&grn_gctx, cache->persistent_keys);
+      cache->persistent_keys = NULL;
+    }
+    cache->persistent_values = grn_ja_open(&grn_gctx, values_path);
+  }
+  if (!cache->persistent_keys || !cache->persistent_values) {
+    ERR(GRN_FILE_CORRUPT,
+        "[cache][persistent] failed to open: <%s>", base_path);
+    grn_cache_close(ctx, cache);
+    cache = NULL;
+  }
+  GRN_API_RETURN(cache);
+}
+
+static grn_cache_value *
+grn_cache_value_open(grn_ctx *ctx, grn_cache_shard *shard,
+                     const char *value, unsigned int value_len)
+{
+  grn_cache_value *cv = GRN_MALLOC(sizeof(grn_cache_value));
+  if (!cv) { return NULL; }
+  GRN_TEXT_INIT(&(cv->value), 0);
+  GRN_TEXT_PUT(ctx, &(cv->value), value, value_len);
+  cv->nref = 0;
+  cv->is_retired = GRN_FALSE;
+  cv->shard = shard;
+  return cv;
+}
+
+static void
+grn_cache_value_close(grn_ctx *ctx, grn_cache_value *cv)
+{
+  GRN_OBJ_FIN(ctx, &(cv->value));
+  GRN_FREE(cv);
+}
+
+/* shard->mutex must be locked. */
+static void
+grn_cache_value_release(grn_cache_value *cv)
+{
+  if (cv->nref) {
+    cv->is_retired = GRN_TRUE;
+  } else {
+    grn_cache_value_close(&(cv->shard->ctx), cv);
+  }
+}
+
+/* shard->mutex must be locked. */
+static void
+grn_cache_value_unref(grn_cache_value *cv)
+{
+  if (cv->nref) { cv->nref--; }
+  if (!cv->nref && cv->is_retired) {
+    grn_cache_value_close(&(cv->shard->ctx), cv);
+  }
+}
+
 grn_rc
 grn_cache_close(grn_ctx *ctx, grn_cache *cache)
 {
+  int i;
   grn_ctx *ctx_original = ctx;
   grn_cache_entry *vp;
 
   GRN_API_ENTER;
 
   ctx = &grn_gctx;
-  GRN_HASH_EACH(ctx, cache->hash, id, NULL, NULL, &vp, {
-    grn_obj_close(ctx, vp->value);
-  });
-  grn_hash_close(ctx, cache->hash);
-  MUTEX_FIN(cache->mutex);
+  for (i = 0; i < GRN_CACHE_N_SHARDS; i++) {
+    grn_cache_shard *shard = &(cache->shards[i]);
+    grn_ctx *shard_ctx = &(shard->ctx);
+    GRN_HASH_EACH(shard_ctx, shard->hash, id, NULL, NULL, &vp, {
+      if (vp->value) {
+        grn_cache_value_close(shard_ctx, vp->value);
+      }
+      if (vp->dependencies) {
+        grn_obj_close(shard_ctx, vp->dependencies);
+      }
+    });
+    grn_hash_close(shard_ctx, shard->hash);
+    grn_ctx_fin(shard_ctx);
+    MUTEX_FIN(shard->mutex);
+    COND_FIN(shard->cond);
+  }
+  if (cache->persistent_keys) {
+    grn_hash_close(ctx, cache->persistent_keys);
+  }
+  if (cache->persistent_values) {
+    grn_ja_close(ctx, cache->persistent_values);
+  }
   ctx = ctx_original;
   GRN_FREE(cache);
 
@@ -2063,129 +2506,754 @@ grn_cache_get_max_n_entries(grn_ctx *ctx, grn_cache *cache)
   return cache->max_nentries;
 }
 
+grn_rc
+grn_cache_set_max_n_bytes(grn_ctx *ctx, grn_cache *cache,
+                          unsigned long long int n)
+{
+  if (!cache) {
+    return GRN_INVALID_ARGUMENT;
+  }
+  cache->max_nbytes = n;
+  return GRN_SUCCESS;
+}
+
+unsigned long long int
+grn_cache_get_max_n_bytes(grn_ctx *ctx, grn_cache *cache)
+{
+  if (!cache) {
+    return 0;
+  }
+  return cache->max_nbytes;
+}
+
+grn_rc
+grn_cache_set_stale_window(grn_ctx *ctx, grn_cache *cache,
+                           unsigned int seconds)
+{
+  if (!cache) {
+    return GRN_INVALID_ARGUMENT;
+  }
+  cache->stale_window = seconds;
+  return GRN_SUCCESS;
+}
+
+unsigned int
+grn_cache_get_stale_window(grn_ctx *ctx, grn_cache *cache)
+{
+  if (!cache) {
+    return 0;
+  }
+  return cache->stale_window;
+}
+
+grn_rc
+grn_cache_set_wait_timeout(grn_ctx *ctx, grn_cache *cache,
+                           unsigned int msec)
+{
+  if (!cache) {
+    return GRN_INVALID_ARGUMENT;
+  }
+  cache->wait_timeout = msec;
+  return GRN_SUCCESS;
+}
+
+unsigned int
+grn_cache_get_wait_timeout(grn_ctx *ctx, grn_cache *cache)
+{
+  if (!cache) {
+    return 0;
+  }
+  return cache->wait_timeout;
+}
+
+void
+grn_cache_get_shard_statistics(grn_ctx *ctx, grn_cache *cache, int i,
+                               grn_cache_shard_statistics *statistics)
+{
+  grn_cache_shard *shard = &(cache->shards[i]);
+  MUTEX_LOCK(shard->mutex);
+  statistics->nentries = shard->nentries;
+  statistics->nbytes = shard->nbytes;
+  statistics->nfetches = shard->nfetches;
+  statistics->nhits = shard->nhits;
+  statistics->nevictions = shard->nevictions;
+  statistics->nstale_hits = shard->nstale_hits;
+  statistics->ncoalesced = shard->ncoalesced;
+  statistics->nwait_timeouts = shard->nwait_timeouts;
+  statistics->npersistent_hits = shard->npersistent_hits;
+  MUTEX_UNLOCK(shard->mutex);
+}
+
 void
 grn_cache_get_statistics(grn_ctx *ctx, grn_cache *cache,
                          grn_cache_statistics *statistics)
 {
-  MUTEX_LOCK(cache->mutex);
-  statistics->nentries = GRN_HASH_SIZE(cache->hash);
+  int i;
+  statistics->nentries = 0;
   statistics->max_nentries = cache->max_nentries;
-  statistics->nfetches = cache->nfetches;
-  statistics->nhits = cache->nhits;
-  MUTEX_UNLOCK(cache->mutex);
+  statistics->nbytes = 0;
+  statistics->max_nbytes = cache->max_nbytes;
+  statistics->nfetches = 0;
+  statistics->nhits = 0;
+  statistics->nevictions = 0;
+  statistics->nstale_hits = 0;
+  statistics->ncoalesced = 0;
+  statistics->nwait_timeouts = 0;
+  statistics->npersistent_hits = 0;
+  statistics->npersistent_entries = 0;
+  if (cache->persistent_keys) {
+    statistics->npersistent_entries = *(cache->persistent_keys->n_entries);
+  }
+  for (i = 0; i < GRN_CACHE_N_SHARDS; i++) {
+    grn_cache_shard_statistics shard_statistics;
+    grn_cache_get_shard_statistics(ctx, cache, i, &shard_statistics);
+    statistics->nentries += shard_statistics.nentries;
+    statistics->nbytes += shard_statistics.nbytes;
+    statistics->nfetches += shard_statistics.nfetches;
+    statistics->nhits += shard_statistics.nhits;
+    statistics->nevictions += shard_statistics.nevictions;
+    statistics->nstale_hits += shard_statistics.nstale_hits;
+    statistics->ncoalesced += shard_statistics.ncoalesced;
+    statistics->nwait_timeouts += shard_statistics.nwait_timeouts;
+    statistics->npersistent_hits += shard_statistics.npersistent_hits;
+  }
+}
+
+inline static grn_cache_shard *
+grn_cache_get_shard(grn_cache *cache, const char *str, uint32_t str_len)
+{
+  uint32_t i;
+  uint32_t hash_value = 0;
+  for (i = 0; i < str_len; i++) {
+    hash_value = (hash_value * 1021) + ((const uint8_t *)str)[i];
+  }
+  /* grn_hash uses the low bits. Use the high bits to choose a shard. */
+  hash_value *= 0x9e3779b1;
+  return &(cache->shards[hash_value >> (32 - GRN_CACHE_N_SHARDS_BITS)]);
+}
+
+/* Reads counters of other shards without locks. It is just a hint. */
+static grn_bool
+grn_cache_is_over_limit(grn_cache *cache)
+{
+  int i;
+  uint32_t nentries = 0;
+  uint64_t nbytes = 0;
+  for (i = 0; i < GRN_CACHE_N_SHARDS; i++) {
+    nentries += cache->shards[i].nentries;
+    nbytes += cache->shards[i].nbytes;
+  }
+  if (nentries > cache->max_nentries) {
+    return GRN_TRUE;
+  }
+  if (cache->max_nbytes > 0 && nbytes > cache->max_nbytes) {
+    return GRN_TRUE;
+  }
+  return GRN_FALSE;
 }
 
+/*
+ * shard->mutex must be locked. The entry must have a value. An entry
+ * that is being refreshed is kept for its filler.
+ */
 static void
-grn_cache_expire_entry(grn_cache *cache, grn_cache_entry *ce)
+grn_cache_expire_entry(grn_cache_shard *shard, grn_cache_entry *ce)
+{
+  if (!ce->filler) {
+    ce->prev->next = ce->next;
+    ce->next->prev = ce->prev;
+    shard->nentries--;
+    shard->nbytes -= ce->nbytes;
+    grn_cache_value_release(ce->value);
+    grn_obj_close(&(shard->ctx), ce->dependencies);
+    grn_hash_delete_by_id(&(shard->ctx), shard->hash, ce->id, NULL);
+  }
+}
+
+/* shard->mutex must be locked. */
+static grn_bool
+grn_cache_shard_evict(grn_cache_shard *shard, grn_cache_entry *keep)
+{
+  grn_cache_entry *ce0 = (grn_cache_entry *)shard, *ce;
+  for (ce = ce0->prev; ce != ce0; ce = ce->prev) {
+    if (ce != keep && !ce->filler) {
+      grn_cache_expire_entry(shard, ce);
+      shard->nevictions++;
+      return GRN_TRUE;
+    }
+  }
+  return GRN_FALSE;
+}
+
+/*
+ * An entry is stale when the database or one of the tables that the
+ * cached result depends on has been modified since it was cached.
+ */
+static grn_bool
+grn_cache_is_stale(grn_ctx *ctx, grn_timeval *tv,
+                   grn_id *dependencies, uint32_t n_dependencies)
+{
+  uint32_t i;
+  if (tv->tv_sec <= grn_db_lastmod(ctx->impl->db)) {
+    return GRN_TRUE;
+  }
+  for (i = 0; i < n_dependencies; i++) {
+    grn_obj *table = grn_ctx_at(ctx, dependencies[i]);
+    if (!table || tv->tv_sec <= grn_obj_lastmod(ctx, table)) {
+      return GRN_TRUE;
+    }
+  }
+  return GRN_FALSE;
+}
+
+/*
+ * Checks whether the filled entry is stale. shard->mutex must be locked.
+ * grn_ctx_at() may open and load objects, so the dependencies are copied
+ * to buffer and resolved without the lock. The value of the entry is
+ * referred while the lock is released. It returns GRN_FALSE without
+ * checking when the entry is refilled or is being refilled meanwhile. The
+ * caller must look up the entry again in that case.
+ */
+static grn_bool
+grn_cache_entry_check_stale(grn_ctx *ctx, grn_cache_shard *shard,
+                            const char *str, uint32_t str_len,
+                            grn_cache_entry **entry, grn_obj *buffer,
+                            grn_bool *is_stale)
+{
+  grn_cache_entry *ce = *entry;
+  grn_cache_value *cv = ce->value;
+  grn_timeval tv = ce->tv;
+  grn_bool is_same_entry;
+  GRN_BULK_REWIND(buffer);
+  GRN_TEXT_PUT(ctx, buffer,
+               GRN_BULK_HEAD(ce->dependencies),
+               GRN_BULK_VSIZE(ce->dependencies));
+  cv->nref++;
+  MUTEX_UNLOCK(shard->mutex);
+  *is_stale = grn_cache_is_stale(ctx, &tv,
+                                 (grn_id *)GRN_BULK_HEAD(buffer),
+                                 GRN_BULK_VSIZE(buffer) / sizeof(grn_id));
+  MUTEX_LOCK(shard->mutex);
+  /* cv can't be reused for another entry until it is unreferenced. */
+  is_same_entry = (grn_hash_get(&(shard->ctx), shard->hash, str, str_len,
+                                (void **)&ce) &&
+                   ce->value == cv &&
+                   !ce->filler);
+  grn_cache_value_unref(cv);
+  *entry = ce;
+  return is_same_entry;
+}
+
+/*
+ * Stores the value of the key to the shard. It takes the ownership of
+ * cv and dependencies. shard->mutex must be locked.
+ */
+static grn_cache_entry *
+grn_cache_shard_store(grn_ctx *ctx, grn_cache *cache, grn_cache_shard *shard,
+                      const char *str, uint32_t str_len,
+                      grn_cache_value *cv, grn_obj *dependencies,
+                      grn_timeval *tv, uint32_t nbytes)
 {
-  if (!ce->nref) {
+  grn_id id;
+  int added = 0;
+  grn_cache_entry *ce;
+  if (!(id = grn_hash_add(&(shard->ctx), shard->hash, str, str_len,
+                          (void **)&ce, &added))) {
+    grn_cache_value_close(&(shard->ctx), cv);
+    grn_obj_close(&(shard->ctx), dependencies);
+    return NULL;
+  }
+  if (added) {
+    ce->filler = NULL;
+  } else if (ce->value) {
     ce->prev->next = ce->next;
     ce->next->prev = ce->prev;
-    grn_obj_close(&grn_gctx, ce->value);
-    grn_hash_delete_by_id(&grn_gctx, cache->hash, ce->id, NULL);
+    shard->nentries--;
+    shard->nbytes -= ce->nbytes;
+    grn_cache_value_release(ce->value);
+    grn_obj_close(&(shard->ctx), ce->dependencies);
+  }
+  if (ce->filler == ctx) {
+    ce->filler = NULL;
+  }
+  ce->id = id;
+  ce->value = cv;
+  ce->dependencies = dependencies;
+  ce->tv = *tv;
+  ce->nbytes = nbytes;
+  ce->stale_since = 0;
+  {
+    grn_cache_entry *ce0 = (grn_cache_entry *)shard;
+    ce->next = ce0->next;
+    ce->prev = ce0;
+    ce0->next->prev = ce;
+    ce0->next = ce;
+  }
+  shard->nentries++;
+  shard->nbytes += nbytes;
+  while (grn_cache_is_over_limit(cache) &&
+         grn_cache_shard_evict(shard, ce)) {
+  }
+  COND_BROADCAST(shard->cond);
+  return ce;
+}
+
+/* Evicts entries of the other shards while the cache is over limit. */
+static void
+grn_cache_evict_others(grn_cache *cache, grn_cache_shard *shard)
+{
+  int i;
+  if (!grn_cache_is_over_limit(cache)) {
+    return;
+  }
+  for (i = 0; i < GRN_CACHE_N_SHARDS; i++) {
+    grn_cache_shard *other = &(cache->shards[i]);
+    if (other == shard) { continue; }
+    MUTEX_LOCK(other->mutex);
+    while (grn_cache_is_over_limit(cache) &&
+           grn_cache_shard_evict(other, NULL)) {
+    }
+    MUTEX_UNLOCK(other->mutex);
+    if (!grn_cache_is_over_limit(cache)) { break; }
+  }
+}
+
+/*
+ * xorshift32. The cache doesn't use rand() not to share its state with
+ * the application. The persistent store must be locked.
+ */
+static uint32_t
+grn_cache_random(grn_cache *cache)
+{
+  uint32_t x = cache->random_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  cache->random_state = x;
+  return x;
+}
+
+/*
+ * Evicts the least recently used one of some entries in the persistent
+ * store. The entries are from a random position to keep it cheap.
+ * The store must be locked.
+ */
+static grn_bool
+grn_cache_persistent_evict(grn_ctx *ctx, grn_cache *cache, grn_id keep)
+{
+  grn_hash *keys = cache->persistent_keys;
+  grn_id max_id = keys->header->curr_rec;
+  grn_id id, victim = GRN_ID_NIL;
+  int64_t victim_atime = 0;
+  uint32_t i, n_samples = 0;
+  if (max_id == GRN_ID_NIL) {
+    return GRN_FALSE;
+  }
+  id = (grn_id)(grn_cache_random(cache) % max_id) + 1;
+  for (i = 0;
+       i < max_id && n_samples < GRN_CACHE_PERSISTENT_N_EVICTION_SAMPLES;
+       i++, id = (id % max_id) + 1) {
+    grn_cache_persistent_entry entry;
+    if (id == keep ||
+        !grn_hash_get_value(ctx, keys, id, &entry)) {
+      continue;
+    }
+    if (n_samples == 0 || entry.atime < victim_atime) {
+      victim = id;
+      victim_atime = entry.atime;
+    }
+    n_samples++;
+  }
+  if (victim == GRN_ID_NIL) {
+    return GRN_FALSE;
+  }
+  grn_ja_put(ctx, cache->persistent_values, victim, NULL, 0,
+             GRN_OBJ_SET, NULL);
+  grn_hash_delete_by_id(ctx, keys, victim, NULL);
+  return GRN_TRUE;
+}
+
+static void
+grn_cache_persistent_update(grn_ctx *ctx, grn_cache *cache,
+                            const char *str, uint32_t str_len,
+                            grn_obj *value, grn_obj *dependencies)
+{
+  grn_hash *keys = cache->persistent_keys;
+  grn_cache_persistent_entry *entry;
+  grn_cache_persistent_header header;
+  const char *db_path = grn_obj_path(ctx, ctx->impl->db);
+  grn_id id;
+  grn_obj buffer, *original_dependencies;
+  uint32_t i;
+
+  if (!db_path) { return; }
+  header.db_lastmod = grn_db_lastmod(ctx->impl->db);
+  header.db_path_len = strlen(db_path);
+  header.n_dependencies = GRN_BULK_VSIZE(dependencies) / sizeof(grn_id);
+  GRN_TEXT_INIT(&buffer, 0);
+  GRN_TEXT_PUT(ctx, &buffer, &header, sizeof(header));
+  GRN_TEXT_PUT(ctx, &buffer, db_path, header.db_path_len);
+  /* Don't record the tables resolved here as dependencies again. */
+  original_dependencies = ctx->impl->dependencies;
+  ctx->impl->dependencies = NULL;
+  for (i = 0; i < header.n_dependencies; i++) {
+    grn_cache_persistent_dependency dependency;
+    grn_obj *table;
+    dependency.id = ((grn_id *)GRN_BULK_HEAD(dependencies))[i];
+    if (!(table = grn_ctx_at(ctx, dependency.id))) {
+      break;
+    }
+    dependency.lastmod = grn_obj_lastmod(ctx, table);
+    GRN_TEXT_PUT(ctx, &buffer, &dependency, sizeof(dependency));
+  }
+  ctx->impl->dependencies = original_dependencies;
+  if (i < header.n_dependencies) {
+    GRN_OBJ_FIN(ctx, &buffer);
+    return;
+  }
+  GRN_TEXT_PUT(ctx, &buffer,
+               GRN_TEXT_VALUE(value), GRN_TEXT_LEN(value));
+  if (grn_io_lock(ctx, keys->io, grn_lock_timeout)) {
+    GRN_OBJ_FIN(ctx, &buffer);
+    return;
+  }
+  id = grn_hash_add(ctx, keys, str, str_len, (void **)&entry, NULL);
+  if (id) {
+    if (grn_ja_put(ctx, cache->persistent_values, id,
+                   GRN_TEXT_VALUE(&buffer), GRN_TEXT_LEN(&buffer),
+                   GRN_OBJ_SET, NULL) == GRN_SUCCESS) {
+      entry->tv = ctx->impl->tv;
+      entry->atime = ctx->impl->tv.tv_sec;
+    } else {
+      grn_hash_delete_by_id(ctx, keys, id, NULL);
+    }
+    while (*(keys->n_entries) > cache->max_nentries &&
+           grn_cache_persistent_evict(ctx, cache, id)) {
+    }
+  }
+  grn_io_unlock(keys->io);
+  GRN_OBJ_FIN(ctx, &buffer);
+}
+
+/*
+ * Looks up the persistent store for the key that ctx fills. A valid
+ * value is stored to the shard and returned as a hit.
+ */
+static grn_obj *
+grn_cache_persistent_fetch(grn_ctx *ctx, grn_cache *cache,
+                           grn_cache_shard *shard,
+                           const char *str, uint32_t str_len)
+{
+  grn_hash *keys = cache->persistent_keys;
+  grn_cache_persistent_entry *entry;
+  grn_cache_persistent_header *header;
+  grn_cache_persistent_dependency *dependencies;
+  grn_cache_entry *ce;
+  grn_cache_value *cv;
+  grn_obj *dependencies_obj = NULL;
+  grn_obj buffer;
+  grn_obj *obj = NULL;
+  grn_timeval tv;
+  grn_id id;
+  const char *db_path;
+  const char *result;
+  uint32_t i, header_size, result_len;
+
+  GRN_TEXT_INIT(&buffer, 0);
+  if (grn_io_lock(ctx, keys->io, grn_lock_timeout)) {
+    goto exit;
+  }
+  id = grn_hash_get(ctx, keys, str, str_len, (void **)&entry);
+  if (id) {
+    tv = entry->tv;
+    entry->atime = ctx->impl->tv.tv_sec;
+    grn_ja_get_value(ctx, cache->persistent_values, id, &buffer);
+  }
+  grn_io_unlock(keys->io);
+  if (!id || GRN_TEXT_LEN(&buffer) < sizeof(grn_cache_persistent_header)) {
+    goto exit;
+  }
+
+  header = (grn_cache_persistent_header *)GRN_TEXT_VALUE(&buffer);
+  header_size = sizeof(grn_cache_persistent_header) + header->db_path_len +
+    header->n_dependencies * sizeof(grn_cache_persistent_dependency);
+  if (header->n_dependencies == 0 ||
+      header->db_path_len > PATH_MAX ||
+      header->n_dependencies > GRN_TEXT_LEN(&buffer) ||
+      GRN_TEXT_LEN(&buffer) < header_size) {
+    goto exit;
+  }
+  db_path = grn_obj_path(ctx, ctx->impl->db);
+  if (!db_path ||
+      strlen(db_path) != header->db_path_len ||
+      memcmp(db_path, GRN_TEXT_VALUE(&buffer) + sizeof(*header),
+             header->db_path_len)) {
+    goto exit;
+  }
+  if (grn_db_lastmod(ctx->impl->db) != header->db_lastmod ||
+      tv.tv_sec <= header->db_lastmod) {
+    goto exit;
+  }
+  dependencies = (grn_cache_persistent_dependency *)
+    (GRN_TEXT_VALUE(&buffer) + sizeof(*header) + header->db_path_len);
+  if (!(dependencies_obj = grn_obj_open(ctx, GRN_BULK, 0,
+                                        GRN_DB_UINT32))) {
+    goto exit;
+  }
+  for (i = 0; i < header->n_dependencies; i++) {
+    grn_obj *table = grn_ctx_at(ctx, dependencies[i].id);
+    uint32_t lastmod;
+    if (!table) {
+      goto exit;
+    }
+    lastmod = grn_obj_lastmod(ctx, table);
+    if (lastmod != dependencies[i].lastmod || tv.tv_sec <= lastmod) {
+      goto exit;
+    }
+    GRN_TEXT_PUT(ctx, dependencies_obj,
+                 &(dependencies[i].id), sizeof(grn_id));
+  }
+  result = GRN_TEXT_VALUE(&buffer) + header_size;
+  result_len = GRN_TEXT_LEN(&buffer) - header_size;
+  if (cache->max_nbytes > 0 &&
+      (uint64_t)str_len + result_len > cache->max_nbytes) {
+    goto exit;
+  }
+
+  if (!(cv = grn_cache_value_open(ctx, shard, result, result_len))) {
+    goto exit;
+  }
+  MUTEX_LOCK(shard->mutex);
+  /* The entry owns the dependencies even if it fails. */
+  ce = grn_cache_shard_store(ctx, cache, shard, str, str_len,
+                             cv, dependencies_obj, &tv,
+                             str_len + result_len);
+  dependencies_obj = NULL;
+  if (ce) {
+    cv->nref++;
+    obj = &(cv->value);
+    shard->nhits++;
+    shard->npersistent_hits++;
+  }
+  MUTEX_UNLOCK(shard->mutex);
+  if (ce) {
+    grn_cache_evict_others(cache, shard);
+  }
+
+exit :
+  if (dependencies_obj) {
+    grn_obj_close(ctx, dependencies_obj);
   }
+  GRN_OBJ_FIN(ctx, &buffer);
+  return obj;
 }
 
+/*
+ * Returns the cached value or NULL. If it returns NULL, the caller is
+ * responsible for the key: it must call grn_cache_update() or
+ * grn_cache_cancel() with the key. A returned value must be released by
+ * grn_cache_unref(). A fetch waits for another context filling the same
+ * key at most cache->wait_timeout msec. It returns NULL without filling
+ * the key on timeout, so the caller computes the result by itself.
+ */
 grn_obj *
 grn_cache_fetch(grn_ctx *ctx, grn_cache *cache,
                 const char *str, uint32_t str_len)
 {
   grn_cache_entry *ce;
+  grn_cache_shard *shard;
   grn_obj *obj = NULL;
+  grn_bool is_waited = GRN_FALSE;
+  grn_bool is_filler = GRN_FALSE;
+  grn_timeval deadline;
+  grn_obj dependencies;
   if (!ctx->impl || !ctx->impl->db) { return obj; }
-  MUTEX_LOCK(cache->mutex);
-  cache->nfetches++;
-  if (grn_hash_get(&grn_gctx, cache->hash, str, str_len, (void **)&ce)) {
-    if (ce->tv.tv_sec <= grn_db_lastmod(ctx->impl->db)) {
-      grn_cache_expire_entry(cache, ce);
-      goto exit;
+  if (!cache->max_nentries) { return obj; }
+  GRN_TEXT_INIT(&dependencies, 0);
+  shard = grn_cache_get_shard(cache, str, str_len);
+  MUTEX_LOCK(shard->mutex);
+  shard->nfetches++;
+  for (;;) {
+    grn_id id;
+    int added = 0;
+    if (!(id = grn_hash_add(&(shard->ctx), shard->hash, str, str_len,
+                            (void **)&ce, &added))) {
+      break;
+    }
+    if (added) {
+      /* A placeholder. It isn't linked to the LRU list until it's filled. */
+      ce->id = id;
+      ce->next = ce;
+      ce->prev = ce;
+      ce->value = NULL;
+      ce->dependencies = NULL;
+      ce->nbytes = 0;
+      ce->filler = ctx;
+      ce->stale_since = 0;
+      is_filler = GRN_TRUE;
+      break;
+    }
+    if (ce->filler == ctx) { break; }
+    if (ce->value) {
+      if (ce->filler) {
+        grn_timeval now;
+        grn_timeval_now(ctx, &now);
+        if (cache->stale_window > 0 &&
+            now.tv_sec - ce->stale_since <= cache->stale_window) {
+          shard->nstale_hits++;
+          goto hit;
+        }
+      } else {
+        grn_bool is_stale;
+        if (!grn_cache_entry_check_stale(ctx, shard, str, str_len, &ce,
+                                         &dependencies, &is_stale)) {
+          continue;
+        }
+        if (!is_stale) {
+          goto hit;
+        } else {
+          grn_timeval now;
+          grn_timeval_now(ctx, &now);
+          ce->filler = ctx;
+          ce->stale_since = now.tv_sec;
+          is_filler = GRN_TRUE;
+          break;
+        }
+      }
     }
-    ce->nref++;
-    obj = ce->value;
-    ce->prev->next = ce->next;
-    ce->next->prev = ce->prev;
     {
-      grn_cache_entry *ce0 = (grn_cache_entry *)cache;
-      ce->next = ce0->next;
-      ce->prev = ce0;
-      ce0->next->prev = ce;
-      ce0->next = ce;
+      grn_timeval now;
+      int64_t timeout;
+      grn_timeval_now(ctx, &now);
+      if (!is_waited) {
+        shard->ncoalesced++;
+        is_waited = GRN_TRUE;
+        deadline.tv_sec = now.tv_sec + cache->wait_timeout / 1000;
+        deadline.tv_nsec = now.tv_nsec +
+          (cache->wait_timeout % 1000) * (GRN_TIME_NSEC_PER_SEC / 1000);
+      }
+      timeout = (deadline.tv_sec - now.tv_sec) * 1000 +
+        ((int64_t)deadline.tv_nsec - (int64_t)now.tv_nsec) /
+        (int64_t)(GRN_TIME_NSEC_PER_SEC / 1000);
+      if (timeout <= 0) {
+        shard->nwait_timeouts++;
+        break;
+      }
+      COND_TIMEDWAIT(shard->cond, shard->mutex, timeout);
     }
-    cache->nhits++;
   }
+  goto exit;
+hit :
+  ce->value->nref++;
+  obj = &(ce->value->value);
+  ce->prev->next = ce->next;
+  ce->next->prev = ce->prev;
+  {
+    grn_cache_entry *ce0 = (grn_cache_entry *)shard;
+    ce->next = ce0->next;
+    ce->prev = ce0;
+    ce0->next->prev = ce;
+    ce0->next = ce;
+  }
+  shard->nhits++;
 exit :
-  MUTEX_UNLOCK(cache->mutex);
+  MUTEX_UNLOCK(shard->mutex);
+  GRN_OBJ_FIN(ctx, &dependencies);
+  if (is_filler && cache->persistent_keys) {
+    obj = grn_cache_persistent_fetch(ctx, cache, shard, str, str_len);
+  }
   return obj;
 }
 
 void
-grn_cache_unref(grn_ctx *ctx, grn_cache *cache,
-                const char *str, uint32_t str_len)
+grn_cache_unref(grn_ctx *ctx, grn_cache *cache, grn_obj *value)
+{
+  grn_cache_value *cv = (grn_cache_value *)value;
+  grn_cache_shard *shard = cv->shard;
+  MUTEX_LOCK(shard->mutex);
+  grn_cache_value_unref(cv);
+  MUTEX_UNLOCK(shard->mutex);
+}
+
+/* Gives up filling the key. Waiting fetches retry. */
+void
+grn_cache_cancel(grn_ctx *ctx, grn_cache *cache,
+                 const char *str, uint32_t str_len)
 {
   grn_cache_entry *ce;
-  ctx = &grn_gctx;
-  MUTEX_LOCK(cache->mutex);
-  if (grn_hash_get(ctx, cache->hash, str, str_len, (void **)&ce)) {
-    if (ce->nref) { ce->nref--; }
+  grn_cache_shard *shard;
+  shard = grn_cache_get_shard(cache, str, str_len);
+  MUTEX_LOCK(shard->mutex);
+  if (grn_hash_get(&(shard->ctx), shard->hash, str, str_len, (void **)&ce) &&
+      ce->filler == ctx) {
+    ce->filler = NULL;
+    if (!ce->value) {
+      grn_hash_delete_by_id(&(shard->ctx), shard->hash, ce->id, NULL);
+    }
+    COND_BROADCAST(shard->cond);
   }
-  MUTEX_UNLOCK(cache->mutex);
+  MUTEX_UNLOCK(shard->mutex);
 }
 
 void
 grn_cache_update(grn_ctx *ctx, grn_cache *cache,
-                 const char *str, uint32_t str_len, grn_obj *value)
+                 const char *str, uint32_t str_len, grn_obj *value,
+                 grn_obj *dependencies)
 {
-  grn_id id;
-  int added = 0;
   grn_cache_entry *ce;
-  grn_rc rc = GRN_SUCCESS;
-  grn_obj *old = NULL, *obj;
-  if (!ctx->impl || !cache->max_nentries) { return; }
-  if (!(obj = grn_obj_open(&grn_gctx, GRN_BULK, 0, GRN_DB_TEXT))) { return; }
-  GRN_TEXT_PUT(&grn_gctx, obj, GRN_TEXT_VALUE(value), GRN_TEXT_LEN(value));
-  MUTEX_LOCK(cache->mutex);
-  if ((id = grn_hash_add(&grn_gctx, cache->hash, str, str_len, (void **)&ce, &added))) {
-    if (!added) {
-      if (ce->nref) {
-        rc = GRN_RESOURCE_BUSY;
-        goto exit;
-      }
-      old = ce->value;
-      ce->prev->next = ce->next;
-      ce->next->prev = ce->prev;
-    }
-    ce->id = id;
-    ce->value = obj;
-    ce->tv = ctx->impl->tv;
-    ce->nref = 0;
-    {
-      grn_cache_entry *ce0 = (grn_cache_entry *)cache;
-      ce->next = ce0->next;
-      ce->prev = ce0;
-      ce0->next->prev = ce;
-      ce0->next = ce;
-    }
-    if (GRN_HASH_SIZE(cache->hash) > cache->max_nentries) {
-      grn_cache_expire_entry(cache, cache->prev);
-    }
-  } else {
-    rc = GRN_NO_MEMORY_AVAILABLE;
+  grn_cache_shard *shard;
+  grn_cache_value *cv;
+  grn_obj *dependencies_obj;
+  uint64_t nbytes = (uint64_t)str_len + GRN_TEXT_LEN(value);
+  if (!ctx->impl ||
+      !cache->max_nentries ||
+      GRN_BULK_VSIZE(dependencies) == 0 ||
+      (cache->max_nbytes > 0 && nbytes > cache->max_nbytes)) {
+    grn_cache_cancel(ctx, cache, str, str_len);
+    return;
+  }
+  shard = grn_cache_get_shard(cache, str, str_len);
+  if (!(cv = grn_cache_value_open(ctx, shard,
+                                  GRN_TEXT_VALUE(value),
+                                  GRN_TEXT_LEN(value)))) {
+    grn_cache_cancel(ctx, cache, str, str_len);
+    return;
+  }
+  if (!(dependencies_obj = grn_obj_open(ctx, GRN_BULK, 0, GRN_DB_UINT32))) {
+    grn_cache_value_close(ctx, cv);
+    grn_cache_cancel(ctx, cache, str, str_len);
+    return;
+  }
+  GRN_TEXT_PUT(ctx, dependencies_obj,
+               GRN_BULK_HEAD(dependencies), GRN_BULK_VSIZE(dependencies));
+  MUTEX_LOCK(shard->mutex);
+  ce = grn_cache_shard_store(ctx, cache, shard, str, str_len,
+                             cv, dependencies_obj, &(ctx->impl->tv), nbytes);
+  MUTEX_UNLOCK(shard->mutex);
+  if (!ce) {
+    grn_cache_cancel(ctx, cache, str, str_len);
+    return;
+  }
+  grn_cache_evict_others(cache, shard);
+  if (cache->persistent_keys) {
+    grn_cache_persistent_update(ctx, cache, str, str_len, value, dependencies);
   }
-exit :
-  MUTEX_UNLOCK(cache->mutex);
-  if (rc) { grn_obj_close(&grn_gctx, obj); }
-  if (old) { grn_obj_close(&grn_gctx, old); }
 }
 
 void
 grn_cache_expire(grn_cache *cache, int32_t size)
 {
-  grn_cache_entry *ce0 = (grn_cache_entry *)cache;
-  MUTEX_LOCK(cache->mutex);
-  while (ce0 != ce0->prev && size--) {
-    grn_cache_expire_entry(cache, ce0->prev);
+  int i;
+  for (i = 0; i < GRN_CACHE_N_SHARDS && size; i++) {
+    grn_cache_shard *shard = &(cache->shards[i]);
+    grn_cache_entry *ce0 = (grn_cache_entry *)shard;
+    MUTEX_LOCK(shard->mutex);
+    while (size != 0 && ce0 != ce0->prev && !ce0->prev->filler) {
+      grn_cache_expire_entry(shard, ce0->prev);
+      size--;
+    }
+    MUTEX_UNLOCK(shard->mutex);
   }
-  MUTEX_UNLOCK(cache->mutex);
 }
 
 void
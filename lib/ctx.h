@@ -389,9 +389,13 @@ extern int grn_pagesize;
 extern grn_critical_section grn_glock;
 extern uint32_t grn_gtick;
 extern int grn_lock_timeout;
+extern int grn_n_sort_workers;
+extern int grn_sort_parallel_threshold;
 
 #define GRN_CTX_ALLOCATED                            (0x80)
 #define GRN_CTX_TEMPORARY_DISABLE_II_RESOLVE_SEL_AND (0x40)
+/* The ctx is finalized by the object that owns it, not by grn_fin(). */
+#define GRN_CTX_FIN_BY_OWNER                         (0x20)
 
 typedef struct {
   int64_t tv_sec;
@@ -453,6 +457,14 @@ typedef struct {
   uint8_t subrec_offset;
   uint8_t record_unit;
   uint8_t subrec_unit;
+  struct {
+    /* calc types that the values of the table have room for */
+    grn_table_group_flags calc_types;
+    grn_id calc_range;
+  } group;
+  /* updates of the values in progress, see grn_obj_update_wait() */
+  uint32_t update_epoch;
+  uint32_t n_updaters[2];
   //  grn_obj_flags flags;
 } grn_db_obj;
 
@@ -470,28 +482,63 @@ typedef struct {
   (db_obj)->obj.hooks[4] = NULL;\
   (db_obj)->obj.source = NULL;\
   (db_obj)->obj.source_size = 0;\
+  (db_obj)->obj.group.calc_types = 0;\
+  (db_obj)->obj.group.calc_range = GRN_ID_NIL;\
+  (db_obj)->obj.update_epoch = 0;\
+  (db_obj)->obj.n_updaters[0] = 0;\
+  (db_obj)->obj.n_updaters[1] = 0;\
 } while (0)
 
 /**** cache ****/
 
+#define GRN_CACHE_N_SHARDS_BITS 4
+#define GRN_CACHE_N_SHARDS      (1 << GRN_CACHE_N_SHARDS_BITS)
+
 typedef struct {
   uint32_t nentries;
   uint32_t max_nentries;
+  uint64_t nbytes;
+  uint64_t max_nbytes;
   uint32_t nfetches;
   uint32_t nhits;
+  uint32_t nevictions;
+  uint32_t nstale_hits;
+  uint32_t ncoalesced;
+  uint32_t nwait_timeouts;
+  uint32_t npersistent_entries;
+  uint32_t npersistent_hits;
 } grn_cache_statistics;
 
+typedef struct {
+  uint32_t nentries;
+  uint64_t nbytes;
+  uint32_t nfetches;
+  uint32_t nhits;
+  uint32_t nevictions;
+  uint32_t nstale_hits;
+  uint32_t ncoalesced;
+  uint32_t nwait_timeouts;
+  uint32_t npersistent_hits;
+} grn_cache_shard_statistics;
+
 void grn_cache_init(void);
 grn_obj *grn_cache_fetch(grn_ctx *ctx, grn_cache *cache,
                          const char *str, uint32_t str_size);
-void grn_cache_unref(grn_ctx *ctx, grn_cache *cache,
-                     const char *str, uint32_t str_size);
+void grn_cache_unref(grn_ctx *ctx, grn_cache *cache, grn_obj *value);
+void grn_cache_cancel(grn_ctx *ctx, grn_cache *cache,
+                      const char *str, uint32_t str_size);
 void grn_cache_update(grn_ctx *ctx, grn_cache *cache,
-                      const char *str, uint32_t str_size, grn_obj *value);
+                      const char *str, uint32_t str_size, grn_obj *value,
+                      grn_obj *dependencies);
 void grn_cache_expire(grn_cache *cache, int32_t size);
+void grn_ctx_output_cache_value(grn_ctx *ctx, grn_cache *cache, grn_obj *value);
+GRN_API void grn_ctx_output_ref_clear(grn_ctx *ctx);
+GRN_API void grn_ctx_output_ref_flatten(grn_ctx *ctx);
 void grn_cache_fin(void);
 void grn_cache_get_statistics(grn_ctx *ctx, grn_cache *cache,
                               grn_cache_statistics *statistics);
+void grn_cache_get_shard_statistics(grn_ctx *ctx, grn_cache *cache, int i,
+                                    grn_cache_shard_statistics *statistics);
 
 /**** receive handler ****/
 
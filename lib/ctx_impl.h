@@ -151,6 +151,15 @@ struct _grn_ctx_impl {
   /* match escalation portion */
   int64_t match_escalation_threshold;
 
+  /* match top-k portion: 0 means that all matched records are needed */
+  int match_top_k;
+
+  /* scan portion: the number of threads that evaluate a filter */
+  int n_scan_workers;
+
+  /* cache portion: IDs of the tables that the current command reads */
+  grn_obj *dependencies;
+
   /* lifetime portion */
   grn_proc_func *finalizer;
 
@@ -159,6 +168,14 @@ struct _grn_ctx_impl {
   grn_hash *ios;        /* IOs */
   grn_obj *outbuf;
   void (*output)(grn_ctx *, int, void *);
+  /* output can send output_ref that precedes outbuf without copying it. */
+  grn_bool output_ref_enabled;
+  grn_obj *output_ref;
+  grn_cache *output_ref_cache;
+  /* output is called with GRN_CTX_MORE when outbuf exceeds the chunk size
+     while records are output. 0 disables it. */
+  size_t output_chunk_size;
+  uint32_t n_output_chunks;
   grn_com *com;
   unsigned int com_status;
   union {
@@ -31,6 +31,7 @@
 #include "util.h"
 #include <string.h>
 #include <float.h>
+#include <math.h>
 
 typedef struct {
   grn_id id;
@@ -75,6 +76,9 @@ inline static int
 grn_table_cursor_get_value_inline(grn_ctx *ctx, grn_table_cursor *tc, void **value);
 
 static void grn_obj_ensure_bulk(grn_ctx *ctx, grn_obj *obj);
+static void build_index(grn_ctx *ctx, grn_obj *obj);
+static grn_rc rebuild_index(grn_ctx *ctx, grn_obj *obj,
+                            grn_obj_flags codec_flags);
 static void grn_obj_ensure_vector(grn_ctx *ctx, grn_obj *obj);
 
 inline static void
@@ -415,6 +419,12 @@ grn_obj_io(grn_obj *obj)
   return io;
 }
 
+grn_io *
+grn_obj_get_io(grn_obj *obj)
+{
+  return grn_obj_io(obj);
+}
+
 uint32_t
 grn_db_lastmod(grn_obj *s)
 {
@@ -431,6 +441,12 @@ grn_db_touch(grn_ctx *ctx, grn_obj *s)
 
 #define IS_TEMP(obj) (DB_OBJ(obj)->id & GRN_OBJ_TMP_OBJECT)
 
+/*
+ * Touching a table or a column updates the last modified time of the
+ * table, not of the whole database. The query cache checks only the
+ * tables that a cached result depends on. Touching the database
+ * invalidates all cached results.
+ */
 void
 grn_obj_touch(grn_ctx *ctx, grn_obj *obj, grn_timeval *tv)
 {
@@ -448,17 +464,33 @@ grn_obj_touch(grn_ctx *ctx, grn_obj *obj, grn_timeval *tv)
     case GRN_TABLE_PAT_KEY :
     case GRN_TABLE_DAT_KEY :
     case GRN_TABLE_NO_KEY :
+      if (!IS_TEMP(obj)) {
+        grn_obj_io(obj)->header->lastmod = tv->tv_sec;
+      }
+      break;
     case GRN_COLUMN_VAR_SIZE :
     case GRN_COLUMN_FIX_SIZE :
     case GRN_COLUMN_INDEX :
       if (!IS_TEMP(obj)) {
-        grn_obj_io(DB_OBJ(obj)->db)->header->lastmod = tv->tv_sec;
+        grn_obj *table = grn_ctx_at(ctx, obj->header.domain);
+        grn_obj_io(obj)->header->lastmod = tv->tv_sec;
+        if (table) {
+          grn_obj_io(table)->header->lastmod = tv->tv_sec;
+        }
       }
       break;
     }
   }
 }
 
+uint32_t
+grn_obj_lastmod(grn_ctx *ctx, grn_obj *obj)
+{
+  grn_io *io = grn_obj_io(obj);
+  if (!io) { return 0; }
+  return io->header->lastmod;
+}
+
 grn_rc
 grn_db_check_name(grn_ctx *ctx, const char *name, unsigned int name_size)
 {
@@ -624,6 +656,7 @@ grn_proc_create(grn_ctx *ctx, const char *name, int name_size, grn_proc_type typ
 
 static void
 calc_rec_size(grn_obj_flags flags, uint32_t max_n_subrecs, uint32_t range_size,
+              grn_table_group_flags calc_types,
               uint8_t *subrec_size, uint8_t *subrec_offset,
               uint32_t *key_size, uint32_t *value_size)
 {
@@ -664,6 +697,10 @@ calc_rec_size(grn_obj_flags flags, uint32_t max_n_subrecs, uint32_t range_size,
     }
     *value_size = (uintptr_t)GRN_RSET_SUBRECS_NTH((((grn_rset_recinfo *)0)->subrecs),
                                                   *subrec_size, max_n_subrecs);
+    if (calc_types) {
+      *value_size = GRN_RSET_CALC_VALUES_ALIGN(*value_size) +
+        grn_rset_recinfo_calc_values_size(calc_types);
+    }
   } else {
     *value_size = range_size;
   }
@@ -719,7 +756,8 @@ static grn_obj *
 grn_table_create_with_max_n_subrecs(grn_ctx *ctx, const char *name,
                                     unsigned int name_size, const char *path,
                                     grn_obj_flags flags, grn_obj *key_type,
-                                    grn_obj *value_type, uint32_t max_n_subrecs)
+                                    grn_obj *value_type, uint32_t max_n_subrecs,
+                                    grn_table_group_flags calc_types)
 {
   grn_id id;
   grn_id domain = GRN_ID_NIL, range = GRN_ID_NIL;
@@ -853,7 +891,7 @@ grn_table_create_with_max_n_subrecs(grn_ctx *ctx, const char *name,
       return NULL;
     }
   }
-  calc_rec_size(flags, max_n_subrecs, range_size, &subrec_size,
+  calc_rec_size(flags, max_n_subrecs, range_size, calc_types, &subrec_size,
                 &subrec_offset, &key_size, &value_size);
   switch (flags & GRN_OBJ_TABLE_TYPE_MASK) {
   case GRN_OBJ_TABLE_HASH_KEY :
@@ -877,6 +915,8 @@ grn_table_create_with_max_n_subrecs(grn_ctx *ctx, const char *name,
     DB_OBJ(res)->max_n_subrecs = max_n_subrecs;
     DB_OBJ(res)->subrec_size = subrec_size;
     DB_OBJ(res)->subrec_offset = subrec_offset;
+    DB_OBJ(res)->group.calc_types = calc_types;
+    DB_OBJ(res)->group.calc_range = GRN_ID_NIL;
     if (grn_db_obj_init(ctx, db, id, DB_OBJ(res))) {
       _grn_obj_remove(ctx, res);
       res = NULL;
@@ -895,7 +935,7 @@ grn_table_create(grn_ctx *ctx, const char *name, unsigned int name_size,
   grn_obj *res;
   GRN_API_ENTER;
   res = grn_table_create_with_max_n_subrecs(ctx, name, name_size, path,
-                                            flags, key_type, value_type, 0);
+                                            flags, key_type, value_type, 0, 0);
   GRN_API_RETURN(res);
 }
 
@@ -904,6 +944,18 @@ grn_table_create_for_group(grn_ctx *ctx, const char *name,
                            unsigned int name_size, const char *path,
                            grn_obj *group_key, grn_obj *value_type,
                            unsigned int max_n_subrecs)
+{
+  return grn_table_create_for_group_with_calc(ctx, name, name_size, path,
+                                              group_key, value_type,
+                                              max_n_subrecs, 0);
+}
+
+grn_obj *
+grn_table_create_for_group_with_calc(grn_ctx *ctx, const char *name,
+                                     unsigned int name_size, const char *path,
+                                     grn_obj *group_key, grn_obj *value_type,
+                                     unsigned int max_n_subrecs,
+                                     grn_table_group_flags calc_types)
 {
   grn_obj *res = NULL;
   grn_obj *key_type;
@@ -914,7 +966,9 @@ grn_table_create_for_group(grn_ctx *ctx, const char *name,
                                               GRN_TABLE_HASH_KEY|
                                               GRN_OBJ_WITH_SUBREC|
                                               GRN_OBJ_UNIT_USERDEF_DOCUMENT,
-                                              key_type, value_type, max_n_subrecs);
+                                              key_type, value_type, max_n_subrecs,
+                                              calc_types &
+                                              GRN_TABLE_GROUP_CALC_VALUE_TYPES);
   }
   GRN_API_RETURN(res);
 }
@@ -1058,6 +1112,100 @@ struct _grn_hook {
   uint32_t hld_size;
 };
 
+static void
+grn_table_touch_index_lexicons(grn_ctx *ctx, grn_obj *obj, grn_timeval *tv)
+{
+  grn_hook *hooks;
+  for (hooks = DB_OBJ(obj)->hooks[GRN_HOOK_INSERT]; hooks; hooks = hooks->next) {
+    default_set_value_hook_data *data = (void *)NEXT_ADDR(hooks);
+    grn_obj *target = grn_ctx_at(ctx, data->target);
+    if (target && target->header.type == GRN_COLUMN_INDEX) {
+      grn_obj_touch(ctx, target, tv);
+    }
+  }
+  for (hooks = DB_OBJ(obj)->hooks[GRN_HOOK_SET]; hooks; hooks = hooks->next) {
+    default_set_value_hook_data *data = (void *)NEXT_ADDR(hooks);
+    grn_obj *target = grn_ctx_at(ctx, data->target);
+    if (target && target->header.type == GRN_COLUMN_INDEX) {
+      grn_obj_touch(ctx, target, tv);
+    }
+  }
+}
+
+/*
+ * Adding records to a table may also add keys to the tables that its
+ * reference columns refer to and to the lexicons of its indexes. This
+ * touches all of them.
+ */
+void
+grn_table_touch_with_related(grn_ctx *ctx, grn_obj *table)
+{
+  grn_timeval tv;
+  grn_hash *columns;
+  if (!table || IS_TEMP(table)) { return; }
+  grn_timeval_now(ctx, &tv);
+  grn_obj_touch(ctx, table, &tv);
+  grn_table_touch_index_lexicons(ctx, table, &tv);
+  if ((columns = grn_hash_create(ctx, NULL, sizeof(grn_id), 0,
+                                 GRN_OBJ_TABLE_HASH_KEY|GRN_HASH_TINY))) {
+    if (grn_table_columns(ctx, table, "", 0, (grn_obj *)columns)) {
+      grn_id *key;
+      GRN_HASH_EACH(ctx, columns, id, &key, NULL, NULL, {
+        grn_obj *column = grn_ctx_at(ctx, *key);
+        grn_obj *range;
+        if (!column) { continue; }
+        grn_obj_touch(ctx, column, &tv);
+        grn_table_touch_index_lexicons(ctx, column, &tv);
+        range = grn_ctx_at(ctx, grn_obj_get_range(ctx, column));
+        if (range && GRN_OBJ_TABLEP(range)) {
+          grn_obj_touch(ctx, range, &tv);
+        }
+      });
+    }
+    grn_hash_close(ctx, columns);
+  }
+}
+
+/*
+ * An update of the values of an object, including the hooks that update its
+ * indexes, is bracketed by grn_obj_update_enter() and grn_obj_update_leave().
+ * grn_obj_update_wait() waits for the updates that entered before it was
+ * called. Updates that enter later are counted under the next epoch, so
+ * continuous updates can't keep the waiter waiting.
+ */
+uint32_t
+grn_obj_update_enter(grn_ctx *ctx, grn_obj *obj)
+{
+  grn_db_obj *db_obj = DB_OBJ(obj);
+  uint32_t epoch, n;
+  for (;;) {
+    epoch = *((volatile uint32_t *)&db_obj->update_epoch);
+    GRN_ATOMIC_ADD_EX(&db_obj->n_updaters[epoch & 1], 1, n);
+    if (*((volatile uint32_t *)&db_obj->update_epoch) == epoch) {
+      return epoch;
+    }
+    GRN_ATOMIC_ADD_EX(&db_obj->n_updaters[epoch & 1], -1, n);
+  }
+}
+
+void
+grn_obj_update_leave(grn_ctx *ctx, grn_obj *obj, uint32_t epoch)
+{
+  uint32_t n;
+  GRN_ATOMIC_ADD_EX(&DB_OBJ(obj)->n_updaters[epoch & 1], -1, n);
+}
+
+void
+grn_obj_update_wait(grn_ctx *ctx, grn_obj *obj)
+{
+  grn_db_obj *db_obj = DB_OBJ(obj);
+  uint32_t epoch;
+  GRN_ATOMIC_ADD_EX(&db_obj->update_epoch, 1, epoch);
+  while (*((volatile uint32_t *)&db_obj->n_updaters[epoch & 1])) {
+    grn_nanosleep(1000000);
+  }
+}
+
 static grn_obj *
 default_set_value_hook(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
 {
@@ -1681,10 +1829,14 @@ grn_table_delete(grn_ctx *ctx, grn_obj *table, const void *key, unsigned int key
   if (table) {
     if (key && key_size) { rid = grn_table_get(ctx, table, key, key_size); }
     if (rid) {
+      grn_bool hooked;
+      uint32_t epoch = 0;
       rc = delete_reference_records(ctx, table, rid);
       if (rc != GRN_SUCCESS) {
         goto exit;
       }
+      hooked = DB_OBJ(table)->hooks[GRN_HOOK_DELETE] != NULL;
+      if (hooked) { epoch = grn_obj_update_enter(ctx, table); }
       call_delete_hook(ctx, table, rid, key, key_size);
       clear_column_values(ctx, table, rid);
       switch (table->header.type) {
@@ -1731,6 +1883,7 @@ grn_table_delete(grn_ctx *ctx, grn_obj *table, const void *key, unsigned int key
         });
         break;
       }
+      if (hooked) { grn_obj_update_leave(ctx, table, epoch); }
       grn_obj_touch(ctx, table, NULL);
     }
   }
@@ -1747,10 +1900,14 @@ _grn_table_delete_by_id(grn_ctx *ctx, grn_obj *table, grn_id id,
     const void *key;
     unsigned int key_size;
     if (id) {
+      grn_bool hooked;
+      uint32_t epoch = 0;
       rc = delete_reference_records(ctx, table, id);
       if (rc != GRN_SUCCESS) {
         goto exit;
       }
+      hooked = DB_OBJ(table)->hooks[GRN_HOOK_DELETE] != NULL;
+      if (hooked) { epoch = grn_obj_update_enter(ctx, table); }
       if ((key = _grn_table_key(ctx, table, id, &key_size))) {
         call_delete_hook(ctx, table, id, key, key_size);
       }
@@ -1769,6 +1926,7 @@ _grn_table_delete_by_id(grn_ctx *ctx, grn_obj *table, grn_id id,
         rc = grn_array_delete_by_id(ctx, (grn_array *)table, id, optarg);
         break;
       }
+      if (hooked) { grn_obj_update_leave(ctx, table, epoch); }
       if (rc == GRN_SUCCESS) {
         clear_column_values(ctx, table, id);
       }
@@ -1835,6 +1993,49 @@ exit :
   GRN_API_RETURN(rc);
 }
 
+/*
+ * Rebuilds an index column with the given codec flags (GRN_OBJ_INDEX_SIMD
+ * or 0). The postings are rebuilt from the source columns while the column
+ * keeps serving queries.
+ */
+grn_rc
+grn_index_column_convert(grn_ctx *ctx, grn_obj *column,
+                         grn_obj_flags codec_flags)
+{
+  grn_rc rc = GRN_INVALID_ARGUMENT;
+  GRN_API_ENTER;
+  if (!column || column->header.type != GRN_COLUMN_INDEX) {
+    ERR(rc, "[index][convert] not an index column");
+    goto exit;
+  }
+  if (codec_flags & ~GRN_OBJ_INDEX_SIMD) {
+    ERR(rc, "[index][convert] invalid codec flags: %#x", codec_flags);
+    goto exit;
+  }
+  rc = rebuild_index(ctx, column, codec_flags);
+exit :
+  GRN_API_RETURN(rc);
+}
+
+/*
+ * Rebuilds an index column from the source columns while it keeps serving
+ * queries and updates.
+ */
+grn_rc
+grn_index_column_rebuild(grn_ctx *ctx, grn_obj *column)
+{
+  grn_rc rc = GRN_INVALID_ARGUMENT;
+  GRN_API_ENTER;
+  if (!column || column->header.type != GRN_COLUMN_INDEX) {
+    ERR(rc, "[index][rebuild] not an index column");
+    goto exit;
+  }
+  rc = rebuild_index(ctx, column,
+                     DB_OBJ(column)->header.flags & GRN_OBJ_INDEX_SIMD);
+exit :
+  GRN_API_RETURN(rc);
+}
+
 grn_rc
 grn_table_truncate(grn_ctx *ctx, grn_obj *table)
 {
@@ -1891,7 +2092,7 @@ grn_table_truncate(grn_ctx *ctx, grn_obj *table)
     }
     grn_obj_set_info(ctx, table, GRN_INFO_DEFAULT_TOKENIZER, tokenizer);
     grn_obj_set_info(ctx, table, GRN_INFO_NORMALIZER, normalizer);
-    grn_obj_touch(ctx, table, NULL);
+    grn_table_touch_with_related(ctx, table);
   }
 exit :
   GRN_API_RETURN(rc);
@@ -2956,92 +3157,6 @@ grn_obj_search(grn_ctx *ctx, grn_obj *obj, grn_obj *query,
 #define GRN_TABLE_GROUP_FILTER_PREFIX    0
 #define GRN_TABLE_GROUP_FILTER_SUFFIX    (1L<<2)
 
-static int
-accelerated_table_group(grn_ctx *ctx, grn_obj *table, grn_obj *key, grn_obj *res)
-{
-  if (key->header.type == GRN_ACCESSOR) {
-    grn_accessor *a = (grn_accessor *)key;
-    if (a->action == GRN_ACCESSOR_GET_KEY &&
-        a->next && a->next->action == GRN_ACCESSOR_GET_COLUMN_VALUE &&
-        a->next->obj && !a->next->next) {
-      grn_obj *range = grn_ctx_at(ctx, grn_obj_get_range(ctx, key));
-      int idp = GRN_OBJ_TABLEP(range);
-      grn_table_cursor *tc;
-      if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
-        switch (a->next->obj->header.type) {
-        case GRN_COLUMN_FIX_SIZE :
-          {
-            grn_id id;
-            grn_ra *ra = (grn_ra *)a->next->obj;
-            unsigned int element_size = (ra)->header->element_size;
-            grn_ra_cache cache;
-            GRN_RA_CACHE_INIT(ra, &cache);
-            while ((id = grn_table_cursor_next_inline(ctx, tc))) {
-              void *v, *value;
-              grn_id *id_;
-              uint32_t key_size;
-              grn_rset_recinfo *ri = NULL;
-              if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
-                grn_table_cursor_get_value_inline(ctx, tc, (void **)&ri);
-              }
-              id_ = (grn_id *)_grn_table_key(ctx, table, id, &key_size);
-              v = grn_ra_ref_cache(ctx, ra, *id_, &cache);
-              if (idp && *((grn_id *)v) &&
-                  grn_table_at(ctx, range, *((grn_id *)v)) == GRN_ID_NIL) {
-                continue;
-              }
-              if ((!idp || *((grn_id *)v)) &&
-                  grn_table_add_v_inline(ctx, res, v, element_size, &value, NULL)) {
-                grn_table_add_subrec_inline(res, value, ri ? ri->score : 0,
-                                            (grn_rset_posinfo *)&id, 0);
-              }
-            }
-            GRN_RA_CACHE_FIN(ra, &cache);
-          }
-          break;
-        case GRN_COLUMN_VAR_SIZE :
-          if (idp) { /* todo : support other type */
-            grn_id id;
-            grn_ja *ja = (grn_ja *)a->next->obj;
-            while ((id = grn_table_cursor_next_inline(ctx, tc))) {
-              grn_io_win jw;
-              unsigned int len = 0;
-              void *value;
-              grn_id *v, *id_;
-              uint32_t key_size;
-              grn_rset_recinfo *ri = NULL;
-              if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
-                grn_table_cursor_get_value_inline(ctx, tc, (void **)&ri);
-              }
-              id_ = (grn_id *)_grn_table_key(ctx, table, id, &key_size);
-              if ((v = grn_ja_ref(ctx, ja, *id_, &jw, &len))) {
-                while (len) {
-                  if ((*v != GRN_ID_NIL) &&
-                      grn_table_add_v_inline(ctx, res, v, sizeof(grn_id), &value, NULL)) {
-                    grn_table_add_subrec_inline(res, value, ri ? ri->score : 0,
-                                                (grn_rset_posinfo *)&id, 0);
-                  }
-                  v++;
-                  len -= sizeof(grn_id);
-                }
-                grn_ja_unref(ctx, &jw);
-              }
-            }
-          } else {
-            return 0;
-          }
-          break;
-        default :
-          return 0;
-        }
-        grn_table_cursor_close(ctx, tc);
-        return 1;
-      }
-    }
-  }
-  return 0;
-}
-
 grn_rc
 grn_table_group_with_range_gap(grn_ctx *ctx, grn_obj *table,
                                grn_table_sort_key *group_key,
@@ -3145,120 +3260,1048 @@ grn_table_group_with_range_gap(grn_ctx *ctx, grn_obj *table,
   return 0;
 }
 
-grn_rc
-grn_table_group(grn_ctx *ctx, grn_obj *table,
-                grn_table_sort_key *keys, int n_keys,
-                grn_table_group_result *results, int n_results)
-{
-  grn_rc rc = GRN_SUCCESS;
-  if (!table || !n_keys || !n_results) {
-    ERR(GRN_INVALID_ARGUMENT, "table or n_keys or n_results is void");
-    return GRN_INVALID_ARGUMENT;
+/*
+ * The values calculated for a group are stored in the order of
+ * GRN_TABLE_GROUP_CALC_MAX, _MIN, _SUM, _AVG and _COUNT_DISTINCT. A value
+ * is an int64_t or a double by the range of the calc target and _AVG
+ * keeps the sum of the values as a double after the average.
+ *
+ * _COUNT_DISTINCT keeps the number of distinct values, the harmonic sum
+ * of the registers, the number of empty registers and the number of
+ * hashes, followed by the registers. While a group has at most
+ * CALC_COUNT_DISTINCT_MAX_N_HASHES distinct values, the registers keep
+ * the hashes of the values and the number is exact. After that, the
+ * hashes are converted to HyperLogLog registers and the number is an
+ * estimate, whose standard error is 1.04 / sqrt(1024), about 3.3%. The
+ * harmonic sum and the number of empty registers are updated when a
+ * register is raised.
+ */
+#define CALC_COUNT_DISTINCT_PRECISION 10
+#define CALC_COUNT_DISTINCT_N_REGISTERS (1 << CALC_COUNT_DISTINCT_PRECISION)
+#define CALC_COUNT_DISTINCT_MAX_N_HASHES \
+  (CALC_COUNT_DISTINCT_N_REGISTERS / sizeof(uint64_t))
+/* n_hashes of a group whose registers are HyperLogLog registers. */
+#define CALC_COUNT_DISTINCT_DENSE 0xffffffff
+
+typedef struct {
+  int64_t estimate;
+  double harmonic_sum;
+  uint32_t n_empty_registers;
+  uint32_t n_hashes;
+  uint8_t registers[CALC_COUNT_DISTINCT_N_REGISTERS];
+} calc_count_distinct;
+
+static uint32_t
+calc_value_size(grn_table_group_flags calc_type)
+{
+  switch (calc_type) {
+  case GRN_TABLE_GROUP_CALC_MAX :
+  case GRN_TABLE_GROUP_CALC_MIN :
+  case GRN_TABLE_GROUP_CALC_SUM :
+    return sizeof(int64_t);
+  case GRN_TABLE_GROUP_CALC_AVG :
+    return sizeof(double) * 2;
+  case GRN_TABLE_GROUP_CALC_COUNT_DISTINCT :
+    return sizeof(calc_count_distinct);
+  default :
+    return 0;
   }
-  GRN_API_ENTER;
-  {
-    int k, r;
-    void *key;
-    grn_obj bulk;
-    grn_table_cursor *tc;
-    grn_table_sort_key *kp;
-    grn_table_group_result *rp;
-    for (k = 0, kp = keys; k < n_keys; k++, kp++) {
-      if ((kp->flags & GRN_TABLE_GROUP_BY_COLUMN_VALUE) && !kp->key) {
-        ERR(GRN_INVALID_ARGUMENT, "column missing in (%d)", k);
-        goto exit;
-      }
-    }
-    for (r = 0, rp = results; r < n_results; r++, rp++) {
-      if (!rp->table) {
-        ERR(GRN_INVALID_ARGUMENT, "table missing in (%d)", r);
-        goto exit;
-      }
-    }
-    GRN_TEXT_INIT(&bulk, 0);
-    if (n_keys == 1 && n_results == 1) {
-      if (!accelerated_table_group(ctx, table, keys->key, results->table)) {
-        if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
-          grn_id id;
-          grn_obj *range = grn_ctx_at(ctx, grn_obj_get_range(ctx, keys->key));
-          int idp = GRN_OBJ_TABLEP(range);
-          while ((id = grn_table_cursor_next_inline(ctx, tc))) {
-            void *value;
-            grn_rset_recinfo *ri = NULL;
-            GRN_BULK_REWIND(&bulk);
-            if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
-              grn_table_cursor_get_value_inline(ctx, tc, (void **)&ri);
-            }
-            grn_obj_get_value(ctx, keys->key, id, &bulk);
-            switch (bulk.header.type) {
-            case GRN_UVECTOR :
-              {
-                // todo : support objects except grn_id
-                grn_id *v = (grn_id *)GRN_BULK_HEAD(&bulk);
-                grn_id *ve = (grn_id *)GRN_BULK_CURR(&bulk);
-                while (v < ve) {
-                  if ((*v != GRN_ID_NIL) &&
-                      grn_table_add_v_inline(ctx, results->table, v, sizeof(grn_id), &value, NULL)) {
-                    grn_table_add_subrec_inline(results->table, value, ri ? ri->score : 0,
-                                                (grn_rset_posinfo *)&id, 0);
-                  }
-                  v++;
-                }
-              }
-              break;
-            case GRN_VECTOR :
-              ERR(GRN_OPERATION_NOT_SUPPORTED, "sorry.. not implemented yet");
-              /* todo */
-              break;
-            case GRN_BULK :
-              {
-                if ((!idp || *((grn_id *)GRN_BULK_HEAD(&bulk))) &&
-                    grn_table_add_v_inline(ctx, results->table,
-                                           GRN_BULK_HEAD(&bulk), GRN_BULK_VSIZE(&bulk), &value, NULL)) {
-                  grn_table_add_subrec_inline(results->table, value, ri ? ri->score : 0,
-                                              (grn_rset_posinfo *)&id, 0);
-                }
-              }
-              break;
-            default :
-              ERR(GRN_INVALID_ARGUMENT, "invalid column");
-              break;
-            }
-          }
-          grn_table_cursor_close(ctx, tc);
-        }
-      }
-    } else {
-      if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
-        grn_id id;
-        while ((id = grn_table_cursor_next_inline(ctx, tc))) {
-          grn_rset_recinfo *ri = NULL;
-          GRN_BULK_REWIND(&bulk);
-          if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
-            grn_table_cursor_get_value_inline(ctx, tc, (void **)&ri);
-          }
-          for (k = 0, kp = keys; k < n_keys; k++, kp++) {
-            kp->offset = GRN_BULK_VSIZE(&bulk);
-            grn_obj_get_value(ctx, kp->key, id, &bulk);
-          }
-          for (r = 0, rp = results; r < n_results; r++, rp++) {
-            void *value;
-            int begin = keys[rp->key_begin].offset;
-            int end = rp->key_end >= n_keys
-              ? GRN_BULK_VSIZE(&bulk)
-              : keys[rp->key_end].offset;
-            key = GRN_BULK_HEAD(&bulk) + begin;
-            // todo : cut off GRN_ID_NIL
-            if (grn_table_add_v_inline(ctx, rp->table, key, end - begin, &value, NULL)) {
-              grn_table_add_subrec_inline(rp->table, value, ri ? ri->score : 0,
-                                          (grn_rset_posinfo *)&id, 0);
-            }
-          }
-        }
-        grn_table_cursor_close(ctx, tc);
-      }
+}
+
+uint32_t
+grn_rset_recinfo_calc_values_size(grn_table_group_flags calc_types)
+{
+  uint32_t size = 0;
+  grn_table_group_flags calc_type;
+  for (calc_type = GRN_TABLE_GROUP_CALC_MAX;
+       calc_type <= GRN_TABLE_GROUP_CALC_COUNT_DISTINCT;
+       calc_type <<= 1) {
+    if (calc_types & calc_type) {
+      size += calc_value_size(calc_type);
+    }
+  }
+  return size;
+}
+
+byte *
+grn_rset_recinfo_calc_value(grn_obj *table, grn_rset_recinfo *ri,
+                            grn_table_group_flags calc_type)
+{
+  grn_table_group_flags calc_types = DB_OBJ(table)->group.calc_types;
+  uintptr_t offset;
+  if (!(calc_types & calc_type)) { return NULL; }
+  offset = (uintptr_t)GRN_RSET_SUBRECS_NTH((((grn_rset_recinfo *)0)->subrecs),
+                                           DB_OBJ(table)->subrec_size,
+                                           DB_OBJ(table)->max_n_subrecs);
+  offset = GRN_RSET_CALC_VALUES_ALIGN(offset);
+  offset += grn_rset_recinfo_calc_values_size(calc_types & (calc_type - 1));
+  return (byte *)ri + offset;
+}
+
+grn_id
+grn_rset_recinfo_calc_value_range(grn_obj *table,
+                                  grn_table_group_flags calc_type)
+{
+  switch (calc_type) {
+  case GRN_TABLE_GROUP_CALC_MAX :
+  case GRN_TABLE_GROUP_CALC_MIN :
+  case GRN_TABLE_GROUP_CALC_SUM :
+    if (DB_OBJ(table)->group.calc_range == GRN_DB_FLOAT) {
+      return GRN_DB_FLOAT;
+    }
+    return GRN_DB_INT64;
+  case GRN_TABLE_GROUP_CALC_AVG :
+    return GRN_DB_FLOAT;
+  case GRN_TABLE_GROUP_CALC_COUNT_DISTINCT :
+    return GRN_DB_INT64;
+  default :
+    return GRN_ID_NIL;
+  }
+}
+
+static grn_bool
+calc_target_is_number(grn_id range)
+{
+  switch (range) {
+  case GRN_DB_INT8 :
+  case GRN_DB_UINT8 :
+  case GRN_DB_INT16 :
+  case GRN_DB_UINT16 :
+  case GRN_DB_INT32 :
+  case GRN_DB_UINT32 :
+  case GRN_DB_INT64 :
+  case GRN_DB_UINT64 :
+  case GRN_DB_TIME :
+  case GRN_DB_FLOAT :
+    return GRN_TRUE;
+  default :
+    return GRN_FALSE;
+  }
+}
+
+/* A value of a calc target of a record. */
+typedef struct {
+  int64_t int_value;
+  double float_value;
+  uint64_t hash;
+} calc_value;
+
+inline static uint64_t
+calc_hash(const void *value, uint32_t value_size)
+{
+  const uint8_t *p = (const uint8_t *)value;
+  const uint8_t *pe = p + value_size;
+  uint64_t h = 14695981039346656037ULL;
+  for (; p < pe; p++) {
+    h ^= *p;
+    h *= 1099511628211ULL;
+  }
+  /* FNV-1a doesn't mix the high bits enough for the register index. */
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+#define CALC_VALUE_SET(type) do {\
+  type v = 0;\
+  if (value_size >= sizeof(type)) { memcpy(&v, value, sizeof(type)); }\
+  calc->int_value = (int64_t)v;\
+  calc->float_value = (double)v;\
+} while (0)
+
+static void
+calc_value_set(calc_value *calc, grn_table_group_flags calc_types,
+               grn_id range, const void *value, uint32_t value_size)
+{
+  switch (range) {
+  case GRN_DB_INT8 :
+    CALC_VALUE_SET(int8_t);
+    break;
+  case GRN_DB_UINT8 :
+    CALC_VALUE_SET(uint8_t);
+    break;
+  case GRN_DB_INT16 :
+    CALC_VALUE_SET(int16_t);
+    break;
+  case GRN_DB_UINT16 :
+    CALC_VALUE_SET(uint16_t);
+    break;
+  case GRN_DB_INT32 :
+    CALC_VALUE_SET(int32_t);
+    break;
+  case GRN_DB_UINT32 :
+    CALC_VALUE_SET(uint32_t);
+    break;
+  case GRN_DB_INT64 :
+  case GRN_DB_TIME :
+    CALC_VALUE_SET(int64_t);
+    break;
+  case GRN_DB_UINT64 :
+    CALC_VALUE_SET(uint64_t);
+    break;
+  case GRN_DB_FLOAT :
+    CALC_VALUE_SET(double);
+    break;
+  default :
+    calc->int_value = 0;
+    calc->float_value = 0.0;
+    break;
+  }
+  if (calc_types & GRN_TABLE_GROUP_CALC_COUNT_DISTINCT) {
+    calc->hash = calc_hash(value, value_size);
+  }
+}
+
+static int64_t
+calc_count_distinct_estimate(calc_count_distinct *count_distinct)
+{
+  double m = CALC_COUNT_DISTINCT_N_REGISTERS;
+  double estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m /
+    count_distinct->harmonic_sum;
+  if (estimate <= 2.5 * m && count_distinct->n_empty_registers > 0) {
+    /* linear counting is more accurate for small cardinalities */
+    estimate = m * log(m / count_distinct->n_empty_registers);
+  }
+  return (int64_t)(estimate + 0.5);
+}
+
+static void
+calc_count_distinct_init(calc_count_distinct *count_distinct)
+{
+  count_distinct->estimate = 0;
+  count_distinct->harmonic_sum = CALC_COUNT_DISTINCT_N_REGISTERS;
+  count_distinct->n_empty_registers = CALC_COUNT_DISTINCT_N_REGISTERS;
+  count_distinct->n_hashes = 0;
+}
+
+inline static void
+calc_count_distinct_raise(calc_count_distinct *count_distinct,
+                          uint32_t i, uint8_t rank)
+{
+  uint8_t current = count_distinct->registers[i];
+  if (rank <= current) { return; }
+  if (!current) { count_distinct->n_empty_registers--; }
+  count_distinct->harmonic_sum +=
+    1.0 / ((uint64_t)1 << rank) - 1.0 / ((uint64_t)1 << current);
+  count_distinct->registers[i] = rank;
+  count_distinct->estimate = calc_count_distinct_estimate(count_distinct);
+}
+
+inline static void
+calc_count_distinct_add_dense(calc_count_distinct *count_distinct,
+                              uint64_t hash)
+{
+  uint32_t i = (uint32_t)(hash >> (64 - CALC_COUNT_DISTINCT_PRECISION));
+  uint64_t rest = hash << CALC_COUNT_DISTINCT_PRECISION;
+  uint8_t rank = 1;
+  while (rank <= 64 - CALC_COUNT_DISTINCT_PRECISION &&
+         !(rest & 0x8000000000000000ULL)) {
+    rank++;
+    rest <<= 1;
+  }
+  calc_count_distinct_raise(count_distinct, i, rank);
+}
+
+/* Converts the hashes in the registers to HyperLogLog registers. */
+static void
+calc_count_distinct_densify(calc_count_distinct *count_distinct)
+{
+  uint64_t hashes[CALC_COUNT_DISTINCT_MAX_N_HASHES];
+  uint32_t i, n_hashes = count_distinct->n_hashes;
+  memcpy(hashes, count_distinct->registers, sizeof(uint64_t) * n_hashes);
+  memset(count_distinct->registers, 0, CALC_COUNT_DISTINCT_N_REGISTERS);
+  count_distinct->n_hashes = CALC_COUNT_DISTINCT_DENSE;
+  for (i = 0; i < n_hashes; i++) {
+    calc_count_distinct_add_dense(count_distinct, hashes[i]);
+  }
+}
+
+inline static void
+calc_count_distinct_add(calc_count_distinct *count_distinct, uint64_t hash)
+{
+  if (count_distinct->n_hashes != CALC_COUNT_DISTINCT_DENSE) {
+    uint32_t i;
+    uint64_t kept_hash;
+    for (i = 0; i < count_distinct->n_hashes; i++) {
+      memcpy(&kept_hash, count_distinct->registers + sizeof(uint64_t) * i,
+             sizeof(uint64_t));
+      if (kept_hash == hash) { return; }
+    }
+    if (count_distinct->n_hashes < CALC_COUNT_DISTINCT_MAX_N_HASHES) {
+      memcpy(count_distinct->registers + sizeof(uint64_t) * i,
+             &hash, sizeof(uint64_t));
+      count_distinct->n_hashes++;
+      count_distinct->estimate = count_distinct->n_hashes;
+      return;
+    }
+    calc_count_distinct_densify(count_distinct);
+  }
+  calc_count_distinct_add_dense(count_distinct, hash);
+}
+
+static void
+calc_count_distinct_merge(calc_count_distinct *count_distinct,
+                          calc_count_distinct *group_count_distinct)
+{
+  uint32_t i;
+  if (group_count_distinct->n_hashes != CALC_COUNT_DISTINCT_DENSE) {
+    uint64_t hash;
+    for (i = 0; i < group_count_distinct->n_hashes; i++) {
+      memcpy(&hash, group_count_distinct->registers + sizeof(uint64_t) * i,
+             sizeof(uint64_t));
+      calc_count_distinct_add(count_distinct, hash);
+    }
+    return;
+  }
+  if (count_distinct->n_hashes != CALC_COUNT_DISTINCT_DENSE) {
+    calc_count_distinct_densify(count_distinct);
+  }
+  for (i = 0; i < CALC_COUNT_DISTINCT_N_REGISTERS; i++) {
+    calc_count_distinct_raise(count_distinct, i,
+                              group_count_distinct->registers[i]);
+  }
+}
+
+/* Updates the calculated values of a group that a record has just been
+   added to. */
+static void
+calc_values_update(grn_obj *table, grn_rset_recinfo *ri, const calc_value *calc)
+{
+  grn_table_group_flags calc_types = DB_OBJ(table)->group.calc_types;
+  grn_bool is_float = DB_OBJ(table)->group.calc_range == GRN_DB_FLOAT;
+  grn_bool is_first = GRN_RSET_N_SUBRECS(ri) == 1;
+  byte *p = grn_rset_recinfo_calc_value(table, ri, calc_types & -calc_types);
+  if (calc_types & GRN_TABLE_GROUP_CALC_MAX) {
+    if (is_float) {
+      double *max = (double *)p;
+      if (is_first || calc->float_value > *max) { *max = calc->float_value; }
+    } else {
+      int64_t *max = (int64_t *)p;
+      if (is_first || calc->int_value > *max) { *max = calc->int_value; }
+    }
+    p += sizeof(int64_t);
+  }
+  if (calc_types & GRN_TABLE_GROUP_CALC_MIN) {
+    if (is_float) {
+      double *min = (double *)p;
+      if (is_first || calc->float_value < *min) { *min = calc->float_value; }
+    } else {
+      int64_t *min = (int64_t *)p;
+      if (is_first || calc->int_value < *min) { *min = calc->int_value; }
+    }
+    p += sizeof(int64_t);
+  }
+  if (calc_types & GRN_TABLE_GROUP_CALC_SUM) {
+    if (is_float) {
+      double *sum = (double *)p;
+      *sum = is_first ? calc->float_value : *sum + calc->float_value;
+    } else {
+      int64_t *sum = (int64_t *)p;
+      *sum = is_first ? calc->int_value : *sum + calc->int_value;
+    }
+    p += sizeof(int64_t);
+  }
+  if (calc_types & GRN_TABLE_GROUP_CALC_AVG) {
+    double *avg = (double *)p;
+    double *sum = avg + 1;
+    *sum = is_first ? calc->float_value : *sum + calc->float_value;
+    *avg = *sum / GRN_RSET_N_SUBRECS(ri);
+    p += sizeof(double) * 2;
+  }
+  if (calc_types & GRN_TABLE_GROUP_CALC_COUNT_DISTINCT) {
+    calc_count_distinct *count_distinct = (calc_count_distinct *)p;
+    if (is_first) { calc_count_distinct_init(count_distinct); }
+    calc_count_distinct_add(count_distinct, calc->hash);
+  }
+}
+
+/* Merges the calculated values of a group into the values of the same
+   group of another table that has the same calc types. */
+static void
+calc_values_merge(grn_obj *table, grn_rset_recinfo *ri,
+                  grn_rset_recinfo *group_ri, grn_bool is_first)
+{
+  grn_table_group_flags calc_types = DB_OBJ(table)->group.calc_types;
+  grn_bool is_float = DB_OBJ(table)->group.calc_range == GRN_DB_FLOAT;
+  grn_table_group_flags first_type = calc_types & -calc_types;
+  byte *p = grn_rset_recinfo_calc_value(table, ri, first_type);
+  byte *gp = grn_rset_recinfo_calc_value(table, group_ri, first_type);
+  if (is_first) {
+    memcpy(p, gp, grn_rset_recinfo_calc_values_size(calc_types));
+    return;
+  }
+  if (calc_types & GRN_TABLE_GROUP_CALC_MAX) {
+    if (is_float) {
+      if (*((double *)gp) > *((double *)p)) { *((double *)p) = *((double *)gp); }
+    } else {
+      if (*((int64_t *)gp) > *((int64_t *)p)) { *((int64_t *)p) = *((int64_t *)gp); }
+    }
+    p += sizeof(int64_t);
+    gp += sizeof(int64_t);
+  }
+  if (calc_types & GRN_TABLE_GROUP_CALC_MIN) {
+    if (is_float) {
+      if (*((double *)gp) < *((double *)p)) { *((double *)p) = *((double *)gp); }
+    } else {
+      if (*((int64_t *)gp) < *((int64_t *)p)) { *((int64_t *)p) = *((int64_t *)gp); }
+    }
+    p += sizeof(int64_t);
+    gp += sizeof(int64_t);
+  }
+  if (calc_types & GRN_TABLE_GROUP_CALC_SUM) {
+    if (is_float) {
+      *((double *)p) += *((double *)gp);
+    } else {
+      *((int64_t *)p) += *((int64_t *)gp);
+    }
+    p += sizeof(int64_t);
+    gp += sizeof(int64_t);
+  }
+  if (calc_types & GRN_TABLE_GROUP_CALC_AVG) {
+    double *avg = (double *)p;
+    avg[1] += ((double *)gp)[1];
+    avg[0] = avg[1] / GRN_RSET_N_SUBRECS(ri);
+    p += sizeof(double) * 2;
+    gp += sizeof(double) * 2;
+  }
+  if (calc_types & GRN_TABLE_GROUP_CALC_COUNT_DISTINCT) {
+    calc_count_distinct_merge((calc_count_distinct *)p,
+                              (calc_count_distinct *)gp);
+  }
+}
+
+/*
+ * Groups records by all keys in one pass. Each key value is read once per
+ * record and shared by all results: a value of a fixed size column is
+ * read from the column directly and the other values are read into a
+ * bulk. A result for one key is grouped like grn_table_group() with one
+ * key does and a result for multiple keys uses the concatenated values as
+ * its key. The records can be split into contiguous parts that are
+ * grouped into temporary hash tables by ctx->impl->n_scan_workers threads.
+ * The temporary tables are merged into the results in the order of the
+ * parts, so the IDs of groups are the same as the sequential grouping.
+ */
+#define GROUP_MAX_N_WORKERS 64
+#define GROUP_MIN_N_RECORDS_PER_WORKER 4096
+
+typedef enum {
+  GROUP_KEY_FIX_SIZE,
+  GROUP_KEY_REFERENCE_VECTOR,
+  GROUP_KEY_GENERIC
+} group_key_type;
+
+typedef struct {
+  group_key_type type;
+  grn_obj *key;
+  grn_obj *range;
+  grn_bool idp;
+  grn_obj *column;
+  /* whether the column is a column of the table referred by _key */
+  grn_bool via_key;
+} group_key;
+
+typedef struct {
+  grn_ra_cache cache;
+  grn_io_win jw;
+  grn_bool referred;
+  grn_obj bulk;
+  const void *value;
+  uint32_t value_size;
+  grn_bool is_valid;
+} group_key_value;
+
+typedef struct {
+  grn_ctx ctx;
+  grn_thread thread;
+  grn_obj *table;
+  group_key *keys;
+  int n_keys;
+  group_key *calc_keys;
+  grn_table_group_result *results;
+  int n_results;
+  grn_obj **targets;
+  const grn_id *ids;
+  const int *scores;
+  size_t n_records;
+} group_worker;
+
+static void
+group_key_init(grn_ctx *ctx, grn_obj *table, grn_obj *key,
+               group_key *group_key)
+{
+  group_key->type = GROUP_KEY_GENERIC;
+  group_key->key = key;
+  group_key->range = grn_ctx_at(ctx, grn_obj_get_range(ctx, key));
+  group_key->idp = GRN_OBJ_TABLEP(group_key->range);
+  group_key->column = NULL;
+  group_key->via_key = GRN_FALSE;
+  if (key->header.type == GRN_ACCESSOR) {
+    grn_accessor *a = (grn_accessor *)key;
+    if (a->action == GRN_ACCESSOR_GET_KEY &&
+        a->next && a->next->action == GRN_ACCESSOR_GET_COLUMN_VALUE &&
+        a->next->obj && !a->next->next) {
+      group_key->column = a->next->obj;
+      group_key->via_key = GRN_TRUE;
+    }
+  } else if (GRN_DB_OBJP(key) && GRN_DB_OBJP(table) &&
+             key->header.domain == DB_OBJ(table)->id) {
+    group_key->column = key;
+  }
+  if (group_key->column) {
+    switch (group_key->column->header.type) {
+    case GRN_COLUMN_FIX_SIZE :
+      group_key->type = GROUP_KEY_FIX_SIZE;
+      break;
+    case GRN_COLUMN_VAR_SIZE :
+      if (group_key->idp) {
+        group_key->type = GROUP_KEY_REFERENCE_VECTOR;
+      } else {
+        group_key->column = NULL;
+      }
+      break;
+    default :
+      group_key->column = NULL;
+      break;
+    }
+  }
+}
+
+static void
+group_keys_init(grn_ctx *ctx, grn_obj *table, grn_table_sort_key *keys,
+                int n_keys, group_key *group_keys)
+{
+  int k;
+  for (k = 0; k < n_keys; k++) {
+    group_key_init(ctx, table, keys[k].key, &(group_keys[k]));
+  }
+}
+
+static void
+group_key_values_init(grn_ctx *ctx, group_key *keys, int n_keys,
+                      group_key_value *values)
+{
+  int k;
+  for (k = 0; k < n_keys; k++) {
+    if (keys[k].type == GROUP_KEY_FIX_SIZE) {
+      GRN_RA_CACHE_INIT((grn_ra *)keys[k].column, &(values[k].cache));
+    }
+    values[k].referred = GRN_FALSE;
+    GRN_TEXT_INIT(&(values[k].bulk), 0);
+  }
+}
+
+static void
+group_key_values_fin(grn_ctx *ctx, group_key *keys, int n_keys,
+                     group_key_value *values)
+{
+  int k;
+  for (k = 0; k < n_keys; k++) {
+    if (keys[k].type == GROUP_KEY_FIX_SIZE) {
+      GRN_RA_CACHE_FIN((grn_ra *)keys[k].column, &(values[k].cache));
+    }
+    GRN_OBJ_FIN(ctx, &(values[k].bulk));
+  }
+}
+
+static void
+group_key_values_read(grn_ctx *ctx, grn_obj *table, grn_id id,
+                      group_key *keys, int n_keys, group_key_value *values)
+{
+  int k;
+  grn_id *key_id = NULL;
+  for (k = 0; k < n_keys; k++) {
+    group_key *key = &(keys[k]);
+    group_key_value *value = &(values[k]);
+    grn_id column_id = id;
+    value->is_valid = GRN_TRUE;
+    if (key->via_key) {
+      if (!key_id) {
+        uint32_t key_size;
+        key_id = (grn_id *)_grn_table_key(ctx, table, id, &key_size);
+      }
+      column_id = *key_id;
+    }
+    switch (key->type) {
+    case GROUP_KEY_FIX_SIZE :
+      {
+        grn_ra *ra = (grn_ra *)key->column;
+        value->value = grn_ra_ref_cache(ctx, ra, column_id, &(value->cache));
+        value->value_size = ra->header->element_size;
+        if (!value->value) {
+          value->value_size = 0;
+          value->is_valid = GRN_FALSE;
+        } else if (key->via_key && key->idp && *((grn_id *)value->value) &&
+            grn_table_at(ctx, key->range,
+                         *((grn_id *)value->value)) == GRN_ID_NIL) {
+          value->is_valid = GRN_FALSE;
+        }
+      }
+      break;
+    case GROUP_KEY_REFERENCE_VECTOR :
+      {
+        unsigned int len = 0;
+        value->value = grn_ja_ref(ctx, (grn_ja *)key->column, column_id,
+                                  &(value->jw), &len);
+        value->referred = value->value ? GRN_TRUE : GRN_FALSE;
+        value->value_size = value->value ? len : 0;
+      }
+      break;
+    case GROUP_KEY_GENERIC :
+      GRN_BULK_REWIND(&(value->bulk));
+      grn_obj_get_value(ctx, key->key, id, &(value->bulk));
+      value->value = GRN_BULK_HEAD(&(value->bulk));
+      value->value_size = GRN_BULK_VSIZE(&(value->bulk));
+      break;
+    }
+  }
+}
+
+static void
+group_key_values_release(grn_ctx *ctx, group_key *keys, int n_keys,
+                         group_key_value *values)
+{
+  int k;
+  for (k = 0; k < n_keys; k++) {
+    if (values[k].referred) {
+      grn_ja_unref(ctx, &(values[k].jw));
+      values[k].referred = GRN_FALSE;
+    }
+  }
+}
+
+inline static void
+group_add(grn_ctx *ctx, grn_obj *target, const void *key, uint32_t key_size,
+          grn_id id, int score, const calc_value *calc)
+{
+  void *value;
+  if (grn_table_add_v_inline(ctx, target, key, key_size, &value, NULL)) {
+    grn_table_add_subrec_inline(target, value, score,
+                                (grn_rset_posinfo *)&id, 0);
+    if (calc) {
+      calc_values_update(target, (grn_rset_recinfo *)value, calc);
+    }
+  }
+}
+
+/* Adds a record to the group of each value like grn_table_group() with
+   one key does. */
+static void
+group_add_by_key(grn_ctx *ctx, grn_obj *target, group_key *key,
+                 group_key_value *value, grn_id id, int score,
+                 const calc_value *calc)
+{
+  switch (key->type) {
+  case GROUP_KEY_FIX_SIZE :
+    if (value->is_valid && (!key->idp || *((grn_id *)value->value))) {
+      group_add(ctx, target, value->value, value->value_size, id, score,
+                calc);
+    }
+    break;
+  case GROUP_KEY_REFERENCE_VECTOR :
+    {
+      const grn_id *v = (const grn_id *)value->value;
+      const grn_id *ve = v + value->value_size / sizeof(grn_id);
+      for (; v < ve; v++) {
+        if (*v != GRN_ID_NIL) {
+          group_add(ctx, target, v, sizeof(grn_id), id, score, calc);
+        }
+      }
+    }
+    break;
+  case GROUP_KEY_GENERIC :
+    switch (value->bulk.header.type) {
+    case GRN_UVECTOR :
+      {
+        // todo : support objects except grn_id
+        const grn_id *v = (const grn_id *)value->value;
+        const grn_id *ve = v + value->value_size / sizeof(grn_id);
+        for (; v < ve; v++) {
+          if (*v != GRN_ID_NIL) {
+            group_add(ctx, target, v, sizeof(grn_id), id, score, calc);
+          }
+        }
+      }
+      break;
+    case GRN_VECTOR :
+      ERR(GRN_OPERATION_NOT_SUPPORTED, "sorry.. not implemented yet");
+      /* todo */
+      break;
+    case GRN_BULK :
+      if (!key->idp || *((grn_id *)value->value)) {
+        group_add(ctx, target, value->value, value->value_size, id, score,
+                calc);
+      }
+      break;
+    default :
+      ERR(GRN_INVALID_ARGUMENT, "invalid column");
+      break;
+    }
+    break;
+  }
+}
+
+static void
+group_records(grn_ctx *ctx, grn_obj *table,
+              group_key *keys, int n_keys, group_key *calc_keys,
+              grn_table_group_result *results, int n_results,
+              grn_obj **targets, const grn_id *ids, const int *scores,
+              size_t n_records)
+{
+  size_t i;
+  int r;
+  grn_obj composite_key;
+  group_key_value *values, *calc_key_values;
+  calc_value calc;
+  values = GRN_MALLOCN(group_key_value, n_keys);
+  calc_key_values = GRN_MALLOCN(group_key_value, n_results);
+  if (!values || !calc_key_values) {
+    if (values) { GRN_FREE(values); }
+    if (calc_key_values) { GRN_FREE(calc_key_values); }
+    return;
+  }
+  group_key_values_init(ctx, keys, n_keys, values);
+  group_key_values_init(ctx, calc_keys, n_results, calc_key_values);
+  GRN_TEXT_INIT(&composite_key, 0);
+  for (i = 0; i < n_records; i++) {
+    grn_id id = ids[i];
+    group_key_values_read(ctx, table, id, keys, n_keys, values);
+    for (r = 0; r < n_results; r++) {
+      grn_table_group_result *rp = &(results[r]);
+      int key_end = rp->key_end > n_keys ? n_keys : rp->key_end;
+      const calc_value *calcp = NULL;
+      if (calc_keys[r].key) {
+        group_key_value *calc_key_value = &(calc_key_values[r]);
+        group_key_values_read(ctx, table, id, &(calc_keys[r]), 1,
+                              calc_key_value);
+        calc_value_set(&calc, DB_OBJ(targets[r])->group.calc_types,
+                       DB_OBJ(targets[r])->group.calc_range,
+                       calc_key_value->value, calc_key_value->value_size);
+        calcp = &calc;
+      }
+      if (key_end - rp->key_begin == 1) {
+        group_add_by_key(ctx, targets[r], &(keys[rp->key_begin]),
+                         &(values[rp->key_begin]), id, scores[i], calcp);
+      } else {
+        int k;
+        GRN_BULK_REWIND(&composite_key);
+        for (k = rp->key_begin; k < key_end; k++) {
+          GRN_TEXT_PUT(ctx, &composite_key,
+                       values[k].value, values[k].value_size);
+        }
+        // todo : cut off GRN_ID_NIL
+        group_add(ctx, targets[r],
+                  GRN_BULK_HEAD(&composite_key),
+                  GRN_BULK_VSIZE(&composite_key),
+                  id, scores[i], calcp);
+      }
+    }
+    group_key_values_release(ctx, keys, n_keys, values);
+    group_key_values_release(ctx, calc_keys, n_results, calc_key_values);
+  }
+  GRN_OBJ_FIN(ctx, &composite_key);
+  group_key_values_fin(ctx, calc_keys, n_results, calc_key_values);
+  group_key_values_fin(ctx, keys, n_keys, values);
+  GRN_FREE(calc_key_values);
+  GRN_FREE(values);
+}
+
+static void * CALLBACK
+group_worker_func(void *arg)
+{
+  group_worker *worker = (group_worker *)arg;
+  group_records(&worker->ctx, worker->table,
+                worker->keys, worker->n_keys, worker->calc_keys,
+                worker->results, worker->n_results, worker->targets,
+                worker->ids, worker->scores, worker->n_records);
+  return NULL;
+}
+
+/* Merges groups grouped by a worker into the result. */
+static void
+group_merge(grn_ctx *ctx, grn_obj *target, grn_hash *groups, grn_bool with_calc)
+{
+  void *key, *value;
+  uint32_t key_size;
+  GRN_HASH_EACH(ctx, groups, id, &key, &key_size, &value, {
+    void *target_value;
+    if (grn_table_add_v_inline(ctx, target, key, key_size,
+                               &target_value, NULL)) {
+      grn_rset_recinfo *ri = (grn_rset_recinfo *)target_value;
+      grn_rset_recinfo *group_ri = (grn_rset_recinfo *)value;
+      grn_bool is_first = GRN_RSET_N_SUBRECS(ri) == 0;
+      ri->score += group_ri->score;
+      ri->n_subrecs += GRN_RSET_N_SUBRECS(group_ri);
+      if (with_calc) {
+        calc_values_merge(target, ri, group_ri, is_first);
+      }
+    }
+  });
+}
+
+static grn_bool
+group_can_parallelize(grn_ctx *ctx, grn_table_group_result *results,
+                      int n_results)
+{
+  int r;
+  for (r = 0; r < n_results; r++) {
+    grn_obj *target = results[r].table;
+    if (target->header.type != GRN_TABLE_HASH_KEY ||
+        !(DB_OBJ(target)->header.flags & GRN_OBJ_WITH_SUBREC) ||
+        DB_OBJ(target)->max_n_subrecs) {
+      return GRN_FALSE;
+    }
+  }
+  return GRN_TRUE;
+}
+
+static void
+group_by_keys(grn_ctx *ctx, grn_obj *table,
+              grn_table_sort_key *keys, int n_keys,
+              grn_table_group_result *results, int n_results)
+{
+  int i, r, n_workers, n_started = 0;
+  size_t n_records = 0, n_records_per_part;
+  grn_id *ids;
+  int *scores;
+  grn_obj **targets;
+  group_key *group_keys, *calc_keys;
+  group_worker *workers = NULL;
+  grn_table_cursor *tc;
+  unsigned int n_records_max = grn_table_size(ctx, table);
+
+  ids = GRN_MALLOCN(grn_id, n_records_max + 1);
+  scores = GRN_MALLOCN(int, n_records_max + 1);
+  targets = GRN_MALLOCN(grn_obj *, n_results);
+  group_keys = GRN_MALLOCN(group_key, n_keys);
+  calc_keys = GRN_MALLOCN(group_key, n_results);
+  if (!ids || !scores || !targets || !group_keys || !calc_keys) {
+    if (ids) { GRN_FREE(ids); }
+    if (scores) { GRN_FREE(scores); }
+    if (targets) { GRN_FREE(targets); }
+    if (group_keys) { GRN_FREE(group_keys); }
+    if (calc_keys) { GRN_FREE(calc_keys); }
+    return;
+  }
+  group_keys_init(ctx, table, keys, n_keys, group_keys);
+  for (r = 0; r < n_results; r++) {
+    targets[r] = results[r].table;
+    if (results[r].calc_target && DB_OBJ(targets[r])->group.calc_types) {
+      group_key_init(ctx, table, results[r].calc_target, &(calc_keys[r]));
+    } else {
+      calc_keys[r].type = GROUP_KEY_GENERIC;
+      calc_keys[r].key = NULL;
+    }
+  }
+  if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
+    grn_id id;
+    while (n_records < n_records_max &&
+           (id = grn_table_cursor_next_inline(ctx, tc))) {
+      grn_rset_recinfo *ri = NULL;
+      if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
+        grn_table_cursor_get_value_inline(ctx, tc, (void **)&ri);
+      }
+      ids[n_records] = id;
+      scores[n_records] = ri ? ri->score : 0;
+      n_records++;
+    }
+    grn_table_cursor_close(ctx, tc);
+  }
+
+  n_workers = ctx->impl->n_scan_workers;
+  if ((size_t)n_workers > n_records / GROUP_MIN_N_RECORDS_PER_WORKER) {
+    n_workers = n_records / GROUP_MIN_N_RECORDS_PER_WORKER;
+  }
+  if (n_workers > GROUP_MAX_N_WORKERS) { n_workers = GROUP_MAX_N_WORKERS; }
+  if (n_workers > 1 && !group_can_parallelize(ctx, results, n_results)) {
+    n_workers = 1;
+  }
+  if (n_workers > 1) {
+    workers = GRN_CALLOC(sizeof(group_worker) * (n_workers - 1));
+    if (!workers) {
+      ERRCLR(ctx);
+      n_workers = 1;
+    }
+  }
+  if (n_workers < 1) { n_workers = 1; }
+  n_records_per_part = n_records / n_workers;
+
+  /* The first part is grouped into the results by the calling thread. */
+  for (i = 1; i < n_workers; i++) {
+    group_worker *worker = &workers[n_started];
+    size_t start = n_records_per_part * i;
+    size_t end = (i == n_workers - 1) ? n_records : start + n_records_per_part;
+    grn_ctx_init(&worker->ctx, 0);
+    grn_ctx_use(&worker->ctx, grn_ctx_db(ctx));
+    worker->table = table;
+    worker->keys = group_keys;
+    worker->n_keys = n_keys;
+    worker->calc_keys = calc_keys;
+    worker->results = results;
+    worker->n_results = n_results;
+    worker->targets = GRN_MALLOCN(grn_obj *, n_results);
+    worker->ids = ids + start;
+    worker->scores = scores + start;
+    worker->n_records = end - start;
+    if (!worker->targets) {
+      ERRCLR(ctx);
+      grn_ctx_fin(&worker->ctx);
+      break;
+    }
+    for (r = 0; r < n_results; r++) {
+      grn_hash *target = (grn_hash *)results[r].table;
+      grn_obj *groups =
+        (grn_obj *)grn_hash_create(&worker->ctx, NULL,
+                                   target->key_size, target->value_size,
+                                   DB_OBJ(target)->header.flags &
+                                   (GRN_OBJ_KEY_VAR_SIZE|GRN_OBJ_WITH_SUBREC));
+      worker->targets[r] = groups;
+      if (!groups) { break; }
+      DB_OBJ(groups)->max_n_subrecs = DB_OBJ(target)->max_n_subrecs;
+      DB_OBJ(groups)->subrec_size = DB_OBJ(target)->subrec_size;
+      DB_OBJ(groups)->subrec_offset = DB_OBJ(target)->subrec_offset;
+      DB_OBJ(groups)->group = DB_OBJ(target)->group;
+    }
+    if (r < n_results ||
+        THREAD_CREATE(worker->thread, group_worker_func, worker)) {
+      while (r-- > 0) {
+        if (worker->targets[r]) {
+          grn_hash_close(&worker->ctx, (grn_hash *)worker->targets[r]);
+        }
+      }
+      GRN_FREE(worker->targets);
+      grn_ctx_fin(&worker->ctx);
+      break;
+    }
+    n_started++;
+  }
+  group_records(ctx, table, group_keys, n_keys, calc_keys,
+                results, n_results, targets,
+                ids, scores, n_workers == 1 ? n_records : n_records_per_part);
+  for (i = 0; i < n_started; i++) {
+    group_worker *worker = &workers[i];
+    THREAD_JOIN(worker->thread);
+    if (worker->ctx.rc && !ctx->rc) {
+      ERR(worker->ctx.rc, "[table][group] worker(%d) failed: %s",
+          i + 1, worker->ctx.errbuf);
+    }
+  }
+  /* The groups of the parts are merged in the order of the parts. */
+  for (i = 0; i < n_started; i++) {
+    group_worker *worker = &workers[i];
+    for (r = 0; r < n_results; r++) {
+      if (!ctx->rc) {
+        group_merge(ctx, results[r].table, (grn_hash *)worker->targets[r],
+                    calc_keys[r].key != NULL);
+      }
+      grn_hash_close(&worker->ctx, (grn_hash *)worker->targets[r]);
+    }
+    GRN_FREE(worker->targets);
+    grn_ctx_fin(&worker->ctx);
+  }
+  /* The parts that no worker has taken are grouped here. */
+  if (n_workers > 1 && n_started < n_workers - 1) {
+    size_t start = n_records_per_part * (n_started + 1);
+    group_records(ctx, table, group_keys, n_keys, calc_keys,
+                  results, n_results, targets,
+                  ids + start, scores + start, n_records - start);
+  }
+  if (workers) { GRN_FREE(workers); }
+  GRN_FREE(calc_keys);
+  GRN_FREE(group_keys);
+  GRN_FREE(targets);
+  GRN_FREE(scores);
+  GRN_FREE(ids);
+}
+
+grn_rc
+grn_table_group(grn_ctx *ctx, grn_obj *table,
+                grn_table_sort_key *keys, int n_keys,
+                grn_table_group_result *results, int n_results)
+{
+  grn_rc rc = GRN_SUCCESS;
+  if (!table || !n_keys || !n_results) {
+    ERR(GRN_INVALID_ARGUMENT, "table or n_keys or n_results is void");
+    return GRN_INVALID_ARGUMENT;
+  }
+  GRN_API_ENTER;
+  {
+    int k, r;
+    void *key;
+    grn_obj bulk;
+    grn_table_cursor *tc;
+    grn_table_sort_key *kp;
+    grn_table_group_result *rp;
+    for (k = 0, kp = keys; k < n_keys; k++, kp++) {
+      if ((kp->flags & GRN_TABLE_GROUP_BY_COLUMN_VALUE) && !kp->key) {
+        ERR(GRN_INVALID_ARGUMENT, "column missing in (%d)", k);
+        goto exit;
+      }
     }
-    grn_obj_close(ctx, &bulk);
+    for (r = 0, rp = results; r < n_results; r++, rp++) {
+      if (!rp->table) {
+        ERR(GRN_INVALID_ARGUMENT, "table missing in (%d)", r);
+        goto exit;
+      }
+      if (rp->calc_target) {
+        grn_table_group_flags calc_types = DB_OBJ(rp->table)->group.calc_types;
+        grn_id calc_range = grn_obj_get_range(ctx, rp->calc_target);
+        if (rp->flags & GRN_TABLE_GROUP_CALC_VALUE_TYPES & ~calc_types) {
+          ERR(GRN_INVALID_ARGUMENT, "calc types not reserved in table (%d)", r);
+          goto exit;
+        }
+        if ((calc_types & ~GRN_TABLE_GROUP_CALC_COUNT_DISTINCT) &&
+            !calc_target_is_number(calc_range)) {
+          ERR(GRN_INVALID_ARGUMENT, "calc target must be a number in (%d)", r);
+          goto exit;
+        }
+        DB_OBJ(rp->table)->group.calc_range = calc_range;
+      }
+    }
+    GRN_TEXT_INIT(&bulk, 0);
+    for (r = 0, rp = results; r < n_results; r++, rp++) {
+      if (rp->key_begin >= n_keys || rp->key_end <= rp->key_begin) { break; }
+    }
+    if (n_keys == 1 && n_results == 1) {
+      grn_table_group_result result = *results;
+      result.key_begin = 0;
+      result.key_end = 1;
+      group_by_keys(ctx, table, keys, n_keys, &result, n_results);
+    } else if (r == n_results) {
+      group_by_keys(ctx, table, keys, n_keys, results, n_results);
+    } else {
+      if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
+        grn_id id;
+        while ((id = grn_table_cursor_next_inline(ctx, tc))) {
+          grn_rset_recinfo *ri = NULL;
+          GRN_BULK_REWIND(&bulk);
+          if (DB_OBJ(table)->header.flags & GRN_OBJ_WITH_SUBREC) {
+            grn_table_cursor_get_value_inline(ctx, tc, (void **)&ri);
+          }
+          for (k = 0, kp = keys; k < n_keys; k++, kp++) {
+            kp->offset = GRN_BULK_VSIZE(&bulk);
+            grn_obj_get_value(ctx, kp->key, id, &bulk);
+          }
+          for (r = 0, rp = results; r < n_results; r++, rp++) {
+            void *value;
+            int begin = keys[rp->key_begin].offset;
+            int end = rp->key_end >= n_keys
+              ? GRN_BULK_VSIZE(&bulk)
+              : keys[rp->key_end].offset;
+            key = GRN_BULK_HEAD(&bulk) + begin;
+            // todo : cut off GRN_ID_NIL
+            if (grn_table_add_v_inline(ctx, rp->table, key, end - begin, &value, NULL)) {
+              grn_table_add_subrec_inline(rp->table, value, ri ? ri->score : 0,
+                                          (grn_rset_posinfo *)&id, 0);
+            }
+          }
+        }
+        grn_table_cursor_close(ctx, tc);
+      }
+    }
+    grn_obj_close(ctx, &bulk);
     for (r = 0, rp = results; r < n_results; r++, rp++) {
       GRN_TABLE_GROUPED_ON(rp->table);
     }
@@ -3786,6 +4829,7 @@ default_column_set_value(grn_ctx *ctx, grn_proc_ctx *pctx, grn_obj *in, grn_obj
           return GRN_NO_MEMORY_AVAILABLE;
         }
         memcpy(v, in->u.p.ptr, value_size);
+        grn_ra_zone_map_update(ctx, (grn_ra *)pctx->obj, arg->id, v);
         grn_ra_unref(ctx, (grn_ra *)pctx->obj, arg->id);
       }
       break;
@@ -4193,6 +5237,86 @@ accessor_new(grn_ctx *ctx)
   return res;
 }
 
+static grn_table_group_flags
+calc_type_by_column_name(const char *name, unsigned int name_size)
+{
+#define CALC_TYPE_BY_COLUMN_NAME(type) do {\
+  if (name_size == GRN_COLUMN_NAME_ ## type ## _LEN &&\
+      !memcmp(name, GRN_COLUMN_NAME_ ## type, name_size)) {\
+    return GRN_TABLE_GROUP_CALC_ ## type;\
+  }\
+} while (0)
+  CALC_TYPE_BY_COLUMN_NAME(MAX);
+  CALC_TYPE_BY_COLUMN_NAME(MIN);
+  CALC_TYPE_BY_COLUMN_NAME(SUM);
+  CALC_TYPE_BY_COLUMN_NAME(AVG);
+#undef CALC_TYPE_BY_COLUMN_NAME
+  if (name_size == GRN_COLUMN_NAME_NDISTINCT_LEN &&
+      !memcmp(name, GRN_COLUMN_NAME_NDISTINCT, name_size)) {
+    return GRN_TABLE_GROUP_CALC_COUNT_DISTINCT;
+  }
+  return 0;
+}
+
+static const char *
+calc_type_column_name(grn_table_group_flags calc_type)
+{
+  switch (calc_type) {
+  case GRN_TABLE_GROUP_CALC_MAX :
+    return GRN_COLUMN_NAME_MAX;
+  case GRN_TABLE_GROUP_CALC_MIN :
+    return GRN_COLUMN_NAME_MIN;
+  case GRN_TABLE_GROUP_CALC_SUM :
+    return GRN_COLUMN_NAME_SUM;
+  case GRN_TABLE_GROUP_CALC_AVG :
+    return GRN_COLUMN_NAME_AVG;
+  case GRN_TABLE_GROUP_CALC_COUNT_DISTINCT :
+    return GRN_COLUMN_NAME_NDISTINCT;
+  default :
+    return NULL;
+  }
+}
+
+static grn_bool
+grn_obj_get_accessor_calc_value(grn_ctx *ctx, grn_obj *obj,
+                                grn_accessor **res,
+                                grn_table_group_flags calc_type)
+{
+  grn_accessor **rp;
+  for (rp = res; ; rp = &(*rp)->next) {
+    *rp = accessor_new(ctx);
+    (*rp)->obj = obj;
+    if (GRN_DB_OBJP(obj) && (DB_OBJ(obj)->group.calc_types & calc_type)) {
+      (*rp)->action = GRN_ACCESSOR_GET_CALC_VALUE;
+      (*rp)->offset = calc_type;
+      return GRN_TRUE;
+    }
+    switch (obj->header.type) {
+    case GRN_TABLE_PAT_KEY :
+    case GRN_TABLE_DAT_KEY :
+    case GRN_TABLE_HASH_KEY :
+      (*rp)->action = GRN_ACCESSOR_GET_KEY;
+      break;
+    case GRN_TABLE_NO_KEY :
+      if (obj->header.domain) {
+        (*rp)->action = GRN_ACCESSOR_GET_VALUE;
+        break;
+      }
+      /* fallthru */
+    default :
+      /* lookup failed */
+      grn_obj_close(ctx, (grn_obj *)*res);
+      *res = NULL;
+      return GRN_FALSE;
+    }
+    if (!(obj = grn_ctx_at(ctx, obj->header.domain))) {
+      grn_obj_close(ctx, (grn_obj *)*res);
+      *res = NULL;
+      return GRN_FALSE;
+    }
+  }
+}
+
 static grn_obj *
 grn_obj_get_accessor(grn_ctx *ctx, grn_obj *obj, const char *name, unsigned int name_size)
 {
@@ -4214,6 +5338,10 @@ grn_obj_get_accessor(grn_ctx *ctx, grn_obj *obj, const char *name, unsigned int
     case GRN_ACCESSOR_GET_NSUBRECS :
       obj = grn_ctx_at(ctx, DB_OBJ(res->obj)->range);
       break;
+    case GRN_ACCESSOR_GET_CALC_VALUE :
+      obj = grn_ctx_at(ctx, grn_rset_recinfo_calc_value_range(res->obj,
+                                                              res->offset));
+      break;
     case GRN_ACCESSOR_GET_COLUMN_VALUE :
       obj = grn_ctx_at(ctx, DB_OBJ(res->obj)->range);
       break;
@@ -4239,6 +5367,7 @@ grn_obj_get_accessor(grn_ctx *ctx, grn_obj *obj, const char *name, unsigned int
     if (!(len = sp - name)) { goto exit; }
     if (*name == GRN_DB_PSEUDO_COLUMN_PREFIX) { /* pseudo column */
       int done = 0;
+      grn_table_group_flags calc_type = calc_type_by_column_name(name, len);
       if (len < 2) { goto exit; }
       switch (name[1]) {
       case 'k' : /* key */
@@ -4375,7 +5504,13 @@ grn_obj_get_accessor(grn_ctx *ctx, grn_obj *obj, const char *name, unsigned int
           }
         }
         break;
-      case 's' : /* score */
+      case 's' : /* score, sum */
+        if (calc_type) {
+          if (!grn_obj_get_accessor_calc_value(ctx, obj, &res, calc_type)) {
+            goto exit;
+          }
+          break;
+        }
         if (len != GRN_COLUMN_NAME_SCORE_LEN ||
             memcmp(name, GRN_COLUMN_NAME_SCORE, GRN_COLUMN_NAME_SCORE_LEN)) {
           goto exit;
@@ -4413,7 +5548,13 @@ grn_obj_get_accessor(grn_ctx *ctx, grn_obj *obj, const char *name, unsigned int
           }
         }
         break;
-      case 'n' : /* nsubrecs */
+      case 'n' : /* nsubrecs, ndistinct */
+        if (calc_type) {
+          if (!grn_obj_get_accessor_calc_value(ctx, obj, &res, calc_type)) {
+            goto exit;
+          }
+          break;
+        }
         if (len != GRN_COLUMN_NAME_NSUBRECS_LEN ||
             memcmp(name,
                    GRN_COLUMN_NAME_NSUBRECS,
@@ -4453,6 +5594,13 @@ grn_obj_get_accessor(grn_ctx *ctx, grn_obj *obj, const char *name, unsigned int
           }
         }
         break;
+      case 'm' : /* max, min */
+      case 'a' : /* avg */
+        if (!calc_type ||
+            !grn_obj_get_accessor_calc_value(ctx, obj, &res, calc_type)) {
+          goto exit;
+        }
+        break;
       default :
         res = NULL;
         goto exit;
@@ -4561,6 +5709,9 @@ grn_obj_get_range_info(grn_ctx *ctx, grn_obj *obj,
       case GRN_ACCESSOR_GET_NSUBRECS :
         *range_id = GRN_DB_INT32;
         break;
+      case GRN_ACCESSOR_GET_CALC_VALUE :
+        *range_id = grn_rset_recinfo_calc_value_range(a->obj, a->offset);
+        break;
       case GRN_ACCESSOR_GET_COLUMN_VALUE :
         if (GRN_DB_OBJP(a->obj)) {
           *range_id = DB_OBJ(a->obj)->range;
@@ -4603,6 +5754,7 @@ grn_obj_is_persistent(grn_ctx *ctx, grn_obj *obj)
       switch (a->action) {
       case GRN_ACCESSOR_GET_SCORE :
       case GRN_ACCESSOR_GET_NSUBRECS :
+      case GRN_ACCESSOR_GET_CALC_VALUE :
         res = 0;
         break;
       case GRN_ACCESSOR_GET_ID :
@@ -5089,6 +6241,14 @@ grn_accessor_get_value_(grn_ctx *ctx, grn_accessor *a, grn_id id, uint32_t *size
         *size = sizeof(int);
       }
       break;
+    case GRN_ACCESSOR_GET_CALC_VALUE :
+      if ((value = grn_obj_get_value_(ctx, a->obj, id, size))) {
+        value = (const char *)
+          grn_rset_recinfo_calc_value(a->obj, (grn_rset_recinfo *)value,
+                                      a->offset);
+        *size = sizeof(int64_t);
+      }
+      break;
     case GRN_ACCESSOR_GET_COLUMN_VALUE :
       /* todo : support vector */
       value = grn_obj_get_value_(ctx, a->obj, id, size);
@@ -5155,6 +6315,13 @@ grn_accessor_get_value(grn_ctx *ctx, grn_accessor *a, grn_id id, grn_obj *value)
         GRN_INT32_PUT(ctx, value, ri->n_subrecs);
       }
       break;
+    case GRN_ACCESSOR_GET_CALC_VALUE :
+      {
+        grn_rset_recinfo *ri = (grn_rset_recinfo *)grn_obj_get_value_(ctx, a->obj, id, &vs);
+        byte *calc_value = grn_rset_recinfo_calc_value(a->obj, ri, a->offset);
+        grn_bulk_write(ctx, value, (const char *)calc_value, sizeof(int64_t));
+      }
+      break;
     case GRN_ACCESSOR_GET_COLUMN_VALUE :
       /* todo : support vector */
       grn_obj_get_value(ctx, a->obj, id, value);
@@ -5844,6 +7011,7 @@ grn_obj_set_value_column_fix_size(grn_ctx *ctx, grn_obj *obj, grn_id id,
       rc = GRN_OPERATION_NOT_SUPPORTED;
       break;
     }
+    if (!rc) { grn_ra_zone_map_update(ctx, (grn_ra *)obj, id, p); }
     grn_ra_unref(ctx, (grn_ra *)obj, id);
   }
   GRN_OBJ_FIN(ctx, &buf);
@@ -5877,6 +7045,9 @@ grn_obj_set_value(grn_ctx *ctx, grn_obj *obj, grn_id id,
       ERR(GRN_INVALID_ARGUMENT, "not db_obj");
     }
   } else {
+    grn_bool hooked = DB_OBJ(obj)->hooks[GRN_HOOK_SET] != NULL;
+    uint32_t epoch = 0;
+    if (hooked) { epoch = grn_obj_update_enter(ctx, obj); }
     switch (obj->header.type) {
     case GRN_TABLE_PAT_KEY :
       rc = grn_obj_set_value_table_pat_key(ctx, obj, id, value, flags);
@@ -5912,6 +7083,7 @@ grn_obj_set_value(grn_ctx *ctx, grn_obj *obj, grn_id id,
       rc = grn_obj_set_value_column_index(ctx, obj, id, value, flags);
       break;
     }
+    if (hooked) { grn_obj_update_leave(ctx, obj, epoch); }
   }
   GRN_API_RETURN(rc);
 }
@@ -6298,6 +7470,50 @@ exit :
   GRN_API_RETURN(valuebuf);
 }
 
+/* grn_ii_build() can't build indexes with weights or hash lexicons. */
+static grn_bool
+build_index_is_bufferable(grn_ctx *ctx, grn_ii *ii, int ncol, grn_obj **col)
+{
+  int i;
+  grn_obj_flags flags;
+  grn_table_get_info(ctx, ii->lexicon, &flags, NULL, NULL, NULL);
+  switch (flags & GRN_OBJ_TABLE_TYPE_MASK) {
+  case GRN_OBJ_TABLE_PAT_KEY :
+  case GRN_OBJ_TABLE_DAT_KEY :
+    break;
+  default :
+    return GRN_FALSE;
+  }
+  if ((ii->header->flags & GRN_OBJ_WITH_WEIGHT)) {
+    return GRN_FALSE;
+  }
+  for (i = 0; i < ncol; i++) {
+    if (GRN_OBJ_TABLEP(grn_ctx_at(ctx, DB_OBJ(col[i])->range))) {
+      return GRN_FALSE;
+    }
+  }
+  return GRN_TRUE;
+}
+
+static void
+build_index_get_params(uint64_t *sparsity, uint32_t *n_workers)
+{
+  *sparsity = 10;
+  *n_workers = 1;
+  if (getenv("GRN_INDEX_SPARSITY")) {
+    uint64_t v;
+    errno = 0;
+    v = strtoull(getenv("GRN_INDEX_SPARSITY"), NULL, 0);
+    if (!errno) { *sparsity = v; }
+  }
+  if (getenv("GRN_INDEX_BUILD_N_WORKERS")) {
+    unsigned long v;
+    errno = 0;
+    v = strtoul(getenv("GRN_INDEX_BUILD_N_WORKERS"), NULL, 0);
+    if (!errno && v > 0) { *n_workers = v; }
+  }
+}
+
 static void
 build_index(grn_ctx *ctx, grn_obj *obj)
 {
@@ -6308,21 +7524,7 @@ build_index(grn_ctx *ctx, grn_obj *obj)
     target = GRN_OBJ_TABLEP(src) ? src : grn_ctx_at(ctx, src->header.domain);
     if (target) {
       int i, ncol = DB_OBJ(obj)->source_size / sizeof(grn_id);
-      grn_obj_flags flags;
       grn_ii *ii = (grn_ii *)obj;
-      grn_bool use_grn_ii_build;
-      grn_table_get_info(ctx, ii->lexicon, &flags, NULL, NULL, NULL);
-      switch (flags & GRN_OBJ_TABLE_TYPE_MASK) {
-      case GRN_OBJ_TABLE_PAT_KEY :
-      case GRN_OBJ_TABLE_DAT_KEY :
-        use_grn_ii_build = GRN_TRUE;
-        break;
-      default :
-        use_grn_ii_build = GRN_FALSE;
-      }
-      if ((ii->header->flags & GRN_OBJ_WITH_WEIGHT)) {
-        use_grn_ii_build = GRN_FALSE;
-      }
       if ((col = GRN_MALLOC(ncol * sizeof(grn_obj *)))) {
         for (cp = col, i = ncol; i; s++, cp++, i--) {
           if (!(*cp = grn_ctx_at(ctx, *s))) {
@@ -6330,19 +7532,12 @@ build_index(grn_ctx *ctx, grn_obj *obj)
             GRN_FREE(col);
             return;
           }
-          if (GRN_OBJ_TABLEP(grn_ctx_at(ctx, DB_OBJ(*cp)->range))) {
-            use_grn_ii_build = GRN_FALSE;
-          }
         }
-        if (use_grn_ii_build) {
-          uint64_t sparsity = 10;
-          if (getenv("GRN_INDEX_SPARSITY")) {
-            uint64_t v;
-            errno = 0;
-            v = strtoull(getenv("GRN_INDEX_SPARSITY"), NULL, 0);
-            if (!errno) { sparsity = v; }
-          }
-          grn_ii_build(ctx, ii, sparsity);
+        if (build_index_is_bufferable(ctx, ii, ncol, col)) {
+          uint64_t sparsity;
+          uint32_t n_workers;
+          build_index_get_params(&sparsity, &n_workers);
+          grn_ii_build(ctx, ii, sparsity, n_workers);
         } else {
           grn_table_cursor  *tc;
           if ((tc = grn_table_cursor_open(ctx, target, NULL, 0, NULL, 0,
@@ -6375,6 +7570,46 @@ build_index(grn_ctx *ctx, grn_obj *obj)
   }
 }
 
+static grn_rc
+rebuild_index(grn_ctx *ctx, grn_obj *obj, grn_obj_flags codec_flags)
+{
+  grn_rc rc;
+  grn_obj **col;
+  grn_id *s = DB_OBJ(obj)->source;
+  grn_ii *ii = (grn_ii *)obj;
+  int i, ncol = DB_OBJ(obj)->source_size / sizeof(grn_id);
+  grn_bool use_buffer;
+  uint64_t sparsity;
+  uint32_t n_workers;
+  grn_obj_flags flags;
+  if (!ncol || !s) {
+    ERR(GRN_INVALID_ARGUMENT, "[index][rebuild] no source");
+    return ctx->rc;
+  }
+  if (!(col = GRN_MALLOC(ncol * sizeof(grn_obj *)))) { return ctx->rc; }
+  for (i = 0; i < ncol; i++) {
+    if (!(col[i] = grn_ctx_at(ctx, s[i]))) {
+      ERR(GRN_INVALID_ARGUMENT, "source invalid, n=%d", i);
+      GRN_FREE(col);
+      return ctx->rc;
+    }
+  }
+  use_buffer = build_index_is_bufferable(ctx, ii, ncol, col);
+  GRN_FREE(col);
+  build_index_get_params(&sparsity, &n_workers);
+  flags = (ii->header->flags & ~GRN_OBJ_INDEX_SIMD) | codec_flags;
+  if ((rc = grn_ii_rebuild(ctx, ii, flags, use_buffer, sparsity, n_workers))) {
+    return rc;
+  }
+  flags = (DB_OBJ(obj)->header.flags & ~GRN_OBJ_INDEX_SIMD) | codec_flags;
+  if (flags != DB_OBJ(obj)->header.flags) {
+    DB_OBJ(obj)->header.flags = flags;
+    obj->header.flags = flags;
+    grn_obj_spec_save(ctx, DB_OBJ(obj));
+  }
+  return ctx->rc;
+}
+
 static void
 update_source_hook(grn_ctx *ctx, grn_obj *obj)
 {
@@ -7733,6 +8968,68 @@ grn_db_obj_init(grn_ctx *ctx, grn_obj *db, grn_id id, grn_db_obj *obj)
   }\
 } while (0)
 
+grn_bool
+grn_ctx_is_opened(grn_ctx *ctx, grn_id id)
+{
+  grn_bool is_opened = GRN_FALSE;
+  grn_db *s;
+  if (!ctx || !ctx->impl || !id || (id & GRN_OBJ_TMP_OBJECT)) {
+    return is_opened;
+  }
+  s = (grn_db *)ctx->impl->db;
+  if (s && id <= grn_db_curr_id(ctx, (grn_obj *)s)) {
+    db_value *vp;
+    vp = grn_tiny_array_at(&s->values, id);
+    if (vp && vp->ptr) {
+      is_opened = GRN_TRUE;
+    }
+  }
+  return is_opened;
+}
+
+static void
+grn_ctx_add_dependency(grn_ctx *ctx, grn_id table_id)
+{
+  grn_obj *dependencies = ctx->impl->dependencies;
+  size_t i, n = GRN_BULK_VSIZE(dependencies) / sizeof(grn_id);
+  for (i = 0; i < n; i++) {
+    if (GRN_UINT32_VALUE_AT(dependencies, i) == table_id) { return; }
+  }
+  GRN_UINT32_PUT(ctx, dependencies, table_id);
+}
+
+/*
+ * Records the table that `obj' belongs to while the query cache collects
+ * the dependencies of a command. An index column also depends on the
+ * tables of its sources because they update it.
+ */
+static void
+grn_ctx_record_dependency(grn_ctx *ctx, grn_id id, grn_obj *obj)
+{
+  switch (obj->header.type) {
+  case GRN_TABLE_HASH_KEY :
+  case GRN_TABLE_PAT_KEY :
+  case GRN_TABLE_DAT_KEY :
+  case GRN_TABLE_NO_KEY :
+    grn_ctx_add_dependency(ctx, id);
+    break;
+  case GRN_COLUMN_VAR_SIZE :
+  case GRN_COLUMN_FIX_SIZE :
+    grn_ctx_add_dependency(ctx, obj->header.domain);
+    break;
+  case GRN_COLUMN_INDEX :
+    grn_ctx_add_dependency(ctx, obj->header.domain);
+    {
+      grn_id *source = DB_OBJ(obj)->source;
+      int i, n = DB_OBJ(obj)->source_size / sizeof(grn_id);
+      for (i = 0; i < n; i++) {
+        grn_ctx_at(ctx, source[i]);
+      }
+    }
+    break;
+  }
+}
+
 grn_obj *
 grn_ctx_at(grn_ctx *ctx, grn_id id)
 {
@@ -7883,6 +9180,9 @@ grn_ctx_at(grn_ctx *ctx, grn_id id)
         }
       }
       res = vp->ptr;
+      if (res && ctx->impl->dependencies) {
+        grn_ctx_record_dependency(ctx, id, res);
+      }
     }
   }
 exit :
@@ -8294,6 +9594,9 @@ grn_column_name(grn_ctx *ctx, grn_obj *obj, char *namebuf, int buf_size)
       case GRN_ACCESSOR_GET_NSUBRECS :
         name = GRN_COLUMN_NAME_NSUBRECS;
         break;
+      case GRN_ACCESSOR_GET_CALC_VALUE :
+        name = calc_type_column_name(a->offset);
+        break;
       case GRN_ACCESSOR_GET_COLUMN_VALUE :
       case GRN_ACCESSOR_GET_DB_OBJ :
       case GRN_ACCESSOR_LOOKUP :
@@ -8357,6 +9660,9 @@ grn_column_name_(grn_ctx *ctx, grn_obj *obj, grn_obj *buf)
                      GRN_COLUMN_NAME_NSUBRECS,
                      GRN_COLUMN_NAME_NSUBRECS_LEN);
         break;
+      case GRN_ACCESSOR_GET_CALC_VALUE :
+        GRN_TEXT_PUTS(ctx, buf, calc_type_column_name(a->offset));
+        break;
       case GRN_ACCESSOR_GET_COLUMN_VALUE :
         grn_column_name_(ctx, a->obj, buf);
         if (a->next) { GRN_TEXT_PUTC(ctx, buf, '.'); }
@@ -8417,6 +9723,21 @@ grn_obj_set_finalizer(grn_ctx *ctx, grn_obj *obj, grn_proc_func *func)
   return GRN_SUCCESS;
 }
 
+static void
+grn_table_clear_version(grn_ctx *ctx, grn_obj *table)
+{
+  switch (table->header.type) {
+  case GRN_TABLE_HASH_KEY :
+    GRN_TABLE_VERSION_CLEAR(((grn_hash *)table)->version);
+    break;
+  case GRN_TABLE_PAT_KEY :
+    GRN_TABLE_VERSION_CLEAR(&(((grn_pat *)table)->header->version));
+    break;
+  default :
+    break;
+  }
+}
+
 grn_rc
 grn_obj_clear_lock(grn_ctx *ctx, grn_obj *obj)
 {
@@ -8447,6 +9768,7 @@ grn_obj_clear_lock(grn_ctx *ctx, grn_obj *obj)
       }
     }
     grn_io_clear_lock(grn_obj_io(obj));
+    grn_table_clear_version(ctx, ((grn_db *)obj)->keys);
     break;
   case GRN_TABLE_NO_KEY :
     grn_array_queue_lock_clear(ctx, (grn_array *)obj);
@@ -8468,6 +9790,7 @@ grn_obj_clear_lock(grn_ctx *ctx, grn_obj *obj)
         grn_hash_close(ctx, cols);
       }
       grn_io_clear_lock(grn_obj_io(obj));
+      grn_table_clear_version(ctx, obj);
     }
     break;
   case GRN_COLUMN_FIX_SIZE:
@@ -8586,24 +9909,102 @@ enum {
     if (bs) {\
       type va = *((type *)(ap));\
       type vb = *((type *)(bp));\
-      if (va != vb) { return va > vb; }\
+      if (va != vb) { return va > vb ? 1 : -1; }\
     } else {\
       return 1;\
     }\
   } else {\
-    if (bs) { return 0; }\
+    if (bs) { return -1; }\
   }\
 } while (0)
 
+/*
+ * Returns a positive value if a value is after b value, a negative value if
+ * a value is before b value and 0 otherwise. A value without size is before
+ * any value with size.
+ */
 inline static int
-compare_value(grn_ctx *ctx, sort_entry *a, sort_entry *b,
-              grn_table_sort_key *keys, int n_keys)
+compare_key_value(uint8_t type,
+                  const unsigned char *ap, uint32_t as,
+                  const unsigned char *bp, uint32_t bs)
+{
+  switch (type) {
+  case KEY_ID :
+    if (ap != bp) { return ap > bp ? 1 : -1; }
+    break;
+  case KEY_BULK :
+    for (;; ap++, bp++, as--, bs--) {
+      if (!as) { if (bs) { return -1; } else { break; } }
+      if (!bs) { return 1; }
+      if (*ap < *bp) { return -1; }
+      if (*ap > *bp) { return 1; }
+    }
+    break;
+  case KEY_INT8 :
+    CMPNUM(int8_t);
+    break;
+  case KEY_INT16 :
+    CMPNUM(int16_t);
+    break;
+  case KEY_INT32 :
+    CMPNUM(int32_t);
+    break;
+  case KEY_INT64 :
+    CMPNUM(int64_t);
+    break;
+  case KEY_UINT8 :
+    CMPNUM(uint8_t);
+    break;
+  case KEY_UINT16 :
+    CMPNUM(uint16_t);
+    break;
+  case KEY_UINT32 :
+    CMPNUM(uint32_t);
+    break;
+  case KEY_UINT64 :
+    CMPNUM(uint64_t);
+    break;
+  case KEY_FLOAT32 :
+    if (as) {
+      if (bs) {
+        float va = *((float *)(ap));
+        float vb = *((float *)(bp));
+        if (va < vb || va > vb) { return va > vb ? 1 : -1; }
+      } else {
+        return 1;
+      }
+    } else {
+      if (bs) { return -1; }
+    }
+    break;
+  case KEY_FLOAT64 :
+    if (as) {
+      if (bs) {
+        double va = *((double *)(ap));
+        double vb = *((double *)(bp));
+        if (va < vb || va > vb) { return va > vb ? 1 : -1; }
+      } else {
+        return 1;
+      }
+    } else {
+      if (bs) { return -1; }
+    }
+    break;
+  }
+  return 0;
+}
+
+/* Returns a positive value when a is after b, a negative value when a is
+   before b and 0 when they have the same keys. */
+inline static int
+compare_value_order(grn_ctx *ctx, sort_entry *a, sort_entry *b,
+                    grn_table_sort_key *keys, int n_keys)
 {
   int i;
-  uint8_t type;
   uint32_t as, bs;
   const unsigned char *ap, *bp;
   for (i = 0; i < n_keys; i++, keys++) {
+    int r;
     if (i) {
       const char *ap_raw, *bp_raw;
       if (keys->flags & GRN_TABLE_SORT_DESC) {
@@ -8624,74 +10025,26 @@ compare_value(grn_ctx *ctx, sort_entry *a, sort_entry *b,
         bp = b->value; bs = b->size;
       }
     }
-    type = keys->offset;
-    switch (type) {
-    case KEY_ID :
-      if (ap != bp) { return ap > bp; }
-      break;
-    case KEY_BULK :
-      for (;; ap++, bp++, as--, bs--) {
-        if (!as) { if (bs) { return 0; } else { break; } }
-        if (!bs) { return 1; }
-        if (*ap < *bp) { return 0; }
-        if (*ap > *bp) { return 1; }
-      }
-      break;
-    case KEY_INT8 :
-      CMPNUM(int8_t);
-      break;
-    case KEY_INT16 :
-      CMPNUM(int16_t);
-      break;
-    case KEY_INT32 :
-      CMPNUM(int32_t);
-      break;
-    case KEY_INT64 :
-      CMPNUM(int64_t);
-      break;
-    case KEY_UINT8 :
-      CMPNUM(uint8_t);
-      break;
-    case KEY_UINT16 :
-      CMPNUM(uint16_t);
-      break;
-    case KEY_UINT32 :
-      CMPNUM(uint32_t);
-      break;
-    case KEY_UINT64 :
-      CMPNUM(uint64_t);
-      break;
-    case KEY_FLOAT32 :
-      if (as) {
-        if (bs) {
-          float va = *((float *)(ap));
-          float vb = *((float *)(bp));
-          if (va < vb || va > vb) { return va > vb; }
-        } else {
-          return 1;
-        }
-      } else {
-        if (bs) { return 0; }
-      }
-      break;
-    case KEY_FLOAT64 :
-      if (as) {
-        if (bs) {
-          double va = *((double *)(ap));
-          double vb = *((double *)(bp));
-          if (va < vb || va > vb) { return va > vb; }
-        } else {
-          return 1;
-        }
-      } else {
-        if (bs) { return 0; }
-      }
-      break;
+    if ((r = compare_key_value(keys->offset, ap, as, bp, bs))) {
+      return r;
     }
   }
   return 0;
 }
 
+/*
+ * Returns true when a is after b. Records that have the same keys are
+ * ordered by ID when is_id_order is true.
+ */
+inline static int
+compare_value(grn_ctx *ctx, sort_entry *a, sort_entry *b,
+              grn_table_sort_key *keys, int n_keys, grn_bool is_id_order)
+{
+  int r = compare_value_order(ctx, a, b, keys, n_keys);
+  if (r || !is_id_order) { return r > 0; }
+  return a->id > b->id;
+}
+
 inline static void
 swap(sort_entry *a, sort_entry *b)
 {
@@ -8701,19 +10054,20 @@ swap(sort_entry *a, sort_entry *b)
 }
 
 inline static sort_entry *
-part(grn_ctx *ctx, sort_entry *b, sort_entry *e, grn_table_sort_key *keys, int n_keys)
+part(grn_ctx *ctx, sort_entry *b, sort_entry *e, grn_table_sort_key *keys,
+     int n_keys, grn_bool is_id_order)
 {
   sort_entry *c;
   intptr_t d = e - b;
-  if (compare_value(ctx, b, e, keys, n_keys)) {
+  if (compare_value(ctx, b, e, keys, n_keys, is_id_order)) {
     swap(b, e);
   }
   if (d < 2) { return NULL; }
   c = b + (d >> 1);
-  if (compare_value(ctx, b, c, keys, n_keys)) {
+  if (compare_value(ctx, b, c, keys, n_keys, is_id_order)) {
     swap(b, c);
   } else {
-    if (compare_value(ctx, c, e, keys, n_keys)) {
+    if (compare_value(ctx, c, e, keys, n_keys, is_id_order)) {
       swap(c, e);
     }
   }
@@ -8724,10 +10078,10 @@ part(grn_ctx *ctx, sort_entry *b, sort_entry *e, grn_table_sort_key *keys, int n
   for (;;) {
     do {
       b++;
-    } while (compare_value(ctx, c, b, keys, n_keys));
+    } while (compare_value(ctx, c, b, keys, n_keys, is_id_order));
     do {
       e--;
-    } while (compare_value(ctx, e, c, keys, n_keys));
+    } while (compare_value(ctx, e, c, keys, n_keys, is_id_order));
     if (b >= e) { break; }
     swap(b, e);
   }
@@ -8737,19 +10091,23 @@ part(grn_ctx *ctx, sort_entry *b, sort_entry *e, grn_table_sort_key *keys, int n
 
 static void
 _sort(grn_ctx *ctx, sort_entry *head, sort_entry *tail, int from, int to,
-      grn_table_sort_key *keys, int n_keys)
+      grn_table_sort_key *keys, int n_keys, grn_bool is_id_order)
 {
   sort_entry *c;
-  if (head < tail && (c = part(ctx, head, tail, keys, n_keys))) {
+  if (head < tail && (c = part(ctx, head, tail, keys, n_keys, is_id_order))) {
     intptr_t m = c - head + 1;
-    if (from < m - 1) { _sort(ctx, head, c - 1, from, to, keys, n_keys); }
-    if (m < to) { _sort(ctx, c + 1, tail, from - m, to - m, keys, n_keys); }
+    if (from < m - 1) {
+      _sort(ctx, head, c - 1, from, to, keys, n_keys, is_id_order);
+    }
+    if (m < to) {
+      _sort(ctx, c + 1, tail, from - m, to - m, keys, n_keys, is_id_order);
+    }
   }
 }
 
 static sort_entry *
 pack(grn_ctx *ctx, grn_obj *table, sort_entry *head, sort_entry *tail,
-     grn_table_sort_key *keys, int n_keys)
+     grn_table_sort_key *keys, int n_keys, grn_bool is_id_order)
 {
   int i = 0;
   sort_entry e, c;
@@ -8759,7 +10117,7 @@ pack(grn_ctx *ctx, grn_obj *table, sort_entry *head, sort_entry *tail,
     c.value = grn_obj_get_value_(ctx, keys->key, c.id, &c.size);
     while ((e.id = grn_table_cursor_next_inline(ctx, tc))) {
       e.value = grn_obj_get_value_(ctx, keys->key, e.id, &e.size);
-      if (compare_value(ctx, &c, &e, keys, n_keys)) {
+      if (compare_value(ctx, &c, &e, keys, n_keys, is_id_order)) {
         *head++ = e;
       } else {
         *tail-- = e;
@@ -8773,6 +10131,508 @@ pack(grn_ctx *ctx, grn_obj *table, sort_entry *head, sort_entry *tail,
   return i > 2 ? head : NULL;
 }
 
+/*
+ * The following paths are used only for larger tables. They order records
+ * that have the same keys by ID, so the quicksort above does so for
+ * tables of the same size too. Then the pages of the same sort don't
+ * depend on offset, limit nor the path.
+ */
+#define SORT_MIN_N_RECORDS_FOR_HEAP_OR_RADIX 1024
+/* The heap is used when at most 1/SORT_HEAP_RATIO of records are needed. */
+#define SORT_HEAP_RATIO 16
+
+inline static void
+sort_heap_down(grn_ctx *ctx, sort_entry *heap, int n_entries, int i,
+               grn_table_sort_key *keys, int n_keys)
+{
+  for (;;) {
+    int largest = i;
+    int left = i * 2 + 1;
+    int right = left + 1;
+    if (left < n_entries &&
+        compare_value(ctx, heap + left, heap + largest, keys, n_keys,
+                      GRN_TRUE)) {
+      largest = left;
+    }
+    if (right < n_entries &&
+        compare_value(ctx, heap + right, heap + largest, keys, n_keys,
+                      GRN_TRUE)) {
+      largest = right;
+    }
+    if (largest == i) { break; }
+    swap(heap + i, heap + largest);
+    i = largest;
+  }
+}
+
+/*
+ * Keeps only the first n_entries records in a max-heap whose root is the
+ * last record of them. Only one comparison is needed for a record that
+ * isn't in the first n_entries records.
+ */
+static int
+sort_top_by_heap(grn_ctx *ctx, grn_obj *table, sort_entry *heap,
+                 int n_entries, grn_table_sort_key *keys, int n_keys)
+{
+  int i, n = 0;
+  sort_entry e;
+  grn_table_cursor *tc;
+  tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0);
+  if (!tc) { return 0; }
+  while ((e.id = grn_table_cursor_next_inline(ctx, tc))) {
+    e.value = grn_obj_get_value_(ctx, keys->key, e.id, &e.size);
+    if (n < n_entries) {
+      for (i = n++; i > 0; i = (i - 1) / 2) {
+        int parent = (i - 1) / 2;
+        if (!compare_value(ctx, &e, heap + parent, keys, n_keys, GRN_TRUE)) {
+          break;
+        }
+        heap[i] = heap[parent];
+      }
+      heap[i] = e;
+    } else if (compare_value(ctx, heap, &e, keys, n_keys, GRN_TRUE)) {
+      heap[0] = e;
+      sort_heap_down(ctx, heap, n, 0, keys, n_keys);
+    }
+  }
+  grn_table_cursor_close(ctx, tc);
+  for (i = n - 1; i > 0; i--) {
+    swap(heap, heap + i);
+    sort_heap_down(ctx, heap, i, 0, keys, n_keys);
+  }
+  return n;
+}
+
+typedef struct {
+  uint64_t key;
+  grn_id id;
+} sort_radix_entry;
+
+inline static int
+sort_radix_key_size(uint8_t type)
+{
+  switch (type) {
+  case KEY_INT8 :
+  case KEY_UINT8 :
+    return 1;
+  case KEY_INT16 :
+  case KEY_UINT16 :
+    return 2;
+  case KEY_ID :
+  case KEY_INT32 :
+  case KEY_UINT32 :
+  case KEY_FLOAT32 :
+    return 4;
+  case KEY_INT64 :
+  case KEY_UINT64 :
+  case KEY_FLOAT64 :
+    return 8;
+  default :
+    return 0;
+  }
+}
+
+/* Maps a value to an unsigned integer that has the same order. */
+inline static uint64_t
+sort_radix_key(uint8_t type, const void *value)
+{
+  switch (type) {
+  case KEY_ID :
+    return (uint32_t)(uintptr_t)value;
+  case KEY_INT8 :
+    return (uint8_t)(*((const int8_t *)value)) ^ 0x80;
+  case KEY_INT16 :
+    return (uint16_t)(*((const int16_t *)value)) ^ 0x8000;
+  case KEY_INT32 :
+    return (uint32_t)(*((const int32_t *)value)) ^ 0x80000000U;
+  case KEY_INT64 :
+    return (uint64_t)(*((const int64_t *)value)) ^ 0x8000000000000000ULL;
+  case KEY_UINT8 :
+    return *((const uint8_t *)value);
+  case KEY_UINT16 :
+    return *((const uint16_t *)value);
+  case KEY_UINT32 :
+    return *((const uint32_t *)value);
+  case KEY_UINT64 :
+    return *((const uint64_t *)value);
+  case KEY_FLOAT32 :
+    {
+      uint32_t bits;
+      memcpy(&bits, value, sizeof(bits));
+      return (bits & 0x80000000U) ? (uint32_t)~bits : (bits | 0x80000000U);
+    }
+  case KEY_FLOAT64 :
+    {
+      uint64_t bits;
+      memcpy(&bits, value, sizeof(bits));
+      return (bits & 0x8000000000000000ULL) ?
+        ~bits : (bits | 0x8000000000000000ULL);
+    }
+  default :
+    return 0;
+  }
+}
+
+/*
+ * Sorts records by LSD radix sort. Each key value is fetched only once
+ * per record and records are sorted by the last key first because each
+ * pass is stable. Records without value are placed before records with
+ * value like compare_value() does.
+ */
+static sort_radix_entry *
+sort_by_radix(grn_ctx *ctx, grn_obj *table, sort_radix_entry *entries,
+              sort_radix_entry *buffer, int *n_entries,
+              grn_table_sort_key *keys, int n_keys)
+{
+  int i, k, n = *n_entries;
+  grn_bool is_id_order = GRN_TRUE;
+  grn_table_cursor *tc;
+  tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0);
+  if (!tc) { return NULL; }
+  for (i = 0; i < n; i++) {
+    if (!(entries[i].id = grn_table_cursor_next_inline(ctx, tc))) { break; }
+    if (i > 0 && entries[i].id < entries[i - 1].id) {
+      is_id_order = GRN_FALSE;
+    }
+  }
+  grn_table_cursor_close(ctx, tc);
+  *n_entries = n = i;
+  /* Records that have the same keys are ordered by ID. Cursors of tables
+     that are ordered by key need an extra pass for it. */
+  for (k = n_keys - (is_id_order ? 1 : 0); k >= 0; k--) {
+    grn_table_sort_key *key = keys + k;
+    grn_bool is_id_pass = (k == n_keys) ? GRN_TRUE : GRN_FALSE;
+    uint8_t type = is_id_pass ? KEY_ID : key->offset;
+    int key_size = sort_radix_key_size(type);
+    uint64_t mask = (key_size == 8) ? ~0ULL : ((1ULL << (key_size * 8)) - 1);
+    grn_bool is_desc = (!is_id_pass && (key->flags & GRN_TABLE_SORT_DESC)) ?
+      GRN_TRUE : GRN_FALSE;
+    int n_nulls = 0;
+    int shift;
+    if (is_id_pass) {
+      for (i = 0; i < n; i++) {
+        entries[i].key = entries[i].id;
+      }
+    } else {
+      for (i = 0; i < n; i++) {
+        uint32_t size;
+        const void *value = grn_obj_get_value_(ctx, key->key, entries[i].id,
+                                               &size);
+        if (type == KEY_ID || (value && size)) {
+          uint64_t radix_key = sort_radix_key(type, value);
+          entries[i].key = is_desc ? (~radix_key & mask) : radix_key;
+        } else {
+          /* Uses the largest key as a mark. It is reordered below. */
+          entries[i].key = mask;
+          entries[i].id |= 0x80000000U;
+          n_nulls++;
+        }
+      }
+    }
+    for (shift = 0; shift < key_size * 8; shift += 8) {
+      uint32_t offsets[256];
+      sort_radix_entry *swapped;
+      memset(offsets, 0, sizeof(offsets));
+      for (i = 0; i < n; i++) {
+        offsets[(entries[i].key >> shift) & 0xff]++;
+      }
+      if (offsets[(entries[0].key >> shift) & 0xff] == (uint32_t)n) {
+        continue;
+      }
+      {
+        uint32_t offset = 0;
+        int byte;
+        for (byte = 0; byte < 256; byte++) {
+          uint32_t count = offsets[byte];
+          offsets[byte] = offset;
+          offset += count;
+        }
+      }
+      for (i = 0; i < n; i++) {
+        buffer[offsets[(entries[i].key >> shift) & 0xff]++] = entries[i];
+      }
+      swapped = entries;
+      entries = buffer;
+      buffer = swapped;
+    }
+    if (n_nulls) {
+      /* Records without value are first in ascending order and last in
+         descending order. */
+      int null_offset = is_desc ? n - n_nulls : 0;
+      int value_offset = is_desc ? 0 : n_nulls;
+      sort_radix_entry *swapped;
+      for (i = 0; i < n; i++) {
+        if (entries[i].id & 0x80000000U) {
+          buffer[null_offset] = entries[i];
+          buffer[null_offset++].id &= ~0x80000000U;
+        } else {
+          buffer[value_offset++] = entries[i];
+        }
+      }
+      swapped = entries;
+      entries = buffer;
+      buffer = swapped;
+    }
+  }
+  return entries;
+}
+
+/*
+ * Parallel merge sort. The values of all keys are fetched by the calling
+ * thread first, so that the workers compare them without touching the
+ * context nor the tables. Each worker sorts a contiguous chunk and the
+ * sorted chunks are merged pairwise. Each merge is split into parts that
+ * are merged by different workers.
+ */
+#define SORT_MAX_N_WORKERS 64
+#define SORT_INSERTION_SORT_SIZE 16
+
+typedef struct {
+  const void *value;
+  uint32_t size;
+} sort_value;
+
+typedef struct {
+  grn_id id;
+  const sort_value *values;
+} sort_parallel_entry;
+
+typedef struct {
+  grn_thread thread;
+  grn_table_sort_key *keys;
+  int n_keys;
+  /* for sorting a chunk: entries are sorted by using buffer */
+  sort_parallel_entry *entries;
+  sort_parallel_entry *buffer;
+  size_t n_entries;
+  /* for merging: a and b are merged into out */
+  const sort_parallel_entry *a;
+  size_t n_a;
+  const sort_parallel_entry *b;
+  size_t n_b;
+  sort_parallel_entry *out;
+} sort_worker;
+
+inline static int
+compare_values(const sort_parallel_entry *a, const sort_parallel_entry *b,
+               grn_table_sort_key *keys, int n_keys)
+{
+  int i;
+  for (i = 0; i < n_keys; i++, keys++) {
+    const sort_value *av = a->values + i;
+    const sort_value *bv = b->values + i;
+    int r = compare_key_value(keys->offset,
+                              av->value, av->size,
+                              bv->value, bv->size);
+    if (r) {
+      return (keys->flags & GRN_TABLE_SORT_DESC) ? -r : r;
+    }
+  }
+  if (a->id != b->id) { return a->id < b->id ? -1 : 1; }
+  return 0;
+}
+
+/* Merges a and b into out. Entries in a are first for the same keys. */
+static void
+sort_merge(const sort_parallel_entry *a, size_t n_a,
+           const sort_parallel_entry *b, size_t n_b,
+           sort_parallel_entry *out,
+           grn_table_sort_key *keys, int n_keys)
+{
+  const sort_parallel_entry *a_end = a + n_a;
+  const sort_parallel_entry *b_end = b + n_b;
+  while (a < a_end && b < b_end) {
+    if (compare_values(a, b, keys, n_keys) <= 0) {
+      *out++ = *a++;
+    } else {
+      *out++ = *b++;
+    }
+  }
+  while (a < a_end) { *out++ = *a++; }
+  while (b < b_end) { *out++ = *b++; }
+}
+
+/* Returns the number of entries of a in the first n entries of merged
+   a and b. */
+static size_t
+sort_merge_split(const sort_parallel_entry *a, size_t n_a,
+                 const sort_parallel_entry *b, size_t n_b,
+                 size_t n, grn_table_sort_key *keys, int n_keys)
+{
+  size_t low = (n > n_b) ? n - n_b : 0;
+  size_t high = (n < n_a) ? n : n_a;
+  while (low < high) {
+    size_t i = low + (high - low) / 2;
+    if (compare_values(a + i, b + (n - i - 1), keys, n_keys) <= 0) {
+      low = i + 1;
+    } else {
+      high = i;
+    }
+  }
+  return low;
+}
+
+/* Sorts entries stably. The sorted entries are stored into entries. */
+static void
+sort_chunk(sort_parallel_entry *entries, sort_parallel_entry *buffer,
+           size_t n, grn_table_sort_key *keys, int n_keys)
+{
+  sort_parallel_entry *from = entries, *to = buffer;
+  size_t start, width;
+  for (start = 0; start < n; start += SORT_INSERTION_SORT_SIZE) {
+    size_t end = start + SORT_INSERTION_SORT_SIZE, i;
+    if (end > n) { end = n; }
+    for (i = start + 1; i < end; i++) {
+      sort_parallel_entry e = entries[i];
+      size_t j = i;
+      while (j > start && compare_values(entries + j - 1, &e, keys, n_keys) > 0) {
+        entries[j] = entries[j - 1];
+        j--;
+      }
+      entries[j] = e;
+    }
+  }
+  for (width = SORT_INSERTION_SORT_SIZE; width < n; width *= 2) {
+    sort_parallel_entry *swapped;
+    for (start = 0; start < n; start += width * 2) {
+      size_t middle = start + width, end = start + width * 2;
+      if (middle > n) { middle = n; }
+      if (end > n) { end = n; }
+      sort_merge(from + start, middle - start, from + middle, end - middle,
+                 to + start, keys, n_keys);
+    }
+    swapped = from;
+    from = to;
+    to = swapped;
+  }
+  if (from != entries) {
+    memcpy(entries, from, sizeof(sort_parallel_entry) * n);
+  }
+}
+
+static void * CALLBACK
+sort_worker_func(void *arg)
+{
+  sort_worker *worker = (sort_worker *)arg;
+  if (worker->a) {
+    sort_merge(worker->a, worker->n_a, worker->b, worker->n_b, worker->out,
+               worker->keys, worker->n_keys);
+  } else {
+    sort_chunk(worker->entries, worker->buffer, worker->n_entries,
+               worker->keys, worker->n_keys);
+  }
+  return NULL;
+}
+
+/* Runs workers[1..n_workers - 1] by threads and workers[0] by the calling
+   thread. A worker whose thread can't be created is run by the calling
+   thread too. */
+static void
+sort_workers_run(sort_worker *workers, int n_workers)
+{
+  int i;
+  grn_bool started[SORT_MAX_N_WORKERS];
+  for (i = 1; i < n_workers; i++) {
+    started[i] = !THREAD_CREATE(workers[i].thread, sort_worker_func,
+                                &workers[i]);
+  }
+  sort_worker_func(&workers[0]);
+  for (i = 1; i < n_workers; i++) {
+    if (started[i]) {
+      THREAD_JOIN(workers[i].thread);
+    } else {
+      sort_worker_func(&workers[i]);
+    }
+  }
+}
+
+static sort_parallel_entry *
+sort_by_parallel_merge(grn_ctx *ctx, grn_obj *table,
+                       sort_parallel_entry *entries,
+                       sort_parallel_entry *buffer,
+                       sort_value *values, int *n_entries,
+                       grn_table_sort_key *keys, int n_keys, int n_workers)
+{
+  int i, k, n = *n_entries, n_runs;
+  size_t runs[SORT_MAX_N_WORKERS + 1];
+  sort_worker workers[SORT_MAX_N_WORKERS];
+  grn_table_cursor *tc;
+  tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0);
+  if (!tc) { return NULL; }
+  for (i = 0; i < n; i++) {
+    sort_value *record_values = values + (size_t)i * n_keys;
+    if (!(entries[i].id = grn_table_cursor_next_inline(ctx, tc))) { break; }
+    entries[i].values = record_values;
+    for (k = 0; k < n_keys; k++) {
+      record_values[k].value = grn_obj_get_value_(ctx, keys[k].key,
+                                                  entries[i].id,
+                                                  &(record_values[k].size));
+    }
+  }
+  grn_table_cursor_close(ctx, tc);
+  *n_entries = n = i;
+
+  if (n_workers > SORT_MAX_N_WORKERS) { n_workers = SORT_MAX_N_WORKERS; }
+  memset(workers, 0, sizeof(sort_worker) * n_workers);
+  for (i = 0; i < n_workers; i++) {
+    runs[i] = (size_t)n * i / n_workers;
+    workers[i].keys = keys;
+    workers[i].n_keys = n_keys;
+    workers[i].entries = entries + runs[i];
+    workers[i].buffer = buffer + runs[i];
+  }
+  runs[n_workers] = n;
+  for (i = 0; i < n_workers; i++) {
+    workers[i].n_entries = runs[i + 1] - runs[i];
+  }
+  sort_workers_run(workers, n_workers);
+
+  for (n_runs = n_workers; n_runs > 1; n_runs = (n_runs + 1) / 2) {
+    int n_pairs = n_runs / 2;
+    int n_parts = n_workers / n_pairs;
+    int n_merge_workers = 0;
+    sort_parallel_entry *swapped;
+    if (n_parts < 1) { n_parts = 1; }
+    for (i = 0; i < n_pairs; i++) {
+      const sort_parallel_entry *a = entries + runs[i * 2];
+      const sort_parallel_entry *b = entries + runs[i * 2 + 1];
+      size_t n_a = runs[i * 2 + 1] - runs[i * 2];
+      size_t n_b = runs[i * 2 + 2] - runs[i * 2 + 1];
+      size_t a_start = 0, out_start = 0;
+      int part;
+      for (part = 1; part <= n_parts; part++) {
+        sort_worker *worker = &workers[n_merge_workers++];
+        size_t out_end = (n_a + n_b) * part / n_parts;
+        size_t a_end = sort_merge_split(a, n_a, b, n_b, out_end, keys, n_keys);
+        worker->a = a + a_start;
+        worker->n_a = a_end - a_start;
+        worker->b = b + (out_start - a_start);
+        worker->n_b = (out_end - a_end) - (out_start - a_start);
+        worker->out = buffer + runs[i * 2] + out_start;
+        a_start = a_end;
+        out_start = out_end;
+      }
+    }
+    if (n_runs % 2) {
+      size_t last = runs[n_runs - 1];
+      memcpy(buffer + last, entries + last,
+             sizeof(sort_parallel_entry) * (n - last));
+    }
+    sort_workers_run(workers, n_merge_workers);
+    for (i = 0; i < n_pairs; i++) {
+      runs[i] = runs[i * 2];
+    }
+    if (n_runs % 2) {
+      runs[n_pairs] = runs[n_runs - 1];
+    }
+    runs[(n_runs + 1) / 2] = n;
+    swapped = entries;
+    entries = buffer;
+    buffer = swapped;
+  }
+  return entries;
+}
+
 static int
 range_is_idp(grn_obj *obj)
 {
@@ -8918,13 +10778,90 @@ grn_table_sort(grn_ctx *ctx, grn_obj *table, int offset, int limit,
         }
       }
     }
+    if (n >= SORT_MIN_N_RECORDS_FOR_HEAP_OR_RADIX &&
+        0 < e && e <= n / SORT_HEAP_RATIO) {
+      int n_entries;
+      if (!(array = GRN_MALLOC(sizeof(sort_entry) * e))) {
+        goto exit;
+      }
+      n_entries = sort_top_by_heap(ctx, table, array, e, keys, n_keys);
+      {
+        grn_id *v;
+        for (i = 0, ep = array + offset;
+             i < limit && ep < array + n_entries;
+             i++, ep++) {
+          if (!grn_array_add(ctx, (grn_array *)result, (void **)&v)) { break; }
+          *v = ep->id;
+        }
+        GRN_FREE(array);
+      }
+      goto exit;
+    }
+    if (n >= SORT_MIN_N_RECORDS_FOR_HEAP_OR_RADIX) {
+      for (kp = keys, j = n_keys; j; kp++, j--) {
+        if (!sort_radix_key_size(kp->offset)) { break; }
+      }
+      if (j && grn_n_sort_workers > 1 && n >= grn_sort_parallel_threshold) {
+        sort_parallel_entry *entries, *sorted;
+        sort_value *values;
+        int n_entries = n;
+        entries = GRN_MALLOC(sizeof(sort_parallel_entry) * n * 2);
+        values = GRN_MALLOC(sizeof(sort_value) * n * n_keys);
+        if (!entries || !values) {
+          if (entries) { GRN_FREE(entries); }
+          if (values) { GRN_FREE(values); }
+          goto exit;
+        }
+        sorted = sort_by_parallel_merge(ctx, table, entries, entries + n,
+                                        values, &n_entries, keys, n_keys,
+                                        grn_n_sort_workers);
+        if (sorted) {
+          grn_id *v;
+          for (i = 0; i < limit && offset + i < n_entries; i++) {
+            if (!grn_array_add(ctx, (grn_array *)result, (void **)&v)) { break; }
+            *v = sorted[offset + i].id;
+          }
+        }
+        GRN_FREE(values);
+        GRN_FREE(entries);
+        goto exit;
+      }
+      if (!j) {
+        sort_radix_entry *entries, *buffer, *sorted;
+        int n_entries = n;
+        if (!(entries = GRN_MALLOC(sizeof(sort_radix_entry) * n * 2))) {
+          goto exit;
+        }
+        buffer = entries + n;
+        sorted = sort_by_radix(ctx, table, entries, buffer, &n_entries,
+                               keys, n_keys);
+        if (sorted) {
+          grn_id *v;
+          for (i = 0; i < limit && offset + i < n_entries; i++) {
+            if (!grn_array_add(ctx, (grn_array *)result, (void **)&v)) { break; }
+            *v = sorted[offset + i].id;
+          }
+        }
+        GRN_FREE(entries);
+        goto exit;
+      }
+    }
     if (!(array = GRN_MALLOC(sizeof(sort_entry) * n))) {
       goto exit;
     }
-    if ((ep = pack(ctx, table, array, array + n - 1, keys, n_keys))) {
-      intptr_t m = ep - array + 1;
-      if (offset < m - 1) { _sort(ctx, array, ep - 1, offset, e, keys, n_keys); }
-      if (m < e) { _sort(ctx, ep + 1, array + n - 1, offset - m, e - m, keys, n_keys); }
+    {
+      grn_bool is_id_order = (n >= SORT_MIN_N_RECORDS_FOR_HEAP_OR_RADIX);
+      if ((ep = pack(ctx, table, array, array + n - 1, keys, n_keys,
+                     is_id_order))) {
+        intptr_t m = ep - array + 1;
+        if (offset < m - 1) {
+          _sort(ctx, array, ep - 1, offset, e, keys, n_keys, is_id_order);
+        }
+        if (m < e) {
+          _sort(ctx, ep + 1, array + n - 1, offset - m, e - m, keys, n_keys,
+                is_id_order);
+        }
+      }
     }
     {
       grn_id *v;
@@ -10589,6 +12526,7 @@ grn_load_(grn_ctx *ctx, grn_content_type input_type,
   case GRN_CONTENT_TSV :
   case GRN_CONTENT_XML :
   case GRN_CONTENT_MSGPACK :
+  case GRN_CONTENT_COLUMNAR :
     ERR(GRN_FUNCTION_NOT_IMPLEMENTED, "unsupported input_type");
     // todo
     break;
@@ -62,6 +62,22 @@ typedef struct {
 #define GRN_RSET_SUBRECS_COPY(subrecs,size,n,src) \
   (memcpy(GRN_RSET_SUBRECS_NTH(subrecs, size, n), src, GRN_RSET_SCORE_SIZE + size))
 
+/* The values calculated by grn_table_group() for the calc types of a table
+   follow the subrecs in the value of each record. */
+#define GRN_TABLE_GROUP_CALC_VALUE_TYPES (GRN_TABLE_GROUP_CALC_MAX|\
+                                          GRN_TABLE_GROUP_CALC_MIN|\
+                                          GRN_TABLE_GROUP_CALC_SUM|\
+                                          GRN_TABLE_GROUP_CALC_AVG|\
+                                          GRN_TABLE_GROUP_CALC_COUNT_DISTINCT)
+#define GRN_RSET_CALC_VALUES_ALIGN(offset) \
+  (((offset) + sizeof(int64_t) - 1) & ~(sizeof(int64_t) - 1))
+
+uint32_t grn_rset_recinfo_calc_values_size(grn_table_group_flags calc_types);
+byte *grn_rset_recinfo_calc_value(grn_obj *table, grn_rset_recinfo *ri,
+                                  grn_table_group_flags calc_type);
+grn_id grn_rset_recinfo_calc_value_range(grn_obj *table,
+                                         grn_table_group_flags calc_type);
+
 #define GRN_JSON_LOAD_OPEN_BRACKET 0x40000000
 #define GRN_JSON_LOAD_OPEN_BRACE   0x40000001
 
@@ -86,6 +102,12 @@ GRN_API grn_rc grn_db_close(grn_ctx *ctx, grn_obj *db);
 grn_obj *grn_db_keys(grn_obj *s);
 
 uint32_t grn_db_lastmod(grn_obj *s);
+void grn_obj_touch(grn_ctx *ctx, grn_obj *obj, grn_timeval *tv);
+uint32_t grn_obj_lastmod(grn_ctx *ctx, grn_obj *obj);
+void grn_table_touch_with_related(grn_ctx *ctx, grn_obj *table);
+uint32_t grn_obj_update_enter(grn_ctx *ctx, grn_obj *obj);
+void grn_obj_update_leave(grn_ctx *ctx, grn_obj *obj, uint32_t epoch);
+void grn_obj_update_wait(grn_ctx *ctx, grn_obj *obj);
 
 grn_rc _grn_table_delete_by_id(grn_ctx *ctx, grn_obj *table, grn_id id,
                                grn_table_delete_optarg *optarg);
@@ -232,6 +254,7 @@ enum {
   GRN_ACCESSOR_GET_VALUE,
   GRN_ACCESSOR_GET_SCORE,
   GRN_ACCESSOR_GET_NSUBRECS,
+  GRN_ACCESSOR_GET_CALC_VALUE,
   GRN_ACCESSOR_GET_COLUMN_VALUE,
   GRN_ACCESSOR_GET_DB_OBJ,
   GRN_ACCESSOR_LOOKUP,
@@ -281,6 +304,7 @@ grn_rc grn_db_init_builtin_types(grn_ctx *ctx);
 /* expr */
 
 typedef struct _grn_expr grn_expr;
+typedef struct _grn_expr_closure grn_expr_closure;
 
 #define GRN_EXPR_CODE_RELATIONAL_EXPRESSION (0x01)
 
@@ -314,6 +338,7 @@ struct _grn_expr {
   grn_obj objs;
   grn_obj dfi;
   grn_expr_code *code0;
+  grn_expr_closure *closures;
 };
 
 GRN_API grn_rc grn_expr_clear_vars(grn_ctx *ctx, grn_obj *expr);
@@ -415,6 +440,12 @@ grn_rc grn_db_obj_init(grn_ctx *ctx, grn_obj *db, grn_id id, grn_db_obj *obj);
 grn_id grn_obj_register(grn_ctx *ctx, grn_obj *db, const char *name, unsigned int name_size);
 int grn_obj_is_persistent(grn_ctx *ctx, grn_obj *obj);
 void grn_obj_spec_save(grn_ctx *ctx, grn_db_obj *obj);
+grn_io *grn_obj_get_io(grn_obj *obj);
+grn_bool grn_ctx_is_opened(grn_ctx *ctx, grn_id id);
+
+grn_rc grn_index_column_convert(grn_ctx *ctx, grn_obj *column,
+                                grn_obj_flags codec_flags);
+grn_rc grn_index_column_rebuild(grn_ctx *ctx, grn_obj *column);
 
 grn_rc grn_obj_reinit_for(grn_ctx *ctx, grn_obj *obj, grn_obj *domain_obj);
 
@@ -510,6 +510,7 @@ grn_expr_open(grn_ctx *ctx, grn_obj_spec *spec, const uint8_t *p, const uint8_t
     GRN_PTR_INIT(&expr->objs, GRN_OBJ_VECTOR, GRN_ID_NIL);
     expr->vars = NULL;
     expr->nvars = 0;
+    expr->closures = NULL;
     GRN_DB_OBJ_SET_TYPE(expr, GRN_EXPR);
     if ((expr->values = GRN_MALLOCN(grn_obj, size))) {
       int i;
@@ -578,6 +579,483 @@ dfi_value_at(grn_expr *expr, int offset)
     : NULL;
 }
 
+/*
+ * A closure is a tree of functions that is compiled from an expression. Each
+ * leaf compares a scalar column of a record with a constant that is cast
+ * beforehand as grn_expr_exec() casts it for each record, so that the tree
+ * evaluates a record without dispatching on the operators nor allocating
+ * values. A function returns 1 or 0, or -1 if the value of the record can't
+ * be referenced; the record must be evaluated by grn_expr_exec() in the case.
+ * Closures are cached in the expression and they are cleared when a code is
+ * appended to it.
+ */
+#define GRN_EXPR_CLOSURE_MAX_DEPTH 32
+
+typedef struct _grn_expr_closure_node grn_expr_closure_node;
+
+typedef int (*grn_expr_closure_func)(grn_ctx *ctx,
+                                     grn_expr_closure_node *node, grn_id id);
+
+struct _grn_expr_closure_node {
+  grn_expr_closure_func func;
+  grn_obj *column;
+  grn_expr_closure_node *x;
+  grn_expr_closure_node *y;
+  int64_t int_value;
+  uint32_t uint32_value;
+  double float_value;
+  const char *text;
+  uint32_t text_size;
+};
+
+struct _grn_expr_closure {
+  grn_expr_closure *next;
+  grn_expr_code *codes;
+  uint32_t n_codes;
+  grn_id table_id;
+  grn_expr_closure_node *root;
+  grn_expr_closure_node nodes[1];
+};
+
+typedef enum {
+  GRN_EXPR_CLOSURE_INT32_SIGNED = 0,
+  GRN_EXPR_CLOSURE_INT32_UNSIGNED,
+  GRN_EXPR_CLOSURE_INT32_FLOAT,
+  GRN_EXPR_CLOSURE_FLOAT,
+  GRN_EXPR_CLOSURE_TIME,
+  GRN_EXPR_CLOSURE_TEXT,
+  GRN_EXPR_CLOSURE_N_KINDS
+} grn_expr_closure_kind;
+
+#define GRN_EXPR_CLOSURE_EQUAL(x, y) ((x) <= (y) && (x) >= (y))
+#define GRN_EXPR_CLOSURE_NOT_EQUAL(x, y) (!GRN_EXPR_CLOSURE_EQUAL(x, y))
+#define GRN_EXPR_CLOSURE_LESS(x, y) ((x) < (y))
+#define GRN_EXPR_CLOSURE_GREATER(x, y) ((x) > (y))
+#define GRN_EXPR_CLOSURE_LESS_EQUAL(x, y) ((x) <= (y))
+#define GRN_EXPR_CLOSURE_GREATER_EQUAL(x, y) ((x) >= (y))
+
+#define GRN_EXPR_CLOSURE_FIX_SIZE_FUNC(name, type, cast, value, compare) \
+static int                                                              \
+name(grn_ctx *ctx, grn_expr_closure_node *node, grn_id id)              \
+{                                                                       \
+  int r;                                                                \
+  grn_ra *ra = (grn_ra *)node->column;                                  \
+  void *p = grn_ra_ref(ctx, ra, id);                                    \
+  if (!p) { return -1; }                                                \
+  r = compare((cast)(*(type *)p), node->value);                         \
+  grn_ra_unref(ctx, ra, id);                                            \
+  return r;                                                             \
+}
+
+#define GRN_EXPR_CLOSURE_FIX_SIZE_FUNCS(prefix, type, cast, value)      \
+  GRN_EXPR_CLOSURE_FIX_SIZE_FUNC(prefix ## _equal, type, cast, value,   \
+                                 GRN_EXPR_CLOSURE_EQUAL)                \
+  GRN_EXPR_CLOSURE_FIX_SIZE_FUNC(prefix ## _not_equal, type, cast, value, \
+                                 GRN_EXPR_CLOSURE_NOT_EQUAL)            \
+  GRN_EXPR_CLOSURE_FIX_SIZE_FUNC(prefix ## _less, type, cast, value,    \
+                                 GRN_EXPR_CLOSURE_LESS)                 \
+  GRN_EXPR_CLOSURE_FIX_SIZE_FUNC(prefix ## _greater, type, cast, value, \
+                                 GRN_EXPR_CLOSURE_GREATER)              \
+  GRN_EXPR_CLOSURE_FIX_SIZE_FUNC(prefix ## _less_equal, type, cast, value, \
+                                 GRN_EXPR_CLOSURE_LESS_EQUAL)           \
+  GRN_EXPR_CLOSURE_FIX_SIZE_FUNC(prefix ## _greater_equal, type, cast, value, \
+                                 GRN_EXPR_CLOSURE_GREATER_EQUAL)
+
+GRN_EXPR_CLOSURE_FIX_SIZE_FUNCS(closure_int32_signed,
+                                int32_t, int64_t, int_value)
+GRN_EXPR_CLOSURE_FIX_SIZE_FUNCS(closure_int32_unsigned,
+                                int32_t, uint32_t, uint32_value)
+GRN_EXPR_CLOSURE_FIX_SIZE_FUNCS(closure_int32_float,
+                                int32_t, double, float_value)
+GRN_EXPR_CLOSURE_FIX_SIZE_FUNCS(closure_float, double, double, float_value)
+GRN_EXPR_CLOSURE_FIX_SIZE_FUNCS(closure_time, int64_t, int64_t, int_value)
+
+#define GRN_EXPR_CLOSURE_TEXT_FUNC(name, compare)                       \
+static int                                                              \
+name(grn_ctx *ctx, grn_expr_closure_node *node, grn_id id)              \
+{                                                                       \
+  int r_;                                                               \
+  grn_io_win iw;                                                        \
+  uint32_t la = 0, lb = node->text_size;                                \
+  const char *x = grn_ja_ref(ctx, (grn_ja *)node->column, id, &iw, &la); \
+  if (!x) { la = 0; }                                                   \
+  if (la > lb) {                                                        \
+    if (!(r_ = memcmp(x, node->text, lb))) { r_ = 1; }                  \
+  } else {                                                              \
+    if (!(r_ = memcmp(x, node->text, la))) { r_ = la == lb ? 0 : -1; }  \
+  }                                                                     \
+  if (x) { grn_ja_unref(ctx, &iw); }                                    \
+  return compare(r_, 0);                                                \
+}
+
+GRN_EXPR_CLOSURE_TEXT_FUNC(closure_text_equal, GRN_EXPR_CLOSURE_EQUAL)
+GRN_EXPR_CLOSURE_TEXT_FUNC(closure_text_not_equal, GRN_EXPR_CLOSURE_NOT_EQUAL)
+GRN_EXPR_CLOSURE_TEXT_FUNC(closure_text_less, GRN_EXPR_CLOSURE_LESS)
+GRN_EXPR_CLOSURE_TEXT_FUNC(closure_text_greater, GRN_EXPR_CLOSURE_GREATER)
+GRN_EXPR_CLOSURE_TEXT_FUNC(closure_text_less_equal,
+                           GRN_EXPR_CLOSURE_LESS_EQUAL)
+GRN_EXPR_CLOSURE_TEXT_FUNC(closure_text_greater_equal,
+                           GRN_EXPR_CLOSURE_GREATER_EQUAL)
+
+#define GRN_EXPR_CLOSURE_COMPARE_FUNCS(prefix) {\
+  prefix ## _equal,\
+  prefix ## _not_equal,\
+  prefix ## _less,\
+  prefix ## _greater,\
+  prefix ## _less_equal,\
+  prefix ## _greater_equal\
+}
+
+static grn_expr_closure_func
+closure_compare_funcs[GRN_EXPR_CLOSURE_N_KINDS][6] = {
+  GRN_EXPR_CLOSURE_COMPARE_FUNCS(closure_int32_signed),
+  GRN_EXPR_CLOSURE_COMPARE_FUNCS(closure_int32_unsigned),
+  GRN_EXPR_CLOSURE_COMPARE_FUNCS(closure_int32_float),
+  GRN_EXPR_CLOSURE_COMPARE_FUNCS(closure_float),
+  GRN_EXPR_CLOSURE_COMPARE_FUNCS(closure_time),
+  GRN_EXPR_CLOSURE_COMPARE_FUNCS(closure_text)
+};
+
+static int
+closure_and(grn_ctx *ctx, grn_expr_closure_node *node, grn_id id)
+{
+  int r = node->x->func(ctx, node->x, id);
+  if (r != 1) { return r; }
+  return node->y->func(ctx, node->y, id);
+}
+
+static int
+closure_or(grn_ctx *ctx, grn_expr_closure_node *node, grn_id id)
+{
+  int r = node->x->func(ctx, node->x, id);
+  if (r != 0) { return r; }
+  return node->y->func(ctx, node->y, id);
+}
+
+static int
+closure_not(grn_ctx *ctx, grn_expr_closure_node *node, grn_id id)
+{
+  int r = node->x->func(ctx, node->x, id);
+  if (r < 0) { return r; }
+  return !r;
+}
+
+/*
+ * Casts a constant for a comparison with a column value as DO_COMPARE() and
+ * DO_EQ() do. Returns GRN_FALSE if grn_expr_exec() doesn't compare them as
+ * numbers of the kind.
+ */
+static grn_bool
+closure_cast_const(grn_ctx *ctx, grn_expr_closure_node *node,
+                   grn_id range, grn_obj *y, grn_bool is_equal,
+                   grn_expr_closure_kind *kind)
+{
+  grn_id domain = y->header.domain;
+  grn_bool is_text = (GRN_DB_SHORT_TEXT <= domain &&
+                      domain <= GRN_DB_LONG_TEXT);
+  int text_int_value = 0;
+  if (is_text) {
+    const char *p = GRN_TEXT_VALUE(y);
+    text_int_value = grn_atoi(p, p + GRN_TEXT_LEN(y), NULL);
+  }
+  switch (range) {
+  case GRN_DB_INT32 :
+    *kind = GRN_EXPR_CLOSURE_INT32_SIGNED;
+    switch (domain) {
+    case GRN_DB_INT8 :
+      node->int_value = GRN_INT8_VALUE(y);
+      break;
+    case GRN_DB_UINT8 :
+      node->int_value = GRN_UINT8_VALUE(y);
+      break;
+    case GRN_DB_INT16 :
+      node->int_value = GRN_INT16_VALUE(y);
+      break;
+    case GRN_DB_UINT16 :
+      node->int_value = GRN_UINT16_VALUE(y);
+      break;
+    case GRN_DB_INT32 :
+      node->int_value = GRN_INT32_VALUE(y);
+      break;
+    case GRN_DB_INT64 :
+      node->int_value = GRN_INT64_VALUE(y);
+      break;
+    case GRN_DB_UINT32 :
+      *kind = GRN_EXPR_CLOSURE_INT32_UNSIGNED;
+      node->uint32_value = GRN_UINT32_VALUE(y);
+      break;
+    case GRN_DB_FLOAT :
+      *kind = GRN_EXPR_CLOSURE_INT32_FLOAT;
+      node->float_value = GRN_FLOAT_VALUE(y);
+      break;
+    case GRN_DB_SHORT_TEXT :
+    case GRN_DB_TEXT :
+    case GRN_DB_LONG_TEXT :
+      if (is_equal) {
+        node->int_value = text_int_value;
+      } else {
+        grn_obj casted;
+        grn_rc rc;
+        GRN_INT32_INIT(&casted, 0);
+        rc = grn_obj_cast(ctx, y, &casted, GRN_FALSE);
+        node->int_value = GRN_INT32_VALUE(&casted);
+        GRN_OBJ_FIN(ctx, &casted);
+        if (rc) { return GRN_FALSE; }
+      }
+      break;
+    default :
+      return GRN_FALSE;
+    }
+    break;
+  case GRN_DB_FLOAT :
+    *kind = GRN_EXPR_CLOSURE_FLOAT;
+    switch (domain) {
+    case GRN_DB_INT32 :
+      node->float_value = GRN_INT32_VALUE(y);
+      break;
+    case GRN_DB_UINT32 :
+      node->float_value = GRN_UINT32_VALUE(y);
+      break;
+    case GRN_DB_INT64 :
+      node->float_value = GRN_INT64_VALUE(y);
+      break;
+    case GRN_DB_UINT64 :
+      node->float_value = GRN_UINT64_VALUE(y);
+      break;
+    case GRN_DB_FLOAT :
+      node->float_value = GRN_FLOAT_VALUE(y);
+      break;
+    case GRN_DB_SHORT_TEXT :
+    case GRN_DB_TEXT :
+    case GRN_DB_LONG_TEXT :
+      if (is_equal) {
+        node->float_value = text_int_value;
+      } else {
+        grn_obj casted;
+        grn_rc rc;
+        GRN_FLOAT_INIT(&casted, 0);
+        rc = grn_obj_cast(ctx, y, &casted, GRN_FALSE);
+        node->float_value = GRN_FLOAT_VALUE(&casted);
+        GRN_OBJ_FIN(ctx, &casted);
+        if (rc) { return GRN_FALSE; }
+      }
+      break;
+    default :
+      return GRN_FALSE;
+    }
+    break;
+  case GRN_DB_TIME :
+    *kind = GRN_EXPR_CLOSURE_TIME;
+    switch (domain) {
+    case GRN_DB_INT32 :
+      node->int_value = GRN_TIME_PACK(GRN_INT32_VALUE(y), 0);
+      break;
+    case GRN_DB_UINT32 :
+      node->int_value = GRN_TIME_PACK(GRN_UINT32_VALUE(y), 0);
+      break;
+    case GRN_DB_INT64 :
+    case GRN_DB_TIME :
+      node->int_value = GRN_INT64_VALUE(y);
+      break;
+    case GRN_DB_FLOAT :
+      node->int_value = GRN_TIME_PACK(GRN_FLOAT_VALUE(y), 0);
+      break;
+    case GRN_DB_SHORT_TEXT :
+    case GRN_DB_TEXT :
+    case GRN_DB_LONG_TEXT :
+      node->int_value = GRN_TIME_PACK(text_int_value, 0);
+      break;
+    default :
+      return GRN_FALSE;
+    }
+    break;
+  case GRN_DB_SHORT_TEXT :
+  case GRN_DB_TEXT :
+  case GRN_DB_LONG_TEXT :
+    if (!is_text) { return GRN_FALSE; }
+    *kind = GRN_EXPR_CLOSURE_TEXT;
+    node->text = GRN_TEXT_VALUE(y);
+    node->text_size = GRN_TEXT_LEN(y);
+    break;
+  default :
+    return GRN_FALSE;
+  }
+  return GRN_TRUE;
+}
+
+static grn_bool
+closure_column_is_supported(grn_ctx *ctx, grn_obj *column, grn_id table_id)
+{
+  grn_id range;
+  if (!column || column->header.domain != table_id ||
+      (column->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) !=
+      GRN_OBJ_COLUMN_SCALAR) {
+    return GRN_FALSE;
+  }
+  range = DB_OBJ(column)->range;
+  switch (column->header.type) {
+  case GRN_COLUMN_FIX_SIZE :
+    switch (range) {
+    case GRN_DB_INT32 :
+      return ((grn_ra *)column)->header->element_size == sizeof(int32_t);
+    case GRN_DB_FLOAT :
+      return ((grn_ra *)column)->header->element_size == sizeof(double);
+    case GRN_DB_TIME :
+      return ((grn_ra *)column)->header->element_size == sizeof(int64_t);
+    default :
+      return GRN_FALSE;
+    }
+  case GRN_COLUMN_VAR_SIZE :
+    return (GRN_DB_SHORT_TEXT <= range && range <= GRN_DB_LONG_TEXT);
+  default :
+    return GRN_FALSE;
+  }
+}
+
+/*
+ * Compiles an expression into a closure for the records of the table. The
+ * expression must consist of comparisons between a column and a constant
+ * combined by &&, || and !. Returns NULL otherwise.
+ */
+static grn_expr_closure *
+grn_expr_closure_compile(grn_ctx *ctx, grn_expr *e, grn_id table_id)
+{
+  grn_expr_code *code, *code_end = e->codes + e->codes_curr;
+  grn_obj *stack[GRN_EXPR_CLOSURE_MAX_DEPTH];
+  grn_expr_closure_node *nodes[GRN_EXPR_CLOSURE_MAX_DEPTH];
+  grn_expr_closure *closure;
+  grn_expr_closure_node *node;
+  int sp = 0, n_nodes = 0;
+  grn_obj *v = e->nvars ? &e->vars[0].value : NULL;
+  closure = GRN_MALLOC(sizeof(grn_expr_closure) +
+                       sizeof(grn_expr_closure_node) * e->codes_curr);
+  if (!closure) {
+    ERRCLR(ctx);
+    return NULL;
+  }
+  for (code = e->codes; code < code_end; code++) {
+    switch (code->op) {
+    case GRN_OP_GET_VALUE :
+      if (code->nargs != 1 || sp == GRN_EXPR_CLOSURE_MAX_DEPTH ||
+          !closure_column_is_supported(ctx, code->value, table_id)) {
+        goto exit;
+      }
+      stack[sp] = code->value;
+      nodes[sp++] = NULL;
+      break;
+    case GRN_OP_PUSH :
+      if (!code->value || code->value == v || !(code->value->header.impl_flags & GRN_OBJ_EXPRCONST) ||
+          code->value->header.type != GRN_BULK ||
+          sp == GRN_EXPR_CLOSURE_MAX_DEPTH) {
+        goto exit;
+      }
+      stack[sp] = code->value;
+      nodes[sp++] = NULL;
+      break;
+    case GRN_OP_EQUAL :
+    case GRN_OP_NOT_EQUAL :
+    case GRN_OP_LESS :
+    case GRN_OP_GREATER :
+    case GRN_OP_LESS_EQUAL :
+    case GRN_OP_GREATER_EQUAL :
+      {
+        grn_obj *x, *y;
+        grn_expr_closure_kind kind;
+        if (code->nargs != 2 || sp < 2 || nodes[sp - 2] || nodes[sp - 1]) {
+          goto exit;
+        }
+        x = stack[sp - 2];
+        y = stack[sp - 1];
+        if (!GRN_DB_OBJP(x) || y->header.type != GRN_BULK) { goto exit; }
+        node = &closure->nodes[n_nodes++];
+        node->column = x;
+        if (!closure_cast_const(ctx, node, DB_OBJ(x)->range, y,
+                                code->op == GRN_OP_EQUAL ||
+                                code->op == GRN_OP_NOT_EQUAL,
+                                &kind)) {
+          goto exit;
+        }
+        node->func =
+          closure_compare_funcs[kind][code->op - GRN_OP_EQUAL];
+        nodes[sp - 2] = node;
+        sp--;
+      }
+      break;
+    case GRN_OP_AND :
+    case GRN_OP_OR :
+      if (code->nargs != 2 || sp < 2 || !nodes[sp - 2] || !nodes[sp - 1]) {
+        goto exit;
+      }
+      node = &closure->nodes[n_nodes++];
+      node->func = code->op == GRN_OP_AND ? closure_and : closure_or;
+      node->x = nodes[sp - 2];
+      node->y = nodes[sp - 1];
+      nodes[sp - 2] = node;
+      sp--;
+      break;
+    case GRN_OP_NOT :
+      if (sp < 1 || !nodes[sp - 1]) { goto exit; }
+      node = &closure->nodes[n_nodes++];
+      node->func = closure_not;
+      node->x = nodes[sp - 1];
+      nodes[sp - 1] = node;
+      break;
+    default :
+      goto exit;
+    }
+  }
+  if (sp == 1 && nodes[0]) {
+    closure->root = nodes[0];
+    return closure;
+  }
+exit :
+  GRN_FREE(closure);
+  return NULL;
+}
+
+/*
+ * Returns the closure of the current codes of an expression for the table,
+ * compiling it at the first call. Returns NULL if the expression can't be
+ * compiled into a closure.
+ */
+static grn_expr_closure *
+grn_expr_closure_get(grn_ctx *ctx, grn_obj *expr, grn_obj *table)
+{
+  grn_expr *e = (grn_expr *)expr;
+  grn_id table_id = grn_obj_id(ctx, table);
+  grn_expr_closure *closure;
+  for (closure = e->closures; closure; closure = closure->next) {
+    if (closure->codes == e->codes && closure->n_codes == e->codes_curr &&
+        closure->table_id == table_id) {
+      return closure->root ? closure : NULL;
+    }
+  }
+  if (!(closure = grn_expr_closure_compile(ctx, e, table_id))) {
+    /* Remembers that the codes can't be compiled. */
+    if (!(closure = GRN_MALLOC(sizeof(grn_expr_closure)))) {
+      ERRCLR(ctx);
+      return NULL;
+    }
+    closure->root = NULL;
+  }
+  closure->codes = e->codes;
+  closure->n_codes = e->codes_curr;
+  closure->table_id = table_id;
+  closure->next = e->closures;
+  e->closures = closure;
+  return closure->root ? closure : NULL;
+}
+
+static void
+grn_expr_closures_clear(grn_ctx *ctx, grn_expr *e)
+{
+  while (e->closures) {
+    grn_expr_closure *closure = e->closures;
+    e->closures = closure->next;
+    GRN_FREE(closure);
+  }
+}
+
 grn_obj *
 grn_expr_create(grn_ctx *ctx, const char *name, unsigned int name_size)
 {
@@ -620,6 +1098,7 @@ grn_expr_create(grn_ctx *ctx, const char *name, unsigned int name_size)
     expr->values_size = size;
     expr->codes_curr = 0;
     expr->codes_size = size;
+    expr->closures = NULL;
     GRN_DB_OBJ_SET_TYPE(expr, GRN_EXPR);
     expr->obj.header.domain = GRN_ID_NIL;
     expr->obj.range = GRN_ID_NIL;
@@ -694,6 +1173,7 @@ grn_expr_close(grn_ctx *ctx, grn_obj *expr)
   }
   GRN_FREE(e->values);
   GRN_FREE(e->codes);
+  grn_expr_closures_clear(ctx, e);
   GRN_FREE(e);
   GRN_API_RETURN(ctx->rc);
 }
@@ -856,6 +1336,7 @@ grn_expr_append_obj(grn_ctx *ctx, grn_obj *expr, grn_obj *obj, grn_operator op,
   grn_obj *res = NULL;
   grn_expr *e = (grn_expr *)expr;
   GRN_API_ENTER;
+  grn_expr_closures_clear(ctx, e);
   if (e->codes_curr >= e->codes_size) {
     ERR(GRN_NO_MEMORY_AVAILABLE, "stack is full");
     goto exit;
@@ -3379,6 +3860,7 @@ grn_expr_exec(grn_ctx *ctx, grn_obj *expr, int nargs)
               results.limit = 0;
               results.flags = 0;
               results.op = GRN_OP_OR;
+              results.calc_target = NULL;
               WITH_SPSAVE({
                 grn_table_group(ctx, table, keys, n_keys, &results, 1);
               });
@@ -4669,95 +5151,1341 @@ exec_result_to_score(grn_ctx *ctx, grn_obj *result, grn_obj *score_buffer)
   }
 }
 
-static void
-grn_table_select_(grn_ctx *ctx, grn_obj *table, grn_obj *expr, grn_obj *v,
-                  grn_obj *res, grn_operator op)
+#define SCAN_BATCH_SIZE 1024
+#define SCAN_BATCH_MAX_N_CODES 64
+#define SCAN_BATCH_MAX_DEPTH 8
+
+/*
+ * A batch evaluates an expression for SCAN_BATCH_SIZE records at once. Each
+ * slot of the stack holds the values of all records, so that the operators
+ * become simple loops over arrays. Integers are held as int64_t and they are
+ * truncated to the type of the left operand after each arithmetic operation
+ * as grn_expr_exec() does.
+ */
+typedef union {
+  int64_t i[SCAN_BATCH_SIZE];
+  double f[SCAN_BATCH_SIZE];
+} scan_batch_slot;
+
+typedef struct {
+  grn_operator op;
+  int slot;
+  grn_id domain;
+  grn_bool is_float;
+  grn_bool y_is_float;
+  grn_bool is_unsigned;
+  grn_ra *ra;
+  int64_t int_value;
+  double float_value;
+} scan_batch_code;
+
+typedef struct {
+  scan_batch_code codes[SCAN_BATCH_MAX_N_CODES];
+  int n_codes;
+  int n_slots;
+  int n_columns;
+} scan_batch;
+
+typedef struct {
+  grn_id domain;
+  grn_bool is_float;
+  grn_bool is_boolean;
+  grn_bool is_const;
+  int64_t int_value;
+} scan_batch_operand;
+
+/*
+ * The zones of the table that no record can match. A zone is
+ * 2^GRN_RA_ZONE_WIDTH consecutive IDs and the zone maps of the columns
+ * prove that a condition is false for all records of a zone.
+ */
+typedef struct {
+  uint8_t *skips;
+  uint32_t n_zones;
+} scan_zones;
+
+#define SCAN_MAX_N_WORKERS 64
+#define SCAN_MIN_N_RECORDS_PER_WORKER 128
+
+typedef struct {
+  grn_ctx ctx;
+  grn_thread thread;
+  grn_obj *table;
+  grn_obj *expr;
+  scan_zones *zones;
+  scan_batch *batch;
+  grn_expr_closure *closure;
+  const grn_id *rids;
+  grn_id start;
+  grn_id end;
+  int32_t *scores;
+} scan_worker;
+
+/*
+ * Returns whether an expression can be evaluated by other threads at the
+ * same time. The values of the codes are shared by the copies, so the
+ * expression must not call procedures, run nested expressions or change
+ * anything.
+ */
+static grn_bool
+scan_expr_is_shareable(grn_ctx *ctx, grn_obj *expr)
 {
-  int32_t score;
-  grn_id id, *idp;
-  grn_table_cursor *tc;
-  grn_hash_cursor *hc;
-  grn_hash *s = (grn_hash *)res;
-  grn_obj *r;
-  grn_obj score_buffer;
-  GRN_RECORD_INIT(v, 0, grn_obj_id(ctx, table));
-  GRN_INT32_INIT(&score_buffer, 0);
-  switch (op) {
-  case GRN_OP_OR :
-    if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
-      while ((id = grn_table_cursor_next(ctx, tc))) {
-        GRN_RECORD_SET(ctx, v, id);
-        r = grn_expr_exec(ctx, expr, 0);
-        score = exec_result_to_score(ctx, r, &score_buffer);
-        if (score > 0) {
-          grn_rset_recinfo *ri;
-          if (grn_hash_add(ctx, s, &id, s->key_size, (void **)&ri, NULL)) {
-            grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)&id, 1);
-          }
-        }
-      }
-      grn_table_cursor_close(ctx, tc);
-    }
-    break;
-  case GRN_OP_AND :
-    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
-      while (grn_hash_cursor_next(ctx, hc)) {
-        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
-        GRN_RECORD_SET(ctx, v, *idp);
-        r = grn_expr_exec(ctx, expr, 0);
-        score = exec_result_to_score(ctx, r, &score_buffer);
-        if (score > 0) {
-          grn_rset_recinfo *ri;
-          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
-          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
-        } else {
-          grn_hash_cursor_delete(ctx, hc, NULL);
-        }
-      }
-      grn_hash_cursor_close(ctx, hc);
-    }
-    break;
-  case GRN_OP_AND_NOT :
-    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
-      while (grn_hash_cursor_next(ctx, hc)) {
-        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
-        GRN_RECORD_SET(ctx, v, *idp);
-        r = grn_expr_exec(ctx, expr, 0);
-        score = exec_result_to_score(ctx, r, &score_buffer);
-        if (score > 0) {
-          grn_hash_cursor_delete(ctx, hc, NULL);
-        }
+  grn_expr *e = (grn_expr *)expr;
+  grn_expr_code *code, *code_end = e->codes + e->codes_curr;
+  for (code = e->codes; code < code_end; code++) {
+    switch (code->op) {
+    case GRN_OP_CALL :
+    case GRN_OP_INTERN :
+    case GRN_OP_GET_REF :
+    case GRN_OP_DELETE :
+    case GRN_OP_INCR :
+    case GRN_OP_DECR :
+    case GRN_OP_INCR_POST :
+    case GRN_OP_DECR_POST :
+    case GRN_OP_OBJ_SEARCH :
+    case GRN_OP_EXPR_GET_VAR :
+    case GRN_OP_TABLE_CREATE :
+    case GRN_OP_TABLE_SELECT :
+    case GRN_OP_TABLE_SORT :
+    case GRN_OP_TABLE_GROUP :
+    case GRN_OP_JSON_PUT :
+      return GRN_FALSE;
+    default :
+      if (GRN_OP_ASSIGN <= code->op && code->op <= GRN_OP_OR_ASSIGN) {
+        return GRN_FALSE;
       }
-      grn_hash_cursor_close(ctx, hc);
+      break;
     }
-    break;
-  case GRN_OP_ADJUST :
-    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
-      while (grn_hash_cursor_next(ctx, hc)) {
-        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
-        GRN_RECORD_SET(ctx, v, *idp);
-        r = grn_expr_exec(ctx, expr, 0);
-        score = exec_result_to_score(ctx, r, &score_buffer);
-        if (score > 0) {
-          grn_rset_recinfo *ri;
-          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
-          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
-        }
+    if (code->value) {
+      switch (code->value->header.type) {
+      case GRN_PROC :
+      case GRN_EXPR :
+      case GRN_SNIP :
+      case GRN_QUERY :
+      case GRN_CURSOR_TABLE_HASH_KEY :
+      case GRN_CURSOR_TABLE_PAT_KEY :
+      case GRN_CURSOR_TABLE_DAT_KEY :
+      case GRN_CURSOR_TABLE_NO_KEY :
+      case GRN_CURSOR_COLUMN_INDEX :
+      case GRN_CURSOR_COLUMN_GEO_INDEX :
+        return GRN_FALSE;
+      default :
+        break;
       }
-      grn_hash_cursor_close(ctx, hc);
     }
-    break;
-  default :
-    break;
   }
-  GRN_OBJ_FIN(ctx, &score_buffer);
+  return GRN_TRUE;
 }
 
-static inline grn_bool
-grn_table_select_index_range_column(grn_ctx *ctx, grn_obj *table,
-                                    grn_obj *index,
-                                    scan_info *si, grn_operator logical_op,
-                                    grn_obj *res)
+/*
+ * Copies an expression into the context of a worker. The variables are
+ * copied and the other values are shared with the original.
+ */
+static grn_obj *
+scan_expr_clone(grn_ctx *ctx, grn_obj *expr, grn_ctx *worker_ctx)
+{
+  grn_expr *e = (grn_expr *)expr, *clone;
+  grn_hash *vars;
+  unsigned int i, j, nvars;
+  grn_obj *clone_expr = grn_expr_create(worker_ctx, NULL, 0);
+  if (!clone_expr) { return NULL; }
+  clone = (grn_expr *)clone_expr;
+  vars = grn_expr_get_vars(ctx, expr, &nvars);
+  for (i = 0; i < nvars; i++) {
+    char name[GRN_TABLE_MAX_KEY_SIZE];
+    int name_size;
+    grn_obj *var, *clone_var;
+    name_size = grn_hash_get_key(ctx, vars, i + 1, name, GRN_TABLE_MAX_KEY_SIZE);
+    var = grn_expr_get_var_by_offset(ctx, expr, i);
+    clone_var = grn_expr_add_var(worker_ctx, clone_expr, name, name_size);
+    if (!var || !clone_var) { break; }
+    if (var->header.type != GRN_BULK && var->header.type != GRN_VOID) { break; }
+    if (var->header.type == GRN_BULK) {
+      GRN_OBJ_FIN(worker_ctx, clone_var);
+      GRN_OBJ_INIT(clone_var, GRN_BULK, 0, var->header.domain);
+      grn_bulk_write(worker_ctx, clone_var,
+                     GRN_BULK_HEAD(var), GRN_BULK_VSIZE(var));
+    }
+  }
+  if (i < nvars || e->codes_curr > clone->codes_size) {
+    grn_obj_close(worker_ctx, clone_expr);
+    return NULL;
+  }
+  memcpy(clone->codes, e->codes, sizeof(grn_expr_code) * e->codes_curr);
+  clone->codes_curr = e->codes_curr;
+  for (j = 0; j < clone->codes_curr; j++) {
+    grn_expr_code *code = &clone->codes[j];
+    if (!code->value) { continue; }
+    for (i = 0; i < nvars; i++) {
+      if (code->value == grn_expr_get_var_by_offset(ctx, expr, i)) {
+        code->value = grn_expr_get_var_by_offset(worker_ctx, clone_expr, i);
+        break;
+      }
+    }
+  }
+  return clone_expr;
+}
+
+static int
+scan_batch_domain_size(grn_id domain)
+{
+  switch (domain) {
+  case GRN_DB_INT8 :
+  case GRN_DB_UINT8 :
+    return 1;
+  case GRN_DB_INT16 :
+  case GRN_DB_UINT16 :
+    return 2;
+  case GRN_DB_INT32 :
+  case GRN_DB_UINT32 :
+    return 4;
+  case GRN_DB_INT64 :
+  case GRN_DB_FLOAT :
+    return 8;
+  default :
+    /* UInt64 and Time aren't supported because they aren't compared nor
+       computed as int64_t by grn_expr_exec(). */
+    return 0;
+  }
+}
+
+/*
+ * Compiles an expression into a batch. Returns NULL if the expression
+ * isn't comparisons, arithmetic operations and logical operations over
+ * fixed size numeric columns of the table and constants, or if its result
+ * isn't a boolean.
+ */
+static scan_batch *
+scan_batch_open(grn_ctx *ctx, grn_obj *table, grn_obj *expr)
+{
+  grn_expr *e = (grn_expr *)expr;
+  grn_expr_code *code, *code_end = e->codes + e->codes_curr;
+  grn_obj *v = grn_expr_get_var_by_offset(ctx, expr, 0);
+  grn_id table_id = grn_obj_id(ctx, table);
+  scan_batch_operand stack[SCAN_BATCH_MAX_DEPTH], *x, *y;
+  scan_batch *batch;
+  int sp = 0;
+  if (e->codes_curr > SCAN_BATCH_MAX_N_CODES) { return NULL; }
+  if (!(batch = GRN_CALLOC(sizeof(scan_batch)))) {
+    ERRCLR(ctx);
+    return NULL;
+  }
+  for (code = e->codes; code < code_end; code++) {
+    scan_batch_code *bc = &batch->codes[batch->n_codes++];
+    grn_obj *value = code->value;
+    bc->op = code->op;
+    switch (code->op) {
+    case GRN_OP_PUSH :
+      if (!value || value == v || value->header.type != GRN_BULK ||
+          !scan_batch_domain_size(value->header.domain) ||
+          GRN_BULK_VSIZE(value) != scan_batch_domain_size(value->header.domain) ||
+          sp == SCAN_BATCH_MAX_DEPTH) {
+        goto exit;
+      }
+      x = &stack[sp];
+      x->domain = value->header.domain;
+      x->is_float = (x->domain == GRN_DB_FLOAT);
+      x->is_boolean = GRN_FALSE;
+      x->is_const = GRN_TRUE;
+      switch (x->domain) {
+      case GRN_DB_INT8 :
+        x->int_value = GRN_INT8_VALUE(value);
+        break;
+      case GRN_DB_UINT8 :
+        x->int_value = GRN_UINT8_VALUE(value);
+        break;
+      case GRN_DB_INT16 :
+        x->int_value = GRN_INT16_VALUE(value);
+        break;
+      case GRN_DB_UINT16 :
+        x->int_value = GRN_UINT16_VALUE(value);
+        break;
+      case GRN_DB_INT32 :
+        x->int_value = GRN_INT32_VALUE(value);
+        break;
+      case GRN_DB_UINT32 :
+        x->int_value = GRN_UINT32_VALUE(value);
+        break;
+      case GRN_DB_INT64 :
+        x->int_value = GRN_INT64_VALUE(value);
+        break;
+      case GRN_DB_FLOAT :
+        bc->float_value = GRN_FLOAT_VALUE(value);
+        break;
+      }
+      bc->domain = x->domain;
+      bc->int_value = x->int_value;
+      bc->slot = sp++;
+      break;
+    case GRN_OP_GET_VALUE :
+      if (code->nargs != 1 || !value ||
+          value->header.type != GRN_COLUMN_FIX_SIZE ||
+          value->header.domain != table_id ||
+          sp == SCAN_BATCH_MAX_DEPTH) {
+        goto exit;
+      }
+      x = &stack[sp];
+      x->domain = DB_OBJ(value)->range;
+      if (!scan_batch_domain_size(x->domain) ||
+          ((grn_ra *)value)->header->element_size !=
+          scan_batch_domain_size(x->domain)) {
+        goto exit;
+      }
+      x->is_float = (x->domain == GRN_DB_FLOAT);
+      x->is_boolean = GRN_FALSE;
+      x->is_const = GRN_FALSE;
+      bc->domain = x->domain;
+      bc->ra = (grn_ra *)value;
+      bc->slot = sp++;
+      batch->n_columns++;
+      break;
+    case GRN_OP_EQUAL :
+    case GRN_OP_NOT_EQUAL :
+    case GRN_OP_LESS :
+    case GRN_OP_GREATER :
+    case GRN_OP_LESS_EQUAL :
+    case GRN_OP_GREATER_EQUAL :
+    case GRN_OP_PLUS :
+    case GRN_OP_MINUS :
+    case GRN_OP_STAR :
+    case GRN_OP_SLASH :
+    case GRN_OP_MOD :
+    case GRN_OP_AND :
+    case GRN_OP_OR :
+      if (code->nargs != 2 || sp < 2) { goto exit; }
+      x = &stack[sp - 2];
+      y = &stack[sp - 1];
+      bc->slot = sp - 2;
+      bc->domain = x->domain;
+      bc->is_float = x->is_float;
+      bc->y_is_float = y->is_float;
+      /* Integers are compared as unsigned int with an UInt32 by C's usual
+         arithmetic conversions unless the other is an Int64. */
+      bc->is_unsigned = (!x->is_float && !y->is_float &&
+                         (x->domain == GRN_DB_UINT32 ||
+                          y->domain == GRN_DB_UINT32) &&
+                         x->domain != GRN_DB_INT64 &&
+                         y->domain != GRN_DB_INT64);
+      switch (code->op) {
+      case GRN_OP_EQUAL :
+      case GRN_OP_NOT_EQUAL :
+        /* DO_EQ() doesn't match a Float with a small integer. */
+        if (x->is_float && y->domain != GRN_DB_INT32 &&
+            y->domain != GRN_DB_UINT32 && y->domain != GRN_DB_INT64 &&
+            y->domain != GRN_DB_FLOAT) {
+          goto exit;
+        }
+        x->domain = GRN_DB_INT32;
+        x->is_float = GRN_FALSE;
+        x->is_boolean = GRN_TRUE;
+        break;
+      case GRN_OP_PLUS :
+      case GRN_OP_MINUS :
+      case GRN_OP_STAR :
+        /* The type of the result of an operation with a Float depends on
+           whether the operands are temporary values in grn_expr_exec(). */
+        if (x->is_float || y->is_float) { goto exit; }
+        x->is_boolean = GRN_FALSE;
+        break;
+      case GRN_OP_SLASH :
+      case GRN_OP_MOD :
+        /* Only a non-zero constant divisor is supported so that there is
+           no zero division error. An UInt32 dividend with a signed divisor
+           is computed by the signed operation on unsigned int. */
+        if (x->is_float || y->is_float || !y->is_const || !y->int_value ||
+            (x->domain == GRN_DB_UINT32 && y->domain != GRN_DB_UINT32)) {
+          goto exit;
+        }
+        bc->int_value = y->int_value;
+        x->is_boolean = GRN_FALSE;
+        break;
+      case GRN_OP_AND :
+      case GRN_OP_OR :
+        if (!x->is_boolean || !y->is_boolean) { goto exit; }
+        break;
+      default :
+        x->domain = GRN_DB_INT32;
+        x->is_float = GRN_FALSE;
+        x->is_boolean = GRN_TRUE;
+        break;
+      }
+      x->is_const = GRN_FALSE;
+      sp--;
+      break;
+    case GRN_OP_NOT :
+      if (code->nargs != 1 || sp < 1 || !stack[sp - 1].is_boolean) {
+        goto exit;
+      }
+      bc->slot = sp - 1;
+      break;
+    default :
+      goto exit;
+    }
+  }
+  if (sp != 1 || !stack[0].is_boolean) { goto exit; }
+  for (code = e->codes, sp = 0; code < code_end; code++) {
+    if (batch->codes[code - e->codes].slot + 1 > sp) {
+      sp = batch->codes[code - e->codes].slot + 1;
+    }
+  }
+  batch->n_slots = sp;
+  return batch;
+exit :
+  GRN_FREE(batch);
+  return NULL;
+}
+
+static void
+scan_batch_close(grn_ctx *ctx, scan_batch *batch)
+{
+  GRN_FREE(batch);
+}
+
+#define SCAN_BATCH_LOAD(type, member) do {\
+  for (j = 0; j < n; j++) {\
+    void *p;\
+    if (!rids[j]) {\
+      x->member[j] = 0;\
+      continue;\
+    }\
+    if (!(p = grn_ra_ref_cache(ctx, bc->ra, rids[j], cache))) {\
+      return GRN_FALSE;\
+    }\
+    x->member[j] = *((type *)p);\
+  }\
+} while (0)
+
+static grn_bool
+scan_batch_load(grn_ctx *ctx, scan_batch_code *bc, grn_ra_cache *cache,
+                const grn_id *rids, int n, scan_batch_slot *x)
+{
+  int j;
+  switch (bc->domain) {
+  case GRN_DB_INT8 :
+    SCAN_BATCH_LOAD(int8_t, i);
+    break;
+  case GRN_DB_UINT8 :
+    SCAN_BATCH_LOAD(uint8_t, i);
+    break;
+  case GRN_DB_INT16 :
+    SCAN_BATCH_LOAD(int16_t, i);
+    break;
+  case GRN_DB_UINT16 :
+    SCAN_BATCH_LOAD(uint16_t, i);
+    break;
+  case GRN_DB_INT32 :
+    SCAN_BATCH_LOAD(int32_t, i);
+    break;
+  case GRN_DB_UINT32 :
+    SCAN_BATCH_LOAD(uint32_t, i);
+    break;
+  case GRN_DB_INT64 :
+    SCAN_BATCH_LOAD(int64_t, i);
+    break;
+  case GRN_DB_FLOAT :
+    SCAN_BATCH_LOAD(double, f);
+    break;
+  }
+  return GRN_TRUE;
+}
+
+#define SCAN_BATCH_CAST(type) do {\
+  for (j = 0; j < n; j++) { x->i[j] = (type)x->i[j]; }\
+} while (0)
+
+/* Truncates the results of an operation to the type of its left operand. */
+static void
+scan_batch_cast(scan_batch_slot *x, grn_id domain, int n)
+{
+  int j;
+  switch (domain) {
+  case GRN_DB_INT8 :
+    SCAN_BATCH_CAST(int8_t);
+    break;
+  case GRN_DB_UINT8 :
+    SCAN_BATCH_CAST(uint8_t);
+    break;
+  case GRN_DB_INT16 :
+    SCAN_BATCH_CAST(int16_t);
+    break;
+  case GRN_DB_UINT16 :
+    SCAN_BATCH_CAST(uint16_t);
+    break;
+  case GRN_DB_INT32 :
+    SCAN_BATCH_CAST(int32_t);
+    break;
+  case GRN_DB_UINT32 :
+    SCAN_BATCH_CAST(uint32_t);
+    break;
+  }
+}
+
+#define SCAN_BATCH_COMPARE(op) do {\
+  if (bc->is_float) {\
+    if (bc->y_is_float) {\
+      for (j = 0; j < n; j++) { x->i[j] = (x->f[j] op y->f[j]); }\
+    } else {\
+      for (j = 0; j < n; j++) { x->i[j] = (x->f[j] op (double)y->i[j]); }\
+    }\
+  } else {\
+    if (bc->y_is_float) {\
+      for (j = 0; j < n; j++) { x->i[j] = ((double)x->i[j] op y->f[j]); }\
+    } else if (bc->is_unsigned) {\
+      for (j = 0; j < n; j++) {\
+        x->i[j] = ((uint32_t)x->i[j] op (uint32_t)y->i[j]);\
+      }\
+    } else {\
+      for (j = 0; j < n; j++) { x->i[j] = (x->i[j] op y->i[j]); }\
+    }\
+  }\
+} while (0)
+
+/* Floating point numbers are compared by <= and >= as DO_EQ() does. */
+#define SCAN_BATCH_EQUAL(eq) do {\
+  if (bc->is_float) {\
+    if (bc->y_is_float) {\
+      for (j = 0; j < n; j++) {\
+        x->i[j] = ((x->f[j] <= y->f[j] && x->f[j] >= y->f[j]) == eq);\
+      }\
+    } else {\
+      for (j = 0; j < n; j++) {\
+        double y_ = (double)y->i[j];\
+        x->i[j] = ((x->f[j] <= y_ && x->f[j] >= y_) == eq);\
+      }\
+    }\
+  } else {\
+    if (bc->y_is_float) {\
+      for (j = 0; j < n; j++) {\
+        double x_ = (double)x->i[j];\
+        x->i[j] = ((x_ <= y->f[j] && x_ >= y->f[j]) == eq);\
+      }\
+    } else if (bc->is_unsigned) {\
+      for (j = 0; j < n; j++) {\
+        x->i[j] = (((uint32_t)x->i[j] == (uint32_t)y->i[j]) == eq);\
+      }\
+    } else {\
+      for (j = 0; j < n; j++) { x->i[j] = ((x->i[j] == y->i[j]) == eq); }\
+    }\
+  }\
+} while (0)
+
+#define SCAN_BATCH_ARITHMETIC(op) do {\
+  for (j = 0; j < n; j++) {\
+    x->i[j] = (int64_t)((uint64_t)x->i[j] op (uint64_t)y->i[j]);\
+  }\
+  scan_batch_cast(x, bc->domain, n);\
+} while (0)
+
+/*
+ * Evaluates n records and stores their scores. Returns GRN_FALSE if a
+ * column value can't be referred. The records must be evaluated by
+ * grn_expr_exec() in the case.
+ */
+static grn_bool
+scan_batch_exec(grn_ctx *ctx, scan_batch *batch, scan_batch_slot *slots,
+                grn_ra_cache *caches, const grn_id *rids, int n,
+                int32_t *scores)
+{
+  int i, j, n_columns = 0;
+  for (i = 0; i < batch->n_codes; i++) {
+    scan_batch_code *bc = &batch->codes[i];
+    scan_batch_slot *x = &slots[bc->slot], *y = &slots[bc->slot + 1];
+    switch (bc->op) {
+    case GRN_OP_PUSH :
+      if (bc->domain == GRN_DB_FLOAT) {
+        for (j = 0; j < n; j++) { x->f[j] = bc->float_value; }
+      } else {
+        for (j = 0; j < n; j++) { x->i[j] = bc->int_value; }
+      }
+      break;
+    case GRN_OP_GET_VALUE :
+      if (!scan_batch_load(ctx, bc, &caches[n_columns++], rids, n, x)) {
+        return GRN_FALSE;
+      }
+      break;
+    case GRN_OP_EQUAL :
+      SCAN_BATCH_EQUAL(1);
+      break;
+    case GRN_OP_NOT_EQUAL :
+      SCAN_BATCH_EQUAL(0);
+      break;
+    case GRN_OP_LESS :
+      SCAN_BATCH_COMPARE(<);
+      break;
+    case GRN_OP_GREATER :
+      SCAN_BATCH_COMPARE(>);
+      break;
+    case GRN_OP_LESS_EQUAL :
+      SCAN_BATCH_COMPARE(<=);
+      break;
+    case GRN_OP_GREATER_EQUAL :
+      SCAN_BATCH_COMPARE(>=);
+      break;
+    case GRN_OP_PLUS :
+      SCAN_BATCH_ARITHMETIC(+);
+      break;
+    case GRN_OP_MINUS :
+      SCAN_BATCH_ARITHMETIC(-);
+      break;
+    case GRN_OP_STAR :
+      SCAN_BATCH_ARITHMETIC(*);
+      break;
+    case GRN_OP_SLASH :
+      if (bc->is_unsigned) {
+        for (j = 0; j < n; j++) {
+          x->i[j] = (uint32_t)x->i[j] / (uint32_t)bc->int_value;
+        }
+      } else if (bc->int_value == -1) {
+        for (j = 0; j < n; j++) { x->i[j] = (int64_t)(0 - (uint64_t)x->i[j]); }
+      } else {
+        for (j = 0; j < n; j++) { x->i[j] = x->i[j] / bc->int_value; }
+      }
+      scan_batch_cast(x, bc->domain, n);
+      break;
+    case GRN_OP_MOD :
+      if (bc->is_unsigned) {
+        for (j = 0; j < n; j++) {
+          x->i[j] = (uint32_t)x->i[j] % (uint32_t)bc->int_value;
+        }
+      } else if (bc->int_value == -1) {
+        for (j = 0; j < n; j++) { x->i[j] = 0; }
+      } else {
+        for (j = 0; j < n; j++) { x->i[j] = x->i[j] % bc->int_value; }
+      }
+      scan_batch_cast(x, bc->domain, n);
+      break;
+    case GRN_OP_AND :
+      for (j = 0; j < n; j++) { x->i[j] = (x->i[j] != 0) & (y->i[j] != 0); }
+      break;
+    case GRN_OP_OR :
+      for (j = 0; j < n; j++) { x->i[j] = (x->i[j] != 0) | (y->i[j] != 0); }
+      break;
+    case GRN_OP_NOT :
+      for (j = 0; j < n; j++) { x->i[j] = (x->i[j] == 0); }
+      break;
+    default :
+      return GRN_FALSE;
+    }
+  }
+  for (j = 0; j < n; j++) {
+    scores[j] = rids[j] ? (int32_t)slots[0].i[j] : 0;
+  }
+  return GRN_TRUE;
+}
+
+static grn_id
+scan_max_id(grn_ctx *ctx, grn_obj *table)
+{
+  grn_id max_id = GRN_ID_NIL;
+  grn_table_cursor *tc;
+  if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, 1,
+                                  GRN_CURSOR_BY_ID|GRN_CURSOR_DESCENDING))) {
+    max_id = grn_table_cursor_next(ctx, tc);
+    grn_table_cursor_close(ctx, tc);
+  }
+  return max_id;
+}
+
+#define SCAN_ZONES_MAX_N_CODES 32
+#define SCAN_ZONES_MAX_DEPTH 8
+
+/*
+ * A term of an expression that can be checked by zone maps, a logical
+ * operator over the terms or GRN_OP_NOP for an unknown value. A term is a
+ * comparison of a fixed size numeric column of the table with a numeric
+ * constant.
+ */
+typedef struct {
+  grn_operator op;
+  grn_obj *column;
+  grn_obj *value;
+  grn_bool is_unsigned;
+  grn_ra_zone *zones;
+  uint32_t n_zones;
+} scan_zones_code;
+
+typedef struct {
+  grn_obj *value;
+  int start;
+} scan_zones_operand;
+
+/*
+ * Returns whether DO_COMPARE() converts a signed value of the column to
+ * unsigned to compare it with a constant of the domain.
+ */
+static grn_bool
+scan_zones_is_unsigned_comparison(grn_id range, grn_id domain)
+{
+  switch (range) {
+  case GRN_DB_INT8 :
+  case GRN_DB_INT16 :
+  case GRN_DB_INT32 :
+    return domain == GRN_DB_UINT32 || domain == GRN_DB_UINT64;
+  case GRN_DB_INT64 :
+  case GRN_DB_TIME :
+    return domain == GRN_DB_UINT64;
+  default :
+    return GRN_FALSE;
+  }
+}
+
+static grn_bool
+scan_zones_is_constant(grn_obj *value)
+{
+  unsigned int size;
+  switch (value->header.domain) {
+  case GRN_DB_INT8 :
+  case GRN_DB_UINT8 :
+    size = 1;
+    break;
+  case GRN_DB_INT16 :
+  case GRN_DB_UINT16 :
+    size = 2;
+    break;
+  case GRN_DB_INT32 :
+  case GRN_DB_UINT32 :
+    size = 4;
+    break;
+  case GRN_DB_INT64 :
+  case GRN_DB_UINT64 :
+  case GRN_DB_FLOAT :
+  case GRN_DB_TIME :
+    size = 8;
+    break;
+  default :
+    return GRN_FALSE;
+  }
+  return value->header.type == GRN_BULK && GRN_BULK_VSIZE(value) == size;
+}
+
+static void
+scan_zones_value_set(grn_ctx *ctx, grn_obj *x, const grn_ra_zone_value *value)
+{
+  switch (x->header.domain) {
+  case GRN_DB_INT8 :
+    GRN_INT8_SET(ctx, x, value->i);
+    break;
+  case GRN_DB_UINT8 :
+    GRN_UINT8_SET(ctx, x, value->u);
+    break;
+  case GRN_DB_INT16 :
+    GRN_INT16_SET(ctx, x, value->i);
+    break;
+  case GRN_DB_UINT16 :
+    GRN_UINT16_SET(ctx, x, value->u);
+    break;
+  case GRN_DB_INT32 :
+    GRN_INT32_SET(ctx, x, value->i);
+    break;
+  case GRN_DB_UINT32 :
+    GRN_UINT32_SET(ctx, x, value->u);
+    break;
+  case GRN_DB_INT64 :
+  case GRN_DB_TIME :
+    GRN_INT64_SET(ctx, x, value->i);
+    break;
+  case GRN_DB_UINT64 :
+    GRN_UINT64_SET(ctx, x, value->u);
+    break;
+  case GRN_DB_FLOAT :
+    GRN_FLOAT_SET(ctx, x, value->f);
+    break;
+  }
+}
+
+/*
+ * Returns whether a record of the zone may match the term. The comparison
+ * is done by DO_COMPARE() as grn_expr_exec() does. It is monotonic in the
+ * value of the column, so only the minimum or the maximum is compared. It
+ * isn't monotonic over negative and non-negative values if they are
+ * converted to unsigned.
+ */
+static grn_bool
+scan_zones_may_match(grn_ctx *ctx, scan_zones_code *zc, uint32_t zone,
+                     grn_obj *x)
+{
+  grn_obj *y = zc->value;
+  grn_bool r = GRN_TRUE;
+  if (zc->is_unsigned &&
+      zc->zones[zone].min.i < 0 && zc->zones[zone].max.i >= 0) {
+    return GRN_TRUE;
+  }
+  switch (zc->op) {
+  case GRN_OP_LESS :
+    scan_zones_value_set(ctx, x, &zc->zones[zone].min);
+    DO_COMPARE(x, y, r, <);
+    break;
+  case GRN_OP_LESS_EQUAL :
+    scan_zones_value_set(ctx, x, &zc->zones[zone].min);
+    DO_COMPARE(x, y, r, <=);
+    break;
+  case GRN_OP_GREATER :
+    scan_zones_value_set(ctx, x, &zc->zones[zone].max);
+    DO_COMPARE(x, y, r, >);
+    break;
+  case GRN_OP_GREATER_EQUAL :
+    scan_zones_value_set(ctx, x, &zc->zones[zone].max);
+    DO_COMPARE(x, y, r, >=);
+    break;
+  default :
+    break;
+  }
+  return r;
+}
+
+static void
+scan_zones_close(grn_ctx *ctx, scan_zones *zones)
+{
+  GRN_FREE(zones->skips);
+  GRN_FREE(zones);
+}
+
+/*
+ * Finds the zones of the table that the zone maps prove no record of
+ * matches the expression. The expression is compiled into the codes in
+ * reverse Polish notation. An operand on the stack is a column or a
+ * constant, or the codes from start that compute it. Returns NULL if the
+ * expression may have side effects, if it has no comparison of a column
+ * with a constant or if no zone is found.
+ */
+static scan_zones *
+scan_zones_open(grn_ctx *ctx, grn_obj *table, grn_obj *expr)
+{
+  grn_expr *e = (grn_expr *)expr;
+  grn_expr_code *code, *code_end = e->codes + e->codes_curr;
+  grn_obj *v = grn_expr_get_var_by_offset(ctx, expr, 0);
+  grn_id table_id = grn_obj_id(ctx, table), max_id;
+  scan_zones_code codes[SCAN_ZONES_MAX_N_CODES];
+  scan_zones_operand stack[SCAN_ZONES_MAX_DEPTH], *x, *y;
+  scan_zones *zones = NULL;
+  uint32_t i, j, n_skips = 0;
+  int n_codes = 0, sp = 0, n_terms = 0;
+  for (code = e->codes; code < code_end; code++) {
+    grn_obj *value = code->value;
+    switch (code->op) {
+    case GRN_OP_PUSH :
+      if (!value || sp == SCAN_ZONES_MAX_DEPTH) { return NULL; }
+      stack[sp].value =
+        (value != v && scan_zones_is_constant(value)) ? value : NULL;
+      stack[sp++].start = -1;
+      continue;
+    case GRN_OP_GET_VALUE :
+      if (code->nargs != 1 || !value || sp == SCAN_ZONES_MAX_DEPTH) {
+        return NULL;
+      }
+      stack[sp].value = (value->header.type == GRN_COLUMN_FIX_SIZE &&
+                         value->header.domain == table_id) ? value : NULL;
+      stack[sp++].start = -1;
+      continue;
+    case GRN_OP_LESS :
+    case GRN_OP_GREATER :
+    case GRN_OP_LESS_EQUAL :
+    case GRN_OP_GREATER_EQUAL :
+      if (code->nargs != 2 || sp < 2) { return NULL; }
+      x = &stack[sp - 2];
+      y = &stack[sp - 1];
+      if (x->value && x->value->header.type == GRN_COLUMN_FIX_SIZE &&
+          y->value && y->value->header.type == GRN_BULK &&
+          n_codes < SCAN_ZONES_MAX_N_CODES) {
+        codes[n_codes].op = code->op;
+        codes[n_codes].column = x->value;
+        codes[n_codes].value = y->value;
+        codes[n_codes].is_unsigned =
+          scan_zones_is_unsigned_comparison(DB_OBJ(x->value)->range,
+                                            y->value->header.domain);
+        codes[n_codes].zones = NULL;
+        codes[n_codes].n_zones = 0;
+        x->value = NULL;
+        x->start = n_codes++;
+        sp--;
+        continue;
+      }
+      break;
+    case GRN_OP_AND :
+    case GRN_OP_OR :
+    case GRN_OP_AND_NOT :
+      if (code->nargs != 2 || sp < 2) { return NULL; }
+      x = &stack[sp - 2];
+      y = &stack[sp - 1];
+      if (x->start >= 0 && y->start >= 0 &&
+          n_codes < SCAN_ZONES_MAX_N_CODES) {
+        codes[n_codes].op = code->op;
+        codes[n_codes].zones = NULL;
+        n_codes++;
+        sp--;
+        continue;
+      }
+      break;
+    case GRN_OP_EQUAL :
+    case GRN_OP_NOT_EQUAL :
+    case GRN_OP_PLUS :
+    case GRN_OP_MINUS :
+    case GRN_OP_STAR :
+    case GRN_OP_BITWISE_OR :
+    case GRN_OP_BITWISE_XOR :
+    case GRN_OP_BITWISE_AND :
+    case GRN_OP_BITWISE_NOT :
+    case GRN_OP_SHIFTL :
+    case GRN_OP_SHIFTR :
+    case GRN_OP_SHIFTRR :
+    case GRN_OP_NOT :
+      break;
+    default :
+      return NULL;
+    }
+    /* The other operations don't change anything, so that they are
+       evaluated to unknown values without their operands. */
+    if (code->nargs < 1 || code->nargs > 2 || sp < code->nargs) {
+      return NULL;
+    }
+    sp -= code->nargs;
+    x = &stack[sp];
+    if (x->start < 0 && code->nargs == 2 && x[1].start >= 0) {
+      x->start = x[1].start;
+    }
+    if (x->start >= 0) {
+      n_codes = x->start;
+    } else if (n_codes == SCAN_ZONES_MAX_N_CODES) {
+      return NULL;
+    }
+    codes[n_codes].op = GRN_OP_NOP;
+    codes[n_codes].zones = NULL;
+    x->value = NULL;
+    x->start = n_codes++;
+    sp++;
+  }
+  if (sp != 1 || stack[0].start < 0) { return NULL; }
+  for (i = 0; i < n_codes; i++) {
+    switch (codes[i].op) {
+    case GRN_OP_LESS :
+    case GRN_OP_GREATER :
+    case GRN_OP_LESS_EQUAL :
+    case GRN_OP_GREATER_EQUAL :
+      n_terms++;
+      break;
+    default :
+      break;
+    }
+  }
+  if (!n_terms) { return NULL; }
+  if ((max_id = scan_max_id(ctx, table)) == GRN_ID_NIL) { return NULL; }
+  for (i = 0; i < n_codes; i++) {
+    switch (codes[i].op) {
+    case GRN_OP_LESS :
+    case GRN_OP_GREATER :
+    case GRN_OP_LESS_EQUAL :
+    case GRN_OP_GREATER_EQUAL :
+      codes[i].zones = grn_ra_zone_map_get(ctx, (grn_ra *)codes[i].column,
+                                           max_id, &codes[i].n_zones);
+      break;
+    default :
+      break;
+    }
+  }
+  if (!(zones = GRN_MALLOC(sizeof(scan_zones)))) { goto exit; }
+  zones->n_zones = (max_id >> GRN_RA_ZONE_WIDTH) + 1;
+  if (!(zones->skips = GRN_MALLOC(zones->n_zones))) {
+    GRN_FREE(zones);
+    zones = NULL;
+    goto exit;
+  }
+  for (j = 0; j < zones->n_zones; j++) {
+    grn_bool skips[SCAN_ZONES_MAX_DEPTH];
+    sp = 0;
+    for (i = 0; i < n_codes; i++) {
+      scan_zones_code *zc = &codes[i];
+      switch (zc->op) {
+      case GRN_OP_AND :
+        sp--;
+        skips[sp - 1] = skips[sp - 1] || skips[sp];
+        break;
+      case GRN_OP_OR :
+        sp--;
+        skips[sp - 1] = skips[sp - 1] && skips[sp];
+        break;
+      case GRN_OP_AND_NOT :
+        sp--;
+        break;
+      default :
+        if (zc->zones && j < zc->n_zones) {
+          grn_obj x;
+          GRN_VALUE_FIX_SIZE_INIT(&x, 0, DB_OBJ(zc->column)->range);
+          skips[sp++] = !scan_zones_may_match(ctx, zc, j, &x);
+          GRN_OBJ_FIN(ctx, &x);
+        } else {
+          skips[sp++] = GRN_FALSE;
+        }
+        break;
+      }
+    }
+    zones->skips[j] = skips[0];
+    if (skips[0]) { n_skips++; }
+  }
+  if (!n_skips) {
+    scan_zones_close(ctx, zones);
+    zones = NULL;
+  }
+exit :
+  for (i = 0; i < n_codes; i++) {
+    if (codes[i].zones) { GRN_FREE(codes[i].zones); }
+  }
+  if (!zones) { ERRCLR(ctx); }
+  return zones;
+}
+
+/*
+ * Returns the end of the run of positions from id whose records are in
+ * skipped zones if skipped is GRN_TRUE, or in the other zones if not.
+ * Positions without records belong to any run.
+ */
+static grn_id
+scan_zones_run_end(scan_zones *zones, const grn_id *rids,
+                   grn_id id, grn_id end, grn_bool skipped)
+{
+  for (; id < end; id++) {
+    grn_id rid = rids[id - 1], zone = rid >> GRN_RA_ZONE_WIDTH;
+    if (rid && (zone < zones->n_zones && zones->skips[zone]) != skipped) {
+      break;
+    }
+  }
+  return id;
+}
+
+/*
+ * Evaluates the records of [start, end) and stores their scores in
+ * scores[id - 1]. The IDs are positions in the table that is scanned and
+ * rids[id - 1] is the record to be evaluated, or GRN_ID_NIL if there is no
+ * record at the position. The records in the skipped zones aren't
+ * evaluated. The others are evaluated by the batch if it is given, and then
+ * by the closure if it is given.
+ */
+static void
+scan_range(grn_ctx *ctx, grn_obj *expr, scan_zones *zones, scan_batch *batch,
+           grn_expr_closure *closure, grn_obj *v,
+           const grn_id *rids, grn_id start, grn_id end, int32_t *scores)
+{
+  grn_id id;
+  grn_obj score_buffer;
+  scan_batch_slot *slots = NULL;
+  grn_ra_cache caches[SCAN_BATCH_MAX_N_CODES];
+  int i;
+  if (batch) {
+    if ((slots = GRN_MALLOC(sizeof(scan_batch_slot) * batch->n_slots))) {
+      for (i = 0; i < batch->n_columns; i++) {
+        GRN_RA_CACHE_INIT(NULL, &caches[i]);
+      }
+    } else {
+      ERRCLR(ctx);
+    }
+  }
+  GRN_INT32_INIT(&score_buffer, 0);
+  for (id = start; id < end && !ctx->rc;) {
+    grn_id block_end = end;
+    if (zones) {
+      grn_id skip_end = scan_zones_run_end(zones, rids, id, end, GRN_TRUE);
+      if (skip_end > id) {
+        for (; id < skip_end; id++) { scores[id - 1] = 0; }
+        continue;
+      }
+      block_end = scan_zones_run_end(zones, rids, id, end, GRN_FALSE);
+    }
+    if (slots) {
+      if (block_end - id > SCAN_BATCH_SIZE) { block_end = id + SCAN_BATCH_SIZE; }
+      if (scan_batch_exec(ctx, batch, slots, caches, rids + id - 1,
+                          block_end - id, scores + id - 1)) {
+        id = block_end;
+        continue;
+      }
+    }
+    for (; id < block_end && !ctx->rc; id++) {
+      grn_obj *r;
+      if (!rids[id - 1]) {
+        scores[id - 1] = 0;
+        continue;
+      }
+      if (closure) {
+        int r = closure->root->func(ctx, closure->root, rids[id - 1]);
+        if (r >= 0) {
+          scores[id - 1] = r;
+          continue;
+        }
+      }
+      GRN_RECORD_SET(ctx, v, rids[id - 1]);
+      r = grn_expr_exec(ctx, expr, 0);
+      scores[id - 1] = exec_result_to_score(ctx, r, &score_buffer);
+    }
+  }
+  GRN_OBJ_FIN(ctx, &score_buffer);
+  if (slots) {
+    int n_columns = 0;
+    for (i = 0; i < batch->n_codes; i++) {
+      if (batch->codes[i].op == GRN_OP_GET_VALUE) {
+        GRN_RA_CACHE_FIN(batch->codes[i].ra, &caches[n_columns]);
+        n_columns++;
+      }
+    }
+    GRN_FREE(slots);
+  }
+}
+
+static void * CALLBACK
+scan_worker_func(void *arg)
+{
+  scan_worker *worker = (scan_worker *)arg;
+  grn_ctx *ctx = &worker->ctx;
+  grn_obj *v = grn_expr_get_var_by_offset(ctx, worker->expr, 0);
+  GRN_RECORD_INIT(v, 0, grn_obj_id(ctx, worker->table));
+  scan_range(ctx, worker->expr, worker->zones, worker->batch,
+             worker->closure, v,
+             worker->rids,
+             worker->start, worker->end, worker->scores);
+  return NULL;
+}
+
+/*
+ * Evaluates an expression for all records of the table, or of res if it is
+ * given, by a batch, the closure of the expression and/or by
+ * ctx->impl->n_scan_workers threads. The records
+ * are listed by the calling thread first, so that the workers don't touch
+ * the tables. The ID space is split into contiguous ranges. The calling
+ * thread evaluates the first one and each worker evaluates another one with
+ * its own context and a copy of the expression. Returns the scores indexed
+ * by ID - 1, or NULL if the records should be evaluated one by one by the
+ * calling thread. The caller walks its cursor as usual and picks the scores
+ * up, so the result is the same as that of a sequential scan.
+ */
+static int32_t *
+scan_scores(grn_ctx *ctx, grn_obj *table, grn_hash *res, grn_obj *expr,
+            grn_obj *v, grn_id *n_scores)
+{
+  grn_id id, max_id, step, *rids;
+  int32_t *scores = NULL;
+  scan_worker *workers = NULL;
+  scan_zones *zones;
+  scan_batch *batch;
+  grn_expr_closure *closure;
+  grn_table_cursor *tc;
+  grn_obj *target = res ? (grn_obj *)res : table;
+  uint32_t i, n = 0, n_workers = ctx->impl->n_scan_workers;
+  zones = scan_zones_open(ctx, table, expr);
+  batch = scan_batch_open(ctx, table, expr);
+  closure = grn_expr_closure_get(ctx, expr, table);
+  if (n_workers > 1 && !batch && !closure &&
+      !scan_expr_is_shareable(ctx, expr)) {
+    n_workers = 1;
+  }
+  max_id = scan_max_id(ctx, target);
+  if (n_workers > max_id / SCAN_MIN_N_RECORDS_PER_WORKER) {
+    n_workers = max_id / SCAN_MIN_N_RECORDS_PER_WORKER;
+  }
+  if (n_workers > SCAN_MAX_N_WORKERS) { n_workers = SCAN_MAX_N_WORKERS; }
+  if (n_workers < 1) { n_workers = 1; }
+  if (max_id == GRN_ID_NIL ||
+      (n_workers == 1 && !zones && !batch && !closure)) {
+    if (zones) { scan_zones_close(ctx, zones); }
+    if (batch) { scan_batch_close(ctx, batch); }
+    return NULL;
+  }
+  if (!(rids = GRN_CALLOC(sizeof(grn_id) * max_id))) {
+    ERRCLR(ctx);
+    if (zones) { scan_zones_close(ctx, zones); }
+    if (batch) { scan_batch_close(ctx, batch); }
+    return NULL;
+  }
+  if ((tc = grn_table_cursor_open(ctx, target, NULL, 0, NULL, 0, 0, -1,
+                                  GRN_CURSOR_BY_ID))) {
+    while ((id = grn_table_cursor_next(ctx, tc)) && id <= max_id) {
+      if (res) {
+        grn_id *idp;
+        grn_table_cursor_get_key(ctx, tc, (void **)&idp);
+        rids[id - 1] = *idp;
+      } else {
+        rids[id - 1] = id;
+      }
+    }
+    grn_table_cursor_close(ctx, tc);
+  }
+  scores = GRN_MALLOCN(int32_t, max_id);
+  if (n_workers > 1) {
+    workers = GRN_CALLOC(sizeof(scan_worker) * (n_workers - 1));
+  }
+  if (!scores || (n_workers > 1 && !workers)) {
+    ERRCLR(ctx);
+    if (scores) { GRN_FREE(scores); }
+    if (workers) { GRN_FREE(workers); }
+    if (zones) { scan_zones_close(ctx, zones); }
+    if (batch) { scan_batch_close(ctx, batch); }
+    GRN_FREE(rids);
+    return NULL;
+  }
+  step = max_id / n_workers + 1;
+  for (; n + 1 < n_workers; n++) {
+    scan_worker *worker = &workers[n];
+    worker->start = GRN_ID_NIL + 1 + step * (n + 1);
+    if (worker->start > max_id) { break; }
+    worker->end = worker->start + step;
+    if (worker->end > max_id + 1) { worker->end = max_id + 1; }
+    worker->table = table;
+    worker->zones = zones;
+    worker->batch = batch;
+    worker->closure = closure;
+    worker->rids = rids;
+    worker->scores = scores;
+    grn_ctx_init(&worker->ctx, 0);
+    grn_ctx_use(&worker->ctx, grn_ctx_db(ctx));
+    if (!(worker->expr = scan_expr_clone(ctx, expr, &worker->ctx))) {
+      grn_ctx_fin(&worker->ctx);
+      break;
+    }
+    if (THREAD_CREATE(worker->thread, scan_worker_func, worker)) {
+      grn_obj_close(&worker->ctx, worker->expr);
+      grn_ctx_fin(&worker->ctx);
+      break;
+    }
+  }
+  if (n_workers == 1) {
+    scan_range(ctx, expr, zones, batch, closure, v, rids,
+               GRN_ID_NIL + 1, max_id + 1, scores);
+  } else {
+    scan_range(ctx, expr, zones, batch, closure, v, rids,
+               GRN_ID_NIL + 1, GRN_ID_NIL + 1 + step, scores);
+    /* The ranges that no worker has taken are evaluated here too. */
+    if (GRN_ID_NIL + 1 + step * (n + 1) <= max_id) {
+      scan_range(ctx, expr, zones, batch, closure, v, rids,
+                 GRN_ID_NIL + 1 + step * (n + 1), max_id + 1, scores);
+    }
+  }
+  for (i = 0; i < n; i++) {
+    scan_worker *worker = &workers[i];
+    THREAD_JOIN(worker->thread);
+    if (worker->ctx.rc && !ctx->rc) {
+      ERR(worker->ctx.rc, "[table][select] worker(%u) failed: %s",
+          i + 1, worker->ctx.errbuf);
+    }
+    grn_obj_close(&worker->ctx, worker->expr);
+    grn_ctx_fin(&worker->ctx);
+  }
+  if (workers) { GRN_FREE(workers); }
+  if (zones) { scan_zones_close(ctx, zones); }
+  if (batch) { scan_batch_close(ctx, batch); }
+  GRN_FREE(rids);
+  *n_scores = max_id;
+  return scores;
+}
+
+static void
+grn_table_select_(grn_ctx *ctx, grn_obj *table, grn_obj *expr, grn_obj *v,
+                  grn_obj *res, grn_operator op)
+{
+  int32_t score;
+  grn_id id, *idp;
+  grn_table_cursor *tc;
+  grn_hash_cursor *hc;
+  grn_hash *s = (grn_hash *)res;
+  grn_obj *r;
+  grn_obj score_buffer;
+  int32_t *scores = NULL;
+  grn_id n_scores = GRN_ID_NIL;
+  GRN_RECORD_INIT(v, 0, grn_obj_id(ctx, table));
+  GRN_INT32_INIT(&score_buffer, 0);
+  if (op == GRN_OP_OR) {
+    scores = scan_scores(ctx, table, NULL, expr, v, &n_scores);
+  } else if (op == GRN_OP_AND || op == GRN_OP_AND_NOT || op == GRN_OP_ADJUST) {
+    scores = scan_scores(ctx, table, s, expr, v, &n_scores);
+  }
+  switch (op) {
+  case GRN_OP_OR :
+    if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
+      while ((id = grn_table_cursor_next(ctx, tc))) {
+        if (id <= n_scores) {
+          score = scores[id - 1];
+        } else {
+          GRN_RECORD_SET(ctx, v, id);
+          r = grn_expr_exec(ctx, expr, 0);
+          score = exec_result_to_score(ctx, r, &score_buffer);
+        }
+        if (score > 0) {
+          grn_rset_recinfo *ri;
+          if (grn_hash_add(ctx, s, &id, s->key_size, (void **)&ri, NULL)) {
+            grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)&id, 1);
+          }
+        }
+      }
+      grn_table_cursor_close(ctx, tc);
+    }
+    break;
+  case GRN_OP_AND :
+    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
+      while ((id = grn_hash_cursor_next(ctx, hc))) {
+        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
+        if (id <= n_scores) {
+          score = scores[id - 1];
+        } else {
+          GRN_RECORD_SET(ctx, v, *idp);
+          r = grn_expr_exec(ctx, expr, 0);
+          score = exec_result_to_score(ctx, r, &score_buffer);
+        }
+        if (score > 0) {
+          grn_rset_recinfo *ri;
+          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
+          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
+        } else {
+          grn_hash_cursor_delete(ctx, hc, NULL);
+        }
+      }
+      grn_hash_cursor_close(ctx, hc);
+    }
+    break;
+  case GRN_OP_AND_NOT :
+    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
+      while ((id = grn_hash_cursor_next(ctx, hc))) {
+        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
+        if (id <= n_scores) {
+          score = scores[id - 1];
+        } else {
+          GRN_RECORD_SET(ctx, v, *idp);
+          r = grn_expr_exec(ctx, expr, 0);
+          score = exec_result_to_score(ctx, r, &score_buffer);
+        }
+        if (score > 0) {
+          grn_hash_cursor_delete(ctx, hc, NULL);
+        }
+      }
+      grn_hash_cursor_close(ctx, hc);
+    }
+    break;
+  case GRN_OP_ADJUST :
+    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
+      while ((id = grn_hash_cursor_next(ctx, hc))) {
+        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
+        if (id <= n_scores) {
+          score = scores[id - 1];
+        } else {
+          GRN_RECORD_SET(ctx, v, *idp);
+          r = grn_expr_exec(ctx, expr, 0);
+          score = exec_result_to_score(ctx, r, &score_buffer);
+        }
+        if (score > 0) {
+          grn_rset_recinfo *ri;
+          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
+          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
+        }
+      }
+      grn_hash_cursor_close(ctx, hc);
+    }
+    break;
+  default :
+    break;
+  }
+  if (scores) { GRN_FREE(scores); }
+  GRN_OBJ_FIN(ctx, &score_buffer);
+}
+
+static inline grn_bool
+grn_table_select_index_range_column(grn_ctx *ctx, grn_obj *table,
+                                    grn_obj *index,
+                                    scan_info *si, grn_operator logical_op,
+                                    grn_obj *res)
 {
   grn_bool processed = GRN_FALSE;
   grn_obj *index_table;
@@ -5242,6 +6970,62 @@ grn_table_select_index(grn_ctx *ctx, grn_obj *table, scan_info *si,
   return processed;
 }
 
+static grn_bool
+grn_table_select_top_k(grn_ctx *ctx, grn_obj *table, scan_info **sis, int n,
+                       grn_obj *res)
+{
+  int i;
+  grn_rc rc;
+  grn_obj *index = NULL;
+  int32_t weight = 0;
+  const char **strings;
+  unsigned int *string_lens;
+  grn_select_optarg optarg = {GRN_OP_EXACT, 0, 0, NULL, 0, NULL, NULL, 0};
+  for (i = 0; i < n; i++) {
+    scan_info *si = sis[i];
+    int32_t *wp;
+    if ((si->flags & (SCAN_PUSH|SCAN_POP)) || si->op != GRN_OP_MATCH ||
+        si->logical_op != GRN_OP_OR || !si->query ||
+        si->query->header.type != GRN_BULK ||
+        si->query->header.domain < GRN_DB_SHORT_TEXT ||
+        si->query->header.domain > GRN_DB_LONG_TEXT ||
+        GRN_BULK_VSIZE(&si->index) != sizeof(grn_obj *) ||
+        GRN_BULK_VSIZE(&si->wv) != sizeof(int32_t) * 2) {
+      return GRN_FALSE;
+    }
+    wp = &GRN_INT32_VALUE(&si->wv);
+    if (i == 0) {
+      index = GRN_PTR_VALUE(&si->index);
+      weight = wp[1];
+      if (index->header.type != GRN_COLUMN_INDEX || weight <= 0) {
+        return GRN_FALSE;
+      }
+    }
+    if (GRN_PTR_VALUE(&si->index) != index || wp[0] || wp[1] != weight) {
+      return GRN_FALSE;
+    }
+  }
+  if (!(strings = GRN_MALLOCN(const char *, n))) { return GRN_FALSE; }
+  if (!(string_lens = GRN_MALLOCN(unsigned int, n))) {
+    GRN_FREE(strings);
+    return GRN_FALSE;
+  }
+  for (i = 0; i < n; i++) {
+    strings[i] = GRN_TEXT_VALUE(sis[i]->query);
+    string_lens[i] = GRN_TEXT_LEN(sis[i]->query);
+  }
+  optarg.vector_size = weight;
+  rc = grn_ii_select_top_k(ctx, (grn_ii *)index, strings, string_lens, n,
+                           (grn_hash *)res, &optarg, ctx->impl->match_top_k);
+  GRN_FREE(strings);
+  GRN_FREE(string_lens);
+  if (rc == GRN_SUCCESS) {
+    GRN_QUERY_LOG(ctx, GRN_QUERY_LOG_SIZE,
+                  ":", "top-k(%d)", grn_table_size(ctx, res));
+  }
+  return rc == GRN_SUCCESS;
+}
+
 grn_obj *
 grn_table_select(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
                  grn_obj *res, grn_operator op)
@@ -5277,7 +7061,12 @@ grn_table_select(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
       grn_expr_code *codes = e->codes;
       uint32_t codes_curr = e->codes_curr;
       GRN_PTR_INIT(&res_stack, GRN_OBJ_VECTOR, GRN_ID_NIL);
-      for (i = 0; i < n; i++) {
+      i = 0;
+      if (ctx->impl->match_top_k > 0 && !res_size &&
+          grn_table_select_top_k(ctx, table, sis, n, res)) {
+        i = n;
+      }
+      for (; i < n; i++) {
         scan_info *si = sis[i];
         if (si->flags & SCAN_POP) {
           grn_obj *res_;
@@ -260,8 +260,21 @@ typedef pthread_mutex_t grn_critical_section;
 
 typedef pthread_cond_t grn_cond;
 #define COND_INIT(c)   pthread_cond_init(&c, NULL)
+#define COND_FIN(c)    pthread_cond_destroy(&c)
 #define COND_SIGNAL(c) pthread_cond_signal(&c)
 #define COND_WAIT(c,m) pthread_cond_wait(&c, &m)
+#define COND_TIMEDWAIT(c,m,msec) do { \
+  struct timeval now_; \
+  struct timespec timeout_; \
+  gettimeofday(&now_, NULL); \
+  timeout_.tv_sec = now_.tv_sec + (msec) / 1000; \
+  timeout_.tv_nsec = now_.tv_usec * 1000 + ((msec) % 1000) * 1000000; \
+  if (timeout_.tv_nsec >= 1000000000) { \
+    timeout_.tv_sec++; \
+    timeout_.tv_nsec -= 1000000000; \
+  } \
+  pthread_cond_timedwait(&c, &m, &timeout_); \
+} while (0)
 #define COND_BROADCAST(c) pthread_cond_broadcast(&c)
 #ifdef HAVE_PTHREAD_CONDATTR_SETPSHARED
 # define COND_INIT_SHARED(c) do {\
@@ -354,6 +367,12 @@ typedef struct
   (c).waiters_done_ = CreateEvent(NULL, FALSE, FALSE, NULL); \
 } while (0)
 
+#define COND_FIN(c) do { \
+  CloseHandle((c).sema_); \
+  MUTEX_FIN((c).waiters_count_lock_); \
+  CloseHandle((c).waiters_done_); \
+} while (0)
+
 #define COND_SIGNAL(c) do { \
   MUTEX_LOCK((c).waiters_count_lock_); \
   { \
@@ -404,16 +423,37 @@ typedef struct
   } \
 } while (0)
 
+#define COND_TIMEDWAIT(c,m,msec) do { \
+  MUTEX_LOCK((c).waiters_count_lock_); \
+  (c).waiters_count_++; \
+  MUTEX_UNLOCK((c).waiters_count_lock_); \
+  SignalObjectAndWait((m), (c).sema_, (msec), FALSE); \
+  MUTEX_LOCK((c).waiters_count_lock_); \
+  (c).waiters_count_--; \
+  { \
+    int last_waiter = (c).was_broadcast_ && (c).waiters_count_ == 0; \
+    MUTEX_UNLOCK((c).waiters_count_lock_); \
+    if (last_waiter)  { \
+      SignalObjectAndWait((c).waiters_done_, (m), INFINITE, FALSE); \
+    } \
+    else { \
+      WaitForSingleObject((m), FALSE); \
+    } \
+  } \
+} while (0)
+
 #else /* WIN32 */
 /* todo */
 typedef int grn_cond;
 #define COND_INIT(c)   ((c) = 0)
+#define COND_FIN(c)
 #define COND_SIGNAL(c)
 #define COND_WAIT(c,m) do { \
   MUTEX_UNLOCK(m); \
   grn_nanosleep(1000000); \
   MUTEX_LOCK(m); \
 } while (0)
+#define COND_TIMEDWAIT(c,m,msec) COND_WAIT(c,m)
 /* todo : must be enhanced! */
 
 #endif /* WIN32 */
@@ -495,6 +535,17 @@ typedef int grn_cond;
 #  define GRN_BIT_SCAN_REV0(v,r) GRN_BIT_SCAN_REV(v,r)
 # endif /* ATOMIC ADD */
 
+/*
+ * GRN_ATOMIC_CAS_EX() performs { r = *p; if (r == e) { *p = v; } } atomically.
+ */
+# define GRN_ATOMIC_CAS_EX(p, e, v, r) \
+  ((r) = __sync_val_compare_and_swap((p), (e), (v)))
+
+/*
+ * GRN_MEMORY_BARRIER() orders the memory accesses before it and after it.
+ */
+# define GRN_MEMORY_BARRIER() __sync_synchronize()
+
 # ifdef __i386__ /* ATOMIC 64BIT SET */
 #  define GRN_SET_64BIT(p,v) \
   __asm__ __volatile__ ("\txchgl %%esi, %%ebx\n1:\n\tmovl (%0), %%eax\n\tmovl 4(%0), %%edx\n\tlock; cmpxchg8b (%0)\n\tjnz 1b\n\txchgl %%ebx, %%esi" : : "D"(p), "S"(*(((uint32_t *)&(v))+0)), "c"(*(((uint32_t *)&(v))+1)) : "ax", "dx", "memory")
@@ -518,6 +569,10 @@ typedef int grn_cond;
 
 # define GRN_ATOMIC_ADD_EX(p,i,r) \
   ((r) = (uint32_t)InterlockedExchangeAdd((int32_t *)(p), (int32_t)(i)))
+# define GRN_ATOMIC_CAS_EX(p,e,v,r) \
+  ((r) = (uint32_t)InterlockedCompareExchange((LONG volatile *)(p),\
+                                              (LONG)(v), (LONG)(e)))
+# define GRN_MEMORY_BARRIER() MemoryBarrier()
 # if defined(_WIN64) /* ATOMIC 64BIT SET */
 #  define GRN_SET_64BIT(p,v) \
   (*(p) = (v))
@@ -553,6 +608,9 @@ typedef int grn_cond;
 #  include <atomic.h>
 #  define GRN_ATOMIC_ADD_EX(p,i,r) \
   (r = atomic_add_32_nv(p, i) - i)
+#  define GRN_ATOMIC_CAS_EX(p,e,v,r) \
+  (r = atomic_cas_32(p, e, v))
+#  define GRN_MEMORY_BARRIER() membar_enter()
 /* todo */
 #  define GRN_BIT_SCAN_REV(v,r)  for (r = 31; r && !((1 << r) & v); r--)
 #  define GRN_BIT_SCAN_REV0(v,r) GRN_BIT_SCAN_REV(v,r)
@@ -1600,6 +1600,7 @@ grn_io_hash_init(grn_ctx *ctx, grn_hash *hash, const char *path,
   header->max_offset = max_offset;
   header->n_entries = 0;
   header->n_garbages = 0;
+  header->version = 0;
   header->tokenizer = GRN_ID_NIL;
   if (header->flags & GRN_OBJ_KEY_NORMALIZE) {
     header->flags &= ~GRN_OBJ_KEY_NORMALIZE;
@@ -1624,6 +1625,7 @@ grn_io_hash_init(grn_ctx *ctx, grn_hash *hash, const char *path,
   hash->header = header;
   hash->lock = &header->lock;
   hash->tokenizer = NULL;
+  hash->version = &header->version;
   return GRN_SUCCESS;
 }
 
@@ -1678,6 +1680,9 @@ grn_tiny_hash_init(grn_ctx *ctx, grn_hash *hash, const char *path,
   hash->max_offset = &hash->max_offset_;
   hash->max_offset_ = INITIAL_INDEX_SIZE - 1;
   hash->io = NULL;
+  hash->version = &hash->version_;
+  hash->version_ = 0;
+  hash->n_retired_indexes = 0;
   hash->n_garbages_ = 0;
   hash->n_entries_ = 0;
   hash->garbages = GRN_ID_NIL;
@@ -1747,6 +1752,7 @@ grn_hash_open(grn_ctx *ctx, const char *path)
             hash->io = io;
             hash->header = header;
             hash->lock = &header->lock;
+            hash->version = &header->version;
             hash->tokenizer = grn_ctx_at(ctx, header->tokenizer);
             if (header->flags & GRN_OBJ_KEY_NORMALIZE) {
               header->flags &= ~GRN_OBJ_KEY_NORMALIZE;
@@ -1798,6 +1804,9 @@ grn_tiny_hash_fin(grn_ctx *ctx, grn_hash *hash)
   grn_tiny_array_fin(&hash->a);
   grn_tiny_bitmap_fin(&hash->bitmap);
   GRN_CTX_FREE(ctx, hash->index);
+  while (hash->n_retired_indexes > 0) {
+    GRN_CTX_FREE(ctx, hash->retired_indexes[--hash->n_retired_indexes]);
+  }
   return GRN_SUCCESS;
 }
 
@@ -1977,7 +1986,16 @@ grn_hash_reset(grn_ctx *ctx, grn_hash *hash, uint32_t expected_n_entries)
   } else {
     grn_id * const old_index = hash->index;
     hash->index = new_index;
-    GRN_CTX_FREE(ctx, old_index);
+    /*
+     * Lock-free readers may still probe the old index. It is freed with the
+     * hash. The index size is doubled on each reset, so the retired indexes
+     * are smaller than the current one in total.
+     */
+    if (hash->n_retired_indexes < GRN_HASH_MAX_N_RETIRED_INDEXES) {
+      hash->retired_indexes[hash->n_retired_indexes++] = old_index;
+    } else {
+      GRN_CTX_FREE(ctx, old_index);
+    }
   }
 
   return GRN_SUCCESS;
@@ -2135,9 +2153,10 @@ grn_hash_add(grn_ctx *ctx, grn_hash *hash, const void *key,
     grn_id id, *index, *garbage_index = NULL;
     grn_hash_entry *entry;
 
-    /* lock */
     if ((*hash->n_entries + *hash->n_garbages) * 2 > *hash->max_offset) {
+      GRN_TABLE_UPDATE_BEGIN(hash->version);
       grn_hash_reset(ctx, hash, 0);
+      GRN_TABLE_UPDATE_END(hash->version);
     }
 
     for (i = hash_value; ; i += step) {
@@ -2172,12 +2191,14 @@ grn_hash_add(grn_ctx *ctx, grn_hash *hash, const void *key,
       }
     }
 
+    GRN_TABLE_UPDATE_BEGIN(hash->version);
     if (grn_hash_is_io_hash(hash)) {
       id = grn_io_hash_add(ctx, hash, hash_value, key, key_size, value);
     } else {
       id = grn_tiny_hash_add(ctx, hash, hash_value, key, key_size, value);
     }
     if (!id) {
+      GRN_TABLE_UPDATE_END(hash->version);
       return GRN_ID_NIL;
     }
     if (garbage_index) {
@@ -2186,7 +2207,7 @@ grn_hash_add(grn_ctx *ctx, grn_hash *hash, const void *key,
     }
     *index = id;
     (*hash->n_entries)++;
-    /* unlock */
+    GRN_TABLE_UPDATE_END(hash->version);
 
     if (added) {
       *added = 1;
@@ -2195,10 +2216,42 @@ grn_hash_add(grn_ctx *ctx, grn_hash *hash, const void *key,
   }
 }
 
+inline static grn_id
+grn_hash_get_(grn_ctx *ctx, grn_hash *hash, uint32_t hash_value,
+              const void *key, unsigned int key_size, void **value)
+{
+  uint32_t i;
+  const uint32_t step = grn_hash_calculate_step(hash_value);
+  for (i = hash_value; ; i += step) {
+    grn_id id;
+    grn_id * const index = grn_hash_idx_at(ctx, hash, i);
+    if (!index) {
+      return GRN_ID_NIL;
+    }
+    id = *index;
+    if (!id) {
+      return GRN_ID_NIL;
+    }
+    if (id != GARBAGE) {
+      grn_hash_entry * const entry = grn_hash_entry_at(ctx, hash, id, 0);
+      if (entry) {
+        if (grn_hash_entry_compare_key(ctx, hash, entry, hash_value,
+                                       key, key_size)) {
+          if (value) {
+            *value = grn_hash_entry_get_value(hash, entry);
+          }
+          return id;
+        }
+      }
+    }
+  }
+}
+
 grn_id
 grn_hash_get(grn_ctx *ctx, grn_hash *hash, const void *key,
              unsigned int key_size, void **value)
 {
+  grn_id id;
   uint32_t hash_value;
   if (hash->obj.header.flags & GRN_OBJ_KEY_VAR_SIZE) {
     if (key_size > hash->key_size) {
@@ -2216,33 +2269,10 @@ grn_hash_get(grn_ctx *ctx, grn_hash *hash, const void *key,
     }
   }
 
-  {
-    uint32_t i;
-    const uint32_t step = grn_hash_calculate_step(hash_value);
-    for (i = hash_value; ; i += step) {
-      grn_id id;
-      grn_id * const index = grn_hash_idx_at(ctx, hash, i);
-      if (!index) {
-        return GRN_ID_NIL;
-      }
-      id = *index;
-      if (!id) {
-        return GRN_ID_NIL;
-      }
-      if (id != GARBAGE) {
-        grn_hash_entry * const entry = grn_hash_entry_at(ctx, hash, id, 0);
-        if (entry) {
-          if (grn_hash_entry_compare_key(ctx, hash, entry, hash_value,
-                                         key, key_size)) {
-            if (value) {
-              *value = grn_hash_entry_get_value(hash, entry);
-            }
-            return id;
-          }
-        }
-      }
-    }
-  }
+  GRN_TABLE_READ(ctx, hash->version, hash->io, {
+    id = grn_hash_get_(ctx, hash, hash_value, key, key_size, value);
+  });
+  return id;
 }
 
 inline static grn_hash_entry *
@@ -2269,15 +2299,17 @@ _grn_hash_key(grn_ctx *ctx, grn_hash *hash, grn_id id, uint32_t *key_size)
 int
 grn_hash_get_key(grn_ctx *ctx, grn_hash *hash, grn_id id, void *keybuf, int bufsize)
 {
-  int key_size;
-  grn_hash_entry * const entry = grn_hash_get_entry(ctx, hash, id);
-  if (!entry) {
-    return 0;
-  }
-  key_size = grn_hash_entry_get_key_size(hash, entry);
-  if (bufsize >= key_size) {
-    memcpy(keybuf, grn_hash_entry_get_key(ctx, hash, entry), key_size);
-  }
+  int key_size = 0;
+  GRN_TABLE_READ(ctx, hash->version, hash->io, {
+    grn_hash_entry * const entry = grn_hash_get_entry(ctx, hash, id);
+    key_size = 0;
+    if (entry) {
+      key_size = grn_hash_entry_get_key_size(hash, entry);
+      if (bufsize >= key_size) {
+        memcpy(keybuf, grn_hash_entry_get_key(ctx, hash, entry), key_size);
+      }
+    }
+  });
   return key_size;
 }
 
@@ -2427,6 +2459,7 @@ grn_hash_set_value(grn_ctx *ctx, grn_hash *hash, grn_id id,
 }
 
 #define DELETE_IT do {\
+  GRN_TABLE_UPDATE_BEGIN(hash->version);\
   *ep = GARBAGE;\
   if (grn_hash_is_io_hash(hash)) {\
     uint32_t size = key_size - 1;\
@@ -2445,6 +2478,7 @@ grn_hash_set_value(grn_ctx *ctx, grn_hash *hash, grn_id id,
   }\
   (*hash->n_entries)--;\
   (*hash->n_garbages)++;\
+  GRN_TABLE_UPDATE_END(hash->version);\
   rc = GRN_SUCCESS;\
 } while (0)
 
@@ -29,6 +29,65 @@
 extern "C" {
 #endif
 
+/**** version of tables ****/
+
+/*
+ * grn_hash and grn_pat have a version counter so that key lookups don't
+ * need any lock while a writer modifies them. The counter of a persistent
+ * table is stored in its header so that readers in other processes see it.
+ *
+ * - GRN_TABLE_UPDATE_BEGIN() and GRN_TABLE_UPDATE_END() surround a
+ *   modification by a writer. The version is odd during the modification.
+ * - GRN_TABLE_READ() runs a block that reads the table and runs it again if
+ *   the version is odd or changed while it ran. Readers only load the
+ *   version so that they don't write its cache line. A writer never waits
+ *   for readers. After GRN_TABLE_READ_MAX_N_RETRIES retries, the reader takes
+ *   the lock of the table io, which writers hold, and runs the block once
+ *   more. A table without io has no other writer, so the block is just run
+ *   again.
+ * - GRN_TABLE_VERSION_CLEAR() makes the version even. It is used when the
+ *   lock of a table is cleared after a writer crashed in a modification.
+ */
+#define GRN_TABLE_READ_MAX_N_RETRIES 128
+
+#define GRN_TABLE_UPDATE_BEGIN(version) do {\
+  uint32_t version_;\
+  GRN_ATOMIC_ADD_EX((version), 1, version_);\
+} while (0)
+
+#define GRN_TABLE_UPDATE_END(version) GRN_TABLE_UPDATE_BEGIN(version)
+
+#define GRN_TABLE_VERSION_CLEAR(version) do {\
+  uint32_t version_;\
+  GRN_ATOMIC_ADD_EX((version), 0, version_);\
+  if (version_ & 1) {\
+    GRN_ATOMIC_ADD_EX((version), 1, version_);\
+  }\
+} while (0)
+
+#define GRN_TABLE_READ(ctx, version, io, block) do {\
+  uint32_t n_retries_, version_begin_, version_end_;\
+  for (n_retries_ = 0;; n_retries_++) {\
+    version_begin_ = *((volatile uint32_t *)(version));\
+    GRN_MEMORY_BARRIER();\
+    block\
+    GRN_MEMORY_BARRIER();\
+    version_end_ = *((volatile uint32_t *)(version));\
+    if (version_begin_ == version_end_ && !(version_begin_ & 1)) {\
+      break;\
+    }\
+    if (n_retries_ == GRN_TABLE_READ_MAX_N_RETRIES) {\
+      if (!(io)) {\
+        block\
+      } else if (!grn_io_lock((ctx), (io), grn_lock_timeout)) {\
+        block\
+        grn_io_unlock((io));\
+      }\
+      break;\
+    }\
+  }\
+} while (0)
+
 /**** grn_tiny_array ****/
 
 /*
@@ -193,6 +252,7 @@ GRN_API grn_id grn_table_queue_tail(grn_table_queue *queue);
 
 #define GRN_HASH_TINY         (0x01<<6)
 #define GRN_HASH_MAX_KEY_SIZE GRN_TABLE_MAX_KEY_SIZE
+#define GRN_HASH_MAX_N_RETIRED_INDEXES 32
 
 struct _grn_hash {
   grn_db_obj obj;
@@ -206,6 +266,8 @@ struct _grn_hash {
   uint32_t *max_offset;
   grn_obj *tokenizer;
   grn_obj *normalizer;
+  /* Incremented before and after a modification. See GRN_TABLE_READ(). */
+  uint32_t *version;
 
   /* For grn_io_hash. */
   grn_io *io;
@@ -228,7 +290,11 @@ struct _grn_hash {
   uint32_t max_offset_;
   uint32_t n_garbages_;
   uint32_t n_entries_;
+  uint32_t version_;
   grn_id *index;
+  /* Indexes replaced by grn_hash_reset(). Readers may still refer them. */
+  grn_id *retired_indexes[GRN_HASH_MAX_N_RETIRED_INDEXES];
+  uint32_t n_retired_indexes;
   grn_id garbages;
   grn_tiny_array a;
   grn_tiny_bitmap bitmap;
@@ -250,7 +316,8 @@ struct grn_hash_header {
   uint32_t n_garbages;
   uint32_t lock;
   grn_id normalizer;
-  uint32_t reserved[15];
+  uint32_t version;
+  uint32_t reserved[14];
   grn_id garbages[GRN_HASH_MAX_KEY_SIZE];
   grn_table_queue queue;
 };
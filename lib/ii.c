@@ -28,6 +28,11 @@
 #include "output.h"
 #include "util.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define GRN_II_SIMD_X86
+# include <immintrin.h>
+#endif
+
 #define MAX_PSEG                 0x20000
 #define S_CHUNK                  (1 << GRN_II_W_CHUNK)
 #define W_SEGMENT                18
@@ -1438,6 +1443,81 @@ pack(uint32_t *p, uint32_t i, uint8_t *freq, uint8_t *rp)
   return rp + (ep - ebuf);
 }
 
+/*
+ * simd pack: a unit of UNIT_SIZE values is packed into 4 lanes of 32-bit
+ * words so that a unit can be unpacked by 128-bit or 256-bit vector
+ * shifts. The i-th value is the (i / 4)-th w bit field of the lane
+ * (i % 4), and the k-th word of a lane is stored at (k * 4 + lane) in
+ * little endian. Exceptions are stored as pairs of its index and the
+ * overflowed value after the packed words.
+ */
+#define SIMD_N_LANES 4
+#define SIMD_W_UNIT  (SIMD_N_LANES * sizeof(uint32_t))
+
+inline static uint32_t
+simd_word_get(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline static void
+simd_word_set(uint8_t *p, uint32_t v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = v >> 24;
+}
+
+static uint8_t *
+simd_pack_(uint32_t *p, int w, uint8_t *rp)
+{
+  int r, j, n = w * SIMD_N_LANES;
+  uint32_t words[UNIT_SIZE];
+  if (!w) { return rp; }
+  memset(words, 0, sizeof(uint32_t) * n);
+  for (r = 0; r < UNIT_SIZE / SIMD_N_LANES; r++) {
+    int bit = r * w, k = bit >> 5, s = bit & 31;
+    for (j = 0; j < SIMD_N_LANES; j++) {
+      uint32_t v = *p++;
+      words[k * SIMD_N_LANES + j] |= v << s;
+      if (s + w > 32) { words[(k + 1) * SIMD_N_LANES + j] |= v >> (32 - s); }
+    }
+  }
+  for (j = 0; j < n; j++, rp += sizeof(uint32_t)) {
+    simd_word_set(rp, words[j]);
+  }
+  return rp;
+}
+
+static uint8_t *
+pack_simd(uint32_t *p, uint8_t *freq, uint8_t *rp)
+{
+  int32_t k, w;
+  uint8_t ebuf[UNIT_SIZE], *ep = ebuf;
+  uint32_t s, r, th = UNIT_SIZE - (UNIT_SIZE >> 3);
+  for (w = 0, s = 0; w <= 32; w++) {
+    if ((s += freq[w]) >= th) { break; }
+  }
+  if (s == UNIT_SIZE) {
+    *rp++ = w;
+    return simd_pack_(p, w, rp);
+  }
+  r = 1 << w;
+  *rp++ = w + 0x80;
+  *rp++ = UNIT_SIZE - s;
+  for (k = 0; k < UNIT_SIZE; k++) {
+    if (p[k] >= r) {
+      *ep++ = k;
+      GRN_B_ENC(p[k] - r, ep);
+      p[k] = 0;
+    }
+  }
+  rp = simd_pack_(p, w, rp);
+  memcpy(rp, ebuf, ep - ebuf);
+  return rp + (ep - ebuf);
+}
+
 int
 grn_p_enc(grn_ctx *ctx, uint32_t *data, uint32_t data_size, uint8_t **res)
 {
@@ -1466,6 +1546,13 @@ grn_p_enc(grn_ctx *ctx, uint32_t *data, uint32_t data_size, uint8_t **res)
 #define USE_P_ENC (1<<0)
 #define CUT_OFF   (1<<1)
 #define ODD       (1<<2)
+#define SIMD_PACK (1<<3)
+
+/* The usep bit which tells that full units are packed by pack_simd(). */
+#define USEP_SIMD_PACK (1<<MAX_N_ELEMENTS)
+
+#define P_ENC_FLAGS(ii) \
+  (USE_P_ENC | (((ii)->header->flags & GRN_OBJ_INDEX_SIMD) ? SIMD_PACK : 0))
 
 typedef struct {
   uint32_t *data;
@@ -1520,7 +1607,7 @@ size_t
 grn_p_encv(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res)
 {
   uint8_t *rp = res, freq[33];
-  uint32_t pgap, usep, l, df, data_size, *dp, *dpe;
+  uint32_t pgap, usep, simd = 0, l, df, data_size, *dp, *dpe;
   if (!dvlen || !(df = dv[0].data_size)) { return 0; }
   for (usep = 0, data_size = 0, l = 0; l < dvlen; l++) {
     uint32_t dl = dv[l].data_size;
@@ -1529,6 +1616,9 @@ grn_p_encv(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res)
       return 0;
     }
     usep += (dv[l].flags & USE_P_ENC) << l;
+    if ((dv[l].flags & (USE_P_ENC|SIMD_PACK)) == (USE_P_ENC|SIMD_PACK)) {
+      simd = USEP_SIMD_PACK;
+    }
     data_size += dl;
   }
   pgap = data_size - df * dvlen;
@@ -1541,7 +1631,7 @@ grn_p_encv(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res)
     }
   } else {
     uint32_t buf[UNIT_SIZE];
-    GRN_B_ENC((usep << 1), rp);
+    GRN_B_ENC(((usep | simd) << 1), rp);
     GRN_B_ENC(df, rp);
     if (dv[dvlen - 1].flags & ODD) {
       GRN_B_ENC(pgap, rp);
@@ -1556,7 +1646,7 @@ grn_p_encv(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res)
         memset(freq, 0, 33);
         while (dp < dpe) {
           if (j == UNIT_SIZE) {
-            rp = pack(buf, j, freq, rp);
+            rp = simd ? pack_simd(buf, freq, rp) : pack(buf, j, freq, rp);
             memset(freq, 0, 33);
             j = 0;
           }
@@ -1568,7 +1658,11 @@ grn_p_encv(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res)
             freq[0]++;
           }
         }
-        if (j) { rp = pack(buf, j, freq, rp); }
+        if (j == UNIT_SIZE && simd) {
+          rp = pack_simd(buf, freq, rp);
+        } else if (j) {
+          rp = pack(buf, j, freq, rp);
+        }
       } else {
         while (dp < dpe) { GRN_B_ENC(*dp++, rp); }
       }
@@ -1709,6 +1803,126 @@ unpack(uint8_t *dp, uint8_t *dpe, int i, uint32_t *rp)
   return dp;
 }
 
+typedef void (*simd_unpack_func)(const uint8_t *dp, int w, uint32_t *rp);
+
+static void
+simd_unpack_scalar(const uint8_t *dp, int w, uint32_t *rp)
+{
+  int r, j;
+  uint32_t mask = (w == 32) ? 0xffffffff : (1U << w) - 1;
+  for (r = 0; r < UNIT_SIZE / SIMD_N_LANES; r++) {
+    int bit = r * w, k = bit >> 5, s = bit & 31;
+    const uint8_t *wp = dp + k * SIMD_W_UNIT;
+    for (j = 0; j < SIMD_N_LANES; j++, wp += sizeof(uint32_t)) {
+      uint32_t v = simd_word_get(wp) >> s;
+      if (s + w > 32) { v |= simd_word_get(wp + SIMD_W_UNIT) << (32 - s); }
+      *rp++ = v & mask;
+    }
+  }
+}
+
+#ifdef GRN_II_SIMD_X86
+__attribute__((target("sse2"))) static void
+simd_unpack_sse2(const uint8_t *dp, int w, uint32_t *rp)
+{
+  int r;
+  const __m128i mask = _mm_set1_epi32((w == 32) ? -1 : (int)((1U << w) - 1));
+  for (r = 0; r < UNIT_SIZE / SIMD_N_LANES; r++, rp += SIMD_N_LANES) {
+    int bit = r * w, k = bit >> 5, s = bit & 31;
+    const uint8_t *wp = dp + k * SIMD_W_UNIT;
+    __m128i v = _mm_srl_epi32(_mm_loadu_si128((const __m128i *)wp),
+                              _mm_cvtsi32_si128(s));
+    if (s + w > 32) {
+      __m128i h = _mm_loadu_si128((const __m128i *)(wp + SIMD_W_UNIT));
+      v = _mm_or_si128(v, _mm_sll_epi32(h, _mm_cvtsi32_si128(32 - s)));
+    }
+    _mm_storeu_si128((__m128i *)rp, _mm_and_si128(v, mask));
+  }
+}
+
+__attribute__((target("avx2"))) static void
+simd_unpack_avx2(const uint8_t *dp, int w, uint32_t *rp)
+{
+  int r;
+  const __m256i mask =
+    _mm256_set1_epi32((w == 32) ? -1 : (int)((1U << w) - 1));
+  const __m128i zero = _mm_setzero_si128();
+  /* two fields of 4 lanes at once by per element shift counts */
+  for (r = 0; r < UNIT_SIZE / SIMD_N_LANES; r += 2, rp += SIMD_N_LANES * 2) {
+    int b0 = r * w, b1 = b0 + w;
+    int k0 = b0 >> 5, s0 = b0 & 31, k1 = b1 >> 5, s1 = b1 & 31;
+    const uint8_t *wp0 = dp + k0 * SIMD_W_UNIT, *wp1 = dp + k1 * SIMD_W_UNIT;
+    __m256i l = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)wp0)),
+      _mm_loadu_si128((const __m128i *)wp1), 1);
+    __m256i v = _mm256_srlv_epi32(l, _mm256_setr_epi32(s0, s0, s0, s0,
+                                                       s1, s1, s1, s1));
+    if (s0 + w > 32 || s1 + w > 32) {
+      __m128i h0 = (s0 + w > 32)
+        ? _mm_loadu_si128((const __m128i *)(wp0 + SIMD_W_UNIT)) : zero;
+      __m128i h1 = (s1 + w > 32)
+        ? _mm_loadu_si128((const __m128i *)(wp1 + SIMD_W_UNIT)) : zero;
+      int c0 = 32 - s0, c1 = 32 - s1;
+      __m256i h = _mm256_inserti128_si256(_mm256_castsi128_si256(h0), h1, 1);
+      v = _mm256_or_si256(v, _mm256_sllv_epi32(h, _mm256_setr_epi32(c0, c0, c0, c0,
+                                                                     c1, c1, c1, c1)));
+    }
+    _mm256_storeu_si256((__m256i *)rp, _mm256_and_si256(v, mask));
+  }
+}
+#endif /* GRN_II_SIMD_X86 */
+
+static simd_unpack_func simd_unpack = NULL;
+
+/*
+ * Chooses the fastest unpacker that the CPU supports. GRN_II_SIMD_UNPACK
+ * environment variable ("scalar", "sse2" or "avx2") can restrict it.
+ */
+static void
+simd_unpack_init(void)
+{
+  simd_unpack_func func = simd_unpack_scalar;
+#ifdef GRN_II_SIMD_X86
+  const char *name = getenv("GRN_II_SIMD_UNPACK");
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && (!name || !strcmp(name, "avx2"))) {
+    func = simd_unpack_avx2;
+  } else if (__builtin_cpu_supports("sse2") &&
+             (!name || strcmp(name, "scalar"))) {
+    func = simd_unpack_sse2;
+  }
+#endif /* GRN_II_SIMD_X86 */
+  simd_unpack = func;
+}
+
+static uint8_t *
+unpack_simd(uint8_t *dp, uint8_t *dpe, uint32_t *rp)
+{
+  uint8_t ne = 0, w;
+  if (dp >= dpe) { return NULL; }
+  w = *dp++;
+  if (w & 0x80) {
+    if (dp >= dpe) { return NULL; }
+    ne = *dp++;
+    w -= 0x80;
+  }
+  if (w > 32 || dp + w * SIMD_W_UNIT > dpe) { return NULL; }
+  if (w) {
+    if (!simd_unpack) { simd_unpack_init(); }
+    simd_unpack(dp, w, rp);
+    dp += w * SIMD_W_UNIT;
+  } else {
+    memset(rp, 0, sizeof(uint32_t) * UNIT_SIZE);
+  }
+  while (ne--) {
+    uint32_t k;
+    if (dp >= dpe || w >= 32 || (k = *dp++) >= UNIT_SIZE) { return NULL; }
+    GRN_B_DEC_CHECK(rp[k], dp, dpe);
+    rp[k] += 1U << w;
+  }
+  return dp;
+}
+
 int
 grn_p_dec(grn_ctx *ctx, uint8_t *data, uint32_t data_size, uint32_t nreq, uint32_t **res)
 {
@@ -1795,7 +2009,11 @@ grn_p_decv(grn_ctx *ctx, uint8_t *data, uint32_t data_size, datavec *dv, uint32_
       dv[l].data_size = n = (l < dvlen - 1) ? df : df + rest;
       if (usep & (1 << l)) {
         for (; n >= UNIT_SIZE; n -= UNIT_SIZE) {
-          if (!(dp = unpack(dp, dpe, UNIT_SIZE, rp))) { return 0; }
+          if (usep & USEP_SIMD_PACK) {
+            if (!(dp = unpack_simd(dp, dpe, rp))) { return 0; }
+          } else {
+            if (!(dp = unpack(dp, dpe, UNIT_SIZE, rp))) { return 0; }
+          }
           rp += UNIT_SIZE;
         }
         if (n) {
@@ -2482,8 +2700,203 @@ typedef struct {
   uint32_t segno;
   uint32_t size;
   uint32_t dgap;
+  uint32_t max_score;
 } chunk_info;
 
+#define CHUNK_MAX_SCORE_P(ii) \
+  ((ii)->header->features & GRN_II_FEATURE_CHUNK_MAX_SCORE)
+
+inline static uint8_t *
+chunk_info_decode(grn_ii *ii, chunk_info *cinfo, uint8_t *p)
+{
+  GRN_B_DEC(cinfo->segno, p);
+  GRN_B_DEC(cinfo->size, p);
+  GRN_B_DEC(cinfo->dgap, p);
+  if (CHUNK_MAX_SCORE_P(ii)) {
+    GRN_B_DEC(cinfo->max_score, p);
+  } else {
+    cinfo->max_score = 0;
+  }
+  return p;
+}
+
+inline static uint8_t *
+chunk_info_encode(grn_ii *ii, chunk_info *cinfo, uint8_t *p)
+{
+  GRN_B_ENC(cinfo->segno, p);
+  GRN_B_ENC(cinfo->size, p);
+  GRN_B_ENC(cinfo->dgap, p);
+  if (CHUNK_MAX_SCORE_P(ii)) {
+    GRN_B_ENC(cinfo->max_score, p);
+  }
+  return p;
+}
+
+inline static uint8_t *
+chunk_tail_decode(grn_ii *ii, uint8_t *p, uint32_t *max_score)
+{
+  if (CHUNK_MAX_SCORE_P(ii)) {
+    GRN_B_DEC(*max_score, p);
+  } else {
+    *max_score = 0;
+  }
+  return p;
+}
+
+/* Returns the largest sum of (tf + weight) over the sections of a record. */
+static uint32_t
+datavec_max_score(grn_ii *ii, datavec *dv, uint32_t ndf)
+{
+  int j = 0;
+  uint32_t i, score = 0, max_score = 0;
+  uint32_t *rp, *tp, *wp = NULL;
+  rp = dv[j++].data;
+  if ((ii->header->flags & GRN_OBJ_WITH_SECTION)) { j++; }
+  tp = dv[j++].data;
+  if ((ii->header->flags & GRN_OBJ_WITH_WEIGHT)) { wp = dv[j].data; }
+  for (i = 0; i < ndf; i++) {
+    if (rp[i]) {
+      if (max_score < score) { max_score = score; }
+      score = 0;
+    }
+    score += tp[i] + 1 + (wp ? wp[i] : 0);
+  }
+  if (max_score < score) { max_score = score; }
+  return max_score;
+}
+
+/*
+ * Chunk data of an index with GRN_II_FEATURE_CHUNK_SKIP starts with the
+ * number of blocks. When it is more than one, the total df, the number of
+ * the extra values of the last element and a skip table follow. The skip
+ * table has a pair of the rid gap to the last record and the encoded size
+ * for each block. Each block holds CHUNK_SKIP_BLOCK_SIZE or a few more
+ * postings encoded by grn_p_encv(). Blocks are split only at record
+ * boundaries, so a cursor can jump to the block which contains a record
+ * without decoding the preceding ones.
+ */
+#define CHUNK_SKIP_P(ii) \
+  ((ii)->header->features & GRN_II_FEATURE_CHUNK_SKIP)
+#define CHUNK_SKIP_BLOCK_SIZE (UNIT_SIZE * 2)
+#define CHUNK_SKIP_MAX_OVERHEAD(df) \
+  (16 + ((df) / CHUNK_SKIP_BLOCK_SIZE + 1) * (10 + 16 + MAX_N_ELEMENTS * 2))
+
+inline static uint32_t
+chunk_skip_block_end(uint32_t *rp, uint32_t s, uint32_t df)
+{
+  uint32_t e = s + CHUNK_SKIP_BLOCK_SIZE;
+  while (e < df && !rp[e]) { e++; }
+  return e < df ? e : df;
+}
+
+static size_t
+chunk_encv(grn_ctx *ctx, grn_ii *ii, datavec *dv, uint32_t dvlen, uint8_t *res)
+{
+  uint8_t *rp = res, *bp, *bp0;
+  uint32_t df = dv[0].data_size, last = dvlen - 1, nblocks, i, l, s, e;
+  uint32_t pgap, poff, *tfp, *table;
+  grn_id rid, lrid;
+  datavec bdv[MAX_N_ELEMENTS];
+  if (!CHUNK_SKIP_P(ii)) { return grn_p_encv(ctx, dv, dvlen, res); }
+  if (!df) { return 0; }
+  if (df <= CHUNK_SKIP_BLOCK_SIZE) {
+    GRN_B_ENC(1, rp);
+    return (rp - res) + grn_p_encv(ctx, dv, dvlen, rp);
+  }
+  for (nblocks = 0, s = 0; s < df; nblocks++) {
+    s = chunk_skip_block_end(dv[0].data, s, df);
+  }
+  if (!(table = GRN_MALLOCN(uint32_t, nblocks * 2))) { return 0; }
+  tfp = dv[(ii->header->flags & GRN_OBJ_WITH_SECTION) ? 2 : 1].data;
+  pgap = dv[last].data_size - df;
+  GRN_B_ENC(nblocks, rp);
+  GRN_B_ENC(df, rp);
+  GRN_B_ENC(pgap, rp);
+  bp = bp0 = rp + nblocks * 10;
+  for (i = 0, s = 0, poff = 0, rid = lrid = 0; i < nblocks; i++, s = e) {
+    uint32_t np;
+    e = chunk_skip_block_end(dv[0].data, s, df);
+    for (l = 0; l < dvlen; l++) {
+      bdv[l].data = dv[l].data + s;
+      bdv[l].data_size = e - s;
+      bdv[l].flags = dv[l].flags;
+    }
+    if ((dv[last].flags & ODD)) {
+      for (np = 0, l = s; l < e; l++) { np += tfp[l] + 1; }
+      if (i == nblocks - 1) { np = dv[last].data_size - poff; }
+      bdv[last].data = dv[last].data + poff;
+      bdv[last].data_size = np;
+      poff += np;
+    }
+    for (l = s; l < e; l++) { rid += dv[0].data[l]; }
+    table[i * 2] = rid - lrid;
+    table[i * 2 + 1] = grn_p_encv(ctx, bdv, dvlen, bp);
+    bp += table[i * 2 + 1];
+    lrid = rid;
+  }
+  for (i = 0; i < nblocks * 2; i++) { GRN_B_ENC(table[i], rp); }
+  memmove(rp, bp0, bp - bp0);
+  rp += bp - bp0;
+  GRN_FREE(table);
+  return rp - res;
+}
+
+static int
+chunk_decv(grn_ctx *ctx, grn_ii *ii, uint8_t *data, uint32_t data_size,
+           datavec *dv, uint32_t dvlen)
+{
+  uint8_t *dp = data, *dpe = data + data_size, *tp, *bp;
+  uint32_t nblocks, df, pgap, size, i, l, bsize, *rp;
+  uint32_t offsets[MAX_N_ELEMENTS];
+  datavec bdv[MAX_N_ELEMENTS + 1];
+  if (!CHUNK_SKIP_P(ii)) { return grn_p_decv(ctx, data, data_size, dv, dvlen); }
+  if (!data_size) {
+    dv[0].data_size = 0;
+    return 0;
+  }
+  GRN_B_DEC_CHECK(nblocks, dp, dpe);
+  if (nblocks <= 1) { return grn_p_decv(ctx, dp, dpe - dp, dv, dvlen); }
+  GRN_B_DEC_CHECK(df, dp, dpe);
+  GRN_B_DEC_CHECK(pgap, dp, dpe);
+  size = df * dvlen + pgap;
+  if (dv[dvlen].data < dv[0].data + size) {
+    if (dv[0].data) { GRN_FREE(dv[0].data); }
+    if (!(rp = GRN_MALLOC(size * sizeof(uint32_t)))) { return 0; }
+    dv[dvlen].data = rp + size;
+  } else {
+    rp = dv[0].data;
+  }
+  for (l = 0; l < dvlen; l++) {
+    dv[l].data = rp + df * l;
+    dv[l].data_size = (l == dvlen - 1) ? df + pgap : df;
+    offsets[l] = 0;
+  }
+  for (tp = dp, i = 0; i < nblocks * 2; i++) { GRN_B_DEC_CHECK(bsize, dp, dpe); }
+  datavec_init(ctx, bdv, dvlen, 0, 0);
+  for (l = 0; l < dvlen; l++) { bdv[l].flags = dv[l].flags; }
+  for (bp = dp, i = 0; i < nblocks; i++, bp += bsize) {
+    uint32_t gap;
+    GRN_B_DEC(gap, tp);
+    GRN_B_DEC(bsize, tp);
+    if (bp + bsize > dpe || !grn_p_decv(ctx, bp, bsize, bdv, dvlen)) { break; }
+    for (l = 0; l < dvlen; l++) {
+      if (offsets[l] + bdv[l].data_size > dv[l].data_size) { break; }
+      memcpy(dv[l].data + offsets[l], bdv[l].data,
+             bdv[l].data_size * sizeof(uint32_t));
+      offsets[l] += bdv[l].data_size;
+      dv[l].flags |= bdv[l].flags & USE_P_ENC;
+    }
+    if (l < dvlen) { break; }
+  }
+  datavec_fin(ctx, bdv);
+  if (i < nblocks) {
+    GRN_LOG(ctx, GRN_LOG_WARNING, "broken chunk skip block: <%u/%u>",
+            i, nblocks);
+    for (l = 0; l < dvlen; l++) { dv[l].data_size = offsets[l]; }
+  }
+  return size;
+}
+
 static grn_rc
 chunk_flush(grn_ctx *ctx, grn_ii *ii, chunk_info *cinfo, uint8_t *enc, uint32_t encsize)
 {
@@ -2528,7 +2941,7 @@ chunk_merge(grn_ctx *ctx, grn_ii *ii, buffer *sb, buffer_term *bt,
     if ((ii->header->flags & GRN_OBJ_WITH_POSITION)) {
       rdv[ii->n_elements - 1].flags = ODD;
     }
-    bufsize += grn_p_decv(ctx, scp, cinfo->size, rdv, ii->n_elements);
+    bufsize += chunk_decv(ctx, ii, scp, cinfo->size, rdv, ii->n_elements);
     // (df in chunk list) = a[1] - sdf;
     {
       int j = 0;
@@ -2567,8 +2980,8 @@ chunk_merge(grn_ctx *ctx, grn_ii *ii, buffer *sb, buffer_term *bt,
     uint8_t *enc;
     uint32_t encsize;
     uint32_t np = posp - dv[ii->n_elements - 1].data;
-    uint32_t f_s = (ndf < 3) ? 0 : USE_P_ENC;
-    uint32_t f_d = ((ndf < 16) || (ndf <= (lid.rid >> 8))) ? 0 : USE_P_ENC;
+    uint32_t f_s = (ndf < 3) ? 0 : P_ENC_FLAGS(ii);
+    uint32_t f_d = ((ndf < 16) || (ndf <= (lid.rid >> 8))) ? 0 : P_ENC_FLAGS(ii);
     dv[j].data_size = ndf; dv[j++].flags = f_d;
     if ((ii->header->flags & GRN_OBJ_WITH_SECTION)) {
       dv[j].data_size = ndf; dv[j++].flags = f_s;
@@ -2578,11 +2991,14 @@ chunk_merge(grn_ctx *ctx, grn_ii *ii, buffer *sb, buffer_term *bt,
       dv[j].data_size = ndf; dv[j++].flags = f_s;
     }
     if ((ii->header->flags & GRN_OBJ_WITH_POSITION)) {
-      uint32_t f_p = ((np < 32) || (np <= (spos >> 13))) ? 0 : USE_P_ENC;
+      uint32_t f_p = ((np < 32) || (np <= (spos >> 13))) ? 0 : P_ENC_FLAGS(ii);
       dv[j].data_size = np; dv[j].flags = f_p|ODD;
     }
-    if ((enc = GRN_MALLOC((ndf * 4 + np) * 2))) {
-      encsize = grn_p_encv(ctx, dv, ii->n_elements, enc);
+    if (CHUNK_MAX_SCORE_P(ii)) {
+      cinfo->max_score = datavec_max_score(ii, dv, ndf);
+    }
+    if ((enc = GRN_MALLOC((ndf * 4 + np) * 2 + CHUNK_SKIP_MAX_OVERHEAD(ndf)))) {
+      encsize = chunk_encv(ctx, ii, dv, ii->n_elements, enc);
       if (!(rc = chunk_flush(ctx, ii, cinfo, enc, encsize))) {
         chunk_free(ctx, ii, segno, 0, size);
       }
@@ -2624,7 +3040,7 @@ buffer_merge(grn_ctx *ctx, grn_ii *ii, uint32_t seg, grn_hash *h,
     chunk_info *cinfo = NULL;
     grn_id crid = GRN_ID_NIL;
     docinfo cid = {0, 0, 0, 0, 0}, lid = {0, 0, 0, 0, 0}, bid = {0, 0};
-    uint32_t sdf = 0, snn = 0, ndf;
+    uint32_t sdf = 0, snn = 0, ndf, tail_max_score = 0;
     uint32_t *srp = NULL, *ssp = NULL, *stp = NULL, *sop = NULL, *snp = NULL;
     if (!bt->tid) {
       nterms_void++;
@@ -2654,9 +3070,7 @@ buffer_merge(grn_ctx *ctx, grn_ii *ii, uint32_t seg, grn_hash *h,
           return GRN_NO_MEMORY_AVAILABLE;
         }
         for (i = 0; i < nchunks; i++) {
-          GRN_B_DEC(cinfo[i].segno, scp);
-          GRN_B_DEC(cinfo[i].size, scp);
-          GRN_B_DEC(cinfo[i].dgap, scp);
+          scp = chunk_info_decode(ii, &cinfo[i], scp);
           crid += cinfo[i].dgap;
           if (bid.rid <= crid) {
             rc = chunk_merge(ctx, ii, sb, bt, &cinfo[i], crid, dv,
@@ -2670,7 +3084,8 @@ buffer_merge(grn_ctx *ctx, grn_ii *ii, uint32_t seg, grn_hash *h,
         }
       }
       if (sce > scp) {
-        size += grn_p_decv(ctx, scp, sce - scp, rdv, ii->n_elements);
+        scp = chunk_tail_decode(ii, scp, &tail_max_score);
+        size += chunk_decv(ctx, ii, scp, sce - scp, rdv, ii->n_elements);
         {
           int j = 0;
           sdf = rdv[j].data_size;
@@ -2762,8 +3177,8 @@ buffer_merge(grn_ctx *ctx, grn_ii *ii, uint32_t seg, grn_hash *h,
           int j = 0;
           uint8_t *dcp0;
           uint32_t encsize;
-          uint32_t f_s = (ndf < 3) ? 0 : USE_P_ENC;
-          uint32_t f_d = ((ndf < 16) || (ndf <= (lid.rid >> 8))) ? 0 : USE_P_ENC;
+          uint32_t f_s = (ndf < 3) ? 0 : P_ENC_FLAGS(ii);
+          uint32_t f_d = ((ndf < 16) || (ndf <= (lid.rid >> 8))) ? 0 : P_ENC_FLAGS(ii);
           dv[j].data_size = ndf; dv[j++].flags = f_d;
           if ((ii->header->flags & GRN_OBJ_WITH_SECTION)) {
             dv[j].data_size = ndf; dv[j++].flags = f_s;
@@ -2774,7 +3189,7 @@ buffer_merge(grn_ctx *ctx, grn_ii *ii, uint32_t seg, grn_hash *h,
           }
           if ((ii->header->flags & GRN_OBJ_WITH_POSITION)) {
             uint32_t np = posp - dv[ii->n_elements - 1].data;
-            uint32_t f_p = ((np < 32) || (np <= (spos >> 13))) ? 0 : USE_P_ENC;
+            uint32_t f_p = ((np < 32) || (np <= (spos >> 13))) ? 0 : P_ENC_FLAGS(ii);
             dv[j].data_size = np; dv[j].flags = f_p|ODD;
           }
           dcp0 = dcp;
@@ -2783,12 +3198,15 @@ buffer_merge(grn_ctx *ctx, grn_ii *ii, uint32_t seg, grn_hash *h,
             int i;
             GRN_B_ENC(nchunks, dcp);
             for (i = 0; i < nchunks; i++) {
-              GRN_B_ENC(cinfo[i].segno, dcp);
-              GRN_B_ENC(cinfo[i].size, dcp);
-              GRN_B_ENC(cinfo[i].dgap, dcp);
+              dcp = chunk_info_encode(ii, &cinfo[i], dcp);
             }
           }
-          encsize = grn_p_encv(ctx, dv, ii->n_elements, dcp);
+          tail_max_score = 0;
+          if (CHUNK_MAX_SCORE_P(ii)) {
+            tail_max_score = datavec_max_score(ii, dv, ndf);
+            GRN_B_ENC(tail_max_score, dcp);
+          }
+          encsize = chunk_encv(ctx, ii, dv, ii->n_elements, dcp);
 
           if (sb->header.chunk_size + S_SEGMENT <= (dcp - dc) + encsize) {
             int i;
@@ -2830,13 +3248,12 @@ buffer_merge(grn_ctx *ctx, grn_ii *ii, uint32_t seg, grn_hash *h,
               !chunk_flush(ctx, ii, &cinfo[nchunks], dcp, encsize)) {
             int i;
             cinfo[nchunks].dgap = lid.rid - crid;
+            cinfo[nchunks].max_score = tail_max_score;
             nchunks++;
             dcp = dcp0;
             GRN_B_ENC(nchunks, dcp);
             for (i = 0; i < nchunks; i++) {
-              GRN_B_ENC(cinfo[i].segno, dcp);
-              GRN_B_ENC(cinfo[i].size, dcp);
-              GRN_B_ENC(cinfo[i].dgap, dcp);
+              dcp = chunk_info_encode(ii, &cinfo[i], dcp);
             }
             GRN_LOG(ctx, GRN_LOG_NOTICE, "split (%d) encsize=%d", tid, encsize);
             bt->tid |= CHUNK_SPLIT;
@@ -3012,7 +3429,7 @@ grn_ii_buffer_check(grn_ctx *ctx, grn_ii *ii, uint32_t seg)
     chunk_info *cinfo = NULL;
     grn_id crid = GRN_ID_NIL;
     docinfo bid = {0, 0};
-    uint32_t sdf = 0, snn = 0;
+    uint32_t sdf = 0, snn = 0, tail_max_score = 0;
     uint32_t *srp = NULL, *ssp = NULL, *stp = NULL, *sop = NULL, *snp = NULL;
     if (!bt->tid && !bt->pos_in_buffer && !bt->size_in_buffer) {
       nterms_void++;
@@ -3047,14 +3464,13 @@ grn_ii_buffer_check(grn_ctx *ctx, grn_ii *ii, uint32_t seg)
           return;
         }
         for (i = 0; i < nchunks; i++) {
-          GRN_B_DEC(cinfo[i].segno, scp);
-          GRN_B_DEC(cinfo[i].size, scp);
-          GRN_B_DEC(cinfo[i].dgap, scp);
+          scp = chunk_info_decode(ii, &cinfo[i], scp);
           crid += cinfo[i].dgap;
         }
       }
       if (sce > scp) {
-        size += grn_p_decv(ctx, scp, sce - scp, rdv, ii->n_elements);
+        scp = chunk_tail_decode(ii, scp, &tail_max_score);
+        size += chunk_decv(ctx, ii, scp, sce - scp, rdv, ii->n_elements);
         {
           int j = 0;
           sdf = rdv[j].data_size;
@@ -3497,6 +3913,8 @@ _grn_ii_create(grn_ctx *ctx, grn_ii *ii, const char *path, grn_obj *lexicon, uin
     header->garbages[i] = NOT_ASSIGNED;
   }
   header->flags = flags;
+  header->features =
+    GRN_II_FEATURE_CHUNK_MAX_SCORE | GRN_II_FEATURE_CHUNK_SKIP;
   ii->seg = seg;
   ii->chunk = chunk;
   ii->lexicon = lexicon;
@@ -3510,6 +3928,164 @@ _grn_ii_create(grn_ctx *ctx, grn_ii *ii, const char *path, grn_obj *lexicon, uin
   return ii;
 }
 
+/*
+ * The ios of an index belong to a generation. Readers pin the current
+ * generation while they read the index, and grn_ii_rebuild() replaces it
+ * with a new one. The ios of a replaced generation are closed when the last
+ * reader unpins it. The index itself holds a reference to its current
+ * generation.
+ *
+ * Each generation has a view, a grn_ii that has only the fields that readers
+ * use, so that pinning is just an atomic increment. A replaced generation is
+ * kept in the list of previous generations until the index is closed
+ * because a reader may still increment it before it sees the new one.
+ */
+struct _grn_ii_generation {
+  grn_ii view;
+  uint32_t n_refs;
+  uint32_t closed;
+  grn_ii_generation *previous;
+};
+
+/* Sets the fields of the view that readers use from ii. */
+static void
+ii_generation_view_init(grn_ii_generation *generation, grn_ii *ii)
+{
+  grn_ii *view = &(generation->view);
+  memset(view, 0, sizeof(grn_ii));
+  GRN_DB_OBJ_SET_TYPE(view, GRN_COLUMN_INDEX);
+  view->seg = ii->seg;
+  view->chunk = ii->chunk;
+  view->lexicon = ii->lexicon;
+  view->lflags = ii->lflags;
+  view->encoding = ii->encoding;
+  view->n_elements = ii->n_elements;
+  view->header = ii->header;
+  view->generation = generation;
+  view->origin = ii;
+}
+
+/* Makes the generation current. Readers see its view initialized. */
+static void
+ii_generation_publish(grn_ii *ii, grn_ii_generation *generation)
+{
+  GRN_MEMORY_BARRIER();
+  *((grn_ii_generation * volatile *)&ii->generation) = generation;
+  GRN_MEMORY_BARRIER();
+}
+
+static grn_rc
+ii_generation_open(grn_ctx *ctx, grn_ii *ii, grn_ii_generation *previous)
+{
+  grn_ii_generation *generation = GRN_GMALLOC(sizeof(grn_ii_generation));
+  if (!generation) {
+    ERR(GRN_NO_MEMORY_AVAILABLE, "[ii] failed to allocate a generation");
+    return ctx->rc;
+  }
+  ii_generation_view_init(generation, ii);
+  generation->n_refs = 1;
+  generation->closed = 0;
+  generation->previous = previous;
+  ii_generation_publish(ii, generation);
+  return GRN_SUCCESS;
+}
+
+static void
+ii_generation_unref(grn_ctx *ctx, grn_ii_generation *generation)
+{
+  uint32_t n, closed;
+  GRN_ATOMIC_ADD_EX(&generation->n_refs, -1, n);
+  if (n == 1) {
+    /* A reader that pinned a replaced generation by mistake may also drop
+       its reference to 0, so only the first one closes the ios. */
+    GRN_ATOMIC_CAS_EX(&generation->closed, 0, 1, closed);
+    if (!closed) {
+      grn_io_close(ctx, generation->view.seg);
+      grn_io_close(ctx, generation->view.chunk);
+    }
+  }
+}
+
+/*
+ * Returns the view of the generation that is current now. The view keeps
+ * using the ios of the generation until it's unpinned by ii_unpin().
+ * Pinning a view pins the same generation again. No lock is taken: a
+ * reader that pinned a generation that has just been replaced drops it and
+ * pins the new one.
+ */
+static grn_ii *
+ii_pin(grn_ctx *ctx, grn_ii *ii)
+{
+  grn_ii_generation *generation;
+  uint32_t n;
+  if (ii->origin) {
+    GRN_ATOMIC_ADD_EX(&ii->generation->n_refs, 1, n);
+    return ii;
+  }
+  for (;;) {
+    generation = *((grn_ii_generation * volatile *)&ii->generation);
+    if (!generation) {
+      /* Waits for grn_ii_truncate() that creates the next generation. */
+      CRITICAL_SECTION_ENTER(ii->generation_lock);
+      CRITICAL_SECTION_LEAVE(ii->generation_lock);
+      continue;
+    }
+    GRN_ATOMIC_ADD_EX(&generation->n_refs, 1, n);
+    GRN_MEMORY_BARRIER();
+    if (generation == *((grn_ii_generation * volatile *)&ii->generation)) {
+      return &(generation->view);
+    }
+    ii_generation_unref(ctx, generation);
+  }
+}
+
+static void
+ii_unpin(grn_ctx *ctx, grn_ii *pinned)
+{
+  ii_generation_unref(ctx, pinned->generation);
+}
+
+/* Replaces the current generation of ii by the new one. */
+static void
+ii_generation_replace(grn_ctx *ctx, grn_ii *ii, grn_ii_generation *generation)
+{
+  grn_ii_generation *previous = ii->generation;
+  generation->previous = previous;
+  ii_generation_view_init(generation, ii);
+  ii_generation_publish(ii, generation);
+  ii_generation_unref(ctx, previous);
+}
+
+static void
+ii_generations_close(grn_ctx *ctx, grn_ii_generation *generation)
+{
+  while (generation) {
+    grn_ii_generation *previous = generation->previous;
+    if (!generation->closed) {
+      grn_io_close(ctx, generation->view.seg);
+      grn_io_close(ctx, generation->view.chunk);
+    }
+    GRN_GFREE(generation);
+    generation = previous;
+  }
+}
+
+static grn_ii *
+ii_init(grn_ctx *ctx, grn_ii *ii)
+{
+  ii->shadow = NULL;
+  ii->origin = NULL;
+  if (ii_generation_open(ctx, ii, NULL)) {
+    grn_io_close(ctx, ii->seg);
+    grn_io_close(ctx, ii->chunk);
+    GRN_GFREE(ii);
+    return NULL;
+  }
+  CRITICAL_SECTION_INIT(ii->shadow_lock);
+  CRITICAL_SECTION_INIT(ii->generation_lock);
+  return ii;
+}
+
 grn_ii *
 grn_ii_create(grn_ctx *ctx, const char *path, grn_obj *lexicon, uint32_t flags)
 {
@@ -3522,7 +4098,7 @@ grn_ii_create(grn_ctx *ctx, const char *path, grn_obj *lexicon, uint32_t flags)
     GRN_FREE(ii);
     return NULL;
   }
-  return ii;
+  return ii_init(ctx, ii);
 }
 
 grn_rc
@@ -3546,6 +4122,7 @@ grn_ii_truncate(grn_ctx *ctx, grn_ii *ii)
   char *segpath, *chunkpath = NULL;
   grn_obj *lexicon;
   uint32_t flags;
+  grn_ii_generation *previous;
   if ((io_segpath = grn_io_path(ii->seg)) && *io_segpath != '\0') {
     if (!(segpath = GRN_STRDUP(io_segpath))) {
       ERR(GRN_NO_MEMORY_AVAILABLE, "cannot duplicate path: <%s>", io_segpath);
@@ -3564,16 +4141,33 @@ grn_ii_truncate(grn_ctx *ctx, grn_ii *ii)
   }
   lexicon = ii->lexicon;
   flags = ii->header->flags;
-  if ((rc = grn_io_close(ctx, ii->seg))) { goto exit; }
-  if ((rc = grn_io_close(ctx, ii->chunk))) { goto exit; }
+  CRITICAL_SECTION_ENTER(ii->generation_lock);
+  previous = ii->generation;
+  ii_generation_publish(ii, NULL);
   ii->seg = NULL;
   ii->chunk = NULL;
   if (segpath && (rc = grn_io_remove(ctx, segpath))) { goto exit; }
   if (chunkpath && (rc = grn_io_remove(ctx, chunkpath))) { goto exit; }
   if (!_grn_ii_create(ctx, ii, segpath, lexicon, flags)) {
     rc = GRN_UNKNOWN_ERROR;
+  } else {
+    rc = ii_generation_open(ctx, ii, previous);
   }
 exit:
+  if (rc) {
+    /* Readers keep using the ios of the previous generation. */
+    if (ii->seg) {
+      grn_io_close(ctx, ii->seg);
+      grn_io_close(ctx, ii->chunk);
+    }
+    ii->seg = previous->view.seg;
+    ii->chunk = previous->view.chunk;
+    ii->header = previous->view.header;
+    ii_generation_publish(ii, previous);
+  } else {
+    ii_generation_unref(ctx, previous);
+  }
+  CRITICAL_SECTION_LEAVE(ii->generation_lock);
   if (segpath) { GRN_FREE(segpath); }
   if (chunkpath) { GRN_FREE(chunkpath); }
   return rc;
@@ -3625,16 +4219,16 @@ grn_ii_open(grn_ctx *ctx, const char *path, grn_obj *lexicon)
   if ((header->flags & GRN_OBJ_WITH_SECTION)) { ii->n_elements++; }
   if ((header->flags & GRN_OBJ_WITH_WEIGHT)) { ii->n_elements++; }
   if ((header->flags & GRN_OBJ_WITH_POSITION)) { ii->n_elements++; }
-  return ii;
+  return ii_init(ctx, ii);
 }
 
 grn_rc
 grn_ii_close(grn_ctx *ctx, grn_ii *ii)
 {
-  grn_rc rc;
   if (!ii) { return GRN_INVALID_ARGUMENT; }
-  if ((rc = grn_io_close(ctx, ii->seg))) { return rc; }
-  if ((rc = grn_io_close(ctx, ii->chunk))) { return rc; }
+  ii_generations_close(ctx, ii->generation);
+  CRITICAL_SECTION_FIN(ii->shadow_lock);
+  CRITICAL_SECTION_FIN(ii->generation_lock);
   GRN_GFREE(ii);
   /*
   {
@@ -3646,27 +4240,26 @@ grn_ii_close(grn_ctx *ctx, grn_ii *ii)
     }
   }
   */
-  return rc;
+  return GRN_SUCCESS;
 }
 
 grn_rc
 grn_ii_info(grn_ctx *ctx, grn_ii *ii, uint64_t *seg_size, uint64_t *chunk_size)
 {
-  grn_rc rc;
+  grn_rc rc = GRN_SUCCESS;
+  grn_ii *pinned;
 
+  pinned = ii_pin(ctx, ii);
   if (seg_size) {
-    if ((rc = grn_io_size(ctx, ii->seg, seg_size))) {
-      return rc;
-    }
+    rc = grn_io_size(ctx, pinned->seg, seg_size);
   }
 
-  if (chunk_size) {
-    if ((rc = grn_io_size(ctx, ii->chunk, chunk_size))) {
-      return rc;
-    }
+  if (!rc && chunk_size) {
+    rc = grn_io_size(ctx, pinned->chunk, chunk_size);
   }
+  ii_unpin(ctx, pinned);
 
-  return GRN_SUCCESS;
+  return rc;
 }
 
 void
@@ -3914,6 +4507,12 @@ exit :
 #define SOLE_DOC_USED 4
 #define SOLE_POS_USED 8
 
+typedef struct {
+  grn_id rid;
+  uint32_t offset;
+  uint32_t size;
+} chunk_block;
+
 struct _grn_ii_cursor {
   grn_db_obj obj;
   grn_ctx *ctx;
@@ -3940,11 +4539,24 @@ struct _grn_ii_cursor {
   uint32_t nchunks;
   uint32_t curr_chunk;
   chunk_info *cinfo;
+  grn_id *chunk_rids;
+  uint32_t tail_max_score;
+  uint32_t buffer_max_score;
+  uint32_t n_skipped_chunks;
+  uint32_t n_skipped_blocks;
   grn_io_win iw;
   uint8_t *cp;
   uint8_t *cpe;
   datavec rdv[MAX_N_ELEMENTS + 1];
 
+  uint32_t nblocks;
+  uint32_t curr_block;
+  uint32_t max_blocks;
+  chunk_block *blocks;
+  uint8_t *bcp;
+  grn_io_win ciw;
+  uint8_t *ccp;
+
   struct grn_ii_buffer *buf;
   uint16_t stat;
   uint16_t nextb;
@@ -4011,13 +4623,17 @@ grn_ii_cursor_open(grn_ctx *ctx, grn_ii *ii, grn_id tid,
 {
   grn_ii_cursor *c  = NULL;
   uint32_t pos, *a;
-  if (!(a = array_at(ctx, ii, tid))) { return NULL; }
+  ii = ii_pin(ctx, ii);
+  if (!(a = array_at(ctx, ii, tid))) {
+    ii_unpin(ctx, ii);
+    return NULL;
+  }
   for (;;) {
     if (!(pos = a[0])) { goto exit; }
     if (!(c = GRN_MALLOC(sizeof(grn_ii_cursor)))) { goto exit; }
     memset(c, 0, sizeof(grn_ii_cursor));
     c->ctx = ctx;
-    c->ii = ii;
+    c->ii = ii_pin(ctx, ii);
     c->id = tid;
     c->min = min;
     c->max = max;
@@ -4039,6 +4655,7 @@ grn_ii_cursor_open(grn_ctx *ctx, grn_ii *ii, grn_id tid,
       uint32_t chunk;
       buffer_term *bt;
       if ((c->buffer_pseg = buffer_open(ctx, ii, pos, &bt, &c->buf)) == NOT_ASSIGNED) {
+        ii_unpin(ctx, c->ii);
         GRN_FREE(c);
         c = NULL;
         goto exit;
@@ -4048,6 +4665,7 @@ grn_ii_cursor_open(grn_ctx *ctx, grn_ii *ii, grn_id tid,
         if (!(c->cp = WIN_MAP2(ii->chunk, ctx, &c->iw, chunk, bt->pos_in_chunk,
                                bt->size_in_chunk, grn_io_rdonly))) {
           buffer_close(ctx, ii, c->buffer_pseg);
+          ii_unpin(ctx, c->ii);
           GRN_FREE(c);
           c = NULL;
           goto exit;
@@ -4065,18 +4683,20 @@ grn_ii_cursor_open(grn_ctx *ctx, grn_ii *ii, grn_id tid,
             grn_ii_cursor_close(ctx, c);
             continue;
           }
-          if (!(c->cinfo = GRN_MALLOCN(chunk_info, c->nchunks))) {
+          if (!(c->cinfo = GRN_MALLOCN(chunk_info, c->nchunks)) ||
+              !(c->chunk_rids = GRN_MALLOCN(grn_id, c->nchunks))) {
+            if (c->cinfo) { GRN_FREE(c->cinfo); }
             buffer_close(ctx, ii, c->buffer_pseg);
             grn_io_win_unmap2(&c->iw);
+            ii_unpin(ctx, c->ii);
             GRN_FREE(c);
             c = NULL;
             goto exit;
           }
           for (i = 0, crid = GRN_ID_NIL; i < c->nchunks; i++) {
-            GRN_B_DEC(c->cinfo[i].segno, c->cp);
-            GRN_B_DEC(c->cinfo[i].size, c->cp);
-            GRN_B_DEC(c->cinfo[i].dgap, c->cp);
+            c->cp = chunk_info_decode(ii, &c->cinfo[i], c->cp);
             crid += c->cinfo[i].dgap;
+            c->chunk_rids[i] = crid;
             if (crid < min) { c->curr_chunk = i + 1; }
           }
           if (chunk_is_reused(ctx, ii, c, chunk, c->buf->header.chunk_size)) {
@@ -4084,6 +4704,9 @@ grn_ii_cursor_open(grn_ctx *ctx, grn_ii *ii, grn_id tid,
             continue;
           }
         }
+        if (c->cp < c->cpe) {
+          c->cp = chunk_tail_decode(ii, c->cp, &c->tail_max_score);
+        }
         if ((ii->header->flags & GRN_OBJ_WITH_POSITION)) {
           c->rdv[ii->n_elements - 1].flags = ODD;
         }
@@ -4096,9 +4719,203 @@ grn_ii_cursor_open(grn_ctx *ctx, grn_ii *ii, grn_id tid,
   }
 exit :
   array_unref(ii, tid);
+  ii_unpin(ctx, ii);
   return c;
 }
 
+/*
+ * Returns an upper bound of the sum of (tf + weight) that a record can get
+ * from the postings which the cursor has not returned yet. It must be called
+ * before the first grn_ii_cursor_next() because the buffer part is bounded by
+ * walking the whole buffer chain of the term.
+ */
+static uint32_t
+grn_ii_cursor_max_score(grn_ctx *ctx, grn_ii_cursor *c)
+{
+  uint32_t i, max_score = 0, buffer_max_score = 0;
+  if (!c->buf) { return c->pb.tf + c->pb.weight; }
+  for (i = c->curr_chunk ? c->curr_chunk - 1 : 0; i < c->nchunks; i++) {
+    if (max_score < c->cinfo[i].max_score) {
+      max_score = c->cinfo[i].max_score;
+    }
+  }
+  if (max_score < c->tail_max_score) { max_score = c->tail_max_score; }
+  {
+    uint16_t nextb = c->nextb;
+    grn_id rid, lrid = GRN_ID_NIL;
+    uint32_t sid, tf, weight = 0, score = 0;
+    while (nextb) {
+      buffer_rec *br = BUFFER_REC_AT(c->buf, nextb);
+      uint8_t *p = NEXT_ADDR(br);
+      GRN_B_DEC(rid, p);
+      if ((c->ii->header->flags & GRN_OBJ_WITH_SECTION)) { GRN_B_DEC(sid, p); }
+      GRN_B_DEC(tf, p);
+      if ((c->ii->header->flags & GRN_OBJ_WITH_WEIGHT)) { GRN_B_DEC(weight, p); }
+      if (rid != lrid) {
+        if (buffer_max_score < score) { buffer_max_score = score; }
+        score = 0;
+        lrid = rid;
+      }
+      if (tf) { score += tf + weight; }
+      nextb = br->step;
+    }
+    if (buffer_max_score < score) { buffer_max_score = score; }
+  }
+  c->buffer_max_score = buffer_max_score;
+  /* a record in the buffer overrides the same section in the chunks */
+  if ((c->ii->header->flags & GRN_OBJ_WITH_SECTION)) {
+    return max_score + buffer_max_score;
+  }
+  return max_score < buffer_max_score ? buffer_max_score : max_score;
+}
+
+/*
+ * Returns an upper bound of the sum of (tf + weight) that the record rid
+ * can get from the cursor. Only the chunks which can contain rid are
+ * consulted. grn_ii_cursor_max_score() must be called before.
+ */
+static uint32_t
+grn_ii_cursor_max_score_at(grn_ctx *ctx, grn_ii_cursor *c, grn_id rid)
+{
+  uint32_t l = 0, r, max_score;
+  if (!c->buf) { return c->pb.rid == rid ? c->pb.tf + c->pb.weight : 0; }
+  /* the first split chunk whose last record is not before rid */
+  r = c->nchunks;
+  while (l < r) {
+    uint32_t m = (l + r) >> 1;
+    if (c->chunk_rids[m] < rid) { l = m + 1; } else { r = m; }
+  }
+  max_score = (l < c->nchunks) ? c->cinfo[l].max_score : c->tail_max_score;
+  /* rid may continue in the next chunk when it is the last one of a chunk */
+  if (l < c->nchunks && c->chunk_rids[l] == rid) {
+    uint32_t next_max_score =
+      (l + 1 < c->nchunks) ? c->cinfo[l + 1].max_score : c->tail_max_score;
+    max_score += next_max_score;
+  }
+  if ((c->ii->header->flags & GRN_OBJ_WITH_SECTION)) {
+    return max_score + c->buffer_max_score;
+  }
+  return max_score < c->buffer_max_score ? c->buffer_max_score : max_score;
+}
+
+static void
+grn_ii_cursor_set_chunk_data(grn_ctx *ctx, grn_ii_cursor *c)
+{
+  int j = 0;
+  c->cdf = c->rdv[j].data_size;
+  c->crp = c->cdp = c->rdv[j++].data;
+  if ((c->ii->header->flags & GRN_OBJ_WITH_SECTION)) {
+    c->csp = c->rdv[j++].data;
+  }
+  c->ctp = c->rdv[j++].data;
+  if ((c->ii->header->flags & GRN_OBJ_WITH_WEIGHT)) {
+    c->cwp = c->rdv[j++].data;
+  }
+  c->cpp = c->rdv[j].data;
+}
+
+/*
+ * Loads the next chunk (a split chunk or the tail in the buffer segment).
+ * A chunk with a skip table is decoded block by block later by
+ * grn_ii_cursor_load_block(). Returns GRN_FALSE if there is no data.
+ */
+static grn_bool
+grn_ii_cursor_load_chunk(grn_ctx *ctx, grn_ii_cursor *c)
+{
+  uint8_t *cp, *cpe;
+  uint32_t segno = 0, size;
+  if (c->ccp) {
+    grn_io_win_unmap2(&c->ciw);
+    c->ccp = NULL;
+  }
+  c->nblocks = 0;
+  c->curr_block = 0;
+  if (c->curr_chunk == c->nchunks) {
+    if (c->cp >= c->cpe) { return GRN_FALSE; }
+    cp = c->cp;
+    cpe = c->cpe;
+  } else {
+    segno = c->cinfo[c->curr_chunk].segno;
+    size = c->cinfo[c->curr_chunk].size;
+    if (!size || !(cp = WIN_MAP2(c->ii->chunk, ctx, &c->ciw, segno, 0,
+                                 size, grn_io_rdonly))) {
+      return GRN_FALSE;
+    }
+    c->ccp = cp;
+    cpe = cp + size;
+  }
+  if (CHUNK_SKIP_P(c->ii)) {
+    uint32_t nblocks;
+    GRN_B_DEC(nblocks, cp);
+    if (nblocks > 1) {
+      uint32_t i, df, pgap, offset = 0;
+      grn_id rid = GRN_ID_NIL;
+      GRN_B_DEC(df, cp);
+      GRN_B_DEC(pgap, cp);
+      if (c->max_blocks < nblocks) {
+        chunk_block *blocks = GRN_REALLOC(c->blocks,
+                                          sizeof(chunk_block) * nblocks);
+        if (!blocks) { return GRN_FALSE; }
+        c->blocks = blocks;
+        c->max_blocks = nblocks;
+      }
+      for (i = 0; i < nblocks; i++) {
+        uint32_t gap;
+        GRN_B_DEC(gap, cp);
+        rid += gap;
+        c->blocks[i].rid = rid;
+        c->blocks[i].offset = offset;
+        GRN_B_DEC(c->blocks[i].size, cp);
+        offset += c->blocks[i].size;
+      }
+      c->bcp = cp;
+      c->nblocks = nblocks;
+      c->cdf = 0;
+      c->crp = c->cdp;
+      goto exit;
+    }
+  }
+  grn_p_decv(ctx, cp, cpe - cp, c->rdv, c->ii->n_elements);
+  if (c->ccp) {
+    grn_io_win_unmap2(&c->ciw);
+    c->ccp = NULL;
+    if (chunk_is_reused(ctx, c->ii, c, segno, size)) {
+      GRN_LOG(ctx, GRN_LOG_WARNING,
+              "chunk(%d) is reused by another thread", segno);
+      return GRN_FALSE;
+    }
+  }
+  grn_ii_cursor_set_chunk_data(ctx, c);
+exit :
+  c->pc.rid = 0;
+  c->pc.sid = 0;
+  c->pc.rest = 0;
+  c->curr_chunk++;
+  return GRN_TRUE;
+}
+
+/* Decodes the next block of the current chunk. */
+static grn_bool
+grn_ii_cursor_load_block(grn_ctx *ctx, grn_ii_cursor *c)
+{
+  chunk_block *block = &c->blocks[c->curr_block++];
+  if (!grn_p_decv(ctx, c->bcp + block->offset, block->size,
+                  c->rdv, c->ii->n_elements)) {
+    return GRN_FALSE;
+  }
+  if (c->ccp) {
+    chunk_info *cinfo = &c->cinfo[c->curr_chunk - 1];
+    if (chunk_is_reused(ctx, c->ii, c, cinfo->segno, cinfo->size)) {
+      GRN_LOG(ctx, GRN_LOG_WARNING,
+              "chunk(%d) is reused by another thread", cinfo->segno);
+      return GRN_FALSE;
+    }
+  }
+  grn_ii_cursor_set_chunk_data(ctx, c);
+  c->pc.rest = 0;
+  return GRN_TRUE;
+}
+
 grn_ii_posting *
 grn_ii_cursor_next(grn_ctx *ctx, grn_ii_cursor *c)
 {
@@ -4147,54 +4964,18 @@ grn_ii_cursor_next(grn_ctx *ctx, grn_ii_cursor *c)
               GRN_OBJ_FIN(ctx, &buf);
             }
             */
+          } else if (c->curr_block < c->nblocks) {
+            if (!grn_ii_cursor_load_block(ctx, c)) {
+              c->pc.rid = 0;
+              break;
+            }
+            continue;
           } else {
             if (c->curr_chunk <= c->nchunks) {
-              if (c->curr_chunk == c->nchunks) {
-                if (c->cp < c->cpe) {
-                  grn_p_decv(ctx, c->cp, c->cpe - c->cp, c->rdv, c->ii->n_elements);
-                } else {
-                  c->pc.rid = 0;
-                  break;
-                }
-              } else {
-                uint8_t *cp;
-                grn_io_win iw;
-                uint32_t size = c->cinfo[c->curr_chunk].size;
-                if (size && (cp = WIN_MAP2(c->ii->chunk, ctx, &iw,
-                                           c->cinfo[c->curr_chunk].segno, 0,
-                                           size, grn_io_rdonly))) {
-                  grn_p_decv(ctx, cp, size, c->rdv, c->ii->n_elements);
-                  grn_io_win_unmap2(&iw);
-                  if (chunk_is_reused(ctx, c->ii, c,
-                                      c->cinfo[c->curr_chunk].segno, size)) {
-                    GRN_LOG(ctx, GRN_LOG_WARNING,
-                            "chunk(%d) is reused by another thread",
-                            c->cinfo[c->curr_chunk].segno);
-                    c->pc.rid = 0;
-                    break;
-                  }
-                } else {
-                  c->pc.rid = 0;
-                  break;
-                }
-              }
-              {
-                int j = 0;
-                c->cdf = c->rdv[j].data_size;
-                c->crp = c->cdp = c->rdv[j++].data;
-                if ((c->ii->header->flags & GRN_OBJ_WITH_SECTION)) {
-                  c->csp = c->rdv[j++].data;
-                }
-                c->ctp = c->rdv[j++].data;
-                if ((c->ii->header->flags & GRN_OBJ_WITH_WEIGHT)) {
-                  c->cwp = c->rdv[j++].data;
-                }
-                c->cpp = c->rdv[j].data;
+              if (!grn_ii_cursor_load_chunk(ctx, c)) {
+                c->pc.rid = 0;
+                break;
               }
-              c->pc.rid = 0;
-              c->pc.sid = 0;
-              c->pc.rest = 0;
-              c->curr_chunk++;
               continue;
             } else {
               c->pc.rid = 0;
@@ -4331,14 +5112,72 @@ grn_ii_cursor_next_pos(grn_ctx *ctx, grn_ii_cursor *c)
   return c->post;
 }
 
+#define GRN_II_POSTING_LT(p,rid_,sid_) \
+  ((p)->rid < (rid_) || ((p)->rid == (rid_) && (p)->sid < (sid_)))
+
+/*
+ * Moves the cursor to the first posting which is not less than (rid, sid)
+ * and returns it. Split chunks and blocks in a chunk which end before rid
+ * are skipped without decoding.
+ */
+grn_ii_posting *
+grn_ii_cursor_seek(grn_ctx *ctx, grn_ii_cursor *c, grn_id rid, uint32_t sid)
+{
+  grn_ii_posting *p = c->post;
+  if (p && !GRN_II_POSTING_LT(p, rid, sid)) { return p; }
+  if (c->buf && c->pc.rid < rid) {
+    grn_bool skipped = GRN_FALSE;
+    while (c->curr_chunk < c->nchunks && c->chunk_rids[c->curr_chunk] < rid) {
+      c->curr_chunk++;
+      c->n_skipped_chunks++;
+      skipped = GRN_TRUE;
+    }
+    if (skipped) {
+      c->cdf = 0;
+      c->crp = c->cdp;
+      c->nblocks = 0;
+      c->curr_block = 0;
+      if (!grn_ii_cursor_load_chunk(ctx, c)) {
+        c->curr_chunk = c->nchunks + 1;
+      }
+      c->stat |= CHUNK_USED;
+    }
+    if (c->curr_block < c->nblocks &&
+        (!c->curr_block || c->blocks[c->curr_block - 1].rid < rid)) {
+      /* the last block whose preceding block ends before rid */
+      uint32_t l = c->curr_block, r = c->nblocks - 1;
+      while (l < r) {
+        uint32_t m = (l + r + 1) >> 1;
+        if (c->blocks[m - 1].rid < rid) { l = m; } else { r = m - 1; }
+      }
+      if (l > c->curr_block || c->crp < c->cdp + c->cdf) {
+        c->n_skipped_blocks += l - c->curr_block;
+        c->curr_block = l;
+        c->cdf = 0;
+        c->crp = c->cdp;
+        c->pc.rid = l ? c->blocks[l - 1].rid : 0;
+        c->pc.sid = 0;
+        c->pc.rest = 0;
+        c->stat |= CHUNK_USED;
+      }
+    }
+  }
+  while ((p = grn_ii_cursor_next(ctx, c)) && GRN_II_POSTING_LT(p, rid, sid)) {}
+  return p;
+}
+
 grn_rc
 grn_ii_cursor_close(grn_ctx *ctx, grn_ii_cursor *c)
 {
   if (!c) { return GRN_INVALID_ARGUMENT; }
   datavec_fin(ctx, c->rdv);
   if (c->cinfo) { GRN_FREE(c->cinfo); }
+  if (c->chunk_rids) { GRN_FREE(c->chunk_rids); }
+  if (c->blocks) { GRN_FREE(c->blocks); }
+  if (c->ccp) { grn_io_win_unmap2(&c->ciw); }
   if (c->buf) { buffer_close(ctx, c->ii, c->buffer_pseg); }
   if (c->cp) { grn_io_win_unmap2(&c->iw); }
+  ii_unpin(ctx, c->ii);
   GRN_FREE(c);
   return GRN_SUCCESS;
 }
@@ -4347,8 +5186,11 @@ uint32_t
 grn_ii_get_chunksize(grn_ctx *ctx, grn_ii *ii, grn_id tid)
 {
   uint32_t res, pos, *a;
-  a = array_at(ctx, ii, tid);
-  if (!a) { return 0; }
+  ii = ii_pin(ctx, ii);
+  if (!(a = array_at(ctx, ii, tid))) {
+    ii_unpin(ctx, ii);
+    return 0;
+  }
   if ((pos = a[0])) {
     if (pos & 1) {
       res = 0;
@@ -4367,6 +5209,7 @@ grn_ii_get_chunksize(grn_ctx *ctx, grn_ii *ii, grn_id tid)
     res = 0;
   }
   array_unref(ii, tid);
+  ii_unpin(ctx, ii);
   return res;
 }
 
@@ -4374,8 +5217,11 @@ uint32_t
 grn_ii_estimate_size(grn_ctx *ctx, grn_ii *ii, grn_id tid)
 {
   uint32_t res, pos, *a;
-  a = array_at(ctx, ii, tid);
-  if (!a) { return 0; }
+  ii = ii_pin(ctx, ii);
+  if (!(a = array_at(ctx, ii, tid))) {
+    ii_unpin(ctx, ii);
+    return 0;
+  }
   if ((pos = a[0])) {
     if (pos & 1) {
       res = 1;
@@ -4394,15 +5240,16 @@ grn_ii_estimate_size(grn_ctx *ctx, grn_ii *ii, grn_id tid)
     res = 0;
   }
   array_unref(ii, tid);
+  ii_unpin(ctx, ii);
   return res;
 }
 
-int
-grn_ii_entry_info(grn_ctx *ctx, grn_ii *ii, grn_id tid, unsigned int *a,
-                   unsigned int *chunk, unsigned int *chunk_size, unsigned int *buffer_free,
-                   unsigned int *nterms, unsigned int *nterms_void, unsigned int *bt_tid,
-                   unsigned int *size_in_chunk, unsigned int *pos_in_chunk,
-                   unsigned int *size_in_buffer, unsigned int *pos_in_buffer)
+static int
+ii_entry_info(grn_ctx *ctx, grn_ii *ii, grn_id tid, unsigned int *a,
+              unsigned int *chunk, unsigned int *chunk_size, unsigned int *buffer_free,
+              unsigned int *nterms, unsigned int *nterms_void, unsigned int *bt_tid,
+              unsigned int *size_in_chunk, unsigned int *pos_in_chunk,
+              unsigned int *size_in_buffer, unsigned int *pos_in_buffer)
 {
   buffer *b;
   buffer_term *bt;
@@ -4428,6 +5275,23 @@ grn_ii_entry_info(grn_ctx *ctx, grn_ii *ii, grn_id tid, unsigned int *a,
   return 4;
 }
 
+int
+grn_ii_entry_info(grn_ctx *ctx, grn_ii *ii, grn_id tid, unsigned int *a,
+                   unsigned int *chunk, unsigned int *chunk_size, unsigned int *buffer_free,
+                   unsigned int *nterms, unsigned int *nterms_void, unsigned int *bt_tid,
+                   unsigned int *size_in_chunk, unsigned int *pos_in_chunk,
+                   unsigned int *size_in_buffer, unsigned int *pos_in_buffer)
+{
+  int r;
+  grn_ii *pinned;
+  pinned = ii_pin(ctx, ii);
+  r = ii_entry_info(ctx, pinned, tid, a, chunk, chunk_size, buffer_free,
+                    nterms, nterms_void, bt_tid, size_in_chunk, pos_in_chunk,
+                    size_in_buffer, pos_in_buffer);
+  ii_unpin(ctx, pinned);
+  return r;
+}
+
 const char *
 grn_ii_path(grn_ii *ii)
 {
@@ -4574,6 +5438,23 @@ cursor_heap_pop(grn_ctx *ctx, cursor_heap *h)
   }
 }
 
+static inline void
+cursor_heap_pop_to(grn_ctx *ctx, cursor_heap *h, grn_id rid, uint32_t sid)
+{
+  if (h->n_entries) {
+    grn_ii_cursor *c = h->bins[0];
+    if (!grn_ii_cursor_seek(ctx, c, rid, sid)) {
+      grn_ii_cursor_close(ctx, c);
+      h->bins[0] = h->bins[--h->n_entries];
+    } else if (!grn_ii_cursor_next_pos(ctx, c)) {
+      GRN_LOG(ctx, GRN_LOG_ERROR, "invalid ii_cursor e");
+      grn_ii_cursor_close(ctx, c);
+      h->bins[0] = h->bins[--h->n_entries];
+    }
+    if (h->n_entries > 1) { cursor_heap_recalc_min(h); }
+  }
+}
+
 static inline void
 cursor_heap_pop_pos(grn_ctx *ctx, cursor_heap *h)
 {
@@ -4939,9 +5820,291 @@ grn_uvector2updspecs(grn_ctx *ctx, grn_ii *ii, grn_id rid, unsigned int section,
   return GRN_SUCCESS;
 }
 
-grn_rc
-grn_ii_column_update(grn_ctx *ctx, grn_ii *ii, grn_id rid, unsigned int section,
-                     grn_obj *oldvalue, grn_obj *newvalue, grn_obj *posting)
+/* online rebuild */
+
+/*
+ * While an index is rebuilt by grn_ii_rebuild(), the old index keeps serving
+ * queries and updates. Updates are also recorded in a change log keyed by
+ * (record, section) so that they can be replayed onto the new index before
+ * it replaces the old one. The builder skips sections that are in the log.
+ * Entries that aren't replayed yet are pending; an update of a replayed
+ * entry makes it pending again.
+ */
+
+typedef struct {
+  grn_id rid;
+  uint32_t sid;
+  grn_bool indexed;
+  grn_bool pending;
+  grn_obj old_value;
+  grn_obj new_value;
+} ii_shadow_entry;
+
+typedef struct {
+  grn_id start;
+  grn_id end;
+  grn_id next;
+} ii_shadow_range;
+
+struct _grn_ii_shadow {
+  grn_ii *ii;
+  grn_ii *origin;
+  uint32_t n_sections;
+  ii_shadow_entry **entries;
+  uint32_t n_entries;
+  ii_shadow_entry **pending;
+  uint32_t n_pending;
+  uint32_t max_pending;
+  uint32_t *slots;
+  uint32_t n_slots;
+  ii_shadow_range *ranges;
+  uint32_t n_ranges;
+  grn_bool failed;
+};
+
+#define II_SHADOW_N_INITIAL_SLOTS 0x400
+
+inline static uint32_t
+ii_shadow_hash(grn_ii_shadow *shadow, grn_id rid, uint32_t sid)
+{
+  return (rid * shadow->n_sections + sid) * 2654435761U;
+}
+
+static ii_shadow_entry *
+ii_shadow_entry_get(grn_ii_shadow *shadow, grn_id rid, uint32_t sid)
+{
+  uint32_t i, mask = shadow->n_slots - 1;
+  if (!shadow->n_slots) { return NULL; }
+  for (i = ii_shadow_hash(shadow, rid, sid) & mask; shadow->slots[i];
+       i = (i + 1) & mask) {
+    ii_shadow_entry *entry = shadow->entries[shadow->slots[i] - 1];
+    if (entry->rid == rid && entry->sid == sid) { return entry; }
+  }
+  return NULL;
+}
+
+static grn_rc
+ii_shadow_slots_grow(grn_ctx *ctx, grn_ii_shadow *shadow)
+{
+  uint32_t i, j, mask, n_slots;
+  uint32_t *slots;
+  ii_shadow_entry **entries;
+  n_slots = shadow->n_slots ? shadow->n_slots * 2 : II_SHADOW_N_INITIAL_SLOTS;
+  if (!(slots = GRN_GCALLOC(n_slots * sizeof(uint32_t)))) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  if (!(entries = GRN_GREALLOC(shadow->entries,
+                               n_slots / 2 * sizeof(ii_shadow_entry *)))) {
+    GRN_GFREE(slots);
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  mask = n_slots - 1;
+  for (i = 0; i < shadow->n_entries; i++) {
+    for (j = ii_shadow_hash(shadow, entries[i]->rid, entries[i]->sid) & mask;
+         slots[j]; j = (j + 1) & mask) {}
+    slots[j] = i + 1;
+  }
+  if (shadow->slots) { GRN_GFREE(shadow->slots); }
+  shadow->slots = slots;
+  shadow->n_slots = n_slots;
+  shadow->entries = entries;
+  return GRN_SUCCESS;
+}
+
+static void
+ii_shadow_value_copy(grn_ctx *ctx, grn_obj *dest, grn_obj *src)
+{
+  if (!src) {
+    GRN_VOID_INIT(dest);
+    return;
+  }
+  switch (src->header.type) {
+  case GRN_VECTOR :
+    {
+      unsigned int i, n = grn_vector_size(ctx, src);
+      GRN_OBJ_INIT(dest, GRN_VECTOR, 0, src->header.domain);
+      for (i = 0; i < n; i++) {
+        const char *content;
+        unsigned int weight, length;
+        grn_id domain;
+        length = grn_vector_get_element(ctx, src, i, &content, &weight, &domain);
+        grn_vector_add_element(ctx, dest, content, length, weight, domain);
+      }
+    }
+    break;
+  case GRN_UVECTOR :
+    GRN_OBJ_INIT(dest, GRN_UVECTOR, 0, src->header.domain);
+    dest->header.impl_flags |= (src->header.impl_flags & GRN_OBJ_WITH_WEIGHT);
+    grn_bulk_write(ctx, dest, GRN_BULK_HEAD(src), GRN_BULK_VSIZE(src));
+    break;
+  default :
+    GRN_OBJ_INIT(dest, GRN_BULK, 0, src->header.domain);
+    grn_bulk_write(ctx, dest, GRN_BULK_HEAD(src), GRN_BULK_VSIZE(src));
+    break;
+  }
+}
+
+/* Returns whether the builder has already read the record. */
+static grn_bool
+ii_shadow_indexed(grn_ii_shadow *shadow, grn_id rid)
+{
+  uint32_t i;
+  for (i = 0; i < shadow->n_ranges; i++) {
+    ii_shadow_range *range = &shadow->ranges[i];
+    if (range->start <= rid && rid < range->end) {
+      return rid < range->next;
+    }
+  }
+  return GRN_FALSE;
+}
+
+static void
+ii_shadow_pending_push(grn_ctx *ctx, grn_ii_shadow *shadow,
+                       ii_shadow_entry *entry)
+{
+  if (shadow->n_pending == shadow->max_pending) {
+    uint32_t max_pending = shadow->max_pending
+      ? shadow->max_pending * 2 : II_SHADOW_N_INITIAL_SLOTS;
+    ii_shadow_entry **pending =
+      GRN_GREALLOC(shadow->pending, max_pending * sizeof(ii_shadow_entry *));
+    if (!pending) {
+      GRN_LOG(ctx, GRN_LOG_ALERT, "[ii][rebuild] failed to grow the change log");
+      shadow->failed = GRN_TRUE;
+      return;
+    }
+    shadow->pending = pending;
+    shadow->max_pending = max_pending;
+  }
+  entry->pending = GRN_TRUE;
+  shadow->pending[shadow->n_pending++] = entry;
+}
+
+/*
+ * Records an update of the old index. The first update of a section keeps
+ * the value that the builder has indexed, if any, and later ones only
+ * replace the new value. Once the entry is replayed, the new index has its
+ * new value, which becomes the old value of the next update. A failure
+ * doesn't fail the update; it aborts the rebuild instead. Must be called
+ * with origin->shadow_lock held.
+ */
+static void
+ii_shadow_log(grn_ctx *ctx, grn_ii_shadow *shadow, grn_id rid, uint32_t sid,
+              grn_obj *oldvalue, grn_obj *newvalue)
+{
+  ii_shadow_entry *entry = ii_shadow_entry_get(shadow, rid, sid);
+  if (entry) {
+    if (entry->pending) {
+      GRN_OBJ_FIN(ctx, &entry->new_value);
+    } else {
+      GRN_OBJ_FIN(ctx, &entry->old_value);
+      entry->old_value = entry->new_value;
+      entry->indexed = GRN_TRUE;
+      ii_shadow_pending_push(ctx, shadow, entry);
+    }
+    ii_shadow_value_copy(ctx, &entry->new_value, newvalue);
+    return;
+  }
+  if ((shadow->n_entries + 1) * 2 > shadow->n_slots &&
+      ii_shadow_slots_grow(ctx, shadow)) {
+    GRN_LOG(ctx, GRN_LOG_ALERT, "[ii][rebuild] failed to grow the change log");
+    shadow->failed = GRN_TRUE;
+    return;
+  }
+  if (!(entry = GRN_GMALLOC(sizeof(ii_shadow_entry)))) {
+    GRN_LOG(ctx, GRN_LOG_ALERT, "[ii][rebuild] failed to log an update");
+    shadow->failed = GRN_TRUE;
+    return;
+  }
+  entry->rid = rid;
+  entry->sid = sid;
+  entry->indexed = ii_shadow_indexed(shadow, rid);
+  if (entry->indexed) {
+    ii_shadow_value_copy(ctx, &entry->old_value, oldvalue);
+  } else {
+    GRN_VOID_INIT(&entry->old_value);
+  }
+  ii_shadow_value_copy(ctx, &entry->new_value, newvalue);
+  shadow->entries[shadow->n_entries++] = entry;
+  ii_shadow_pending_push(ctx, shadow, entry);
+  {
+    uint32_t i, mask = shadow->n_slots - 1;
+    for (i = ii_shadow_hash(shadow, rid, sid) & mask; shadow->slots[i];
+         i = (i + 1) & mask) {}
+    shadow->slots[i] = shadow->n_entries;
+  }
+}
+
+typedef struct {
+  grn_obj *values;
+  grn_bool *skips;
+} ii_shadow_record;
+
+static grn_rc
+ii_shadow_record_init(grn_ctx *ctx, ii_shadow_record *record, int ncols)
+{
+  int i;
+  if (!(record->values = GRN_MALLOCN(grn_obj, ncols))) { return ctx->rc; }
+  if (!(record->skips = GRN_MALLOCN(grn_bool, ncols))) {
+    GRN_FREE(record->values);
+    return ctx->rc;
+  }
+  for (i = 0; i < ncols; i++) {
+    GRN_TEXT_INIT(&record->values[i], 0);
+  }
+  return GRN_SUCCESS;
+}
+
+static void
+ii_shadow_record_fin(grn_ctx *ctx, ii_shadow_record *record, int ncols)
+{
+  int i;
+  for (i = 0; i < ncols; i++) {
+    GRN_OBJ_FIN(ctx, &record->values[i]);
+  }
+  GRN_FREE(record->values);
+  GRN_FREE(record->skips);
+}
+
+/*
+ * Reads the sections of a record that aren't in the change log and marks the
+ * record as read. Returns GRN_FALSE if the record doesn't exist. Must be
+ * called with origin->shadow_lock held so that no update of the record is
+ * logged between reading it and marking it.
+ */
+static grn_bool
+ii_shadow_read_record(grn_ctx *ctx, grn_ii_shadow *shadow,
+                      ii_shadow_record *record, grn_obj *target,
+                      grn_id rid, int ncols, grn_obj **cols)
+{
+  int sid;
+  uint32_t i;
+  for (i = 0; i < shadow->n_ranges; i++) {
+    ii_shadow_range *range = &shadow->ranges[i];
+    if (range->start <= rid && rid < range->end) {
+      range->next = rid + 1;
+      break;
+    }
+  }
+  if (grn_table_at(ctx, target, rid) == GRN_ID_NIL) { return GRN_FALSE; }
+  for (sid = 1; sid <= ncols; sid++) {
+    grn_obj *col = cols[sid - 1];
+    grn_obj *rv = &record->values[sid - 1];
+    if ((record->skips[sid - 1] = !!ii_shadow_entry_get(shadow, rid, sid))) {
+      continue;
+    }
+    grn_obj_reinit_for(ctx, rv, col);
+    if (GRN_OBJ_TABLEP(col)) {
+      grn_table_get_key2(ctx, col, rid, rv);
+    } else {
+      grn_obj_get_value(ctx, col, rid, rv);
+    }
+  }
+  return GRN_TRUE;
+}
+
+static grn_rc
+grn_ii_column_update_(grn_ctx *ctx, grn_ii *ii, grn_id rid, unsigned int section,
+                      grn_obj *oldvalue, grn_obj *newvalue, grn_obj *posting)
 {
   grn_id *tp;
   grn_bool do_grn_ii_updspec_cmp = GRN_TRUE;
@@ -5152,6 +6315,39 @@ exit :
   return ctx->rc;
 }
 
+/*
+ * While an online rebuild runs, the shadow lock is held for the whole update
+ * so that the rebuild can neither miss it nor swap the index under it.
+ * Otherwise the lock isn't taken; grn_ii_rebuild() waits for the updates
+ * that started before they could see the rebuild.
+ */
+grn_rc
+grn_ii_column_update(grn_ctx *ctx, grn_ii *ii, grn_id rid, unsigned int section,
+                     grn_obj *oldvalue, grn_obj *newvalue, grn_obj *posting)
+{
+  grn_rc rc;
+  uint32_t epoch;
+  if (!ii || !ii->lexicon || !rid) {
+    ERR(GRN_INVALID_ARGUMENT, "grn_ii_column_update: invalid argument");
+    return GRN_INVALID_ARGUMENT;
+  }
+  epoch = grn_obj_update_enter(ctx, (grn_obj *)ii);
+  if (!*((grn_ii_shadow * volatile *)&ii->shadow)) {
+    rc = grn_ii_column_update_(ctx, ii, rid, section,
+                               oldvalue, newvalue, posting);
+  } else {
+    CRITICAL_SECTION_ENTER(ii->shadow_lock);
+    if (ii->shadow) {
+      ii_shadow_log(ctx, ii->shadow, rid, section, oldvalue, newvalue);
+    }
+    rc = grn_ii_column_update_(ctx, ii, rid, section,
+                               oldvalue, newvalue, posting);
+    CRITICAL_SECTION_LEAVE(ii->shadow_lock);
+  }
+  grn_obj_update_leave(ctx, (grn_obj *)ii, epoch);
+  return rc;
+}
+
 /* token_info */
 
 typedef struct {
@@ -5320,7 +6516,7 @@ token_info_skip(grn_ctx *ctx, token_info *ti, uint32_t rid, uint32_t sid)
     if (!(c = cursor_heap_min(ti->cursors))) { return GRN_END_OF_DATA; }
     p = c->post;
     if (p->rid > rid || (p->rid == rid && p->sid >= sid)) { break; }
-    cursor_heap_pop(ctx, ti->cursors);
+    cursor_heap_pop_to(ctx, ti->cursors, rid, sid);
   }
   ti->pos = p->pos - ti->offset;
   ti->p = p;
@@ -5847,9 +7043,9 @@ grn_ii_term_extract(grn_ctx *ctx, grn_ii *ii, const char *string,
   return rc;
 }
 
-grn_rc
-grn_ii_select(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_len,
-              grn_hash *s, grn_operator op, grn_select_optarg *optarg)
+static grn_rc
+ii_select(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_len,
+          grn_hash *s, grn_operator op, grn_select_optarg *optarg)
 {
   btr *bt = NULL;
   grn_rc rc = GRN_SUCCESS;
@@ -6024,6 +7220,18 @@ exit :
   return rc;
 }
 
+grn_rc
+grn_ii_select(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_len,
+              grn_hash *s, grn_operator op, grn_select_optarg *optarg)
+{
+  grn_rc rc;
+  grn_ii *pinned;
+  pinned = ii_pin(ctx, ii);
+  rc = ii_select(ctx, pinned, string, string_len, s, op, optarg);
+  ii_unpin(ctx, pinned);
+  return rc;
+}
+
 grn_rc
 grn_ii_sel(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_len,
            grn_hash *s, grn_operator op, grn_search_optarg *optarg)
@@ -6082,19 +7290,247 @@ grn_ii_sel(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_len
   }
 }
 
+typedef struct {
+  grn_ii_cursor *cursor;
+  grn_ii_posting *posting;
+  uint64_t max_score;
+  int nth;
+} top_k_term;
+
+typedef struct {
+  grn_rset_posinfo pi;
+  uint32_t score;
+  int nth;
+} top_k_posting;
+
+static int
+top_k_term_compare(const void *a, const void *b)
+{
+  const top_k_term *t1 = a, *t2 = b;
+  if (t1->max_score == t2->max_score) { return t1->nth - t2->nth; }
+  return t1->max_score < t2->max_score ? -1 : 1;
+}
+
+inline static void
+top_k_heap_push(uint64_t *heap, int *n, int k, uint64_t score)
+{
+  int i, c;
+  if (*n < k) {
+    for (i = (*n)++; i; i = c) {
+      c = (i - 1) >> 1;
+      if (heap[c] <= score) { break; }
+      heap[i] = heap[c];
+    }
+    heap[i] = score;
+  } else if (heap[0] < score) {
+    for (i = 0; (c = i * 2 + 1) < k; i = c) {
+      if (c + 1 < k && heap[c + 1] < heap[c]) { c++; }
+      if (score <= heap[c]) { break; }
+      heap[i] = heap[c];
+    }
+    heap[i] = score;
+  }
+}
+
+static grn_rc
+top_k_term_open(grn_ctx *ctx, grn_ii *ii, const char *string,
+                unsigned int string_len, top_k_term *term)
+{
+  grn_rc rc = GRN_OPERATION_NOT_SUPPORTED;
+  uint32_t i, n = 0;
+  grn_id tid = GRN_ID_NIL;
+  token_info **tis;
+  if (!string_len) { return rc; }
+  if (!(tis = GRN_MALLOC(sizeof(token_info *) * string_len * 2))) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  if (!token_info_build(ctx, ii->lexicon, ii, string, string_len,
+                        tis, &n, GRN_OP_EXACT) &&
+      n == 1 && tis[0]->ntoken == 1) {
+    tid = cursor_heap_min(tis[0]->cursors)->id;
+  }
+  for (i = 0; i < n; i++) { token_info_close(ctx, tis[i]); }
+  GRN_FREE(tis);
+  if (tid &&
+      (term->cursor = grn_ii_cursor_open(ctx, ii, tid, GRN_ID_NIL, GRN_ID_MAX,
+                                         ii->n_elements, 0))) {
+    term->max_score = grn_ii_cursor_max_score(ctx, term->cursor);
+    if ((term->posting = grn_ii_cursor_next(ctx, term->cursor))) {
+      rc = GRN_SUCCESS;
+    }
+  }
+  return rc;
+}
+
+/*
+ * Evaluates OR of single token queries and adds to s at least the records
+ * which get the k highest scores with MaxScore dynamic pruning. Terms are
+ * split into essential and non-essential ones by the max scores of their
+ * whole posting lists. A candidate record is bounded by the max score of
+ * the chunk which can contain it for each non-essential term, and the
+ * non-essential cursors are moved by grn_ii_cursor_seek() so that chunks
+ * and blocks before the candidate aren't decoded. Scores of the added
+ * records are the same as the ones that grn_ii_sel() gives. It returns
+ * GRN_OPERATION_NOT_SUPPORTED without touching s when the query or the
+ * index can't be evaluated in this way.
+ */
+static grn_rc
+ii_select_top_k(grn_ctx *ctx, grn_ii *ii,
+                const char **strings, unsigned int *string_lens,
+                int n_strings, grn_hash *s, grn_select_optarg *optarg,
+                int k)
+{
+  grn_rc rc = GRN_SUCCESS;
+  int i, j, n = 0, first = 0, n_heap = 0;
+  uint32_t weight = 1;
+  uint32_t n_skipped_records = 0, n_skipped_chunks = 0, n_skipped_blocks = 0;
+  uint64_t *bounds = NULL, *chunk_bounds = NULL, *heap = NULL, theta = 0;
+  top_k_term *terms = NULL;
+  grn_obj postings;
+  if (!ii || !ii->lexicon || !s || k <= 0 || n_strings <= 0) {
+    return GRN_INVALID_ARGUMENT;
+  }
+  if (!CHUNK_MAX_SCORE_P(ii) ||
+      ctx->impl->match_escalation_threshold > 0) {
+    return GRN_OPERATION_NOT_SUPPORTED;
+  }
+  if (optarg) {
+    if (optarg->mode != GRN_OP_EXACT || optarg->func ||
+        optarg->weight_vector || optarg->vector_size < 0) {
+      return GRN_OPERATION_NOT_SUPPORTED;
+    }
+    if (optarg->vector_size) { weight = optarg->vector_size; }
+  }
+  if (!(terms = GRN_CALLOC(sizeof(top_k_term) * n_strings)) ||
+      !(bounds = GRN_MALLOCN(uint64_t, n_strings)) ||
+      !(chunk_bounds = GRN_MALLOCN(uint64_t, n_strings)) ||
+      !(heap = GRN_MALLOCN(uint64_t, k))) {
+    rc = GRN_NO_MEMORY_AVAILABLE;
+    goto exit;
+  }
+  for (n = 0; n < n_strings; n++) {
+    top_k_term *term = &terms[n];
+    term->nth = n;
+    if ((rc = top_k_term_open(ctx, ii, strings[n], string_lens[n], term))) {
+      n++;
+      goto exit;
+    }
+    term->max_score *= weight;
+  }
+  qsort(terms, n, sizeof(top_k_term), top_k_term_compare);
+  for (i = 0; i < n; i++) {
+    bounds[i] = (i ? bounds[i - 1] : 0) + terms[i].max_score;
+  }
+  GRN_TEXT_INIT(&postings, 0);
+  for (;;) {
+    grn_id rid = GRN_ID_NIL;
+    uint64_t score = 0;
+    for (i = first; i < n; i++) {
+      if (terms[i].posting && (!rid || terms[i].posting->rid < rid)) {
+        rid = terms[i].posting->rid;
+      }
+    }
+    if (!rid) { break; }
+    GRN_BULK_REWIND(&postings);
+    for (i = n - 1; i >= 0; i--) {
+      top_k_term *term = &terms[i];
+      if (i < first) {
+        if (i == first - 1) {
+          /* The terms that can't enter the top k alone are bounded by the
+             chunks which can contain rid. */
+          for (j = 0; j < first; j++) {
+            uint64_t max_score =
+              grn_ii_cursor_max_score_at(ctx, terms[j].cursor, rid);
+            chunk_bounds[j] = (j ? chunk_bounds[j - 1] : 0) +
+              max_score * weight;
+          }
+        }
+        if (score + chunk_bounds[i] < theta) {
+          n_skipped_records++;
+          break;
+        }
+        if (term->posting && term->posting->rid < rid) {
+          term->posting = grn_ii_cursor_seek(ctx, term->cursor, rid, 0);
+        }
+      }
+      while (term->posting && term->posting->rid == rid) {
+        top_k_posting tp;
+        tp.pi.rid = rid;
+        tp.pi.sid = term->posting->sid;
+        tp.pi.pos = 0;
+        tp.score = (term->posting->tf + term->posting->weight) * weight;
+        tp.nth = term->nth;
+        score += tp.score;
+        GRN_TEXT_PUT(ctx, &postings, &tp, sizeof(top_k_posting));
+        term->posting = grn_ii_cursor_next(ctx, term->cursor);
+      }
+    }
+    if (n_heap < k || theta <= score) {
+      top_k_posting *tp, *tpe = (top_k_posting *)GRN_BULK_CURR(&postings);
+      for (j = 0; j < n_strings; j++) {
+        for (tp = (top_k_posting *)GRN_BULK_HEAD(&postings); tp < tpe; tp++) {
+          if (tp->nth == j) { res_add(ctx, s, &tp->pi, tp->score, GRN_OP_OR); }
+        }
+      }
+      top_k_heap_push(heap, &n_heap, k, score);
+      if (n_heap == k) {
+        theta = heap[0];
+        while (first < n && bounds[first] < theta) { first++; }
+      }
+    }
+  }
+  GRN_OBJ_FIN(ctx, &postings);
+  for (i = 0; i < n; i++) {
+    n_skipped_chunks += terms[i].cursor->n_skipped_chunks;
+    n_skipped_blocks += terms[i].cursor->n_skipped_blocks;
+  }
+  GRN_LOG(ctx, GRN_LOG_INFO,
+          "top-k: k=%d, hits=%d, skipped records=%u, chunks=%u, blocks=%u",
+          k, GRN_HASH_SIZE(s),
+          n_skipped_records, n_skipped_chunks, n_skipped_blocks);
+exit :
+  for (i = 0; i < n; i++) {
+    if (terms[i].cursor) { grn_ii_cursor_close(ctx, terms[i].cursor); }
+  }
+  if (terms) { GRN_FREE(terms); }
+  if (bounds) { GRN_FREE(bounds); }
+  if (chunk_bounds) { GRN_FREE(chunk_bounds); }
+  if (heap) { GRN_FREE(heap); }
+  return rc;
+}
+
+grn_rc
+grn_ii_select_top_k(grn_ctx *ctx, grn_ii *ii,
+                    const char **strings, unsigned int *string_lens,
+                    int n_strings, grn_hash *s, grn_select_optarg *optarg,
+                    int k)
+{
+  grn_rc rc;
+  grn_ii *pinned;
+  pinned = ii_pin(ctx, ii);
+  rc = ii_select_top_k(ctx, pinned, strings, string_lens, n_strings, s,
+                       optarg, k);
+  ii_unpin(ctx, pinned);
+  return rc;
+}
+
 grn_rc
 grn_ii_at(grn_ctx *ctx, grn_ii *ii, grn_id id, grn_hash *s, grn_operator op)
 {
   int rep = 0;
+  grn_ii *pinned;
   grn_ii_cursor *c;
   grn_ii_posting *pos;
-  if ((c = grn_ii_cursor_open(ctx, ii, id, GRN_ID_NIL, GRN_ID_MAX,
-                              rep ? ii->n_elements : ii->n_elements - 1, 0))) {
+  pinned = ii_pin(ctx, ii);
+  if ((c = grn_ii_cursor_open(ctx, pinned, id, GRN_ID_NIL, GRN_ID_MAX,
+                              rep ? pinned->n_elements : pinned->n_elements - 1,
+                              0))) {
     while ((pos = grn_ii_cursor_next(ctx, c))) {
       res_add(ctx, s, (grn_rset_posinfo *) pos, (1 + pos->weight), op);
     }
     grn_ii_cursor_close(ctx, c);
   }
+  ii_unpin(ctx, pinned);
   return ctx->rc;
 }
 
@@ -6169,46 +7605,18 @@ grn_ii_cursor_next_all(grn_ctx *ctx, grn_ii_cursor *c)
               GRN_OBJ_FIN(ctx, &buf);
             }
             */
+          } else if (c->curr_block < c->nblocks) {
+            if (!grn_ii_cursor_load_block(ctx, c)) {
+              c->pc.rid = 0;
+              break;
+            }
+            continue;
           } else {
             if (c->curr_chunk <= c->nchunks) {
-              if (c->curr_chunk == c->nchunks) {
-                if (c->cp < c->cpe) {
-                  grn_p_decv(ctx, c->cp, c->cpe - c->cp, c->rdv, c->ii->n_elements);
-                } else {
-                  c->pc.rid = 0;
-                  break;
-                }
-              } else {
-                uint8_t *cp;
-                grn_io_win iw;
-                uint32_t size = c->cinfo[c->curr_chunk].size;
-                if (size && (cp = WIN_MAP2(c->ii->chunk, ctx, &iw,
-                                           c->cinfo[c->curr_chunk].segno, 0,
-                                           size, grn_io_rdonly))) {
-                  grn_p_decv(ctx, cp, size, c->rdv, c->ii->n_elements);
-                  grn_io_win_unmap2(&iw);
-                } else {
-                  c->pc.rid = 0;
-                  break;
-                }
+              if (!grn_ii_cursor_load_chunk(ctx, c)) {
+                c->pc.rid = 0;
+                break;
               }
-              {
-                int j = 0;
-                c->cdf = c->rdv[j].data_size;
-                c->crp = c->cdp = c->rdv[j++].data;
-                if ((c->ii->header->flags & GRN_OBJ_WITH_SECTION)) {
-                  c->csp = c->rdv[j++].data;
-                }
-                c->ctp = c->rdv[j++].data;
-                if ((c->ii->header->flags & GRN_OBJ_WITH_WEIGHT)) {
-                  c->cwp = c->rdv[j++].data;
-                }
-                c->cpp = c->rdv[j].data;
-              }
-              c->pc.rid = 0;
-              c->pc.sid = 0;
-              c->pc.rest = 0;
-              c->curr_chunk++;
               continue;
             } else {
               c->pc.rid = 0;
@@ -6393,6 +7801,9 @@ const char *TMPFILE_PATH = "grn_ii_buffer_tmp";
 const uint32_t II_BUFFER_NCOUNTERS_MARGIN = 0x100000;
 const size_t II_BUFFER_BLOCK_SIZE = 0x1000000;
 const uint32_t II_BUFFER_BLOCK_READ_UNIT_SIZE = 0x200000;
+const uint32_t II_BUFFER_MAX_N_WORKERS = 64;
+const uint32_t II_BUFFER_MERGE_NTERMS = 0x10000;
+const size_t II_BUFFER_MERGE_DATA_SIZE = 0x800000;
 
 typedef struct {
   uint32_t nrecs;
@@ -6425,6 +7836,29 @@ typedef struct {
   uint32_t *posts;
 } ii_buffer_block;
 
+typedef struct {
+  grn_id tid;
+  uint32_t nrecs;
+  uint32_t nposts;
+  size_t data_offset;
+  size_t max_size;
+  size_t packed_offset;
+  size_t packed_len;
+  datavec data_vectors[MAX_N_ELEMENTS + 1];
+} ii_buffer_term;
+
+typedef struct {
+  grn_ctx ctx;
+  grn_thread thread;
+  grn_ii_buffer *ii_buffer;
+  grn_obj *target;
+  int ncols;
+  grn_obj **cols;
+  grn_id start;
+  grn_id end;
+  grn_bool is_running;
+} ii_buffer_worker;
+
 struct _grn_ii_buffer {
   grn_obj *lexicon;
   grn_obj *tmp_lexicon;
@@ -6447,11 +7881,34 @@ struct _grn_ii_buffer {
   uint32_t lseg;
   uint32_t dseg;
   buffer *term_buffer;
-  datavec data_vectors[MAX_N_ELEMENTS + 1];
   uint8_t *packed_buf;
   size_t packed_buf_size;
   size_t packed_len;
   size_t total_chunk_size;
+  // stuff for merging terms in batches
+  ii_buffer_term *terms;
+  uint32_t nterms;
+  uint32_t terms_size;
+  uint32_t next_term;
+  size_t term_grain;
+  uint32_t *term_data;
+  size_t term_data_size;
+  size_t term_data_len;
+  uint8_t *term_packed;
+  size_t term_packed_size;
+  size_t term_packed_len;
+  uint32_t nterms_merged;
+  // stuff for parallel building
+  grn_ii_buffer *root;
+  uint32_t n_workers;
+  ii_buffer_worker *workers;
+  grn_critical_section lock;
+  uint32_t nrecords;
+  uint32_t nrecords_done;
+  uint32_t nrecords_total;
+  grn_timeval start_time;
+  // stuff for online rebuilding
+  grn_ii_shadow *shadow;
 };
 
 static ii_buffer_block *
@@ -6468,7 +7925,6 @@ block_new(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
     ii_buffer->blocks = blocks;
   }
   block = &ii_buffer->blocks[ii_buffer->nblocks];
-  block->head = ii_buffer->filepos;
   block->rest = 0;
   block->buffer = NULL;
   block->buffersize = 0;
@@ -6526,8 +7982,18 @@ encode_terms(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
     char key[GRN_TABLE_MAX_KEY_SIZE];
     int key_size = grn_table_get_key(ctx, ii_buffer->tmp_lexicon, tid,
                                      key, GRN_TABLE_MAX_KEY_SIZE);
-    grn_id gtid = grn_table_add(ctx, ii_buffer->lexicon, key, key_size, NULL);
+    grn_id gtid;
     ii_buffer_counter *counter = &ii_buffer->counters[tid - 1];
+    CRITICAL_SECTION_ENTER(ii_buffer->root->lock);
+    if (ii_buffer->shadow) {
+      /* the lexicon is also updated by the writers of the old index */
+      CRITICAL_SECTION_ENTER(ii_buffer->shadow->origin->shadow_lock);
+      gtid = grn_table_add(ctx, ii_buffer->lexicon, key, key_size, NULL);
+      CRITICAL_SECTION_LEAVE(ii_buffer->shadow->origin->shadow_lock);
+    } else {
+      gtid = grn_table_add(ctx, ii_buffer->lexicon, key, key_size, NULL);
+    }
+    CRITICAL_SECTION_LEAVE(ii_buffer->root->lock);
     if (counter->nrecs) {
       uint32_t offset_rid = counter->offset_rid;
       uint32_t offset_sid = counter->offset_sid;
@@ -6657,12 +8123,26 @@ encode_last_tf(grn_ctx *ctx, grn_ii_buffer *ii_buffer, uint8_t *outbuf)
   }
 }
 
+static double
+ii_buffer_elapsed(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
+{
+  grn_timeval now;
+  grn_timeval_now(ctx, &now);
+  return (now.tv_sec - ii_buffer->start_time.tv_sec) +
+    (now.tv_nsec - ii_buffer->start_time.tv_nsec) / GRN_TIME_NSEC_PER_SEC_F;
+}
+
+/*
+ * Workers share the temporary file of the root buffer. Each flushed block is
+ * written at once so that it occupies a contiguous range of the file.
+ */
 static void
 grn_ii_buffer_flush(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
 {
   size_t encsize;
   uint8_t *outbuf;
   ii_buffer_block *block;
+  grn_ii_buffer *root = ii_buffer->root;
   GRN_LOG(ctx, GRN_LOG_NOTICE, "flushing:%d npostings:%zu",
           ii_buffer->nblocks, ii_buffer->block_pos);
   if (!(block = block_new(ctx, ii_buffer))) { return; }
@@ -6671,14 +8151,29 @@ grn_ii_buffer_flush(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
   encode_postings(ctx, ii_buffer, outbuf);
   encode_last_tf(ctx, ii_buffer, outbuf);
   {
-    ssize_t r = GRN_WRITE(ii_buffer->tmpfd, outbuf, encsize);
+    ssize_t r;
+    CRITICAL_SECTION_ENTER(root->lock);
+    block->head = root->filepos;
+    r = GRN_WRITE(root->tmpfd, outbuf, encsize);
     if (r != encsize) {
+      CRITICAL_SECTION_LEAVE(root->lock);
       ERR(GRN_INPUT_OUTPUT_ERROR, "write returned %" GRN_FMT_LLD " != %" GRN_FMT_LLU,
           (long long int)r, (unsigned long long int)encsize);
       return;
     }
-    ii_buffer->filepos += r;
-    block->tail = ii_buffer->filepos;
+    root->filepos += r;
+    block->tail = root->filepos;
+    root->nrecords_done += ii_buffer->nrecords;
+    ii_buffer->nrecords = 0;
+    if (root->nrecords_total) {
+      double elapsed = ii_buffer_elapsed(ctx, root);
+      GRN_LOG(ctx, GRN_LOG_NOTICE,
+              "tokenized:%u/%u records(%.1f%%) %.2fsec %.0frecords/sec",
+              root->nrecords_done, root->nrecords_total,
+              root->nrecords_done * 100.0 / root->nrecords_total, elapsed,
+              elapsed > 0 ? root->nrecords_done / elapsed : 0.0);
+    }
+    CRITICAL_SECTION_LEAVE(root->lock);
   }
   GRN_FREE(outbuf);
   memset(ii_buffer->counters, 0,
@@ -6908,25 +8403,14 @@ grn_ii_buffer_chunk_flush(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
   ii_buffer->curr_size = 0;
 }
 
-static size_t
+static void
 merge_hit_blocks(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
-                 ii_buffer_block *hits[], int nhits)
+                 ii_buffer_term *term, ii_buffer_block *hits[], int nhits)
 {
-  uint64_t nrecs = 0;
-  uint64_t nposts = 0;
-  size_t max_size;
+  uint64_t nrecs = term->nrecs;
+  uint64_t nposts = term->nposts;
   uint64_t flags = ii_buffer->ii->header->flags;
-  int i;
-  for (i = 0; i < nhits; i++) {
-    ii_buffer_block *block = hits[i];
-    nrecs += block->nrecs;
-    nposts += block->nposts;
-  }
-  ii_buffer->curr_size += nrecs + nposts;
-  max_size = nrecs * (ii_buffer->ii->n_elements);
-  if (flags & GRN_OBJ_WITH_POSITION) { max_size += nposts - nrecs; }
-  datavec_reset(ctx, ii_buffer->data_vectors,
-                ii_buffer->ii->n_elements, nrecs, max_size);
+  datavec *data_vectors = term->data_vectors;
   {
     int i;
     uint32_t lr = 0;
@@ -6934,16 +8418,16 @@ merge_hit_blocks(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
     uint32_t *ridp, *sidp = NULL, *tfp, *weightp = NULL, *posp = NULL;
     {
       int j = 0;
-      ridp = ii_buffer->data_vectors[j++].data;
+      ridp = data_vectors[j++].data;
       if (flags & GRN_OBJ_WITH_SECTION) {
-        sidp = ii_buffer->data_vectors[j++].data;
+        sidp = data_vectors[j++].data;
       }
-      tfp = ii_buffer->data_vectors[j++].data;
+      tfp = data_vectors[j++].data;
       if (flags & GRN_OBJ_WITH_WEIGHT) {
-        weightp = ii_buffer->data_vectors[j++].data;
+        weightp = data_vectors[j++].data;
       }
       if (flags & GRN_OBJ_WITH_POSITION) {
-        posp = ii_buffer->data_vectors[j++].data;
+        posp = data_vectors[j++].data;
       }
     }
     for (i = 0; i < nhits; i++) {
@@ -6984,29 +8468,28 @@ merge_hit_blocks(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
     }
     {
       int j = 0;
-      uint32_t f_s = (nrecs < 3) ? 0 : USE_P_ENC;
-      uint32_t f_d = ((nrecs < 16) || (nrecs <= (lr >> 8))) ? 0 : USE_P_ENC;
-      ii_buffer->data_vectors[j].data_size = nrecs;
-      ii_buffer->data_vectors[j++].flags = f_d;
+      uint32_t f_s = (nrecs < 3) ? 0 : P_ENC_FLAGS(ii_buffer->ii);
+      uint32_t f_d = ((nrecs < 16) || (nrecs <= (lr >> 8))) ? 0 : P_ENC_FLAGS(ii_buffer->ii);
+      data_vectors[j].data_size = nrecs;
+      data_vectors[j++].flags = f_d;
       if ((flags & GRN_OBJ_WITH_SECTION)) {
-        ii_buffer->data_vectors[j].data_size = nrecs;
-        ii_buffer->data_vectors[j++].flags = f_s;
+        data_vectors[j].data_size = nrecs;
+        data_vectors[j++].flags = f_s;
       }
-      ii_buffer->data_vectors[j].data_size = nrecs;
-      ii_buffer->data_vectors[j++].flags = f_s;
+      data_vectors[j].data_size = nrecs;
+      data_vectors[j++].flags = f_s;
       if ((flags & GRN_OBJ_WITH_WEIGHT)) {
-        ii_buffer->data_vectors[j].data_size = nrecs;
-        ii_buffer->data_vectors[j++].flags = f_s;
+        data_vectors[j].data_size = nrecs;
+        data_vectors[j++].flags = f_s;
       }
       if ((flags & GRN_OBJ_WITH_POSITION)) {
         uint32_t f_p = (((nposts < 32) ||
-                         (nposts <= (spos >> 13))) ? 0 : USE_P_ENC);
-        ii_buffer->data_vectors[j].data_size = nposts;
-        ii_buffer->data_vectors[j++].flags = f_p|ODD;
+                         (nposts <= (spos >> 13))) ? 0 : P_ENC_FLAGS(ii_buffer->ii));
+        data_vectors[j].data_size = nposts;
+        data_vectors[j++].flags = f_p|ODD;
       }
     }
   }
-  return (max_size + ii_buffer->ii->n_elements) * 4;
 }
 
 static buffer *
@@ -7073,50 +8556,255 @@ try_in_place_packing(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
 }
 
 static void
-grn_ii_buffer_merge(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
-                    grn_id tid, ii_buffer_block *hits[], int nhits)
+ii_buffer_term_set_data(grn_ii_buffer *ii_buffer, ii_buffer_term *term)
+{
+  uint32_t j, n_elements = ii_buffer->ii->n_elements;
+  uint32_t *data = ii_buffer->term_data + term->data_offset;
+  for (j = 0; j < n_elements; j++) {
+    term->data_vectors[j].data = data + term->nrecs * j;
+  }
+  term->data_vectors[n_elements].data = data + term->max_size;
+}
+
+static void grn_ii_buffer_merge_terms(grn_ctx *ctx, grn_ii_buffer *ii_buffer);
+
+/*
+ * Terms are merged in batches. The postings of each term in a batch are
+ * decoded into term_data, and then encoded into term_packed by the workers
+ * before they are packed into chunks in the lexicon order.
+ */
+static ii_buffer_term *
+ii_buffer_term_new(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
+                   grn_id tid, ii_buffer_block *hits[], int nhits)
+{
+  int i;
+  uint64_t nrecs = 0;
+  uint64_t nposts = 0;
+  size_t max_size, packed_size;
+  uint32_t n_elements = ii_buffer->ii->n_elements;
+  ii_buffer_term *term;
+  for (i = 0; i < nhits; i++) {
+    nrecs += hits[i]->nrecs;
+    nposts += hits[i]->nposts;
+  }
+  max_size = nrecs * n_elements;
+  if (ii_buffer->ii->header->flags & GRN_OBJ_WITH_POSITION) {
+    max_size += nposts - nrecs;
+  }
+  packed_size = (max_size + n_elements) * 4;
+  if (CHUNK_MAX_SCORE_P(ii_buffer->ii)) { packed_size += sizeof(uint32_t) + 1; }
+  if (CHUNK_SKIP_P(ii_buffer->ii)) {
+    packed_size += CHUNK_SKIP_MAX_OVERHEAD(nrecs);
+  }
+  if (ii_buffer->nterms &&
+      (ii_buffer->nterms >= II_BUFFER_MERGE_NTERMS ||
+       ii_buffer->term_data_len + max_size > II_BUFFER_MERGE_DATA_SIZE)) {
+    grn_ii_buffer_merge_terms(ctx, ii_buffer);
+    if (ctx->rc) { return NULL; }
+  }
+  if (ii_buffer->nterms == ii_buffer->terms_size) {
+    uint32_t terms_size = ii_buffer->terms_size ? ii_buffer->terms_size * 2 : 0x400;
+    ii_buffer_term *terms = GRN_REALLOC(ii_buffer->terms,
+                                        terms_size * sizeof(ii_buffer_term));
+    if (!terms) { return NULL; }
+    ii_buffer->terms = terms;
+    ii_buffer->terms_size = terms_size;
+  }
+  if (ii_buffer->term_data_size < ii_buffer->term_data_len + max_size) {
+    size_t size = ii_buffer->term_data_len + max_size;
+    uint32_t *data;
+    if (size < II_BUFFER_MERGE_DATA_SIZE) { size = II_BUFFER_MERGE_DATA_SIZE; }
+    if (!(data = GRN_REALLOC(ii_buffer->term_data, size * sizeof(uint32_t)))) {
+      return NULL;
+    }
+    ii_buffer->term_data = data;
+    ii_buffer->term_data_size = size;
+  }
+  if (ii_buffer->term_packed_size < ii_buffer->term_packed_len + packed_size) {
+    size_t size = ii_buffer->term_packed_len + packed_size;
+    uint8_t *packed;
+    if (size < II_BUFFER_MERGE_DATA_SIZE * 4) {
+      size = II_BUFFER_MERGE_DATA_SIZE * 4;
+    }
+    if (!(packed = GRN_REALLOC(ii_buffer->term_packed, size))) { return NULL; }
+    ii_buffer->term_packed = packed;
+    ii_buffer->term_packed_size = size;
+  }
+  term = &ii_buffer->terms[ii_buffer->nterms++];
+  term->tid = tid;
+  term->nrecs = nrecs;
+  term->nposts = nposts;
+  term->data_offset = ii_buffer->term_data_len;
+  term->max_size = max_size;
+  term->packed_offset = ii_buffer->term_packed_len;
+  term->packed_len = 0;
+  ii_buffer->term_data_len += max_size;
+  ii_buffer->term_packed_len += packed_size;
+  ii_buffer_term_set_data(ii_buffer, term);
+  return term;
+}
+
+static void
+ii_buffer_term_encode(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
+                      ii_buffer_term *term)
 {
-  if (!try_in_place_packing(ctx, ii_buffer, tid, hits, nhits)) {
-    size_t max_size = merge_hit_blocks(ctx, ii_buffer, hits, nhits);
-    if (ii_buffer->packed_buf &&
-        ii_buffer->packed_buf_size < ii_buffer->packed_len + max_size) {
+  uint8_t *packed = ii_buffer->term_packed + term->packed_offset;
+  uint8_t *p = packed;
+  ii_buffer_term_set_data(ii_buffer, term);
+  if (CHUNK_MAX_SCORE_P(ii_buffer->ii)) {
+    uint32_t max_score =
+      datavec_max_score(ii_buffer->ii, term->data_vectors, term->nrecs);
+    GRN_B_ENC(max_score, p);
+  }
+  p += chunk_encv(ctx, ii_buffer->ii, term->data_vectors,
+                  ii_buffer->ii->n_elements, p);
+  term->packed_len = p - packed;
+}
+
+static void
+ii_buffer_term_pack(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
+                    ii_buffer_term *term)
+{
+  ii_buffer->curr_size += term->nrecs + term->nposts;
+  if (ii_buffer->packed_buf &&
+      ii_buffer->packed_buf_size < ii_buffer->packed_len + term->packed_len) {
+    grn_ii_buffer_chunk_flush(ctx, ii_buffer);
+  }
+  if (!ii_buffer->packed_buf) {
+    size_t buf_size = (term->packed_len > II_BUFFER_PACKED_BUF_SIZE)
+      ? term->packed_len : II_BUFFER_PACKED_BUF_SIZE;
+    if ((ii_buffer->packed_buf = GRN_MALLOC(buf_size))) {
+      ii_buffer->packed_buf_size = buf_size;
+    }
+  }
+  if (ii_buffer->packed_buf) {
+    uint16_t nterm;
+    buffer_term *bt;
+    uint32_t *a = array_get(ctx, ii_buffer->ii, term->tid);
+    buffer *term_buffer = get_term_buffer(ctx, ii_buffer);
+    if (!term_buffer) { return; }
+    nterm = term_buffer->header.nterms++;
+    bt = &term_buffer->terms[nterm];
+    a[0] = SEG2POS(ii_buffer->lseg,
+                   (sizeof(buffer_header) + sizeof(buffer_term) * nterm));
+    memcpy(ii_buffer->packed_buf + ii_buffer->packed_len,
+           ii_buffer->term_packed + term->packed_offset, term->packed_len);
+    a[1] = term->nrecs;
+    bt->tid = term->tid;
+    bt->size_in_buffer = 0;
+    bt->pos_in_buffer = 0;
+    bt->size_in_chunk = term->packed_len;
+    bt->pos_in_chunk = ii_buffer->packed_len;
+    ii_buffer->packed_len += term->packed_len;
+    if (((ii_buffer->curr_size * ii_buffer->update_buffer_size) +
+         (ii_buffer->total_size * term_buffer->header.nterms * 16)) >=
+        (ii_buffer->total_size * II_BUFFER_NTERMS_PER_BUFFER * 16)) {
       grn_ii_buffer_chunk_flush(ctx, ii_buffer);
     }
-    if (!ii_buffer->packed_buf) {
-      size_t buf_size = (max_size > II_BUFFER_PACKED_BUF_SIZE)
-        ? max_size : II_BUFFER_PACKED_BUF_SIZE;
-      if ((ii_buffer->packed_buf = GRN_MALLOC(buf_size))) {
-        ii_buffer->packed_buf_size = buf_size;
+  }
+}
+
+/* Workers take a run of terms whose postings amount to term_grain at once. */
+static void
+ii_buffer_encode_terms(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
+{
+  for (;;) {
+    uint32_t i, start, end;
+    size_t size = 0;
+    CRITICAL_SECTION_ENTER(ii_buffer->lock);
+    start = end = ii_buffer->next_term;
+    while (end < ii_buffer->nterms && size < ii_buffer->term_grain) {
+      size += ii_buffer->terms[end++].max_size;
+    }
+    ii_buffer->next_term = end;
+    CRITICAL_SECTION_LEAVE(ii_buffer->lock);
+    if (start == end) { break; }
+    for (i = start; i < end; i++) {
+      ii_buffer_term_encode(ctx, ii_buffer, &ii_buffer->terms[i]);
+    }
+  }
+}
+
+static void * CALLBACK
+ii_buffer_encode_worker(void *arg)
+{
+  ii_buffer_worker *worker = (ii_buffer_worker *)arg;
+  ii_buffer_encode_terms(&worker->ctx, worker->ii_buffer);
+  return NULL;
+}
+
+static void
+ii_buffer_workers_check(grn_ctx *ctx, grn_ii_buffer *ii_buffer, uint32_t n)
+{
+  uint32_t i;
+  for (i = 0; i < n; i++) {
+    grn_ctx *worker_ctx = &ii_buffer->workers[i].ctx;
+    if (worker_ctx->rc) {
+      if (!ctx->rc) {
+        ERR(worker_ctx->rc, "[ii][build] worker(%u) failed: %s",
+            i + 1, worker_ctx->errbuf);
       }
+      worker_ctx->rc = GRN_SUCCESS;
     }
-    {
-      uint16_t nterm;
-      size_t packed_len;
-      buffer_term *bt;
-      uint32_t *a = array_get(ctx, ii_buffer->ii, tid);
-      buffer *term_buffer = get_term_buffer(ctx, ii_buffer);
-      if (!term_buffer) { return; }
-      nterm = term_buffer->header.nterms++;
-      bt = &term_buffer->terms[nterm];
-      a[0] = SEG2POS(ii_buffer->lseg,
-                     (sizeof(buffer_header) + sizeof(buffer_term) * nterm));
-      packed_len = grn_p_encv(ctx, ii_buffer->data_vectors,
-                              ii_buffer->ii->n_elements,
-                              ii_buffer->packed_buf +
-                              ii_buffer->packed_len);
-      a[1] = ii_buffer->data_vectors[0].data_size;
-      bt->tid = tid;
-      bt->size_in_buffer = 0;
-      bt->pos_in_buffer = 0;
-      bt->size_in_chunk = packed_len;
-      bt->pos_in_chunk = ii_buffer->packed_len;
-      ii_buffer->packed_len += packed_len;
-      if (((ii_buffer->curr_size * ii_buffer->update_buffer_size) +
-           (ii_buffer->total_size * term_buffer->header.nterms * 16)) >=
-          (ii_buffer->total_size * II_BUFFER_NTERMS_PER_BUFFER * 16)) {
-        grn_ii_buffer_chunk_flush(ctx, ii_buffer);
+  }
+}
+
+static void
+grn_ii_buffer_merge_terms(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
+{
+  uint32_t i, n = 0;
+  if (!ii_buffer->nterms) { return; }
+  ii_buffer->next_term = 0;
+  if (ii_buffer->workers && ii_buffer->nterms > 1) {
+    uint32_t n_threads = ii_buffer->n_workers;
+    if (n_threads > ii_buffer->nterms) { n_threads = ii_buffer->nterms; }
+    ii_buffer->term_grain = ii_buffer->term_data_len / (n_threads * 8) + 1;
+    for (; n + 1 < n_threads; n++) {
+      ii_buffer_worker *worker = &ii_buffer->workers[n];
+      worker->ii_buffer = ii_buffer;
+      if (THREAD_CREATE(worker->thread, ii_buffer_encode_worker, worker)) {
+        GRN_LOG(ctx, GRN_LOG_WARNING,
+                "[ii][build] failed to create a merge worker: %u", n + 1);
+        break;
       }
     }
+  } else {
+    ii_buffer->term_grain = ii_buffer->term_data_len + 1;
+  }
+  ii_buffer_encode_terms(ctx, ii_buffer);
+  for (i = 0; i < n; i++) {
+    THREAD_JOIN(ii_buffer->workers[i].thread);
+  }
+  ii_buffer_workers_check(ctx, ii_buffer, n);
+  if (!ctx->rc) {
+    for (i = 0; i < ii_buffer->nterms; i++) {
+      ii_buffer_term_pack(ctx, ii_buffer, &ii_buffer->terms[i]);
+    }
+  }
+  ii_buffer->nterms_merged += ii_buffer->nterms;
+  ii_buffer->nterms = 0;
+  ii_buffer->term_data_len = 0;
+  ii_buffer->term_packed_len = 0;
+  {
+    double elapsed = ii_buffer_elapsed(ctx, ii_buffer);
+    uint32_t nterms_total = grn_table_size(ctx, ii_buffer->lexicon);
+    GRN_LOG(ctx, GRN_LOG_NOTICE,
+            "merged:%u/%u terms(%.1f%%) %.2fsec %.0fterms/sec",
+            ii_buffer->nterms_merged, nterms_total,
+            nterms_total ? ii_buffer->nterms_merged * 100.0 / nterms_total : 0.0,
+            elapsed, elapsed > 0 ? ii_buffer->nterms_merged / elapsed : 0.0);
+  }
+}
+
+static void
+grn_ii_buffer_merge(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
+                    grn_id tid, ii_buffer_block *hits[], int nhits)
+{
+  if (try_in_place_packing(ctx, ii_buffer, tid, hits, nhits)) {
+    ii_buffer->nterms_merged++;
+  } else {
+    ii_buffer_term *term = ii_buffer_term_new(ctx, ii_buffer, tid, hits, nhits);
+    if (term) { merge_hit_blocks(ctx, ii_buffer, term, hits, nhits); }
   }
 }
 
@@ -7145,6 +8833,24 @@ grn_ii_buffer_open(grn_ctx *ctx, grn_ii *ii,
       ii_buffer->packed_len = 0;
       ii_buffer->packed_buf_size = 0;
       ii_buffer->total_chunk_size = 0;
+      ii_buffer->terms = NULL;
+      ii_buffer->nterms = 0;
+      ii_buffer->terms_size = 0;
+      ii_buffer->term_data = NULL;
+      ii_buffer->term_data_size = 0;
+      ii_buffer->term_data_len = 0;
+      ii_buffer->term_packed = NULL;
+      ii_buffer->term_packed_size = 0;
+      ii_buffer->term_packed_len = 0;
+      ii_buffer->nterms_merged = 0;
+      ii_buffer->root = ii_buffer;
+      ii_buffer->n_workers = 1;
+      ii_buffer->workers = NULL;
+      ii_buffer->nrecords = 0;
+      ii_buffer->nrecords_done = 0;
+      ii_buffer->nrecords_total = 0;
+      ii_buffer->shadow = NULL;
+      grn_timeval_now(ctx, &ii_buffer->start_time);
       if (ii_buffer->counters) {
         ii_buffer->block_buf = GRN_MALLOCN(grn_id, II_BUFFER_BLOCK_SIZE);
         if (ii_buffer->block_buf) {
@@ -7161,6 +8867,7 @@ grn_ii_buffer_open(grn_ctx *ctx, grn_ii *ii,
               grn_pat_cache_enable(ctx, (grn_pat *)ii->lexicon,
                                    PAT_CACHE_SIZE);
             }
+            CRITICAL_SECTION_INIT(ii_buffer->lock);
             return ii_buffer;
           } else {
             SERR("mkostemp");
@@ -7219,7 +8926,7 @@ grn_ii_buffer_commit(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
           "nblocks=%d, update_buffer_size=%" GRN_FMT_INT64U,
           ii_buffer->nblocks, ii_buffer->update_buffer_size);
 
-  datavec_init(ctx, ii_buffer->data_vectors, ii_buffer->ii->n_elements, 0, 0);
+  grn_timeval_now(ctx, &ii_buffer->start_time);
 #ifdef WIN32
   ii_buffer->tmpfd = GRN_OPEN(ii_buffer->tmpfpath, O_RDONLY|O_BINARY);
 #else /* WIN32 */
@@ -7254,8 +8961,9 @@ grn_ii_buffer_commit(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
             if (ii_buffer->blocks[i].tid) { nrests++; }
           }
           if (nhits) { grn_ii_buffer_merge(ctx, ii_buffer, tid, hits, nhits); }
-          if (!nrests) { break; }
+          if (!nrests || ctx->rc) { break; }
         }
+        grn_ii_buffer_merge_terms(ctx, ii_buffer);
         if (ii_buffer->packed_len) {
           grn_ii_buffer_chunk_flush(ctx, ii_buffer);
         }
@@ -7264,7 +8972,18 @@ grn_ii_buffer_commit(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
       GRN_FREE(hits);
     }
   }
-  datavec_fin(ctx, ii_buffer->data_vectors);
+  if (ii_buffer->terms) {
+    GRN_FREE(ii_buffer->terms);
+    ii_buffer->terms = NULL;
+  }
+  if (ii_buffer->term_data) {
+    GRN_FREE(ii_buffer->term_data);
+    ii_buffer->term_data = NULL;
+  }
+  if (ii_buffer->term_packed) {
+    GRN_FREE(ii_buffer->term_packed);
+    ii_buffer->term_packed = NULL;
+  }
   GRN_LOG(ctx, GRN_LOG_NOTICE,
           "tmpfile_size:%jd > total_chunk_size:%" GRN_FMT_INT64U,
           ii_buffer->filepos, ii_buffer->total_chunk_size);
@@ -7304,10 +9023,76 @@ grn_ii_buffer_close(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
     }
     GRN_FREE(ii_buffer->blocks);
   }
+  if (ii_buffer->terms) {
+    GRN_FREE(ii_buffer->terms);
+  }
+  if (ii_buffer->term_data) {
+    GRN_FREE(ii_buffer->term_data);
+  }
+  if (ii_buffer->term_packed) {
+    GRN_FREE(ii_buffer->term_packed);
+  }
+  if (ii_buffer->workers) {
+    for (i = 0; i + 1 < ii_buffer->n_workers; i++) {
+      grn_ctx_fin(&ii_buffer->workers[i].ctx);
+    }
+    GRN_FREE(ii_buffer->workers);
+  }
+  CRITICAL_SECTION_FIN(ii_buffer->lock);
   GRN_FREE(ii_buffer);
   return ctx->rc;
 }
 
+static void
+grn_ii_buffer_tokenize_value(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
+                             grn_id rid, int sid, grn_obj *rv)
+{
+  switch (rv->header.type) {
+  case GRN_BULK :
+    grn_ii_buffer_tokenize(ctx, ii_buffer, rid, sid, 0,
+                           GRN_TEXT_VALUE(rv), GRN_TEXT_LEN(rv));
+    break;
+  case GRN_VECTOR :
+    if (rv->u.v.body) {
+      int i;
+      int n_sections = rv->u.v.n_sections;
+      grn_section *sections = rv->u.v.sections;
+      const char *head = GRN_BULK_HEAD(rv->u.v.body);
+      for (i = 0; i < n_sections; i++) {
+        grn_section *section = sections + i;
+        if (section->length == 0) {
+          continue;
+        }
+        grn_ii_buffer_tokenize(ctx, ii_buffer, rid,
+                               sid, section->weight,
+                               head + section->offset, section->length);
+      }
+    }
+    break;
+  default :
+    ERR(GRN_INVALID_ARGUMENT, "[index] invalid object assigned as value");
+    break;
+  }
+}
+
+static void
+grn_ii_buffer_parse_record(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
+                           grn_obj *rv, grn_id rid, int ncols, grn_obj **cols)
+{
+  int sid;
+  grn_obj **col;
+  for (sid = 1, col = cols; sid <= ncols; sid++, col++) {
+    grn_obj_reinit_for(ctx, rv, *col);
+    if (GRN_OBJ_TABLEP(*col)) {
+      grn_table_get_key2(ctx, *col, rid, rv);
+    } else {
+      grn_obj_get_value(ctx, *col, rid, rv);
+    }
+    grn_ii_buffer_tokenize_value(ctx, ii_buffer, rid, sid, rv);
+  }
+  ii_buffer->nrecords++;
+}
+
 static void
 grn_ii_buffer_parse(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
                     grn_obj *target, int ncols, grn_obj **cols)
@@ -7320,52 +9105,217 @@ grn_ii_buffer_parse(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
     grn_obj rv;
     GRN_TEXT_INIT(&rv, 0);
     while ((rid = grn_table_cursor_next(ctx, tc)) != GRN_ID_NIL) {
-      int sid;
-      grn_obj **col;
-      for (sid = 1, col = cols; sid <= ncols; sid++, col++) {
-        grn_obj_reinit_for(ctx, &rv, *col);
-        if (GRN_OBJ_TABLEP(*col)) {
-          grn_table_get_key2(ctx, *col, rid, &rv);
-        } else {
-          grn_obj_get_value(ctx, *col, rid, &rv);
-        }
-        switch (rv.header.type) {
-        case GRN_BULK :
-          grn_ii_buffer_tokenize(ctx, ii_buffer, rid, sid, 0,
-                                 GRN_TEXT_VALUE(&rv), GRN_TEXT_LEN(&rv));
-          break;
-        case GRN_VECTOR :
-          if (rv.u.v.body) {
-            int i;
-            int n_sections = rv.u.v.n_sections;
-            grn_section *sections = rv.u.v.sections;
-            const char *head = GRN_BULK_HEAD(rv.u.v.body);
-            for (i = 0; i < n_sections; i++) {
-              grn_section *section = sections + i;
-              if (section->length == 0) {
-                continue;
-              }
-              grn_ii_buffer_tokenize(ctx, ii_buffer, rid,
-                                     sid, section->weight,
-                                     head + section->offset, section->length);
-            }
-          }
-          break;
-        default :
-          ERR(GRN_INVALID_ARGUMENT, "[index] invalid object assigned as value");
-          break;
+      grn_ii_buffer_parse_record(ctx, ii_buffer, &rv, rid, ncols, cols);
+    }
+    GRN_OBJ_FIN(ctx, &rv);
+    grn_table_cursor_close(ctx, tc);
+  }
+}
+
+static void
+grn_ii_buffer_parse_range(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
+                          grn_obj *target, int ncols, grn_obj **cols,
+                          grn_id start, grn_id end)
+{
+  grn_id rid;
+  grn_obj rv;
+  GRN_TEXT_INIT(&rv, 0);
+  if (ii_buffer->shadow) {
+    grn_ii_shadow *shadow = ii_buffer->shadow;
+    ii_shadow_record record;
+    if (!ii_shadow_record_init(ctx, &record, ncols)) {
+      for (rid = start; rid < end && !ctx->rc; rid++) {
+        grn_bool found;
+        int sid;
+        CRITICAL_SECTION_ENTER(shadow->origin->shadow_lock);
+        found = ii_shadow_read_record(ctx, shadow, &record, target,
+                                      rid, ncols, cols);
+        CRITICAL_SECTION_LEAVE(shadow->origin->shadow_lock);
+        if (!found) { continue; }
+        for (sid = 1; sid <= ncols; sid++) {
+          if (record.skips[sid - 1]) { continue; }
+          grn_ii_buffer_tokenize_value(ctx, ii_buffer, rid, sid,
+                                       &record.values[sid - 1]);
         }
+        ii_buffer->nrecords++;
       }
+      ii_shadow_record_fin(ctx, &record, ncols);
     }
-    GRN_OBJ_FIN(ctx, &rv);
+  } else {
+    for (rid = start; rid < end; rid++) {
+      if (grn_table_at(ctx, target, rid) != GRN_ID_NIL) {
+        grn_ii_buffer_parse_record(ctx, ii_buffer, &rv, rid, ncols, cols);
+      }
+    }
+  }
+  if (ii_buffer->block_pos) {
+    grn_ii_buffer_flush(ctx, ii_buffer);
+  }
+  GRN_OBJ_FIN(ctx, &rv);
+}
+
+static void * CALLBACK
+ii_buffer_parse_worker(void *arg)
+{
+  ii_buffer_worker *worker = (ii_buffer_worker *)arg;
+  grn_ii_buffer_parse_range(&worker->ctx, worker->ii_buffer, worker->target,
+                            worker->ncols, worker->cols,
+                            worker->start, worker->end);
+  return NULL;
+}
+
+/* A worker buffer tokenizes records into its own blocks in the shared file. */
+static grn_ii_buffer *
+ii_buffer_worker_buffer_open(grn_ctx *ctx, grn_ii_buffer *root)
+{
+  grn_ii_buffer *ii_buffer = GRN_CALLOC(sizeof(grn_ii_buffer));
+  if (ii_buffer) {
+    ii_buffer->ii = root->ii;
+    ii_buffer->lexicon = root->lexicon;
+    ii_buffer->root = root;
+    ii_buffer->shadow = root->shadow;
+    ii_buffer->tmpfd = -1;
+    ii_buffer->ncounters = II_BUFFER_NCOUNTERS_MARGIN;
+    ii_buffer->counters = GRN_CALLOC(ii_buffer->ncounters *
+                                     sizeof(ii_buffer_counter));
+    if (ii_buffer->counters) {
+      ii_buffer->block_buf = GRN_MALLOCN(grn_id, II_BUFFER_BLOCK_SIZE);
+      if (ii_buffer->block_buf) {
+        ii_buffer->block_buf_size = II_BUFFER_BLOCK_SIZE;
+        return ii_buffer;
+      }
+      GRN_FREE(ii_buffer->counters);
+    }
+    GRN_FREE(ii_buffer);
+  }
+  return NULL;
+}
+
+/* Appends the blocks of a worker buffer to the root and closes it. */
+static void
+ii_buffer_worker_buffer_close(grn_ctx *ctx, grn_ii_buffer *root,
+                              ii_buffer_worker *worker)
+{
+  grn_ii_buffer *ii_buffer = worker->ii_buffer;
+  if (ii_buffer->nblocks && !ctx->rc) {
+    ii_buffer_block *blocks;
+    blocks = GRN_REALLOC(root->blocks, (root->nblocks + ii_buffer->nblocks) *
+                         sizeof(ii_buffer_block));
+    if (blocks) {
+      memcpy(&blocks[root->nblocks], ii_buffer->blocks,
+             ii_buffer->nblocks * sizeof(ii_buffer_block));
+      root->blocks = blocks;
+      root->nblocks += ii_buffer->nblocks;
+      root->total_size += ii_buffer->total_size;
+    }
+  }
+  if (ii_buffer->tmp_lexicon) {
+    grn_obj_close(&worker->ctx, ii_buffer->tmp_lexicon);
+  }
+  if (ii_buffer->blocks) { GRN_FREE(ii_buffer->blocks); }
+  GRN_FREE(ii_buffer->block_buf);
+  GRN_FREE(ii_buffer->counters);
+  GRN_FREE(ii_buffer);
+  worker->ii_buffer = NULL;
+}
+
+static grn_id
+ii_table_max_id(grn_ctx *ctx, grn_obj *table)
+{
+  grn_id max_id = GRN_ID_NIL;
+  grn_table_cursor *tc;
+  if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, 1,
+                                  GRN_CURSOR_BY_ID|GRN_CURSOR_DESCENDING))) {
+    max_id = grn_table_cursor_next(ctx, tc);
     grn_table_cursor_close(ctx, tc);
   }
+  return max_id;
 }
 
-grn_rc
-grn_ii_build(grn_ctx *ctx, grn_ii *ii, uint64_t sparsity)
+/*
+ * Splits the record IDs of the target into contiguous ranges, one for each
+ * worker. The root tokenizes the first range by itself. Blocks are ordered by
+ * the ranges so that the records of a term are merged in ascending order.
+ * The range of a worker whose thread can't be created is tokenized into its
+ * own buffer by the calling thread, so that no range is left out.
+ */
+static void
+grn_ii_buffer_parse_parallel(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
+                             grn_obj *target, int ncols, grn_obj **cols)
+{
+  uint32_t i, n = 0;
+  grn_id max_id = ii_table_max_id(ctx, target), step;
+  if (max_id == GRN_ID_NIL) { return; }
+  step = max_id / ii_buffer->n_workers + 1;
+  for (; n + 1 < ii_buffer->n_workers; n++) {
+    ii_buffer_worker *worker = &ii_buffer->workers[n];
+    if (!(worker->ii_buffer = ii_buffer_worker_buffer_open(ctx, ii_buffer))) {
+      ERR(GRN_NO_MEMORY_AVAILABLE,
+          "[ii][build] failed to open the buffer of a worker: %u", n + 1);
+      break;
+    }
+    worker->target = target;
+    worker->ncols = ncols;
+    worker->cols = cols;
+    worker->start = GRN_ID_NIL + 1 + step * (n + 1);
+    worker->end = worker->start + step;
+    worker->is_running =
+      !THREAD_CREATE(worker->thread, ii_buffer_parse_worker, worker);
+    if (!worker->is_running) {
+      GRN_LOG(ctx, GRN_LOG_WARNING,
+              "[ii][build] failed to create a parse worker: %u", n + 1);
+      ii_buffer_parse_worker(worker);
+    }
+  }
+  if (!ctx->rc) {
+    grn_ii_buffer_parse_range(ctx, ii_buffer, target, ncols, cols,
+                              GRN_ID_NIL + 1, GRN_ID_NIL + 1 + step);
+  }
+  for (i = 0; i < n; i++) {
+    if (ii_buffer->workers[i].is_running) {
+      THREAD_JOIN(ii_buffer->workers[i].thread);
+    }
+  }
+  ii_buffer_workers_check(ctx, ii_buffer, n);
+  for (i = 0; i < n; i++) {
+    ii_buffer_worker_buffer_close(ctx, ii_buffer, &ii_buffer->workers[i]);
+  }
+}
+
+static grn_rc
+ii_buffer_workers_open(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
+                       uint32_t n_workers)
+{
+  uint32_t i;
+  if (n_workers > II_BUFFER_MAX_N_WORKERS) {
+    n_workers = II_BUFFER_MAX_N_WORKERS;
+  }
+  if (n_workers <= 1) { return GRN_SUCCESS; }
+  if (!(ii_buffer->workers = GRN_MALLOCN(ii_buffer_worker, n_workers - 1))) {
+    return ctx->rc;
+  }
+  for (i = 0; i < n_workers - 1; i++) {
+    ii_buffer_worker *worker = &ii_buffer->workers[i];
+    memset(worker, 0, sizeof(ii_buffer_worker));
+    grn_ctx_init(&worker->ctx, 0);
+    grn_ctx_use(&worker->ctx, grn_ctx_db(ctx));
+  }
+  ii_buffer->n_workers = n_workers;
+  return GRN_SUCCESS;
+}
+
+static grn_rc ii_shadow_ranges_set(grn_ctx *ctx, grn_ii_shadow *shadow,
+                                   grn_id max_id, uint32_t n);
+
+static grn_rc
+ii_build(grn_ctx *ctx, grn_ii *ii, grn_ii_shadow *shadow,
+         uint64_t sparsity, uint32_t n_workers)
 {
   grn_ii_buffer *ii_buffer = grn_ii_buffer_open(ctx, ii, sparsity);
+  if (ii_buffer && ii_buffer_workers_open(ctx, ii_buffer, n_workers)) {
+    grn_ii_buffer_close(ctx, ii_buffer);
+    ii_buffer = NULL;
+  }
   if (ii_buffer) {
     grn_id *s = ii->obj.source;
     if ((ii->obj.source_size) && s) {
@@ -7382,8 +9332,34 @@ grn_ii_build(grn_ctx *ctx, grn_ii *ii, uint64_t sparsity)
             target = grn_ctx_at(ctx, target->header.domain);
           }
           if (target) {
-            grn_ii_buffer_parse(ctx, ii_buffer, target, ncols, cols);
-            grn_ii_buffer_commit(ctx, ii_buffer);
+            ii_buffer->nrecords_total = grn_table_size(ctx, target);
+            if (shadow) {
+              grn_id max_id = ii_table_max_id(ctx, target);
+              ii_buffer->shadow = shadow;
+              if (ii_shadow_ranges_set(ctx, shadow, max_id,
+                                       ii_buffer->n_workers)) {
+                grn_ii_buffer_close(ctx, ii_buffer);
+                GRN_FREE(cols);
+                return ctx->rc;
+              }
+            }
+            if (ii_buffer->workers) {
+              grn_ii_buffer_parse_parallel(ctx, ii_buffer, target, ncols, cols);
+            } else if (shadow) {
+              grn_ii_buffer_parse_range(ctx, ii_buffer, target, ncols, cols,
+                                        GRN_ID_NIL + 1,
+                                        shadow->ranges[0].end);
+            } else {
+              grn_ii_buffer_parse(ctx, ii_buffer, target, ncols, cols);
+            }
+            GRN_LOG(ctx, GRN_LOG_NOTICE,
+                    "tokenized: records=%u nblocks=%u workers=%u %.2fsec",
+                    ii_buffer->nrecords_done + ii_buffer->nrecords,
+                    ii_buffer->nblocks, ii_buffer->n_workers,
+                    ii_buffer_elapsed(ctx, ii_buffer));
+            if (!ctx->rc) {
+              grn_ii_buffer_commit(ctx, ii_buffer);
+            }
           } else {
             ERR(GRN_INVALID_ARGUMENT, "failed to resolve the target");
           }
@@ -7399,3 +9375,258 @@ grn_ii_build(grn_ctx *ctx, grn_ii *ii, uint64_t sparsity)
   }
   return ctx->rc;
 }
+
+grn_rc
+grn_ii_build(grn_ctx *ctx, grn_ii *ii, uint64_t sparsity, uint32_t n_workers)
+{
+  return ii_build(ctx, ii, NULL, sparsity, n_workers);
+}
+
+/* Splits the record IDs in the same way as grn_ii_buffer_parse_parallel(). */
+static grn_rc
+ii_shadow_ranges_set(grn_ctx *ctx, grn_ii_shadow *shadow,
+                     grn_id max_id, uint32_t n)
+{
+  uint32_t i;
+  grn_id step = max_id / n + 1;
+  ii_shadow_range *ranges = GRN_GMALLOC(n * sizeof(ii_shadow_range));
+  if (!ranges) {
+    ERR(GRN_NO_MEMORY_AVAILABLE, "[ii][rebuild] failed to allocate ranges");
+    return ctx->rc;
+  }
+  for (i = 0; i < n; i++) {
+    ranges[i].start = GRN_ID_NIL + 1 + step * i;
+    ranges[i].end = ranges[i].start + step;
+    ranges[i].next = ranges[i].start;
+  }
+  CRITICAL_SECTION_ENTER(shadow->origin->shadow_lock);
+  shadow->ranges = ranges;
+  shadow->n_ranges = n;
+  CRITICAL_SECTION_LEAVE(shadow->origin->shadow_lock);
+  return GRN_SUCCESS;
+}
+
+/*
+ * Builds the new index record by record for the indexes that
+ * grn_ii_buffer can't build. The lexicon is shared with the writers of the
+ * old index, so each record is indexed under origin->shadow_lock.
+ */
+static void
+ii_shadow_build_records(grn_ctx *ctx, grn_ii_shadow *shadow,
+                        grn_obj *target, int ncols, grn_obj **cols)
+{
+  grn_id rid, max_id = ii_table_max_id(ctx, target);
+  grn_obj empty;
+  ii_shadow_record record;
+  if (ii_shadow_ranges_set(ctx, shadow, max_id, 1)) { return; }
+  if (ii_shadow_record_init(ctx, &record, ncols)) { return; }
+  GRN_TEXT_INIT(&empty, 0);
+  for (rid = GRN_ID_NIL + 1; rid < shadow->ranges[0].end && !ctx->rc; rid++) {
+    CRITICAL_SECTION_ENTER(shadow->origin->shadow_lock);
+    if (ii_shadow_read_record(ctx, shadow, &record, target,
+                              rid, ncols, cols)) {
+      int sid;
+      for (sid = 1; sid <= ncols && !ctx->rc; sid++) {
+        if (record.skips[sid - 1]) { continue; }
+        grn_ii_column_update(ctx, shadow->ii, rid, sid,
+                             &empty, &record.values[sid - 1], NULL);
+      }
+    }
+    CRITICAL_SECTION_LEAVE(shadow->origin->shadow_lock);
+  }
+  GRN_OBJ_FIN(ctx, &empty);
+  ii_shadow_record_fin(ctx, &record, ncols);
+}
+
+/*
+ * Applies the pending updates to the new index. It must be called with
+ * origin->shadow_lock held. The lock is released between updates so that
+ * writers aren't blocked for the whole replay, until as many updates as were
+ * pending at the start have been replayed twice; then writers wait until the
+ * log is empty. It returns with the lock held and nothing pending.
+ */
+static void
+ii_shadow_replay(grn_ctx *ctx, grn_ii_shadow *shadow)
+{
+  uint32_t n_yields = shadow->n_pending * 2;
+  grn_obj empty;
+  GRN_TEXT_INIT(&empty, 0);
+  while (shadow->n_pending > 0 && !ctx->rc) {
+    ii_shadow_entry *entry = shadow->pending[--shadow->n_pending];
+    grn_obj *old = &empty, *new = NULL;
+    if (entry->indexed && entry->old_value.header.type != GRN_VOID) {
+      old = &entry->old_value;
+    }
+    if (entry->new_value.header.type != GRN_VOID) {
+      new = &entry->new_value;
+    }
+    grn_ii_column_update(ctx, shadow->ii, entry->rid, entry->sid,
+                         old, new, NULL);
+    entry->pending = GRN_FALSE;
+    if (n_yields) {
+      n_yields--;
+      CRITICAL_SECTION_LEAVE(shadow->origin->shadow_lock);
+      CRITICAL_SECTION_ENTER(shadow->origin->shadow_lock);
+    }
+  }
+  GRN_OBJ_FIN(ctx, &empty);
+}
+
+/*
+ * Renames the files of the new index over the files of the old one and
+ * makes the ios of the new index the current generation of the old one, so
+ * the grn_ii cached in the database stays valid. Readers that have pinned
+ * the old generation keep reading its files until they unpin it. Returns
+ * GRN_FALSE if nothing is replaced.
+ */
+static grn_bool
+ii_shadow_swap(grn_ctx *ctx, grn_ii *ii, grn_ii *new_ii)
+{
+  const char *io_path = grn_io_path(ii->seg);
+  if (io_path && *io_path) {
+    char path[PATH_MAX];
+    strcpy(path, io_path);
+    if (grn_io_replace(ctx, new_ii->chunk, ii->chunk)) { return GRN_FALSE; }
+    if (grn_io_replace(ctx, new_ii->seg, ii->seg)) {
+      GRN_LOG(ctx, GRN_LOG_CRIT,
+              "[ii][rebuild] replaced only the chunk file of <%s>", path);
+    }
+  }
+  CRITICAL_SECTION_ENTER(ii->generation_lock);
+  ii->seg = new_ii->seg;
+  ii->chunk = new_ii->chunk;
+  ii->header = new_ii->header;
+  ii->n_elements = new_ii->n_elements;
+  ii_generation_replace(ctx, ii, new_ii->generation);
+  CRITICAL_SECTION_LEAVE(ii->generation_lock);
+  CRITICAL_SECTION_FIN(new_ii->shadow_lock);
+  CRITICAL_SECTION_FIN(new_ii->generation_lock);
+  GRN_GFREE(new_ii);
+  return GRN_TRUE;
+}
+
+static void
+ii_shadow_free(grn_ctx *ctx, grn_ii_shadow *shadow)
+{
+  uint32_t i;
+  for (i = 0; i < shadow->n_entries; i++) {
+    GRN_OBJ_FIN(ctx, &shadow->entries[i]->old_value);
+    GRN_OBJ_FIN(ctx, &shadow->entries[i]->new_value);
+    GRN_GFREE(shadow->entries[i]);
+  }
+  if (shadow->entries) { GRN_GFREE(shadow->entries); }
+  if (shadow->pending) { GRN_GFREE(shadow->pending); }
+  if (shadow->slots) { GRN_GFREE(shadow->slots); }
+  if (shadow->ranges) { GRN_GFREE(shadow->ranges); }
+  GRN_GFREE(shadow);
+}
+
+/*
+ * Rebuilds an index from its sources while the index keeps serving queries
+ * and updates. The new index, created with the given header flags, is built
+ * next to the old one. The updates made meanwhile are logged, replayed onto
+ * the new index and then the new index replaces the old one. Writers of the
+ * index are blocked only while the last updates are replayed.
+ *
+ * Before building, the rebuild waits for the updates of the index and its
+ * sources that started before they could see the rebuild, so that no value
+ * is stored after the builder has read the record without being logged.
+ */
+grn_rc
+grn_ii_rebuild(grn_ctx *ctx, grn_ii *ii, uint32_t flags,
+               grn_bool use_buffer, uint64_t sparsity, uint32_t n_workers)
+{
+  int i, ncols;
+  grn_obj **cols = NULL, *target = NULL;
+  grn_ii *new_ii;
+  grn_ii_shadow *shadow;
+  grn_bool busy;
+  const char *io_path = grn_io_path(ii->seg);
+  char path[PATH_MAX];
+  if (!ii->obj.source_size || !ii->obj.source) {
+    ERR(GRN_INVALID_ARGUMENT, "[ii][rebuild] ii->obj.source is void");
+    return ctx->rc;
+  }
+  path[0] = '\0';
+  if (io_path && *io_path) {
+    if (strlen(io_path) + 13 >= PATH_MAX) {
+      ERR(GRN_INVALID_ARGUMENT, "[ii][rebuild] too long path: <%s>", io_path);
+      return ctx->rc;
+    }
+    snprintf(path, PATH_MAX, "%s.shadow", io_path);
+  }
+  ncols = ii->obj.source_size / sizeof(grn_id);
+  if (!(cols = GRN_MALLOCN(grn_obj *, ncols))) { return ctx->rc; }
+  for (i = 0; i < ncols; i++) {
+    if (!(cols[i] = grn_ctx_at(ctx, ((grn_id *)ii->obj.source)[i]))) {
+      ERR(GRN_INVALID_ARGUMENT, "[ii][rebuild] failed to resolve a column (%d)", i);
+      GRN_FREE(cols);
+      return ctx->rc;
+    }
+  }
+  target = GRN_OBJ_TABLEP(cols[0])
+    ? cols[0] : grn_ctx_at(ctx, cols[0]->header.domain);
+  if (!target) {
+    ERR(GRN_INVALID_ARGUMENT, "[ii][rebuild] failed to resolve the target");
+    GRN_FREE(cols);
+    return ctx->rc;
+  }
+  if (!(shadow = GRN_GCALLOC(sizeof(grn_ii_shadow)))) {
+    ERR(GRN_NO_MEMORY_AVAILABLE, "[ii][rebuild] failed to allocate a shadow");
+    GRN_FREE(cols);
+    return ctx->rc;
+  }
+  shadow->origin = ii;
+  shadow->n_sections = ncols;
+  CRITICAL_SECTION_ENTER(ii->shadow_lock);
+  if (!(busy = (ii->shadow != NULL))) {
+    ii->shadow = shadow;
+  }
+  CRITICAL_SECTION_LEAVE(ii->shadow_lock);
+  if (busy) {
+    ERR(GRN_OPERATION_NOT_PERMITTED, "[ii][rebuild] already being rebuilt");
+    GRN_GFREE(shadow);
+    GRN_FREE(cols);
+    return ctx->rc;
+  }
+  grn_obj_update_wait(ctx, (grn_obj *)ii);
+  for (i = 0; i < ncols; i++) {
+    grn_obj_update_wait(ctx, cols[i]);
+  }
+  if (*path) {
+    struct stat s;
+    if (!stat(path, &s)) { grn_ii_remove(ctx, path); }
+  }
+  if ((new_ii = grn_ii_create(ctx, *path ? path : NULL, ii->lexicon, flags))) {
+    new_ii->obj = ii->obj;
+    shadow->ii = new_ii;
+    if (use_buffer) {
+      ii_build(ctx, new_ii, shadow, sparsity, n_workers);
+    } else {
+      ii_shadow_build_records(ctx, shadow, target, ncols, cols);
+    }
+  } else if (!ctx->rc) {
+    ERR(GRN_NO_MEMORY_AVAILABLE, "[ii][rebuild] failed to create <%s>", path);
+  }
+  CRITICAL_SECTION_ENTER(ii->shadow_lock);
+  if (!ctx->rc) {
+    GRN_LOG(ctx, GRN_LOG_NOTICE, "[ii][rebuild] replaying %u updates",
+            shadow->n_pending);
+    ii_shadow_replay(ctx, shadow);
+  }
+  if (!ctx->rc && shadow->failed) {
+    ERR(GRN_NO_MEMORY_AVAILABLE, "[ii][rebuild] failed to log updates");
+  }
+  if (!ctx->rc && ii_shadow_swap(ctx, ii, new_ii)) {
+    new_ii = NULL;
+  }
+  ii->shadow = NULL;
+  CRITICAL_SECTION_LEAVE(ii->shadow_lock);
+  if (new_ii) {
+    grn_ii_close(ctx, new_ii);
+    if (*path) { grn_ii_remove(ctx, path); }
+  }
+  ii_shadow_free(ctx, shadow);
+  GRN_FREE(cols);
+  return ctx->rc;
+}
@@ -39,6 +39,9 @@
 extern "C" {
 #endif
 
+typedef struct _grn_ii_shadow grn_ii_shadow;
+typedef struct _grn_ii_generation grn_ii_generation;
+
 struct _grn_ii {
   grn_db_obj obj;
   grn_io *seg;
@@ -48,6 +51,14 @@ struct _grn_ii {
   grn_encoding encoding;
   uint32_t n_elements;
   struct grn_ii_header *header;
+  /* set while the index is rebuilt online, see grn_ii_rebuild() */
+  grn_ii_shadow *shadow;
+  grn_critical_section shadow_lock;
+  /* the ios that readers pin, see ii_pin() */
+  grn_ii_generation *generation;
+  grn_critical_section generation_lock;
+  /* the index that a view of a generation is for, NULL for the index itself */
+  grn_ii *origin;
 };
 
 #define GRN_II_BGQSIZE 16
@@ -58,6 +69,11 @@ struct _grn_ii {
 #define GRN_II_MAX_CHUNK          (1 << (GRN_II_W_TOTAL_CHUNK - GRN_II_W_CHUNK))
 #define GRN_II_N_CHUNK_VARIATION  (GRN_II_W_CHUNK - GRN_II_W_LEAST_CHUNK)
 
+/* Each chunk carries the max score (tf + weight) of its postings. */
+#define GRN_II_FEATURE_CHUNK_MAX_SCORE (0x01)
+/* Chunks are split into blocks of postings with a skip table. */
+#define GRN_II_FEATURE_CHUNK_SKIP      (0x02)
+
 struct grn_ii_header {
   uint64_t total_chunk_size;
   uint64_t bmax;
@@ -70,7 +86,8 @@ struct grn_ii_header {
   uint32_t bgqhead;
   uint32_t bgqtail;
   uint32_t bgqbody[GRN_II_BGQSIZE];
-  uint32_t reserved[288];
+  uint32_t features;
+  uint32_t reserved[287];
   uint32_t ainfo[GRN_II_MAX_LSEG];
   uint32_t binfo[GRN_II_MAX_LSEG];
   uint32_t free_chunks[GRN_II_N_CHUNK_VARIATION + 1];
@@ -137,6 +154,8 @@ grn_ii_cursor *grn_ii_cursor_openv1(grn_ii *ii, uint32_t key);
 grn_rc grn_ii_cursor_openv2(grn_ii_cursor **cursors, int ncursors);
 GRN_API grn_ii_posting *grn_ii_cursor_next(grn_ctx *ctx, grn_ii_cursor *c);
 grn_ii_posting *grn_ii_cursor_next_pos(grn_ctx *ctx, grn_ii_cursor *c);
+grn_ii_posting *grn_ii_cursor_seek(grn_ctx *ctx, grn_ii_cursor *c,
+                                   grn_id rid, uint32_t sid);
 GRN_API grn_rc grn_ii_cursor_close(grn_ctx *ctx, grn_ii_cursor *c);
 
 uint32_t grn_ii_max_section(grn_ii *ii);
@@ -179,6 +198,10 @@ GRN_API grn_rc grn_ii_select(grn_ctx *ctx, grn_ii *ii, const char *string, unsig
                              grn_hash *s, grn_operator op, grn_select_optarg *optarg);
 grn_rc grn_ii_sel(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_len,
                   grn_hash *s, grn_operator op, grn_search_optarg *optarg);
+grn_rc grn_ii_select_top_k(grn_ctx *ctx, grn_ii *ii,
+                           const char **strings, unsigned int *string_lens,
+                           int n_strings, grn_hash *s, grn_select_optarg *optarg,
+                           int k);
 
 void grn_ii_resolve_sel_and(grn_ctx *ctx, grn_hash *s, grn_operator op);
 
@@ -187,7 +210,11 @@ grn_rc grn_ii_at(grn_ctx *ctx, grn_ii *ii, grn_id id, grn_hash *s, grn_operator
 void grn_ii_inspect_elements(grn_ctx *ctx, grn_ii *ii, grn_obj *buf);
 void grn_ii_cursor_inspect(grn_ctx *ctx, grn_ii_cursor *c, grn_obj *buf);
 
-grn_rc grn_ii_build(grn_ctx *ctx, grn_ii *ii, uint64_t sparsity);
+grn_rc grn_ii_build(grn_ctx *ctx, grn_ii *ii, uint64_t sparsity,
+                    uint32_t n_workers);
+grn_rc grn_ii_rebuild(grn_ctx *ctx, grn_ii *ii, uint32_t flags,
+                      grn_bool use_buffer, uint64_t sparsity,
+                      uint32_t n_workers);
 
 #ifdef __cplusplus
 }
@@ -26,6 +26,12 @@
 #include <string.h>
 #include <sys/stat.h>
 
+#if defined(HAVE_LINUX_FUTEX_H) && defined(HAVE_SYS_SYSCALL_H)
+# define GRN_IO_LOCK_USE_FUTEX
+# include <linux/futex.h>
+# include <sys/syscall.h>
+#endif /* defined(HAVE_LINUX_FUTEX_H) && defined(HAVE_SYS_SYSCALL_H) */
+
 #include "ctx.h"
 #include "io.h"
 #include "plugin_in.h"
@@ -133,6 +139,8 @@ grn_io_create_tmp(uint32_t header_size, uint32_t segment_size,
         io->count = 0;
         io->flags = GRN_IO_TEMPORARY;
         io->lock = &header->lock;
+        io->lock_n_spins = 0;
+        memset(&io->lock_statistics, 0, sizeof(grn_io_lock_statistics));
         io->path[0] = '\0';
         return io;
       }
@@ -165,7 +173,8 @@ grn_io_register(grn_io *io)
 static void
 grn_io_unregister(grn_io *io)
 {
-  if (io->fis && (io->flags & (GRN_IO_EXPIRE_GTICK|GRN_IO_EXPIRE_SEGMENT))) {
+  if (io->fis && *io->path &&
+      (io->flags & (GRN_IO_EXPIRE_GTICK|GRN_IO_EXPIRE_SEGMENT))) {
     grn_bool succeeded = GRN_FALSE;
     CRITICAL_SECTION_ENTER(grn_glock);
     if (grn_gctx.impl && grn_gctx.impl->ios) {
@@ -231,6 +240,8 @@ grn_io_create(grn_ctx *ctx, const char *path, uint32_t header_size, uint32_t seg
             io->count = 0;
             io->flags = flags;
             io->lock = &header->lock;
+            io->lock_n_spins = 0;
+            memset(&io->lock_statistics, 0, sizeof(grn_io_lock_statistics));
             grn_io_register(io);
             return io;
           }
@@ -473,6 +484,8 @@ grn_io_open(grn_ctx *ctx, const char *path, grn_io_mode mode)
             io->count = 0;
             io->flags = header->flags;
             io->lock = &header->lock;
+            io->lock_n_spins = 0;
+            memset(&io->lock_statistics, 0, sizeof(grn_io_lock_statistics));
             if (!array_init(io, io->header->n_arrays)) {
               grn_io_register(io);
               return io;
@@ -654,16 +667,86 @@ grn_io_rename(grn_ctx *ctx, const char *old_name, const char *new_name)
       gen_pathname(old_name, old_buffer, fno);
       if (!stat(old_buffer, &s)) {
         gen_pathname(new_name, new_buffer, fno);
-        if (rename(old_buffer, new_buffer)) { SERR(old_buffer); }
+        if (rename(old_buffer, new_buffer)) {
+          SERR(old_buffer);
+          return ctx->rc;
+        }
       } else {
-        SERR("stat");
-        return ctx->rc;
+        break;
       }
     }
     return GRN_SUCCESS;
   }
 }
 
+/*
+ * Opens all the existing files of an io so that the io keeps reading them
+ * after they are renamed over or removed.
+ */
+static grn_rc
+grn_io_open_files(grn_ctx *ctx, grn_io *io)
+{
+  uint32_t bs = io->base_seg;
+  uint32_t max_segment = io->header->segment_tail
+    ? io->header->segment_tail : io->header->max_segment;
+  uint32_t segment_size = io->header->segment_size;
+  unsigned int fno, max_nfiles = (unsigned int)(
+    ((uint64_t)segment_size * (max_segment + bs) + GRN_IO_FILE_SIZE - 1)
+    / GRN_IO_FILE_SIZE);
+  for (fno = 0; fno < max_nfiles; fno++) {
+    fileinfo *fi = &io->fis[fno];
+    if (!grn_opened(fi)) {
+      char path[PATH_MAX];
+      struct stat s;
+      gen_pathname(io->path, path, fno);
+      if (stat(path, &s)) { break; }
+      if (grn_open(ctx, fi, path, O_RDWR|O_CREAT, GRN_IO_FILE_SIZE)) {
+        return ctx->rc;
+      }
+    }
+  }
+  return GRN_SUCCESS;
+}
+
+/*
+ * Renames the files of io over the files of old_io. Each file is replaced
+ * atomically and the files of old_io that io doesn't have are removed.
+ * old_io opens all its files beforehand, so it keeps reading them until it
+ * is closed, and it forgets its path.
+ */
+grn_rc
+grn_io_replace(grn_ctx *ctx, grn_io *io, grn_io *old_io)
+{
+  grn_rc rc;
+  int fno, n_files;
+  struct stat s;
+  char path[PATH_MAX], buffer[PATH_MAX];
+  if (!io->fis || !old_io->fis || !*old_io->path) {
+    return GRN_INVALID_ARGUMENT;
+  }
+  if ((rc = grn_io_open_files(ctx, old_io))) { return rc; }
+  strcpy(path, old_io->path);
+  for (n_files = 1; ; n_files++) {
+    gen_pathname(io->path, buffer, n_files);
+    if (stat(buffer, &s)) { break; }
+  }
+  grn_io_unregister(io);
+  if ((rc = grn_io_rename(ctx, io->path, path))) {
+    grn_io_register(io);
+    return rc;
+  }
+  for (fno = n_files; ; fno++) {
+    gen_pathname(path, buffer, fno);
+    if (stat(buffer, &s)) { break; }
+    if (unlink(buffer)) { SERR(buffer); }
+  }
+  grn_io_unregister(old_io);
+  old_io->path[0] = '\0';
+  strcpy(io->path, path);
+  grn_io_register(io);
+  return GRN_SUCCESS;
+}
+
 typedef struct {
   grn_io_ja_ehead head;
   char body[256];
@@ -1278,42 +1361,145 @@ grn_io_anon_unmap(grn_ctx *ctx, grn_io_mapinfo *mi, size_t length)
   GRN_MUNMAP(ctx, &mi->fmo, mi->map, length);
 }
 
+/*
+ * The lock word in the io header is shared by all processes which map the
+ * file. It is GRN_IO_LOCK_UNLOCKED, GRN_IO_LOCK_LOCKED or
+ * GRN_IO_LOCK_CONTENDED. The last one tells the owner that somebody may be
+ * sleeping on the word and has to be woken up by grn_io_unlock().
+ */
+#define GRN_IO_LOCK_UNLOCKED  0
+#define GRN_IO_LOCK_LOCKED    1
+#define GRN_IO_LOCK_CONTENDED 2
+
+#define GRN_IO_LOCK_MAX_N_SPINS 100
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+# define GRN_IO_LOCK_PAUSE() __asm__ __volatile__ ("pause" : : : "memory")
+#else
+# define GRN_IO_LOCK_PAUSE()
+#endif
+
+inline static uint32_t
+grn_io_lock_exchange(uint32_t *lock, uint32_t value)
+{
+  uint32_t expected = *((volatile uint32_t *)lock);
+  for (;;) {
+    uint32_t actual;
+    GRN_ATOMIC_CAS_EX(lock, expected, value, actual);
+    if (actual == expected) { return actual; }
+    expected = actual;
+  }
+}
+
+/* Waits for a wake up up to the wait time. */
+inline static void
+grn_io_lock_wait(uint32_t *lock, uint32_t value)
+{
+#ifdef GRN_IO_LOCK_USE_FUTEX
+  struct timespec timeout;
+  timeout.tv_sec = GRN_LOCK_WAIT_TIME_NANOSECOND / 1000000000;
+  timeout.tv_nsec = GRN_LOCK_WAIT_TIME_NANOSECOND % 1000000000;
+  syscall(SYS_futex, lock, FUTEX_WAIT, value, &timeout, NULL, 0);
+#else /* GRN_IO_LOCK_USE_FUTEX */
+  grn_nanosleep(GRN_LOCK_WAIT_TIME_NANOSECOND);
+#endif /* GRN_IO_LOCK_USE_FUTEX */
+}
+
+inline static uint64_t
+grn_io_lock_elapsed_nsec(grn_timeval *start, grn_timeval *end)
+{
+  return (uint64_t)(end->tv_sec - start->tv_sec) * GRN_TIME_NSEC_PER_SEC +
+    end->tv_nsec - start->tv_nsec;
+}
+
+inline static void
+grn_io_lock_wake(uint32_t *lock, int n_waiters)
+{
+#ifdef GRN_IO_LOCK_USE_FUTEX
+  syscall(SYS_futex, lock, FUTEX_WAKE, n_waiters, NULL, NULL, 0);
+#endif /* GRN_IO_LOCK_USE_FUTEX */
+}
+
 grn_rc
 grn_io_lock(grn_ctx *ctx, grn_io *io, int timeout)
 {
   static int _ncalls = 0, _ncolls = 0;
   uint32_t count, count_log_border = 1000;
+  uint32_t lock, n_spins, max_n_spins, n_waits = 0;
+  uint64_t timeout_nsec;
+  grn_timeval wait_start, wait_end;
   _ncalls++;
   if (!io) { return GRN_INVALID_ARGUMENT; }
-  for (count = 0;; count++) {
-    uint32_t lock;
-    GRN_ATOMIC_ADD_EX(io->lock, 1, lock);
-    if (lock) {
-      GRN_ATOMIC_ADD_EX(io->lock, -1, lock);
-      if (count == count_log_border) {
+  GRN_ATOMIC_CAS_EX(io->lock, GRN_IO_LOCK_UNLOCKED, GRN_IO_LOCK_LOCKED, lock);
+  if (lock == GRN_IO_LOCK_UNLOCKED) {
+    io->lock_statistics.n_locks++;
+    return GRN_SUCCESS;
+  }
+  if (!timeout) {
+    GRN_LOG(ctx, GRN_LOG_WARNING,
+            "[DB Locked] time out(%d): io(%s) collisions(%d/%d)",
+            timeout, io->path, _ncolls, _ncalls);
+    goto exit;
+  }
+  grn_timeval_now(ctx, &wait_start);
+  /* Spin a while: the owner usually releases the lock soon. The number of
+     spins adapts to how long the previous contended locks took. */
+  max_n_spins = io->lock_n_spins * 2 + 10;
+  if (max_n_spins > GRN_IO_LOCK_MAX_N_SPINS) {
+    max_n_spins = GRN_IO_LOCK_MAX_N_SPINS;
+  }
+  for (n_spins = 0; n_spins < max_n_spins; n_spins++) {
+    GRN_IO_LOCK_PAUSE();
+    if (*((volatile uint32_t *)io->lock) == GRN_IO_LOCK_UNLOCKED) {
+      GRN_ATOMIC_CAS_EX(io->lock, GRN_IO_LOCK_UNLOCKED, GRN_IO_LOCK_LOCKED,
+                        lock);
+      if (lock == GRN_IO_LOCK_UNLOCKED) { goto locked; }
+    }
+  }
+  /* Then sleep on the lock word until the owner wakes us up. A waiter that
+     is woken up but loses the lock waits again, so the timeout is the time
+     of timeout waits since the first try instead of the number of waits. */
+  timeout_nsec = (uint64_t)timeout * GRN_LOCK_WAIT_TIME_NANOSECOND;
+  for (count = 0;;) {
+    lock = grn_io_lock_exchange(io->lock, GRN_IO_LOCK_CONTENDED);
+    if (lock == GRN_IO_LOCK_UNLOCKED) { break; }
+    n_waits++;
+    if (!(++_ncolls % 1000000) && (_ncolls > _ncalls)) {
+      if (_ncolls < 0 || _ncalls < 0) {
+        _ncolls = 0; _ncalls = 0;
+      } else {
         GRN_LOG(ctx, GRN_LOG_NOTICE,
-                "io(%s) collisions(%d/%d): lock failed %d times",
-                io->path, _ncolls, _ncalls, count_log_border);
+                "io(%s) collisions(%d/%d)", io->path, _ncolls, _ncalls);
       }
-      if (!timeout || (timeout > 0 && timeout == count)) {
+    }
+    grn_io_lock_wait(io->lock, GRN_IO_LOCK_CONTENDED);
+    count++;
+    if (count == count_log_border) {
+      GRN_LOG(ctx, GRN_LOG_NOTICE,
+              "io(%s) collisions(%d/%d): lock failed %d times",
+              io->path, _ncolls, _ncalls, count_log_border);
+    }
+    if (timeout > 0) {
+      grn_timeval_now(ctx, &wait_end);
+      if (grn_io_lock_elapsed_nsec(&wait_start, &wait_end) >= timeout_nsec) {
         GRN_LOG(ctx, GRN_LOG_WARNING,
                 "[DB Locked] time out(%d): io(%s) collisions(%d/%d)",
                 timeout, io->path, _ncolls, _ncalls);
-        break;
-      }
-      if (!(++_ncolls % 1000000) && (_ncolls > _ncalls)) {
-        if (_ncolls < 0 || _ncalls < 0) {
-          _ncolls = 0; _ncalls = 0;
-        } else {
-          GRN_LOG(ctx, GRN_LOG_NOTICE,
-                  "io(%s) collisions(%d/%d)", io->path, _ncolls, _ncalls);
-        }
+        goto exit;
       }
-      grn_nanosleep(GRN_LOCK_WAIT_TIME_NANOSECOND);
-      continue;
     }
-    return GRN_SUCCESS;
   }
+locked :
+  grn_timeval_now(ctx, &wait_end);
+  io->lock_statistics.n_locks++;
+  io->lock_statistics.n_contentions++;
+  io->lock_statistics.n_waits += n_waits;
+  io->lock_statistics.wait_time_nsec +=
+    grn_io_lock_elapsed_nsec(&wait_start, &wait_end);
+  io->lock_n_spins += ((int32_t)n_spins - (int32_t)io->lock_n_spins) / 8;
+  return GRN_SUCCESS;
+exit :
+  GRN_ATOMIC_ADD_EX(&io->lock_statistics.n_timeouts, 1, lock);
   ERR(GRN_RESOURCE_DEADLOCK_AVOIDED, "grn_io_lock failed");
   return ctx->rc;
 }
@@ -1323,14 +1509,20 @@ grn_io_unlock(grn_io *io)
 {
   if (io) {
     uint32_t lock;
-    GRN_ATOMIC_ADD_EX(io->lock, -1, lock);
+    lock = grn_io_lock_exchange(io->lock, GRN_IO_LOCK_UNLOCKED);
+    if (lock > GRN_IO_LOCK_LOCKED) {
+      grn_io_lock_wake(io->lock, 1);
+    }
   }
 }
 
 void
 grn_io_clear_lock(grn_io *io)
 {
-  if (io) { *io->lock = 0; }
+  if (io) {
+    *io->lock = GRN_IO_LOCK_UNLOCKED;
+    grn_io_lock_wake(io->lock, INT_MAX);
+  }
 }
 
 uint32_t
@@ -1339,6 +1531,16 @@ grn_io_is_locked(grn_io *io)
   return io ? *io->lock : 0;
 }
 
+void
+grn_io_get_lock_statistics(grn_io *io, grn_io_lock_statistics *statistics)
+{
+  if (io) {
+    *statistics = io->lock_statistics;
+  } else {
+    memset(statistics, 0, sizeof(grn_io_lock_statistics));
+  }
+}
+
 /** mmap abstraction **/
 
 static size_t mmap_size = 0;
@@ -88,6 +88,15 @@ typedef struct {
 
 typedef struct _grn_io_array_info grn_io_array_info;
 
+typedef struct {
+  /* counters of the current process; updated while the lock is held */
+  uint64_t n_locks;
+  uint64_t n_contentions;
+  uint64_t n_waits;
+  uint64_t wait_time_nsec;
+  uint32_t n_timeouts;
+} grn_io_lock_statistics;
+
 struct _grn_io_header {
   char idstr[16];
   uint32_t type;
@@ -119,6 +128,8 @@ struct _grn_io {
   uint32_t count;
   uint8_t flags;
   uint32_t *lock;
+  uint32_t lock_n_spins;
+  grn_io_lock_statistics lock_statistics;
 };
 
 GRN_API grn_io *grn_io_create(grn_ctx *ctx, const char *path,
@@ -130,6 +141,7 @@ GRN_API grn_rc grn_io_close(grn_ctx *ctx, grn_io *io);
 grn_rc grn_io_remove(grn_ctx *ctx, const char *path);
 grn_rc grn_io_size(grn_ctx *ctx, grn_io *io, uint64_t *size);
 grn_rc grn_io_rename(grn_ctx *ctx, const char *old_name, const char *new_name);
+grn_rc grn_io_replace(grn_ctx *ctx, grn_io *io, grn_io *old_io);
 GRN_API void *grn_io_header(grn_io *io);
 
 void *grn_io_win_map(grn_io *io, grn_ctx *ctx, grn_io_win *iw, uint32_t segment,
@@ -320,6 +332,7 @@ GRN_API grn_rc grn_io_lock(grn_ctx *ctx, grn_io *io, int timeout);
 GRN_API void grn_io_unlock(grn_io *io);
 void grn_io_clear_lock(grn_io *io);
 uint32_t grn_io_is_locked(grn_io *io);
+void grn_io_get_lock_statistics(grn_io *io, grn_io_lock_statistics *statistics);
 
 #define GRN_IO_ARRAY_AT(io,array,offset,flags,res) do {\
   grn_io_array_info *ainfo = &(io)->ainfo[array];\
@@ -32,6 +32,66 @@
 #define DECR_DEPTH (DEPTH ? grn_bulk_truncate(ctx, LEVELS, GRN_BULK_VSIZE(LEVELS) - sizeof(uint32_t)) : 0)
 #define INCR_LENGTH (DEPTH ? (GRN_UINT32_VALUE_AT(LEVELS, (DEPTH - 1)) += 2) : 0)
 
+/*
+ * Columnar output: each value is a one byte tag followed by its data in
+ * host byte order. A table is output as a record batch that has a
+ * contiguous buffer for each column.
+ */
+#define COLUMNAR_TAG_NULL            'N'
+#define COLUMNAR_TAG_TRUE            'T'
+#define COLUMNAR_TAG_FALSE           'F'
+#define COLUMNAR_TAG_INT             'i'
+#define COLUMNAR_TAG_UINT            'u'
+#define COLUMNAR_TAG_FLOAT           'd'
+#define COLUMNAR_TAG_TIME            't'
+#define COLUMNAR_TAG_STRING          's'
+#define COLUMNAR_TAG_GEO_POINT       'g'
+#define COLUMNAR_TAG_ARRAY_OPEN      '['
+#define COLUMNAR_TAG_ARRAY_CLOSE     ']'
+#define COLUMNAR_TAG_MAP_OPEN        '{'
+#define COLUMNAR_TAG_MAP_CLOSE       '}'
+#define COLUMNAR_TAG_RECORD_BATCH    'R'
+
+#define COLUMNAR_LAYOUT_FIXED        'f'
+#define COLUMNAR_LAYOUT_VARIABLE     'v'
+#define COLUMNAR_LAYOUT_VALUES       'o'
+
+static inline void
+columnar_put_uint32(grn_ctx *ctx, grn_obj *outbuf, uint32_t value)
+{
+  GRN_TEXT_PUT(ctx, outbuf, &value, sizeof(uint32_t));
+}
+
+static inline void
+columnar_put_int64(grn_ctx *ctx, grn_obj *outbuf, char tag, int64_t value)
+{
+  GRN_TEXT_PUTC(ctx, outbuf, tag);
+  GRN_TEXT_PUT(ctx, outbuf, &value, sizeof(int64_t));
+}
+
+static inline void
+columnar_put_float(grn_ctx *ctx, grn_obj *outbuf, double value)
+{
+  GRN_TEXT_PUTC(ctx, outbuf, COLUMNAR_TAG_FLOAT);
+  GRN_TEXT_PUT(ctx, outbuf, &value, sizeof(double));
+}
+
+static inline void
+columnar_put_raw_str(grn_ctx *ctx, grn_obj *outbuf,
+                     const char *value, size_t value_len)
+{
+  columnar_put_uint32(ctx, outbuf, value_len);
+  GRN_TEXT_PUT(ctx, outbuf, value, value_len);
+}
+
+static inline void
+columnar_put_str(grn_ctx *ctx, grn_obj *outbuf,
+                 const char *value, size_t value_len)
+{
+  GRN_TEXT_PUTC(ctx, outbuf, COLUMNAR_TAG_STRING);
+  columnar_put_raw_str(ctx, outbuf, value, value_len);
+}
+
 static void
 put_delimiter(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type)
 {
@@ -56,6 +116,8 @@ put_delimiter(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type)
   case GRN_CONTENT_MSGPACK :
     // do nothing
     break;
+  case GRN_CONTENT_COLUMNAR :
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
@@ -90,6 +152,9 @@ grn_output_array_open(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_typ
     msgpack_pack_array(&ctx->impl->msgpacker, nelements);
 #endif
     break;
+  case GRN_CONTENT_COLUMNAR :
+    GRN_TEXT_PUTC(ctx, outbuf, COLUMNAR_TAG_ARRAY_OPEN);
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
@@ -121,6 +186,9 @@ grn_output_array_close(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_ty
   case GRN_CONTENT_MSGPACK :
     // do nothing
     break;
+  case GRN_CONTENT_COLUMNAR :
+    GRN_TEXT_PUTC(ctx, outbuf, COLUMNAR_TAG_ARRAY_CLOSE);
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
@@ -157,6 +225,9 @@ grn_output_map_open(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type,
     msgpack_pack_map(&ctx->impl->msgpacker, nelements);
 #endif
     break;
+  case GRN_CONTENT_COLUMNAR :
+    GRN_TEXT_PUTC(ctx, outbuf, COLUMNAR_TAG_MAP_OPEN);
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
@@ -188,6 +259,9 @@ grn_output_map_close(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type
   case GRN_CONTENT_MSGPACK :
     // do nothing
     break;
+  case GRN_CONTENT_COLUMNAR :
+    GRN_TEXT_PUTC(ctx, outbuf, COLUMNAR_TAG_MAP_CLOSE);
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
@@ -216,6 +290,9 @@ grn_output_int32(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type, in
     msgpack_pack_int32(&ctx->impl->msgpacker, value);
 #endif
     break;
+  case GRN_CONTENT_COLUMNAR :
+    columnar_put_int64(ctx, outbuf, COLUMNAR_TAG_INT, value);
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
@@ -243,6 +320,9 @@ grn_output_int64(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type, in
     msgpack_pack_int64(&ctx->impl->msgpacker, value);
 #endif
     break;
+  case GRN_CONTENT_COLUMNAR :
+    columnar_put_int64(ctx, outbuf, COLUMNAR_TAG_INT, value);
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
@@ -270,6 +350,9 @@ grn_output_uint64(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type, i
     msgpack_pack_uint64(&ctx->impl->msgpacker, value);
 #endif
     break;
+  case GRN_CONTENT_COLUMNAR :
+    columnar_put_int64(ctx, outbuf, COLUMNAR_TAG_UINT, value);
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
@@ -297,6 +380,9 @@ grn_output_float(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type, do
     msgpack_pack_double(&ctx->impl->msgpacker, value);
 #endif
     break;
+  case GRN_CONTENT_COLUMNAR :
+    columnar_put_float(ctx, outbuf, value);
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
@@ -326,6 +412,9 @@ grn_output_str(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type,
     msgpack_pack_raw_body(&ctx->impl->msgpacker, value, value_len);
 #endif
     break;
+  case GRN_CONTENT_COLUMNAR :
+    columnar_put_str(ctx, outbuf, value, value_len);
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
@@ -364,6 +453,9 @@ grn_output_bool(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type, grn
     }
 #endif
     break;
+  case GRN_CONTENT_COLUMNAR :
+    GRN_TEXT_PUTC(ctx, outbuf, value ? COLUMNAR_TAG_TRUE : COLUMNAR_TAG_FALSE);
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
@@ -388,6 +480,9 @@ grn_output_null(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type)
     msgpack_pack_nil(&ctx->impl->msgpacker);
 #endif
     break;
+  case GRN_CONTENT_COLUMNAR :
+    GRN_TEXT_PUTC(ctx, outbuf, COLUMNAR_TAG_NULL);
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
@@ -428,6 +523,10 @@ grn_output_time(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type, int
     msgpack_pack_double(&ctx->impl->msgpacker, dv);
 #endif
     break;
+  case GRN_CONTENT_COLUMNAR :
+    /* microseconds since the epoch */
+    columnar_put_int64(ctx, outbuf, COLUMNAR_TAG_TIME, value);
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
@@ -489,6 +588,14 @@ grn_output_geo_point(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type
     }
 #endif
     break;
+  case GRN_CONTENT_COLUMNAR :
+    if (value) {
+      GRN_TEXT_PUTC(ctx, outbuf, COLUMNAR_TAG_GEO_POINT);
+      GRN_TEXT_PUT(ctx, outbuf, value, sizeof(grn_geo_point));
+    } else {
+      GRN_TEXT_PUTC(ctx, outbuf, COLUMNAR_TAG_NULL);
+    }
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
@@ -535,6 +642,14 @@ grn_text_atoj(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type,
         }
         buf.header.domain = GRN_DB_INT32;
         break;
+      case GRN_ACCESSOR_GET_CALC_VALUE :
+        {
+          grn_rset_recinfo *ri = (grn_rset_recinfo *)grn_obj_get_value_(ctx, a->obj, id, &vs);
+          byte *calc_value = grn_rset_recinfo_calc_value(a->obj, ri, a->offset);
+          grn_bulk_write(ctx, &buf, (const char *)calc_value, sizeof(int64_t));
+        }
+        buf.header.domain = grn_rset_recinfo_calc_value_range(a->obj, a->offset);
+        break;
       case GRN_ACCESSOR_GET_COLUMN_VALUE :
         if ((a->obj->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) == GRN_OBJ_COLUMN_VECTOR) {
           if (a->next) {
@@ -1241,6 +1356,27 @@ grn_output_table_record_by_expression(grn_ctx *ctx, grn_obj *outbuf,
   }
 }
 
+/*
+ * Passes the rendered records to the output handler with GRN_CTX_MORE
+ * when they exceed ctx->impl->output_chunk_size. XML isn't streamed
+ * because its envelope transforms the whole body.
+ */
+static inline void
+grn_output_table_records_flush(grn_ctx *ctx, grn_obj *outbuf,
+                               grn_content_type output_type)
+{
+  if (ctx->impl->output_chunk_size == 0 ||
+      GRN_BULK_VSIZE(outbuf) < ctx->impl->output_chunk_size) {
+    return;
+  }
+  if (outbuf != ctx->impl->outbuf || !ctx->impl->output ||
+      ctx->impl->output_ref || output_type == GRN_CONTENT_XML) {
+    return;
+  }
+  ctx->impl->output(ctx, GRN_CTX_MORE, ctx->impl->data.ptr);
+  ctx->impl->n_output_chunks++;
+}
+
 static inline void
 grn_output_table_records_by_expression(grn_ctx *ctx, grn_obj *outbuf,
                                        grn_content_type output_type,
@@ -1300,6 +1436,7 @@ grn_output_table_records_by_expression(grn_ctx *ctx, grn_obj *outbuf,
     }
 
     grn_output_array_close(ctx, outbuf, output_type);
+    grn_output_table_records_flush(ctx, outbuf, output_type);
   }
 }
 
@@ -1319,6 +1456,7 @@ grn_output_table_records_by_columns(grn_ctx *ctx, grn_obj *outbuf,
       grn_text_atoj(ctx, outbuf, output_type, columns[i], id);
     }
     grn_output_array_close(ctx, outbuf, output_type);
+    grn_output_table_records_flush(ctx, outbuf, output_type);
   }
 }
 
@@ -1344,13 +1482,248 @@ grn_output_table_records(grn_ctx *ctx, grn_obj *outbuf,
   }
 }
 
+static char
+grn_output_table_columnar_layout(grn_ctx *ctx, grn_obj *column,
+                                 uint32_t *value_size)
+{
+  grn_id range_id;
+  grn_obj *range;
+  switch (column->header.type) {
+  case GRN_ACCESSOR :
+    {
+      grn_accessor *a;
+      for (a = (grn_accessor *)column; a; a = a->next) {
+        switch (a->action) {
+        case GRN_ACCESSOR_GET_ID :
+        case GRN_ACCESSOR_GET_KEY :
+        case GRN_ACCESSOR_GET_VALUE :
+        case GRN_ACCESSOR_GET_SCORE :
+        case GRN_ACCESSOR_GET_NSUBRECS :
+        case GRN_ACCESSOR_GET_CALC_VALUE :
+          break;
+        case GRN_ACCESSOR_GET_COLUMN_VALUE :
+          if ((a->obj->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) ==
+              GRN_OBJ_COLUMN_VECTOR) {
+            return COLUMNAR_LAYOUT_VALUES;
+          }
+          break;
+        default :
+          return COLUMNAR_LAYOUT_VALUES;
+        }
+      }
+    }
+    break;
+  case GRN_COLUMN_FIX_SIZE :
+  case GRN_COLUMN_VAR_SIZE :
+    if ((column->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) ==
+        GRN_OBJ_COLUMN_VECTOR) {
+      return COLUMNAR_LAYOUT_VALUES;
+    }
+    break;
+  default :
+    return COLUMNAR_LAYOUT_VALUES;
+  }
+  range_id = grn_obj_get_range(ctx, column);
+  switch (range_id) {
+  case GRN_DB_SHORT_TEXT :
+  case GRN_DB_TEXT :
+  case GRN_DB_LONG_TEXT :
+    return COLUMNAR_LAYOUT_VARIABLE;
+  case GRN_DB_BOOL :
+  case GRN_DB_INT8 :
+  case GRN_DB_UINT8 :
+  case GRN_DB_INT16 :
+  case GRN_DB_UINT16 :
+  case GRN_DB_INT32 :
+  case GRN_DB_UINT32 :
+  case GRN_DB_INT64 :
+  case GRN_DB_UINT64 :
+  case GRN_DB_FLOAT :
+  case GRN_DB_TIME :
+  case GRN_DB_TOKYO_GEO_POINT :
+  case GRN_DB_WGS84_GEO_POINT :
+    range = grn_ctx_at(ctx, range_id);
+    *value_size = GRN_TYPE_SIZE(DB_OBJ(range));
+    return COLUMNAR_LAYOUT_FIXED;
+  default :
+    /* References are output as their keys. */
+    return COLUMNAR_LAYOUT_VALUES;
+  }
+}
+
+static void
+grn_output_table_columnar_fixed(grn_ctx *ctx, grn_obj *outbuf,
+                                grn_obj *column, uint32_t value_size,
+                                grn_id *ids, uint32_t n_rows)
+{
+  uint32_t i;
+  size_t bitmap_size = (n_rows + 7) / 8;
+  size_t bitmap_offset, values_offset;
+  uint8_t *bitmap;
+  char *values;
+
+  columnar_put_uint32(ctx, outbuf, value_size);
+  bitmap_offset = GRN_BULK_VSIZE(outbuf);
+  if (grn_bulk_space(ctx, outbuf, bitmap_size + (size_t)value_size * n_rows)) {
+    return;
+  }
+  values_offset = bitmap_offset + bitmap_size;
+  bitmap = (uint8_t *)(GRN_BULK_HEAD(outbuf) + bitmap_offset);
+  values = GRN_BULK_HEAD(outbuf) + values_offset;
+  memset(bitmap, 0, bitmap_size);
+  memset(values, 0, (size_t)value_size * n_rows);
+  if (column->header.type == GRN_COLUMN_FIX_SIZE &&
+      ((grn_ra *)column)->header->element_size == value_size) {
+    /* Copies values from the column directly. */
+    grn_ra *ra = (grn_ra *)column;
+    grn_ra_cache cache;
+    GRN_RA_CACHE_INIT(ra, &cache);
+    for (i = 0; i < n_rows; i++) {
+      void *value = grn_ra_ref_cache(ctx, ra, ids[i], &cache);
+      if (value) {
+        memcpy(values + (size_t)value_size * i, value, value_size);
+        bitmap[i / 8] |= 1 << (i % 8);
+      }
+    }
+    GRN_RA_CACHE_FIN(ra, &cache);
+  } else {
+    grn_obj buf;
+    GRN_TEXT_INIT(&buf, 0);
+    for (i = 0; i < n_rows; i++) {
+      GRN_BULK_REWIND(&buf);
+      grn_obj_get_value(ctx, column, ids[i], &buf);
+      /* _score puts the record info before the score. */
+      if (GRN_BULK_VSIZE(&buf) >= value_size) {
+        memcpy(values + (size_t)value_size * i,
+               GRN_BULK_CURR(&buf) - value_size, value_size);
+        bitmap[i / 8] |= 1 << (i % 8);
+      }
+    }
+    GRN_OBJ_FIN(ctx, &buf);
+  }
+}
+
+static void
+grn_output_table_columnar_variable(grn_ctx *ctx, grn_obj *outbuf,
+                                   grn_obj *column,
+                                   grn_id *ids, uint32_t n_rows)
+{
+  uint32_t i;
+  size_t bitmap_size = (n_rows + 7) / 8;
+  grn_obj offsets, data;
+  GRN_UINT32_INIT(&offsets, GRN_OBJ_VECTOR);
+  GRN_TEXT_INIT(&data, 0);
+  GRN_UINT32_PUT(ctx, &offsets, 0);
+  for (i = 0; i < n_rows; i++) {
+    grn_obj_get_value(ctx, column, ids[i], &data);
+    GRN_UINT32_PUT(ctx, &offsets, GRN_BULK_VSIZE(&data));
+  }
+  /* Text values are always valid. */
+  for (i = 0; i < bitmap_size; i++) {
+    GRN_TEXT_PUTC(ctx, outbuf, 0xff);
+  }
+  GRN_TEXT_PUT(ctx, outbuf,
+               GRN_BULK_HEAD(&offsets), GRN_BULK_VSIZE(&offsets));
+  GRN_TEXT_PUT(ctx, outbuf, GRN_BULK_HEAD(&data), GRN_BULK_VSIZE(&data));
+  GRN_OBJ_FIN(ctx, &data);
+  GRN_OBJ_FIN(ctx, &offsets);
+}
+
+/*
+ * RECORD BATCH := 'R' nhits n_rows n_columns COLUMN*
+ * COLUMN := name type layout BUFFERS
+ *   'f': value_size validity_bitmap values
+ *   'v': validity_bitmap offsets[n_rows + 1] data
+ *   'o': tagged values
+ */
+static void
+grn_output_table_columnar(grn_ctx *ctx, grn_obj *outbuf,
+                          grn_obj *table, grn_obj_format *format)
+{
+  int i;
+  int ncolumns = GRN_BULK_VSIZE(&format->columns)/sizeof(grn_obj *);
+  grn_obj **columns = (grn_obj **)GRN_BULK_HEAD(&format->columns);
+  grn_obj ids, buf;
+  grn_id *row_ids;
+  uint32_t n_rows;
+  grn_table_cursor *tc;
+
+  GRN_RECORD_INIT(&ids, GRN_OBJ_VECTOR, grn_obj_id(ctx, table));
+  GRN_TEXT_INIT(&buf, 0);
+  tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0,
+                             format->offset, format->limit,
+                             GRN_CURSOR_ASCENDING);
+  if (tc) {
+    grn_id id;
+    while ((id = grn_table_cursor_next(ctx, tc)) != GRN_ID_NIL) {
+      GRN_RECORD_PUT(ctx, &ids, id);
+    }
+    grn_table_cursor_close(ctx, tc);
+  } else {
+    ERRCLR(ctx);
+  }
+  row_ids = (grn_id *)GRN_BULK_HEAD(&ids);
+  n_rows = GRN_BULK_VSIZE(&ids) / sizeof(grn_id);
+
+  put_delimiter(ctx, outbuf, GRN_CONTENT_COLUMNAR);
+  GRN_TEXT_PUTC(ctx, outbuf, COLUMNAR_TAG_RECORD_BATCH);
+  columnar_put_uint32(ctx, outbuf, format->nhits);
+  columnar_put_uint32(ctx, outbuf, n_rows);
+  columnar_put_uint32(ctx, outbuf, ncolumns);
+  for (i = 0; i < ncolumns; i++) {
+    grn_obj *column = columns[i];
+    grn_id range_id;
+    uint32_t value_size = 0;
+    char layout;
+
+    GRN_BULK_REWIND(&buf);
+    grn_column_name_(ctx, column, &buf);
+    columnar_put_raw_str(ctx, outbuf, GRN_TEXT_VALUE(&buf), GRN_TEXT_LEN(&buf));
+    GRN_BULK_REWIND(&buf);
+    range_id = grn_obj_get_range(ctx, column);
+    if (range_id != GRN_ID_NIL) {
+      char name_buf[GRN_TABLE_MAX_KEY_SIZE];
+      int name_len = grn_obj_name(ctx, grn_ctx_at(ctx, range_id),
+                                  name_buf, GRN_TABLE_MAX_KEY_SIZE);
+      GRN_TEXT_PUT(ctx, &buf, name_buf, name_len);
+    }
+    columnar_put_raw_str(ctx, outbuf, GRN_TEXT_VALUE(&buf), GRN_TEXT_LEN(&buf));
+
+    layout = grn_output_table_columnar_layout(ctx, column, &value_size);
+    GRN_TEXT_PUTC(ctx, outbuf, layout);
+    switch (layout) {
+    case COLUMNAR_LAYOUT_FIXED :
+      grn_output_table_columnar_fixed(ctx, outbuf, column, value_size,
+                                      row_ids, n_rows);
+      break;
+    case COLUMNAR_LAYOUT_VARIABLE :
+      grn_output_table_columnar_variable(ctx, outbuf, column,
+                                         row_ids, n_rows);
+      break;
+    default :
+      {
+        uint32_t j;
+        for (j = 0; j < n_rows; j++) {
+          grn_text_atoj(ctx, outbuf, GRN_CONTENT_COLUMNAR, column, row_ids[j]);
+        }
+      }
+      break;
+    }
+  }
+  INCR_LENGTH;
+  GRN_OBJ_FIN(ctx, &buf);
+  GRN_OBJ_FIN(ctx, &ids);
+}
+
 static inline void
 grn_output_table(grn_ctx *ctx, grn_obj *outbuf, grn_content_type output_type,
                  grn_obj *table, grn_obj_format *format)
 {
   grn_obj buf;
   GRN_TEXT_INIT(&buf, 0);
-  if (format) {
+  if (format && output_type == GRN_CONTENT_COLUMNAR && !format->expression) {
+    grn_output_table_columnar(ctx, outbuf, table, format);
+  } else if (format) {
     int resultset_size = 1;
     /* resultset: [NHITS, (COLUMNS), (HITS)] */
     if (format->flags & GRN_OBJ_FORMAT_WITH_COLUMN_NAMES) {
@@ -1920,6 +2293,31 @@ grn_output_envelope(grn_ctx *ctx,
     }
 #endif
     break;
+  case GRN_CONTENT_COLUMNAR:
+    /* "GRNC" [HEAD, (BODY)]
+       HEAD := [rc, started, elapsed, (error, (ERROR DETAIL))] */
+    GRN_TEXT_PUTS(ctx, head, "GRNC");
+    GRN_TEXT_PUTC(ctx, head, COLUMNAR_TAG_ARRAY_OPEN);
+    GRN_TEXT_PUTC(ctx, head, COLUMNAR_TAG_ARRAY_OPEN);
+    columnar_put_int64(ctx, head, COLUMNAR_TAG_INT, rc);
+    columnar_put_float(ctx, head, started);
+    columnar_put_float(ctx, head, elapsed);
+    if (rc != GRN_SUCCESS) {
+      columnar_put_str(ctx, head, ctx->errbuf, strlen(ctx->errbuf));
+      if (ctx->errfunc && ctx->errfile) {
+        /* ERROR DETAIL := [[errfunc, errfile, errline]] */
+        GRN_TEXT_PUTC(ctx, head, COLUMNAR_TAG_ARRAY_OPEN);
+        GRN_TEXT_PUTC(ctx, head, COLUMNAR_TAG_ARRAY_OPEN);
+        columnar_put_str(ctx, head, ctx->errfunc, strlen(ctx->errfunc));
+        columnar_put_str(ctx, head, ctx->errfile, strlen(ctx->errfile));
+        columnar_put_int64(ctx, head, COLUMNAR_TAG_INT, ctx->errline);
+        GRN_TEXT_PUTC(ctx, head, COLUMNAR_TAG_ARRAY_CLOSE);
+        GRN_TEXT_PUTC(ctx, head, COLUMNAR_TAG_ARRAY_CLOSE);
+      }
+    }
+    GRN_TEXT_PUTC(ctx, head, COLUMNAR_TAG_ARRAY_CLOSE);
+    GRN_TEXT_PUTC(ctx, foot, COLUMNAR_TAG_ARRAY_CLOSE);
+    break;
   case GRN_CONTENT_NONE:
     break;
   }
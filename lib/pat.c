@@ -423,6 +423,7 @@ _grn_pat_create(grn_ctx *ctx, grn_pat *pat,
   header->curr_del2 = 0;
   header->curr_del3 = 0;
   header->n_garbages = 0;
+  header->version = 0;
   header->tokenizer = GRN_ID_NIL;
   if (header->flags & GRN_OBJ_KEY_NORMALIZE) {
     header->flags &= ~GRN_OBJ_KEY_NORMALIZE;
@@ -695,6 +696,7 @@ _grn_pat_add(grn_ctx *ctx, grn_pat *pat, const uint8_t *key, uint32_t size, uint
   } else {
     c = len - 2;
   }
+  GRN_TABLE_UPDATE_BEGIN(&pat->header->version);
   {
     uint32_t size2 = size > sizeof(uint32_t) ? size : 0;
     if (*lkey && size2) {
@@ -703,10 +705,16 @@ _grn_pat_add(grn_ctx *ctx, grn_pat *pat, const uint8_t *key, uint32_t size, uint
         pat->header->n_entries++;
         pat->header->n_garbages--;
         PAT_AT(pat, r, rn);
-        if (!rn) { return 0; }
+        if (!rn) {
+          GRN_TABLE_UPDATE_END(&pat->header->version);
+          return 0;
+        }
         pat->header->garbages[0] = rn->lr[0];
       } else {
-        if (!(rn = pat_node_new(ctx, pat, &r))) { return 0; }
+        if (!(rn = pat_node_new(ctx, pat, &r))) {
+          GRN_TABLE_UPDATE_END(&pat->header->version);
+          return 0;
+        }
       }
       PAT_IMD_OFF(rn);
       PAT_LEN_SET(rn, size);
@@ -718,13 +726,22 @@ _grn_pat_add(grn_ctx *ctx, grn_pat *pat, const uint8_t *key, uint32_t size, uint
         pat->header->n_entries++;
         pat->header->n_garbages--;
         PAT_AT(pat, r, rn);
-        if (!rn) { return 0; }
+        if (!rn) {
+          GRN_TABLE_UPDATE_END(&pat->header->version);
+          return 0;
+        }
         pat->header->garbages[size2] = rn->lr[0];
-        if (!(keybuf = pat_node_get_key(ctx, pat, rn))) { return 0; }
+        if (!(keybuf = pat_node_get_key(ctx, pat, rn))) {
+          GRN_TABLE_UPDATE_END(&pat->header->version);
+          return 0;
+        }
         PAT_LEN_SET(rn, size);
         memcpy(keybuf, key, size);
       } else {
-        if (!(rn = pat_node_new(ctx, pat, &r))) { return 0; }
+        if (!(rn = pat_node_new(ctx, pat, &r))) {
+          GRN_TABLE_UPDATE_END(&pat->header->version);
+          return 0;
+        }
         pat_node_set_key(ctx, pat, rn, key, size);
       }
       *lkey = rn->key;
@@ -741,6 +758,7 @@ _grn_pat_add(grn_ctx *ctx, grn_pat *pat, const uint8_t *key, uint32_t size, uint
   }
   // smp_wmb();
   *p0 = r;
+  GRN_TABLE_UPDATE_END(&pat->header->version);
   *new = 1;
   if (pat->cache) { pat->cache[cache_id] = r; }
   return r;
@@ -915,9 +933,13 @@ _grn_pat_get(grn_ctx *ctx, grn_pat *pat, const void *key, uint32_t key_size, voi
 grn_id
 grn_pat_get(grn_ctx *ctx, grn_pat *pat, const void *key, uint32_t key_size, void **value)
 {
+  grn_id id;
   uint8_t keybuf[MAX_FIXED_KEY_SIZE];
   KEY_ENCODE(pat, keybuf, key, key_size);
-  return _grn_pat_get(ctx, pat, key, key_size, value);
+  GRN_TABLE_READ(ctx, &pat->header->version, pat->io, {
+    id = _grn_pat_get(ctx, pat, key, key_size, value);
+  });
+  return id;
 }
 
 grn_id
@@ -1046,14 +1068,13 @@ grn_pat_suffix_search2(grn_ctx *ctx, grn_pat *pat, const void *key, uint32_t key
   return h;
 }
 
-grn_id
-grn_pat_lcp_search(grn_ctx *ctx, grn_pat *pat, const void *key, uint32_t key_size)
+inline static grn_id
+_grn_pat_lcp_search(grn_ctx *ctx, grn_pat *pat, const void *key, uint32_t key_size)
 {
   pat_node *rn;
   grn_id r, r2 = GRN_ID_NIL;
   uint32_t len = key_size * 16;
   int c0 = -1, c;
-  if (!pat || !key || !(pat->obj.header.flags & GRN_OBJ_KEY_VAR_SIZE)) { return GRN_ID_NIL; }
   PAT_AT(pat, 0, rn);
   for (r = rn->lr[1]; r;) {
     PAT_AT(pat, r, rn);
@@ -1086,9 +1107,20 @@ grn_pat_lcp_search(grn_ctx *ctx, grn_pat *pat, const void *key, uint32_t key_siz
   return r2;
 }
 
+grn_id
+grn_pat_lcp_search(grn_ctx *ctx, grn_pat *pat, const void *key, uint32_t key_size)
+{
+  grn_id id;
+  if (!pat || !key || !(pat->obj.header.flags & GRN_OBJ_KEY_VAR_SIZE)) { return GRN_ID_NIL; }
+  GRN_TABLE_READ(ctx, &pat->header->version, pat->io, {
+    id = _grn_pat_lcp_search(ctx, pat, key, key_size);
+  });
+  return id;
+}
+
 inline static grn_rc
-_grn_pat_del(grn_ctx *ctx, grn_pat *pat, const char *key, uint32_t key_size, int shared,
-             grn_table_delete_optarg *optarg)
+_grn_pat_del_(grn_ctx *ctx, grn_pat *pat, const char *key, uint32_t key_size,
+              int shared, grn_table_delete_optarg *optarg)
 {
   grn_pat_delinfo *di;
   uint8_t direction;
@@ -1215,6 +1247,17 @@ _grn_pat_del(grn_ctx *ctx, grn_pat *pat, const char *key, uint32_t key_size, int
   return GRN_SUCCESS;
 }
 
+inline static grn_rc
+_grn_pat_del(grn_ctx *ctx, grn_pat *pat, const char *key, uint32_t key_size, int shared,
+             grn_table_delete_optarg *optarg)
+{
+  grn_rc rc;
+  GRN_TABLE_UPDATE_BEGIN(&pat->header->version);
+  rc = _grn_pat_del_(ctx, pat, key, key_size, shared, optarg);
+  GRN_TABLE_UPDATE_END(&pat->header->version);
+  return rc;
+}
+
 static grn_rc
 _grn_pat_delete(grn_ctx *ctx, grn_pat *pat, const void *key, uint32_t key_size,
                 grn_table_delete_optarg *optarg)
@@ -1277,13 +1320,12 @@ grn_pat_delete_by_id(grn_ctx *ctx, grn_pat *pat, grn_id id,
   }
 }
 
-int
-grn_pat_get_key(grn_ctx *ctx, grn_pat *pat, grn_id id, void *keybuf, int bufsize)
+inline static int
+_grn_pat_get_key(grn_ctx *ctx, grn_pat *pat, grn_id id, void *keybuf, int bufsize)
 {
   int len;
   uint8_t *key;
   pat_node *node;
-  if (!pat) { return GRN_INVALID_ARGUMENT; }
   PAT_AT(pat, id, node);
   if (!node) { return 0; }
   if (!(key = pat_node_get_key(ctx, pat, node))) { return 0; }
@@ -1298,6 +1340,17 @@ grn_pat_get_key(grn_ctx *ctx, grn_pat *pat, grn_id id, void *keybuf, int bufsize
   return len;
 }
 
+int
+grn_pat_get_key(grn_ctx *ctx, grn_pat *pat, grn_id id, void *keybuf, int bufsize)
+{
+  int len;
+  if (!pat) { return GRN_INVALID_ARGUMENT; }
+  GRN_TABLE_READ(ctx, &pat->header->version, pat->io, {
+    len = _grn_pat_get_key(ctx, pat, id, keybuf, bufsize);
+  });
+  return len;
+}
+
 int
 grn_pat_get_key2(grn_ctx *ctx, grn_pat *pat, grn_id id, grn_obj *bulk)
 {
@@ -66,7 +66,9 @@ struct grn_pat_header {
   int32_t curr_del3;
   uint32_t n_garbages;
   grn_id normalizer;
-  uint32_t reserved[1004];
+  /* Incremented before and after a modification. See GRN_TABLE_READ(). */
+  uint32_t version;
+  uint32_t reserved[1003];
   grn_pat_delinfo delinfos[GRN_PAT_NDELINFOS];
   grn_id garbages[GRN_PAT_MAX_KEY_SIZE + 1];
 };
@@ -417,6 +417,51 @@ grn_parse_query_flags(grn_ctx *ctx, const char *query_flags,
   return flags;
 }
 
+static grn_table_group_flags
+grn_parse_table_group_calc_types(grn_ctx *ctx, const char *calc_types,
+                                 unsigned int calc_types_len)
+{
+  grn_table_group_flags flags = 0;
+  const char *calc_types_end = calc_types + calc_types_len;
+
+  while (calc_types < calc_types_end) {
+    if (*calc_types == ',' || *calc_types == '|' || *calc_types == ' ') {
+      calc_types += 1;
+      continue;
+    }
+
+#define CHECK_TABLE_GROUP_CALC_TYPE(name)\
+  if (((calc_types_end - calc_types) >= (sizeof(#name) - 1)) &&\
+      (!memcmp(calc_types, #name, sizeof(#name) - 1)) &&\
+      (calc_types + sizeof(#name) - 1 == calc_types_end ||\
+       calc_types[sizeof(#name) - 1] == ',' ||\
+       calc_types[sizeof(#name) - 1] == '|' ||\
+       calc_types[sizeof(#name) - 1] == ' ')) {\
+    flags |= GRN_TABLE_GROUP_CALC_ ## name;\
+    calc_types += sizeof(#name) - 1;\
+    continue;\
+  }
+
+    CHECK_TABLE_GROUP_CALC_TYPE(COUNT);
+    CHECK_TABLE_GROUP_CALC_TYPE(MAX);
+    CHECK_TABLE_GROUP_CALC_TYPE(MIN);
+    CHECK_TABLE_GROUP_CALC_TYPE(SUM);
+    CHECK_TABLE_GROUP_CALC_TYPE(AVG);
+    CHECK_TABLE_GROUP_CALC_TYPE(COUNT_DISTINCT);
+
+#define GRN_TABLE_GROUP_CALC_NONE 0
+    CHECK_TABLE_GROUP_CALC_TYPE(NONE);
+#undef GRN_TABLE_GROUP_CALC_NONE
+
+    ERR(GRN_INVALID_ARGUMENT, "invalid table group calc type: <%.*s>",
+        (int)(calc_types_end - calc_types), calc_types);
+    return 0;
+#undef CHECK_TABLE_GROUP_CALC_TYPE
+  }
+
+  return flags;
+}
+
 static inline grn_bool
 is_output_columns_format_v1(grn_ctx *ctx,
                             const char *output_columns,
@@ -551,11 +596,15 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
            const char *drilldown_sortby, unsigned int drilldown_sortby_len,
            const char *drilldown_output_columns, unsigned int drilldown_output_columns_len,
            int drilldown_offset, int drilldown_limit,
+           const char *drilldown_calc_types, unsigned int drilldown_calc_types_len,
+           const char *drilldown_calc_target, unsigned int drilldown_calc_target_len,
            const char *cache, unsigned int cache_len,
            const char *match_escalation_threshold, unsigned int match_escalation_threshold_len,
            const char *query_expander, unsigned int query_expander_len,
            const char *query_flags, unsigned int query_flags_len,
-           const char *adjuster, unsigned int adjuster_len)
+           const char *adjuster, unsigned int adjuster_len,
+           const char *match_top_k, unsigned int match_top_k_len,
+           const char *n_scan_workers, unsigned int n_scan_workers_len)
 {
   uint32_t nkeys, nhits;
   uint16_t cacheable = 1, taintable = 0;
@@ -568,11 +617,17 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
   uint32_t cache_key_size = table_len + 1 + match_columns_len + 1 + query_len + 1 +
     filter_len + 1 + scorer_len + 1 + sortby_len + 1 + output_columns_len + 1 +
     drilldown_len + 1 + drilldown_sortby_len + 1 +
-    drilldown_output_columns_len + 1 + match_escalation_threshold_len + 1 +
+    drilldown_output_columns_len + 1 + drilldown_calc_types_len + 1 +
+    drilldown_calc_target_len + 1 + match_escalation_threshold_len + 1 +
     query_expander_len + 1 + query_flags_len + 1 + adjuster_len + 1 +
+    match_top_k_len + 1 +
     sizeof(grn_content_type) + sizeof(int) * 4;
   long long int threshold, original_threshold = 0;
+  int original_n_scan_workers = 0;
   grn_cache *cache_obj = grn_cache_current_get(ctx);
+  grn_obj dependencies, *original_dependencies = ctx->impl->dependencies;
+  uint32_t original_n_output_chunks = ctx->impl->n_output_chunks;
+  GRN_UINT32_INIT(&dependencies, GRN_OBJ_VECTOR);
   if (cache_key_size <= GRN_TABLE_MAX_KEY_SIZE) {
     grn_obj *cache_value;
     char *cp = cache_key;
@@ -596,6 +651,10 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
     cp += drilldown_sortby_len; *cp++ = '\0';
     memcpy(cp, drilldown_output_columns, drilldown_output_columns_len);
     cp += drilldown_output_columns_len; *cp++ = '\0';
+    memcpy(cp, drilldown_calc_types, drilldown_calc_types_len);
+    cp += drilldown_calc_types_len; *cp++ = '\0';
+    memcpy(cp, drilldown_calc_target, drilldown_calc_target_len);
+    cp += drilldown_calc_target_len; *cp++ = '\0';
     memcpy(cp, match_escalation_threshold, match_escalation_threshold_len);
     cp += match_escalation_threshold_len; *cp++ = '\0';
     memcpy(cp, query_expander, query_expander_len);
@@ -604,6 +663,8 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
     cp += query_flags_len; *cp++ = '\0';
     memcpy(cp, adjuster, adjuster_len);
     cp += adjuster_len; *cp++ = '\0';
+    memcpy(cp, match_top_k, match_top_k_len);
+    cp += match_top_k_len; *cp++ = '\0';
     memcpy(cp, &output_type, sizeof(grn_content_type)); cp += sizeof(grn_content_type);
     memcpy(cp, &offset, sizeof(int)); cp += sizeof(int);
     memcpy(cp, &limit, sizeof(int)); cp += sizeof(int);
@@ -611,16 +672,20 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
     memcpy(cp, &drilldown_limit, sizeof(int)); cp += sizeof(int);
     cache_value = grn_cache_fetch(ctx, cache_obj, cache_key, cache_key_size);
     if (cache_value) {
-      GRN_TEXT_PUT(ctx, outbuf,
-                   GRN_TEXT_VALUE(cache_value),
-                   GRN_TEXT_LEN(cache_value));
-      grn_cache_unref(ctx, cache_obj, cache_key, cache_key_size);
       GRN_QUERY_LOG(ctx, GRN_QUERY_LOG_CACHE,
                     ":", "cache(%" GRN_FMT_LLD ")",
                     (long long int)GRN_TEXT_LEN(cache_value));
+      grn_ctx_output_cache_value(ctx, cache_obj, cache_value);
+      GRN_OBJ_FIN(ctx, &dependencies);
       return ctx->rc;
     }
+    if (cache_len == 2 && cache[0] == 'n' && cache[1] == 'o') {
+      /* This result isn't cached. Don't make others wait for it. */
+      grn_cache_cancel(ctx, cache_obj, cache_key, cache_key_size);
+    }
   }
+  /* Records the tables that the result depends on for the cache. */
+  ctx->impl->dependencies = &dependencies;
   if (match_escalation_threshold_len) {
     const char *end, *rest;
     original_threshold = grn_ctx_get_match_escalation_threshold(ctx);
@@ -630,6 +695,16 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
       grn_ctx_set_match_escalation_threshold(ctx, threshold);
     }
   }
+  if (n_scan_workers_len) {
+    const char *end, *rest;
+    int n;
+    original_n_scan_workers = grn_ctx_get_n_scan_workers(ctx);
+    end = n_scan_workers + n_scan_workers_len;
+    n = grn_atoi(n_scan_workers, end, &rest);
+    if (end == rest && n > 0) {
+      grn_ctx_set_n_scan_workers(ctx, n);
+    }
+  }
   if ((table_ = grn_ctx_get(ctx, table, table_len))) {
     // match_columns_ = grn_obj_column(ctx, table_, match_columns, match_columns_len);
     if (query_len || filter_len) {
@@ -686,6 +761,9 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
         }
         cacheable *= ((grn_expr *)cond)->cacheable;
         taintable += ((grn_expr *)cond)->taintable;
+        if (!cacheable && cache_key_size <= GRN_TABLE_MAX_KEY_SIZE) {
+          grn_cache_cancel(ctx, cache_obj, cache_key, cache_key_size);
+        }
         /*
         grn_obj strbuf;
         GRN_TEXT_INIT(&strbuf, 0);
@@ -694,7 +772,18 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
         GRN_LOG(ctx, GRN_LOG_NOTICE, "query=(%s)", GRN_TEXT_VALUE(&strbuf));
         GRN_OBJ_FIN(ctx, &strbuf);
         */
-        if (!ctx->rc) { res = grn_table_select(ctx, table_, cond, NULL, GRN_OP_OR); }
+        if (!ctx->rc) {
+          /* Only the best offset + limit records are needed when they are
+             sorted by score alone. */
+          if (match_top_k_len == 3 && !memcmp(match_top_k, "yes", 3) &&
+              query_len && !filter_len && !scorer_len && !adjuster_len &&
+              !drilldown_len && offset >= 0 && limit > 0 &&
+              sortby_len == 7 && !memcmp(sortby, "-_score", 7)) {
+            ctx->impl->match_top_k = offset + limit;
+          }
+          res = grn_table_select(ctx, table_, cond, NULL, GRN_OP_OR);
+          ctx->impl->match_top_k = 0;
+        }
       } else {
         /* todo */
         ERRCLR(ctx);
@@ -835,14 +924,70 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
       if (!ctx->rc && drilldown_len) {
         uint32_t i;
         grn_table_group_result g = {NULL, 0, 0, 1, GRN_TABLE_GROUP_CALC_COUNT, 0};
-        if (gkeys) {
+        grn_obj **drilldown_tables = NULL;
+        grn_table_group_result *results = NULL;
+        grn_table_sort_key *group_keys = NULL;
+        grn_table_group_flags calc_types = 0;
+        grn_obj *calc_target = NULL;
+        if (drilldown_calc_types_len) {
+          calc_types = grn_parse_table_group_calc_types(ctx,
+                                                        drilldown_calc_types,
+                                                        drilldown_calc_types_len);
+        }
+        if (!ctx->rc && drilldown_calc_target_len) {
+          calc_target = grn_obj_column(ctx, res, drilldown_calc_target,
+                                       drilldown_calc_target_len);
+          if (!calc_target) {
+            ERR(GRN_INVALID_ARGUMENT,
+                "[select][drilldown] nonexistent calc target: <%.*s>",
+                drilldown_calc_target_len, drilldown_calc_target);
+          }
+        }
+        if (calc_target) {
+          g.flags |= calc_types;
+          g.calc_target = calc_target;
+        } else {
+          calc_types = 0;
+        }
+        if (gkeys && !ctx->rc) {
+          drilldown_tables = GRN_MALLOCN(grn_obj *, ngkeys);
+          results = GRN_MALLOCN(grn_table_group_result, ngkeys);
+          group_keys = GRN_MALLOCN(grn_table_sort_key, ngkeys);
+        }
+        if (drilldown_tables && results && group_keys) {
+          int n_results = 0;
+          /* All drilldowns are grouped by one pass over the result. */
+          for (i = 0; i < ngkeys; i++) {
+            drilldown_tables[i] =
+              grn_table_create_for_group_with_calc(ctx, NULL, 0, NULL,
+                                                   gkeys[i].key, res, 0,
+                                                   calc_types);
+            if (drilldown_tables[i]) {
+              results[n_results] = g;
+              results[n_results].table = drilldown_tables[i];
+              results[n_results].key_begin = n_results;
+              results[n_results].key_end = n_results + 1;
+              group_keys[n_results] = gkeys[i];
+              n_results++;
+            }
+          }
+          if (n_results > 0) {
+            grn_table_group(ctx, res, group_keys, n_results,
+                            results, n_results);
+          }
+          if (ctx->rc) {
+            for (i = 0; i < ngkeys; i++) {
+              if (drilldown_tables[i]) {
+                grn_obj_unlink(ctx, drilldown_tables[i]);
+                drilldown_tables[i] = NULL;
+              }
+            }
+          }
           for (i = 0; i < ngkeys; i++) {
-            if ((g.table = grn_table_create_for_group(ctx, NULL, 0, NULL,
-                                                      gkeys[i].key, res, 0))) {
+            if ((g.table = drilldown_tables[i])) {
               int n_drilldown_offset = drilldown_offset,
                   n_drilldown_limit = drilldown_limit;
 
-              grn_table_group(ctx, res, &gkeys[i], 1, &g, 1);
               nhits = grn_table_size(ctx, g.table);
 
               grn_normalize_offset_and_limit(ctx, nhits,
@@ -886,6 +1031,12 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
             GRN_QUERY_LOG(ctx, GRN_QUERY_LOG_SIZE,
                           ":", "drilldown(%d)", nhits);
           }
+        }
+        if (drilldown_tables) { GRN_FREE(drilldown_tables); }
+        if (results) { GRN_FREE(results); }
+        if (group_keys) { GRN_FREE(group_keys); }
+        if (calc_target) { grn_obj_unlink(ctx, calc_target); }
+        if (gkeys) {
           grn_table_sort_key_close(ctx, gkeys, ngkeys);
         }
       }
@@ -894,11 +1045,14 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
       GRN_OUTPUT_ARRAY_OPEN("RESULT", 0);
     }
     GRN_OUTPUT_ARRAY_CLOSE();
+    /* A streamed result is partially sent and isn't in outbuf. */
     if (!ctx->rc && cacheable && cache_key_size <= GRN_TABLE_MAX_KEY_SIZE
+        && ctx->impl->n_output_chunks == original_n_output_chunks
         && (!cache || cache_len != 2 || *cache != 'n' || *(cache + 1) != 'o')) {
-      grn_cache_update(ctx, cache_obj, cache_key, cache_key_size, outbuf);
+      grn_cache_update(ctx, cache_obj, cache_key, cache_key_size, outbuf,
+                       &dependencies);
     }
-    if (taintable) { grn_db_touch(ctx, DB_OBJ(table_)->db); }
+    if (taintable) { grn_table_touch_with_related(ctx, table_); }
     grn_obj_unlink(ctx, table_);
   } else {
     ERR(GRN_INVALID_ARGUMENT, "invalid table name: <%.*s>", table_len, table);
@@ -907,12 +1061,21 @@ exit:
   if (match_escalation_threshold_len) {
     grn_ctx_set_match_escalation_threshold(ctx, original_threshold);
   }
+  if (n_scan_workers_len) {
+    grn_ctx_set_n_scan_workers(ctx, original_n_scan_workers);
+  }
   if (match_columns_) {
     grn_obj_unlink(ctx, match_columns_);
   }
   if (cond) {
     grn_obj_unlink(ctx, cond);
   }
+  ctx->impl->dependencies = original_dependencies;
+  GRN_OBJ_FIN(ctx, &dependencies);
+  if (cache_key_size <= GRN_TABLE_MAX_KEY_SIZE) {
+    /* Wakes up the requests that wait for this result if it isn't cached. */
+    grn_cache_cancel(ctx, cache_obj, cache_key, cache_key_size);
+  }
   /* GRN_LOG(ctx, GRN_LOG_NONE, "%d", ctx->seqno); */
   return ctx->rc;
 }
@@ -939,6 +1102,10 @@ proc_select(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
   grn_obj *query_expansion = VAR(16);
   grn_obj *query_expander = VAR(18);
   grn_obj *adjuster = VAR(19);
+  grn_obj *match_top_k = VAR(20);
+  grn_obj *n_scan_workers = VAR(21);
+  grn_obj *drilldown_calc_types = VAR(22);
+  grn_obj *drilldown_calc_target = VAR(23);
   if (GRN_TEXT_LEN(query_expander) == 0 && GRN_TEXT_LEN(query_expansion) > 0) {
     query_expander = query_expansion;
   }
@@ -962,11 +1129,17 @@ proc_select(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
                  GRN_TEXT_VALUE(VAR(10)), GRN_TEXT_LEN(VAR(10)),
                  drilldown_output_columns, drilldown_output_columns_len,
                  drilldown_offset, drilldown_limit,
+                 GRN_TEXT_VALUE(drilldown_calc_types),
+                 GRN_TEXT_LEN(drilldown_calc_types),
+                 GRN_TEXT_VALUE(drilldown_calc_target),
+                 GRN_TEXT_LEN(drilldown_calc_target),
                  GRN_TEXT_VALUE(VAR(14)), GRN_TEXT_LEN(VAR(14)),
                  GRN_TEXT_VALUE(VAR(15)), GRN_TEXT_LEN(VAR(15)),
                  GRN_TEXT_VALUE(query_expander), GRN_TEXT_LEN(query_expander),
                  GRN_TEXT_VALUE(VAR(17)), GRN_TEXT_LEN(VAR(17)),
-                 GRN_TEXT_VALUE(adjuster), GRN_TEXT_LEN(adjuster))) {
+                 GRN_TEXT_VALUE(adjuster), GRN_TEXT_LEN(adjuster),
+                 GRN_TEXT_VALUE(match_top_k), GRN_TEXT_LEN(match_top_k),
+                 GRN_TEXT_VALUE(n_scan_workers), GRN_TEXT_LEN(n_scan_workers))) {
   }
   return NULL;
 }
@@ -1002,13 +1175,125 @@ proc_load(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
   } else {
     GRN_OUTPUT_INT64(ctx->impl->loader.nrecords);
     if (ctx->impl->loader.table) {
-      grn_db_touch(ctx, DB_OBJ(ctx->impl->loader.table)->db);
+      grn_table_touch_with_related(ctx, ctx->impl->loader.table);
     }
     /* maybe necessary : grn_ctx_loader_clear(ctx); */
   }
   return NULL;
 }
 
+static void
+proc_status_output_io_locks(grn_ctx *ctx)
+{
+  grn_obj *db = grn_ctx_db(ctx);
+  grn_obj ids;
+  int i, n_ids;
+
+  GRN_UINT32_INIT(&ids, GRN_OBJ_VECTOR);
+  if (db) {
+    grn_table_cursor *cursor;
+    cursor = grn_table_cursor_open(ctx, db, NULL, 0, NULL, 0, 0, -1, 0);
+    if (cursor) {
+      grn_id id;
+      while ((id = grn_table_cursor_next(ctx, cursor)) != GRN_ID_NIL) {
+        grn_io_lock_statistics statistics;
+        if (!grn_ctx_is_opened(ctx, id)) { continue; }
+        grn_io_get_lock_statistics(grn_obj_get_io(grn_ctx_at(ctx, id)),
+                                   &statistics);
+        if (statistics.n_contentions > 0 || statistics.n_timeouts > 0) {
+          GRN_UINT32_PUT(ctx, &ids, id);
+        }
+      }
+      grn_table_cursor_close(ctx, cursor);
+    }
+  }
+
+  n_ids = GRN_BULK_VSIZE(&ids) / sizeof(grn_id);
+  GRN_OUTPUT_MAP_OPEN("io_locks", n_ids);
+  for (i = 0; i < n_ids; i++) {
+    grn_obj *obj = grn_ctx_at(ctx, GRN_UINT32_VALUE_AT(&ids, i));
+    grn_io_lock_statistics statistics;
+    char name[GRN_TABLE_MAX_KEY_SIZE];
+    int name_size;
+
+    grn_io_get_lock_statistics(grn_obj_get_io(obj), &statistics);
+    name_size = grn_obj_name(ctx, obj, name, GRN_TABLE_MAX_KEY_SIZE);
+    GRN_OUTPUT_STR(name, name_size);
+    GRN_OUTPUT_MAP_OPEN("io_lock", 5);
+    GRN_OUTPUT_CSTR("n_locks");
+    GRN_OUTPUT_INT64(statistics.n_locks);
+    GRN_OUTPUT_CSTR("n_contentions");
+    GRN_OUTPUT_INT64(statistics.n_contentions);
+    GRN_OUTPUT_CSTR("n_waits");
+    GRN_OUTPUT_INT64(statistics.n_waits);
+    GRN_OUTPUT_CSTR("n_timeouts");
+    GRN_OUTPUT_INT64(statistics.n_timeouts);
+    GRN_OUTPUT_CSTR("wait_time");
+    GRN_OUTPUT_FLOAT(statistics.wait_time_nsec / GRN_TIME_NSEC_PER_SEC_F);
+    GRN_OUTPUT_MAP_CLOSE();
+  }
+  GRN_OUTPUT_MAP_CLOSE();
+  GRN_OBJ_FIN(ctx, &ids);
+}
+
+static void
+proc_status_output_cache(grn_ctx *ctx, grn_cache *cache,
+                         grn_cache_statistics *statistics)
+{
+  int i;
+  GRN_OUTPUT_MAP_OPEN("cache", 13);
+  GRN_OUTPUT_CSTR("n_entries");
+  GRN_OUTPUT_INT64(statistics->nentries);
+  GRN_OUTPUT_CSTR("max_n_entries");
+  GRN_OUTPUT_INT64(statistics->max_nentries);
+  GRN_OUTPUT_CSTR("n_bytes");
+  GRN_OUTPUT_INT64(statistics->nbytes);
+  GRN_OUTPUT_CSTR("max_n_bytes");
+  GRN_OUTPUT_INT64(statistics->max_nbytes);
+  GRN_OUTPUT_CSTR("n_fetches");
+  GRN_OUTPUT_INT64(statistics->nfetches);
+  GRN_OUTPUT_CSTR("n_hits");
+  GRN_OUTPUT_INT64(statistics->nhits);
+  GRN_OUTPUT_CSTR("n_evictions");
+  GRN_OUTPUT_INT64(statistics->nevictions);
+  GRN_OUTPUT_CSTR("n_stale_hits");
+  GRN_OUTPUT_INT64(statistics->nstale_hits);
+  GRN_OUTPUT_CSTR("n_coalesced");
+  GRN_OUTPUT_INT64(statistics->ncoalesced);
+  GRN_OUTPUT_CSTR("stale_window");
+  GRN_OUTPUT_INT64(grn_cache_get_stale_window(ctx, cache));
+  GRN_OUTPUT_CSTR("n_persistent_entries");
+  GRN_OUTPUT_INT64(statistics->npersistent_entries);
+  GRN_OUTPUT_CSTR("n_persistent_hits");
+  GRN_OUTPUT_INT64(statistics->npersistent_hits);
+  GRN_OUTPUT_CSTR("shards");
+  GRN_OUTPUT_ARRAY_OPEN("shards", GRN_CACHE_N_SHARDS);
+  for (i = 0; i < GRN_CACHE_N_SHARDS; i++) {
+    grn_cache_shard_statistics shard_statistics;
+    grn_cache_get_shard_statistics(ctx, cache, i, &shard_statistics);
+    GRN_OUTPUT_MAP_OPEN("shard", 8);
+    GRN_OUTPUT_CSTR("n_entries");
+    GRN_OUTPUT_INT64(shard_statistics.nentries);
+    GRN_OUTPUT_CSTR("n_bytes");
+    GRN_OUTPUT_INT64(shard_statistics.nbytes);
+    GRN_OUTPUT_CSTR("n_fetches");
+    GRN_OUTPUT_INT64(shard_statistics.nfetches);
+    GRN_OUTPUT_CSTR("n_hits");
+    GRN_OUTPUT_INT64(shard_statistics.nhits);
+    GRN_OUTPUT_CSTR("n_evictions");
+    GRN_OUTPUT_INT64(shard_statistics.nevictions);
+    GRN_OUTPUT_CSTR("n_stale_hits");
+    GRN_OUTPUT_INT64(shard_statistics.nstale_hits);
+    GRN_OUTPUT_CSTR("n_coalesced");
+    GRN_OUTPUT_INT64(shard_statistics.ncoalesced);
+    GRN_OUTPUT_CSTR("n_persistent_hits");
+    GRN_OUTPUT_INT64(shard_statistics.npersistent_hits);
+    GRN_OUTPUT_MAP_CLOSE();
+  }
+  GRN_OUTPUT_ARRAY_CLOSE();
+  GRN_OUTPUT_MAP_CLOSE();
+}
+
 static grn_obj *
 proc_status(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
 {
@@ -1019,7 +1304,7 @@ proc_status(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
   grn_timeval_now(ctx, &now);
   cache = grn_cache_current_get(ctx);
   grn_cache_get_statistics(ctx, cache, &statistics);
-  GRN_OUTPUT_MAP_OPEN("RESULT", 9);
+  GRN_OUTPUT_MAP_OPEN("RESULT", 11);
   GRN_OUTPUT_CSTR("alloc_count");
   GRN_OUTPUT_INT32(grn_alloc_count());
   GRN_OUTPUT_CSTR("starttime");
@@ -1044,6 +1329,10 @@ proc_status(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
   GRN_OUTPUT_INT32(grn_get_default_command_version());
   GRN_OUTPUT_CSTR("max_command_version");
   GRN_OUTPUT_INT32(GRN_COMMAND_VERSION_MAX);
+  GRN_OUTPUT_CSTR("cache");
+  proc_status_output_cache(ctx, cache, &statistics);
+  GRN_OUTPUT_CSTR("io_locks");
+  proc_status_output_io_locks(ctx);
   GRN_OUTPUT_MAP_CLOSE();
   return NULL;
 }
@@ -1114,6 +1403,9 @@ grn_parse_column_create_flags(grn_ctx *ctx, const char *nptr, const char *end)
     } else if (!memcmp(nptr, "RING_BUFFER", 11)) {
       flags |= GRN_OBJ_RING_BUFFER;
       nptr += 11;
+    } else if (!memcmp(nptr, "INDEX_SIMD", 10)) {
+      flags |= GRN_OBJ_INDEX_SIMD;
+      nptr += 10;
     } else {
       ERR(GRN_INVALID_ARGUMENT, "invalid flags option: %.*s",
           (int)(end - nptr), nptr);
@@ -1177,6 +1469,9 @@ grn_column_create_flags_to_text(grn_ctx *ctx, grn_obj *buf, grn_obj_flags flags)
     if (flags & GRN_OBJ_WITH_POSITION) {
       GRN_TEXT_PUTS(ctx, buf, "|WITH_POSITION");
     }
+    if (flags & GRN_OBJ_INDEX_SIMD) {
+      GRN_TEXT_PUTS(ctx, buf, "|INDEX_SIMD");
+    }
     break;
   }
   switch (flags & GRN_OBJ_COMPRESS_MASK) {
@@ -1482,6 +1777,98 @@ exit:
   return NULL;
 }
 
+static grn_obj *
+proc_index_column_convert(grn_ctx *ctx, int nargs, grn_obj **args,
+                          grn_user_data *user_data)
+{
+  grn_rc rc = GRN_SUCCESS;
+  grn_obj *table = NULL;
+  grn_obj *column = NULL;
+  grn_obj_flags codec_flags = 0;
+  if (GRN_TEXT_LEN(VAR(0)) == 0) {
+    rc = GRN_INVALID_ARGUMENT;
+    ERR(rc, "[index_column][convert] table name isn't specified");
+    goto exit;
+  }
+  table = grn_ctx_get(ctx, GRN_TEXT_VALUE(VAR(0)), GRN_TEXT_LEN(VAR(0)));
+  if (!table) {
+    rc = GRN_INVALID_ARGUMENT;
+    ERR(rc,
+        "[index_column][convert] table isn't found: <%.*s>",
+        (int)GRN_TEXT_LEN(VAR(0)), GRN_TEXT_VALUE(VAR(0)));
+    goto exit;
+  }
+  column = grn_obj_column(ctx, table,
+                          GRN_TEXT_VALUE(VAR(1)), GRN_TEXT_LEN(VAR(1)));
+  if (!column || column->header.type != GRN_COLUMN_INDEX) {
+    rc = GRN_INVALID_ARGUMENT;
+    ERR(rc,
+        "[index_column][convert] index column isn't found: <%.*s.%.*s>",
+        (int)GRN_TEXT_LEN(VAR(0)), GRN_TEXT_VALUE(VAR(0)),
+        (int)GRN_TEXT_LEN(VAR(1)), GRN_TEXT_VALUE(VAR(1)));
+    goto exit;
+  }
+#define CODEC_NAME_EQUAL(name)\
+  (GRN_TEXT_LEN(VAR(2)) == strlen(name) &&\
+   memcmp(GRN_TEXT_VALUE(VAR(2)), name, strlen(name)) == 0)
+  if (CODEC_NAME_EQUAL("simd")) {
+    codec_flags = GRN_OBJ_INDEX_SIMD;
+  } else if (GRN_TEXT_LEN(VAR(2)) == 0 || CODEC_NAME_EQUAL("default")) {
+    codec_flags = 0;
+  } else {
+    rc = GRN_INVALID_ARGUMENT;
+    ERR(rc,
+        "[index_column][convert] codec must be <simd> or <default>: <%.*s>",
+        (int)GRN_TEXT_LEN(VAR(2)), GRN_TEXT_VALUE(VAR(2)));
+    goto exit;
+  }
+#undef CODEC_NAME_EQUAL
+  rc = grn_index_column_convert(ctx, column, codec_flags);
+exit:
+  GRN_OUTPUT_BOOL(!rc);
+  if (column) { grn_obj_unlink(ctx, column); }
+  if (table) { grn_obj_unlink(ctx, table); }
+  return NULL;
+}
+
+static grn_obj *
+proc_index_column_rebuild(grn_ctx *ctx, int nargs, grn_obj **args,
+                          grn_user_data *user_data)
+{
+  grn_rc rc = GRN_SUCCESS;
+  grn_obj *table = NULL;
+  grn_obj *column = NULL;
+  if (GRN_TEXT_LEN(VAR(0)) == 0) {
+    rc = GRN_INVALID_ARGUMENT;
+    ERR(rc, "[index_column][rebuild] table name isn't specified");
+    goto exit;
+  }
+  table = grn_ctx_get(ctx, GRN_TEXT_VALUE(VAR(0)), GRN_TEXT_LEN(VAR(0)));
+  if (!table) {
+    rc = GRN_INVALID_ARGUMENT;
+    ERR(rc,
+        "[index_column][rebuild] table isn't found: <%.*s>",
+        (int)GRN_TEXT_LEN(VAR(0)), GRN_TEXT_VALUE(VAR(0)));
+    goto exit;
+  }
+  column = grn_obj_column(ctx, table,
+                          GRN_TEXT_VALUE(VAR(1)), GRN_TEXT_LEN(VAR(1)));
+  if (!column || column->header.type != GRN_COLUMN_INDEX) {
+    rc = GRN_INVALID_ARGUMENT;
+    ERR(rc,
+        "[index_column][rebuild] index column isn't found: <%.*s.%.*s>",
+        (int)GRN_TEXT_LEN(VAR(0)), GRN_TEXT_VALUE(VAR(0)),
+        (int)GRN_TEXT_LEN(VAR(1)), GRN_TEXT_VALUE(VAR(1)));
+    goto exit;
+  }
+  rc = grn_index_column_rebuild(ctx, column);
+exit:
+  GRN_OUTPUT_BOOL(!rc);
+  if (column) { grn_obj_unlink(ctx, column); }
+  if (table) { grn_obj_unlink(ctx, table); }
+  return NULL;
+}
+
 #define GRN_STRLEN(s) ((s) ? strlen(s) : 0)
 
 static void
@@ -2742,6 +3129,30 @@ proc_cache_limit(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_da
           (int)GRN_TEXT_LEN(VAR(0)), GRN_TEXT_VALUE(VAR(0)));
     }
   }
+  if (ctx->rc == GRN_SUCCESS && GRN_TEXT_LEN(VAR(1))) {
+    const char *rest;
+    int64_t max_bytes = grn_atoll(GRN_TEXT_VALUE(VAR(1)),
+                                  GRN_BULK_CURR(VAR(1)), &rest);
+    if (GRN_BULK_CURR(VAR(1)) == rest && max_bytes >= 0) {
+      grn_cache_set_max_n_bytes(ctx, cache, max_bytes);
+    } else {
+      ERR(GRN_INVALID_ARGUMENT,
+          "max_bytes value is invalid unsigned integer format: <%.*s>",
+          (int)GRN_TEXT_LEN(VAR(1)), GRN_TEXT_VALUE(VAR(1)));
+    }
+  }
+  if (ctx->rc == GRN_SUCCESS && GRN_TEXT_LEN(VAR(2))) {
+    const char *rest;
+    uint32_t stale_window = grn_atoui(GRN_TEXT_VALUE(VAR(2)),
+                                      GRN_BULK_CURR(VAR(2)), &rest);
+    if (GRN_BULK_CURR(VAR(2)) == rest) {
+      grn_cache_set_stale_window(ctx, cache, stale_window);
+    } else {
+      ERR(GRN_INVALID_ARGUMENT,
+          "stale_window value is invalid unsigned integer format: <%.*s>",
+          (int)GRN_TEXT_LEN(VAR(2)), GRN_TEXT_VALUE(VAR(2)));
+    }
+  }
   if (ctx->rc == GRN_SUCCESS) {
     GRN_OUTPUT_INT64(current_max_n_entries);
   }
@@ -5028,7 +5439,7 @@ func_highlight_full(grn_ctx *ctx, int nargs, grn_obj **args,
 void
 grn_db_init_builtin_query(grn_ctx *ctx)
 {
-  grn_expr_var vars[21];
+  grn_expr_var vars[25];
 
   DEF_VAR(vars[0], "name");
   DEF_VAR(vars[1], "table");
@@ -5052,8 +5463,12 @@ grn_db_init_builtin_query(grn_ctx *ctx)
   DEF_VAR(vars[18], "query_flags");
   DEF_VAR(vars[19], "query_expander");
   DEF_VAR(vars[20], "adjuster");
-  DEF_COMMAND("define_selector", proc_define_selector, 21, vars);
-  DEF_COMMAND("select", proc_select, 20, vars + 1);
+  DEF_VAR(vars[21], "match_top_k");
+  DEF_VAR(vars[22], "n_scan_workers");
+  DEF_VAR(vars[23], "drilldown_calc_types");
+  DEF_VAR(vars[24], "drilldown_calc_target");
+  DEF_COMMAND("define_selector", proc_define_selector, 25, vars);
+  DEF_COMMAND("select", proc_select, 24, vars + 1);
 
   DEF_VAR(vars[0], "values");
   DEF_VAR(vars[1], "table");
@@ -5101,6 +5516,15 @@ grn_db_init_builtin_query(grn_ctx *ctx)
   DEF_VAR(vars[2], "new_name");
   DEF_COMMAND("column_rename", proc_column_rename, 3, vars);
 
+  DEF_VAR(vars[0], "table");
+  DEF_VAR(vars[1], "name");
+  DEF_VAR(vars[2], "codec");
+  DEF_COMMAND("index_column_convert", proc_index_column_convert, 3, vars);
+
+  DEF_VAR(vars[0], "table");
+  DEF_VAR(vars[1], "name");
+  DEF_COMMAND("index_column_rebuild", proc_index_column_rebuild, 2, vars);
+
   DEF_VAR(vars[0], "path");
   DEF_COMMAND(GRN_EXPR_MISSING_NAME, proc_missing, 1, vars);
 
@@ -5131,7 +5555,9 @@ grn_db_init_builtin_query(grn_ctx *ctx)
   DEF_COMMAND("delete", proc_delete, 4, vars);
 
   DEF_VAR(vars[0], "max");
-  DEF_COMMAND("cache_limit", proc_cache_limit, 1, vars);
+  DEF_VAR(vars[1], "max_bytes");
+  DEF_VAR(vars[2], "stale_window");
+  DEF_COMMAND("cache_limit", proc_cache_limit, 3, vars);
 
   DEF_VAR(vars[0], "tables");
   DEF_COMMAND("dump", proc_dump, 1, vars);
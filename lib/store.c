@@ -20,11 +20,14 @@
 #include "ctx_impl.h"
 #include "output.h"
 #include <string.h>
+#include <math.h>
 
 /* rectangular arrays */
 
 #define GRN_RA_SEGMENT_SIZE (1 << 22)
 
+static void ra_zone_map_close(grn_ra *ra);
+
 static grn_ra *
 _grn_ra_create(grn_ctx *ctx, grn_ra *ra, const char *path, unsigned int element_size)
 {
@@ -66,6 +69,8 @@ grn_ra_create(grn_ctx *ctx, const char *path, unsigned int element_size)
     GRN_FREE(ra);
     return NULL;
   }
+  ra->zone_map = NULL;
+  CRITICAL_SECTION_INIT(ra->zone_map_lock);
   return ra;
 }
 
@@ -95,6 +100,8 @@ grn_ra_open(grn_ctx *ctx, const char *path)
   ra->header = header;
   ra->element_mask =  n_elm - 1;
   ra->element_width = w_elm;
+  ra->zone_map = NULL;
+  CRITICAL_SECTION_INIT(ra->zone_map_lock);
   return ra;
 }
 
@@ -112,6 +119,8 @@ grn_ra_close(grn_ctx *ctx, grn_ra *ra)
   grn_rc rc;
   if (!ra) { return GRN_INVALID_ARGUMENT; }
   rc = grn_io_close(ctx, ra->io);
+  ra_zone_map_close(ra);
+  CRITICAL_SECTION_FIN(ra->zone_map_lock);
   GRN_GFREE(ra);
   return rc;
 }
@@ -139,6 +148,9 @@ grn_ra_truncate(grn_ctx *ctx, grn_ra *ra)
     path = NULL;
   }
   element_size = ra->header->element_size;
+  CRITICAL_SECTION_ENTER(ra->zone_map_lock);
+  ra_zone_map_close(ra);
+  CRITICAL_SECTION_LEAVE(ra->zone_map_lock);
   if ((rc = grn_io_close(ctx, ra->io))) { goto exit; }
   ra->io = NULL;
   if (path && (rc = grn_io_remove(ctx, path))) { goto exit; }
@@ -201,6 +213,220 @@ grn_ra_cache_fin(grn_ctx *ctx, grn_ra *ra, grn_id id)
   return GRN_SUCCESS;
 }
 
+/* zone maps */
+
+struct _grn_ra_zone_map {
+  uint32_t n_updates;
+  grn_id max_id;
+  uint32_t n_zones;
+  grn_ra_zone *zones;
+};
+
+static grn_bool
+ra_zone_map_is_supported(grn_ra *ra)
+{
+  uint32_t size;
+  switch (ra->obj.range) {
+  case GRN_DB_INT8 :
+  case GRN_DB_UINT8 :
+    size = 1;
+    break;
+  case GRN_DB_INT16 :
+  case GRN_DB_UINT16 :
+    size = 2;
+    break;
+  case GRN_DB_INT32 :
+  case GRN_DB_UINT32 :
+    size = 4;
+    break;
+  case GRN_DB_INT64 :
+  case GRN_DB_UINT64 :
+  case GRN_DB_TIME :
+  case GRN_DB_FLOAT :
+    size = 8;
+    break;
+  default :
+    return GRN_FALSE;
+  }
+  return ra->header->element_size == size;
+}
+
+static void
+ra_zone_init(grn_ra *ra, grn_ra_zone *zone)
+{
+  switch (ra->obj.range) {
+  case GRN_DB_UINT8 :
+  case GRN_DB_UINT16 :
+  case GRN_DB_UINT32 :
+  case GRN_DB_UINT64 :
+    zone->min.u = UINT64_MAX;
+    zone->max.u = 0;
+    break;
+  case GRN_DB_FLOAT :
+    zone->min.f = HUGE_VAL;
+    zone->max.f = -HUGE_VAL;
+    break;
+  default :
+    zone->min.i = INT64_MAX;
+    zone->max.i = INT64_MIN;
+    break;
+  }
+}
+
+/* NaN is never added because it is neither less nor greater than any
+   value. It is fine because no comparison matches NaN. */
+#define RA_ZONE_ADD(member, type) do {\
+  type value_ = *((const type *)value);\
+  if (value_ < zone->min.member) { zone->min.member = value_; }\
+  if (value_ > zone->max.member) { zone->max.member = value_; }\
+} while (0)
+
+static void
+ra_zone_add(grn_ra *ra, grn_ra_zone *zone, const void *value)
+{
+  switch (ra->obj.range) {
+  case GRN_DB_INT8 :
+    RA_ZONE_ADD(i, int8_t);
+    break;
+  case GRN_DB_UINT8 :
+    RA_ZONE_ADD(u, uint8_t);
+    break;
+  case GRN_DB_INT16 :
+    RA_ZONE_ADD(i, int16_t);
+    break;
+  case GRN_DB_UINT16 :
+    RA_ZONE_ADD(u, uint16_t);
+    break;
+  case GRN_DB_INT32 :
+    RA_ZONE_ADD(i, int32_t);
+    break;
+  case GRN_DB_UINT32 :
+    RA_ZONE_ADD(u, uint32_t);
+    break;
+  case GRN_DB_INT64 :
+  case GRN_DB_TIME :
+    RA_ZONE_ADD(i, int64_t);
+    break;
+  case GRN_DB_UINT64 :
+    RA_ZONE_ADD(u, uint64_t);
+    break;
+  case GRN_DB_FLOAT :
+    RA_ZONE_ADD(f, double);
+    break;
+  }
+}
+
+static void
+ra_zone_map_close(grn_ra *ra)
+{
+  grn_ra_zone_map *map = ra->zone_map;
+  if (!map) { return; }
+  if (map->zones) { GRN_GFREE(map->zones); }
+  GRN_GFREE(map);
+  ra->zone_map = NULL;
+}
+
+/* Adds the values of (map->max_id, max_id] to the zones. */
+static grn_bool
+ra_zone_map_extend(grn_ctx *ctx, grn_ra *ra, grn_id max_id)
+{
+  grn_id id;
+  grn_ra_cache cache;
+  grn_ra_zone_map *map = ra->zone_map;
+  uint32_t i, n_zones = (max_id >> GRN_RA_ZONE_WIDTH) + 1;
+  if (n_zones > map->n_zones) {
+    grn_ra_zone *zones;
+    if (!(zones = GRN_GREALLOC(map->zones, sizeof(grn_ra_zone) * n_zones))) {
+      return GRN_FALSE;
+    }
+    for (i = map->n_zones; i < n_zones; i++) { ra_zone_init(ra, &zones[i]); }
+    map->zones = zones;
+    map->n_zones = n_zones;
+  }
+  GRN_RA_CACHE_INIT(ra, &cache);
+  for (id = map->max_id + 1; id <= max_id; id++) {
+    void *p = grn_ra_ref_cache(ctx, ra, id, &cache);
+    if (!p) { break; }
+    ra_zone_add(ra, &map->zones[id >> GRN_RA_ZONE_WIDTH], p);
+  }
+  GRN_RA_CACHE_FIN(ra, &cache);
+  if (id <= max_id) { return GRN_FALSE; }
+  map->max_id = max_id;
+  return GRN_TRUE;
+}
+
+/*
+ * Returns a copy of the zones that cover the IDs up to max_id, or NULL if
+ * the column isn't numeric or the zone map can't be built. The copy must be
+ * freed by GRN_FREE().
+ */
+grn_ra_zone *
+grn_ra_zone_map_get(grn_ctx *ctx, grn_ra *ra, grn_id max_id, uint32_t *n_zones)
+{
+  grn_ra_zone *zones = NULL;
+  grn_ra_zone_map *map;
+  if (max_id == GRN_ID_NIL || max_id > GRN_ID_MAX ||
+      !ra_zone_map_is_supported(ra)) {
+    return NULL;
+  }
+  CRITICAL_SECTION_ENTER(ra->zone_map_lock);
+  if (ra->zone_map && ra->zone_map->n_updates != ra->header->n_updates) {
+    ra_zone_map_close(ra);
+  }
+  if (!(map = ra->zone_map)) {
+    if (!(map = GRN_GCALLOC(sizeof(grn_ra_zone_map)))) { goto exit; }
+    if (!ra->header->zone_map_used) {
+      uint32_t used;
+      /* Writers count their writes from now on. */
+      GRN_ATOMIC_CAS_EX(&ra->header->zone_map_used, 0, 1, used);
+    }
+    map->n_updates = ra->header->n_updates;
+    map->max_id = GRN_ID_NIL;
+    ra->zone_map = map;
+  }
+  if (map->max_id < max_id && !ra_zone_map_extend(ctx, ra, max_id)) {
+    goto exit;
+  }
+  *n_zones = (max_id >> GRN_RA_ZONE_WIDTH) + 1;
+  if ((zones = GRN_MALLOC(sizeof(grn_ra_zone) * *n_zones))) {
+    memcpy(zones, map->zones, sizeof(grn_ra_zone) * *n_zones);
+  }
+exit :
+  CRITICAL_SECTION_LEAVE(ra->zone_map_lock);
+  return zones;
+}
+
+/*
+ * Widens the zone of id by value that has been written to id. The zones
+ * are never narrowed, so they may be wider than the current values.
+ */
+void
+grn_ra_zone_map_update(grn_ctx *ctx, grn_ra *ra, grn_id id, const void *value)
+{
+  uint32_t n_updates;
+  grn_ra_zone_map *map;
+  if (!ra->zone_map) {
+    /* A zone map built after the barrier reads the written value. */
+    GRN_MEMORY_BARRIER();
+    if (!ra->header->zone_map_used) { return; }
+  }
+  GRN_ATOMIC_ADD_EX(&ra->header->n_updates, 1, n_updates);
+  if (!ra->zone_map) { return; }
+  CRITICAL_SECTION_ENTER(ra->zone_map_lock);
+  if ((map = ra->zone_map)) {
+    if (map->n_updates != n_updates) {
+      /* Others wrote the column after the zone map was built. */
+      ra_zone_map_close(ra);
+    } else {
+      if (id <= map->max_id) {
+        ra_zone_add(ra, &map->zones[id >> GRN_RA_ZONE_WIDTH], value);
+      }
+      map->n_updates = n_updates + 1;
+    }
+  }
+  CRITICAL_SECTION_LEAVE(ra->zone_map_lock);
+}
+
 /**** jagged arrays ****/
 
 #define GRN_JA_W_SEGREGATE_THRESH_V1   7
@@ -40,6 +40,7 @@ extern "C" {
 /**** fixed sized elements ****/
 
 typedef struct _grn_ra grn_ra;
+typedef struct _grn_ra_zone_map grn_ra_zone_map;
 
 struct _grn_ra {
   grn_db_obj obj;
@@ -47,12 +48,16 @@ struct _grn_ra {
   int element_width;
   int element_mask;
   struct grn_ra_header *header;
+  grn_ra_zone_map *zone_map;
+  grn_critical_section zone_map_lock;
 };
 
 struct grn_ra_header {
   uint32_t element_size;
   uint32_t nrecords; /* nrecords is not maintained by default */
-  uint32_t reserved[10];
+  uint32_t n_updates;
+  uint32_t zone_map_used;
+  uint32_t reserved[8];
 };
 
 grn_ra *grn_ra_create(grn_ctx *ctx, const char *path, unsigned int element_size);
@@ -80,6 +85,33 @@ struct _grn_ra_cache {
 
 void *grn_ra_ref_cache(grn_ctx *ctx, grn_ra *ra, grn_id id, grn_ra_cache *cache);
 
+/*
+ * A zone map holds the minimum and the maximum of the values of each zone,
+ * 2^GRN_RA_ZONE_WIDTH consecutive elements, of a numeric column. It is built
+ * on the first request and it is widened by grn_ra_zone_map_update() on each
+ * write. The writes are counted in the header, so that a zone map is rebuilt
+ * after other processes write the column. They aren't counted until a zone
+ * map of the column is built by any process. The values are held by i for
+ * signed integers and Time, by u for unsigned integers and by f for Float.
+ */
+#define GRN_RA_ZONE_WIDTH 12
+
+typedef union {
+  int64_t i;
+  uint64_t u;
+  double f;
+} grn_ra_zone_value;
+
+typedef struct {
+  grn_ra_zone_value min;
+  grn_ra_zone_value max;
+} grn_ra_zone;
+
+grn_ra_zone *grn_ra_zone_map_get(grn_ctx *ctx, grn_ra *ra, grn_id max_id,
+                                 uint32_t *n_zones);
+void grn_ra_zone_map_update(grn_ctx *ctx, grn_ra *ra, grn_id id,
+                            const void *value);
+
 /**** variable sized elements ****/
 
 extern grn_bool grn_ja_skip_same_value_put;
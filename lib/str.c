@@ -2590,6 +2590,14 @@ grn_text_atoj(grn_ctx *ctx, grn_obj *bulk, grn_obj *obj, grn_id id)
         }
         buf.header.domain = GRN_DB_INT32;
         break;
+      case GRN_ACCESSOR_GET_CALC_VALUE :
+        {
+          grn_rset_recinfo *ri = (grn_rset_recinfo *)grn_obj_get_value_(ctx, a->obj, id, &vs);
+          byte *calc_value = grn_rset_recinfo_calc_value(a->obj, ri, a->offset);
+          grn_bulk_write(ctx, &buf, (const char *)calc_value, sizeof(int64_t));
+        }
+        buf.header.domain = grn_rset_recinfo_calc_value_range(a->obj, a->offset);
+        break;
       case GRN_ACCESSOR_GET_COLUMN_VALUE :
         if ((a->obj->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) == GRN_OBJ_COLUMN_VECTOR) {
           if (a->next) {
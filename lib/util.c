@@ -474,6 +474,11 @@ grn_ii_inspect(grn_ctx *ctx, grn_obj *buf, grn_obj *obj)
     GRN_TEXT_PUTS(ctx, buf, "POSITION");
     have_flags = 1;
   }
+  if (obj->header.flags & GRN_OBJ_INDEX_SIMD) {
+    if (have_flags) { GRN_TEXT_PUTS(ctx, buf, "|"); }
+    GRN_TEXT_PUTS(ctx, buf, "SIMD");
+    have_flags = 1;
+  }
   if (!have_flags) {
     GRN_TEXT_PUTS(ctx, buf, "NONE");
   }
@@ -73,6 +73,8 @@
 #define DEFAULT_GQTP_PORT 10043
 #define DEFAULT_DEST "localhost"
 #define DEFAULT_MAX_NFTHREADS 8
+#define DEFAULT_KEEP_ALIVE_TIMEOUT 5
+#define DEFAULT_MAX_KEEP_ALIVE_REQUESTS 100
 #define MAX_CON 0x10000
 
 #define RLIMIT_NOFILE_MINIMUM 4096
@@ -341,6 +343,10 @@ c_output(grn_ctx *ctx)
   int flags;
   char *str;
   unsigned int str_len;
+  grn_obj foot;
+  /* A body split into GRN_CTX_MORE frames is being output. */
+  grn_bool is_streaming = GRN_FALSE;
+  GRN_TEXT_INIT(&foot, 0);
   do {
     grn_ctx_recv(ctx, &str, &str_len, &flags);
     /*
@@ -349,11 +355,12 @@ c_output(grn_ctx *ctx)
       return -1;
     }
     */
-    if (str_len || ctx->rc) {
-      grn_obj head, body, foot;
+    if (is_streaming) {
+      fwrite(str, 1, str_len, output);
+    } else if (str_len || ctx->rc) {
+      grn_obj head, body;
       GRN_TEXT_INIT(&head, 0);
       GRN_TEXT_INIT(&body, GRN_OBJ_DO_SHALLOW_COPY);
-      GRN_TEXT_INIT(&foot, 0);
       if (ctx->rc == GRN_SUCCESS) {
         GRN_TEXT_SET(ctx, &body, str, str_len);
       } else {
@@ -362,14 +369,21 @@ c_output(grn_ctx *ctx)
       output_envelope(ctx, ctx->rc, &head, &body, &foot);
       fwrite(GRN_TEXT_VALUE(&head), 1, GRN_TEXT_LEN(&head), output);
       fwrite(GRN_TEXT_VALUE(&body), 1, GRN_TEXT_LEN(&body), output);
+      is_streaming = ((flags & GRN_CTX_MORE) && ctx->rc == GRN_SUCCESS);
+      GRN_OBJ_FIN(ctx, &head);
+      GRN_OBJ_FIN(ctx, &body);
+    } else {
+      continue;
+    }
+    if (!(flags & GRN_CTX_MORE) || !is_streaming) {
       fwrite(GRN_TEXT_VALUE(&foot), 1, GRN_TEXT_LEN(&foot), output);
       fputc('\n', output);
       fflush(output);
-      GRN_OBJ_FIN(ctx, &head);
-      GRN_OBJ_FIN(ctx, &body);
-      GRN_OBJ_FIN(ctx, &foot);
+      GRN_BULK_REWIND(&foot);
+      is_streaming = GRN_FALSE;
     }
   } while ((flags & GRN_CTX_MORE));
+  GRN_OBJ_FIN(ctx, &foot);
   return 0;
 }
 
@@ -417,6 +431,165 @@ static grn_com_queue ctx_old;
 static grn_mutex q_mutex;
 static grn_cond q_cond;
 static uint32_t nthreads = 0, nfthreads = 0, max_nfthreads;
+static uint32_t keep_alive_timeout = 0, max_keep_alive_requests = 0;
+static uint32_t output_chunk_size = 0;
+
+/*
+ * Worker pool: a fixed number of workers are spawned before the server
+ * starts accepting requests. Each worker has its own queue, so dispatch
+ * does not serialize on q_mutex. An idle worker steals work from the
+ * other workers' queues.
+ */
+typedef struct {
+  grn_com_queue queue;
+  grn_mutex mutex;
+  grn_cond cond;
+  grn_thread thread;
+  uint32_t id;
+  grn_bool is_idle;
+  void *arg;
+} pool_worker;
+
+typedef void * (CALLBACK *pool_worker_func)(void *arg);
+
+static uint32_t worker_pool_size = 0;
+static grn_bool worker_pool_pin_cpus = GRN_FALSE;
+static pool_worker *pool_workers = NULL;
+static uint32_t n_pool_workers = 0;
+static uint32_t pool_next_worker = 0;
+
+static uint32_t get_core_number(void);
+
+static void
+pool_worker_pin(pool_worker *worker)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  if (worker_pool_pin_cpus) {
+    cpu_set_t cpu_set;
+    uint32_t n_cores = get_core_number();
+    if (n_cores == 0) { return; }
+    CPU_ZERO(&cpu_set);
+    CPU_SET(worker->id % n_cores, &cpu_set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set)) {
+      GRN_LOG(&grn_gctx, GRN_LOG_WARNING,
+              "failed to pin worker %u to CPU %u",
+              worker->id, worker->id % n_cores);
+    }
+  }
+#endif /* HAVE_PTHREAD_SETAFFINITY_NP */
+}
+
+static grn_rc
+pool_start(grn_ctx *ctx, pool_worker_func func, void *arg)
+{
+  uint32_t i;
+  pool_workers = GRN_MALLOCN(pool_worker, worker_pool_size);
+  if (!pool_workers) { return ctx->rc; }
+  for (i = 0; i < worker_pool_size; i++) {
+    pool_worker *worker = &pool_workers[i];
+    GRN_COM_QUEUE_INIT(&worker->queue);
+    MUTEX_INIT(worker->mutex);
+    COND_INIT(worker->cond);
+    worker->id = i;
+    worker->is_idle = GRN_FALSE;
+    worker->arg = arg;
+    if (THREAD_CREATE(worker->thread, func, worker)) {
+      SERR("pthread_create");
+      break;
+    }
+    n_pool_workers++;
+  }
+  GRN_LOG(ctx, GRN_LOG_NOTICE, "worker pool started (%u/%u)",
+          n_pool_workers, worker_pool_size);
+  return ctx->rc;
+}
+
+static void
+pool_fin(grn_ctx *ctx)
+{
+  uint32_t i;
+  for (i = 0; i < n_pool_workers; i++) {
+    pool_worker *worker = &pool_workers[i];
+    MUTEX_LOCK(worker->mutex);
+    COND_BROADCAST(worker->cond);
+    MUTEX_UNLOCK(worker->mutex);
+  }
+  for (i = 0; i < n_pool_workers; i++) {
+    THREAD_JOIN(pool_workers[i].thread);
+  }
+  n_pool_workers = 0;
+  GRN_FREE(pool_workers);
+  pool_workers = NULL;
+}
+
+static void
+pool_enque(grn_ctx *ctx, grn_com_queue_entry *entry)
+{
+  uint32_t i, start;
+  pool_worker *worker = NULL, *idle_worker = NULL;
+  GRN_ATOMIC_ADD_EX(&pool_next_worker, 1, start);
+  start %= n_pool_workers;
+  for (i = 0; i < n_pool_workers; i++) {
+    pool_worker *candidate = &pool_workers[(start + i) % n_pool_workers];
+    if (candidate->is_idle) {
+      worker = candidate;
+      break;
+    }
+  }
+  if (!worker) { worker = &pool_workers[start]; }
+  grn_com_queue_enque(ctx, &worker->queue, entry);
+  MUTEX_LOCK(worker->mutex);
+  COND_SIGNAL(worker->cond);
+  MUTEX_UNLOCK(worker->mutex);
+  if (worker->is_idle) { return; }
+  /* The worker may be busy for a while. Wake an idle one to steal it. */
+  for (i = 0; i < n_pool_workers; i++) {
+    pool_worker *candidate = &pool_workers[(start + i) % n_pool_workers];
+    if (candidate->is_idle) {
+      idle_worker = candidate;
+      break;
+    }
+  }
+  if (idle_worker) {
+    MUTEX_LOCK(idle_worker->mutex);
+    COND_SIGNAL(idle_worker->cond);
+    MUTEX_UNLOCK(idle_worker->mutex);
+  }
+}
+
+static grn_com_queue_entry *
+pool_deque(grn_ctx *ctx, pool_worker *worker)
+{
+  uint32_t i;
+  grn_com_queue_entry *entry;
+  if ((entry = grn_com_queue_deque(ctx, &worker->queue))) {
+    return entry;
+  }
+  for (i = 1; i < n_pool_workers; i++) {
+    pool_worker *victim = &pool_workers[(worker->id + i) % n_pool_workers];
+    if (GRN_COM_QUEUE_EMPTYP(&victim->queue)) { continue; }
+    if ((entry = grn_com_queue_deque(ctx, &victim->queue))) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/* Returns NULL when the server is shutting down. */
+static grn_com_queue_entry *
+pool_worker_next(pool_worker *worker)
+{
+  grn_com_queue_entry *entry = NULL;
+  MUTEX_LOCK(worker->mutex);
+  while (grn_gctx.stat != GRN_CTX_QUIT &&
+         !(entry = pool_deque(&grn_gctx, worker))) {
+    worker->is_idle = GRN_TRUE;
+    COND_WAIT(worker->cond, worker->mutex);
+    worker->is_idle = GRN_FALSE;
+  }
+  MUTEX_UNLOCK(worker->mutex);
+  return entry;
+}
 
 static void
 reset_ready_notify_pipe(void)
@@ -526,11 +699,32 @@ clean_pid_file(void)
 #endif
 }
 
+/* Closes keep-alive connections which have been idle too long. */
+static void
+close_idle_connections(grn_ctx *ctx, grn_com_event *ev)
+{
+  grn_timeval now;
+  grn_com *com;
+  grn_timeval_now(ctx, &now);
+  GRN_HASH_EACH(ctx, ev->hash, id, NULL, NULL, &com, {
+    /* Suspended connections are being handled by workers. */
+    if (com != ev->acceptor &&
+        com->n_requests > 0 &&
+        com->events == GRN_COM_POLLIN &&
+        now.tv_sec - com->last_active_time >= keep_alive_timeout) {
+      grn_com_close(ctx, com);
+    }
+  });
+}
+
 static void
 run_server_loop(grn_ctx *ctx, grn_com_event *ev)
 {
   while (!grn_com_event_poll(ctx, ev, 1000) && grn_gctx.stat != GRN_CTX_QUIT) {
     grn_edge *edge;
+    if (keep_alive_timeout > 0) {
+      close_idle_connections(ctx, ev);
+    }
     while ((edge = (grn_edge *)grn_com_queue_deque(ctx, &ctx_old))) {
       grn_obj *msg;
       while ((msg = (grn_obj *)grn_com_queue_deque(ctx, &edge->send_old))) {
@@ -547,11 +741,15 @@ run_server_loop(grn_ctx *ctx, grn_com_event *ev)
     }
     /* todo : log stat */
   }
-  for (;;) {
-    MUTEX_LOCK(q_mutex);
-    if (nthreads == nfthreads) { break; }
-    MUTEX_UNLOCK(q_mutex);
-    grn_nanosleep(1000000);
+  if (n_pool_workers > 0) {
+    pool_fin(ctx);
+  } else {
+    for (;;) {
+      MUTEX_LOCK(q_mutex);
+      if (nthreads == nfthreads) { break; }
+      MUTEX_UNLOCK(q_mutex);
+      grn_nanosleep(1000000);
+    }
   }
   {
     grn_edge *edge;
@@ -578,7 +776,8 @@ run_server_loop(grn_ctx *ctx, grn_com_event *ev)
 
 static int
 run_server(grn_ctx *ctx, grn_obj *db, grn_com_event *ev,
-           grn_edge_dispatcher_func dispatcher, grn_handler_func handler)
+           grn_edge_dispatcher_func dispatcher, grn_handler_func handler,
+           pool_worker_func worker_func)
 {
   int exit_code = EXIT_SUCCESS;
   struct hostent *he;
@@ -589,6 +788,9 @@ run_server(grn_ctx *ctx, grn_obj *db, grn_com_event *ev,
     ev->opaque = db;
     grn_edges_init(ctx, dispatcher);
     if (!grn_com_sopen(ctx, ev, bind_address, port, handler, he)) {
+      if (worker_pool_size > 0) {
+        pool_start(ctx, worker_func, db);
+      }
       send_ready_notify();
       run_server_loop(ctx, ev);
       exit_code = EXIT_SUCCESS;
@@ -604,7 +806,8 @@ run_server(grn_ctx *ctx, grn_obj *db, grn_com_event *ev,
 
 static int
 start_service(grn_ctx *ctx, const char *db_path,
-              grn_edge_dispatcher_func dispatcher, grn_handler_func handler)
+              grn_edge_dispatcher_func dispatcher, grn_handler_func handler,
+              pool_worker_func worker_func)
 {
   int exit_code = EXIT_SUCCESS;
   grn_com_event ev;
@@ -620,7 +823,7 @@ start_service(grn_ctx *ctx, const char *db_path,
     grn_obj *db;
     db = (newdb || !db_path) ? grn_db_create(ctx, db_path, NULL) : grn_db_open(ctx, db_path);
     if (db) {
-      exit_code = run_server(ctx, db, &ev, dispatcher, handler);
+      exit_code = run_server(ctx, db, &ev, dispatcher, handler, worker_func);
       grn_obj_close(ctx, db);
     } else {
       fprintf(stderr, "db open failed (%s)\n", db_path);
@@ -643,103 +846,263 @@ start_service(grn_ctx *ctx, const char *db_path,
 
 typedef struct {
   grn_msg *msg;
+  grn_bool is_keep_alive;
+  grn_bool is_responded;
+  /* The response is sent by chunked transfer encoding. */
+  grn_bool is_chunked;
 } ht_context;
 
+#define H_MAX_N_BUFFERS 5
+
 static void
-h_output(grn_ctx *ctx, int flags, void *arg)
+h_send_buffers(grn_ctx *ctx, grn_sock fd, grn_obj **buffers, int n_buffers)
 {
-  grn_rc expr_rc = ctx->rc;
-  ht_context *hc = (ht_context *)arg;
-  grn_sock fd = hc->msg->u.fd;
-  grn_obj header, head, foot, *outbuf = ctx->impl->outbuf;
-  if (!(flags & GRN_CTX_TAIL)) { return; }
-  GRN_TEXT_INIT(&header, 0);
-  GRN_TEXT_INIT(&head, 0);
-  GRN_TEXT_INIT(&foot, 0);
-  output_envelope(ctx, expr_rc, &head, outbuf, &foot);
-  switch (expr_rc) {
+  int i;
+  ssize_t ret, len = 0;
+#ifdef WIN32
+  WSABUF wsabufs[H_MAX_N_BUFFERS];
+  for (i = 0; i < n_buffers; i++) {
+    wsabufs[i].buf = buffers[i] ? GRN_TEXT_VALUE(buffers[i]) : NULL;
+    wsabufs[i].len = buffers[i] ? GRN_TEXT_LEN(buffers[i]) : 0;
+    len += wsabufs[i].len;
+  }
+  if (WSASend(fd, wsabufs, n_buffers, &ret, 0, NULL, NULL) == SOCKET_ERROR) {
+    SERR("WSASend");
+  }
+#else /* WIN32 */
+  struct iovec msg_iov[H_MAX_N_BUFFERS];
+  struct msghdr msg;
+  msg.msg_name = NULL;
+  msg.msg_namelen = 0;
+  msg.msg_iov = msg_iov;
+  msg.msg_iovlen = n_buffers;
+  msg.msg_control = NULL;
+  msg.msg_controllen = 0;
+  msg.msg_flags = 0;
+  for (i = 0; i < n_buffers; i++) {
+    msg_iov[i].iov_base = buffers[i] ? GRN_TEXT_VALUE(buffers[i]) : NULL;
+    msg_iov[i].iov_len = buffers[i] ? GRN_TEXT_LEN(buffers[i]) : 0;
+    len += msg_iov[i].iov_len;
+  }
+  if ((ret = sendmsg(fd, &msg, MSG_NOSIGNAL)) == -1) {
+    SERR("sendmsg");
+  }
+#endif /* WIN32 */
+  if (ret != len) {
+    GRN_LOG(&grn_gctx, GRN_LOG_NOTICE,
+            "couldn't send all data (%" GRN_FMT_LLD "/%" GRN_FMT_LLD ")",
+            (long long int)ret, (long long int)len);
+  }
+}
+
+static void
+h_output_header(grn_ctx *ctx, ht_context *hc, grn_rc rc, grn_obj *header)
+{
+  switch (rc) {
   case GRN_SUCCESS :
-    GRN_TEXT_SETS(ctx, &header, "HTTP/1.1 200 OK\r\n");
+    GRN_TEXT_SETS(ctx, header, "HTTP/1.1 200 OK\r\n");
     break;
   case GRN_INVALID_ARGUMENT :
   case GRN_SYNTAX_ERROR :
-    GRN_TEXT_SETS(ctx, &header, "HTTP/1.1 400 Bad Request\r\n");
+    GRN_TEXT_SETS(ctx, header, "HTTP/1.1 400 Bad Request\r\n");
     break;
   case GRN_NO_SUCH_FILE_OR_DIRECTORY :
-    GRN_TEXT_SETS(ctx, &header, "HTTP/1.1 404 Not Found\r\n");
+    GRN_TEXT_SETS(ctx, header, "HTTP/1.1 404 Not Found\r\n");
     break;
   default :
-    GRN_TEXT_SETS(ctx, &header, "HTTP/1.1 500 Internal Server Error\r\n");
+    GRN_TEXT_SETS(ctx, header, "HTTP/1.1 500 Internal Server Error\r\n");
     break;
   }
-  GRN_TEXT_PUTS(ctx, &header, "Connection: close\r\n");
-  GRN_TEXT_PUTS(ctx, &header, "Content-Type: ");
-  GRN_TEXT_PUTS(ctx, &header, grn_ctx_get_mime_type(ctx));
-  GRN_TEXT_PUTS(ctx, &header, "\r\nContent-Length: ");
-  grn_text_lltoa(ctx, &header,
-                 GRN_TEXT_LEN(&head) + GRN_TEXT_LEN(outbuf) + GRN_TEXT_LEN(&foot));
-  GRN_TEXT_PUTS(ctx, &header, "\r\n\r\n");
-  {
-    ssize_t ret, len;
-#ifdef WIN32
-    WSABUF wsabufs[4];
-    wsabufs[0].buf = GRN_TEXT_VALUE(&header);
-    wsabufs[0].len = GRN_TEXT_LEN(&header);
-    wsabufs[1].buf = GRN_TEXT_VALUE(&head);
-    wsabufs[1].len = GRN_TEXT_LEN(&head);
-    wsabufs[2].buf = GRN_TEXT_VALUE(outbuf);
-    wsabufs[2].len = GRN_TEXT_LEN(outbuf);
-    wsabufs[3].buf = GRN_TEXT_VALUE(&foot);
-    wsabufs[3].len = GRN_TEXT_LEN(&foot);
-    if (WSASend(fd, wsabufs, 4, &ret, 0, NULL, NULL) == SOCKET_ERROR) {
-      SERR("WSASend");
-    }
-#else /* WIN32 */
-    struct iovec msg_iov[4];
-    struct msghdr msg;
-    msg.msg_name = NULL;
-    msg.msg_namelen = 0;
-    msg.msg_iov = msg_iov;
-    msg.msg_iovlen = 4;
-    msg.msg_control = NULL;
-    msg.msg_controllen = 0;
-    msg.msg_flags = 0;
-    msg_iov[0].iov_base = GRN_TEXT_VALUE(&header);
-    msg_iov[0].iov_len = GRN_TEXT_LEN(&header);
-    msg_iov[1].iov_base = GRN_TEXT_VALUE(&head);
-    msg_iov[1].iov_len = GRN_TEXT_LEN(&head);
-    msg_iov[2].iov_base = GRN_TEXT_VALUE(outbuf);
-    msg_iov[2].iov_len = GRN_TEXT_LEN(outbuf);
-    msg_iov[3].iov_base = GRN_TEXT_VALUE(&foot);
-    msg_iov[3].iov_len = GRN_TEXT_LEN(&foot);
-    if ((ret = sendmsg(fd, &msg, MSG_NOSIGNAL)) == -1) {
-      SERR("sendmsg");
-    }
-#endif /* WIN32 */
-    len = GRN_TEXT_LEN(&header) + GRN_TEXT_LEN(&head) +
-      GRN_TEXT_LEN(outbuf) + GRN_TEXT_LEN(&foot);
-    if (ret != len) {
-      GRN_LOG(&grn_gctx, GRN_LOG_NOTICE,
-              "couldn't send all data (%" GRN_FMT_LLD "/%" GRN_FMT_LLD ")",
-              (long long int)ret, (long long int)len);
-    }
+  if (hc->is_keep_alive) {
+    GRN_TEXT_PUTS(ctx, header, "Connection: keep-alive\r\n");
+  } else {
+    GRN_TEXT_PUTS(ctx, header, "Connection: close\r\n");
   }
+  GRN_TEXT_PUTS(ctx, header, "Content-Type: ");
+  GRN_TEXT_PUTS(ctx, header, grn_ctx_get_mime_type(ctx));
+  GRN_TEXT_PUTS(ctx, header, "\r\n");
+}
+
+/*
+ * Sends outbuf as a chunk. The first chunk has the header and the head
+ * of the envelope and the last chunk has the foot. The status can't be
+ * changed after the first chunk is sent, so it is always 200.
+ */
+static void
+h_output_chunk(grn_ctx *ctx, ht_context *hc, grn_bool is_last)
+{
+  grn_sock fd = hc->msg->u.peer->fd;
+  grn_obj header, head, foot, chunk_footer;
+  grn_obj *outbuf = ctx->impl->outbuf;
+  grn_obj *buffers[H_MAX_N_BUFFERS];
+  int n_buffers = 0;
+  size_t chunk_len;
+  GRN_TEXT_INIT(&header, 0);
+  GRN_TEXT_INIT(&head, 0);
+  GRN_TEXT_INIT(&foot, 0);
+  GRN_TEXT_INIT(&chunk_footer, 0);
+  output_envelope(ctx, GRN_SUCCESS, &head, outbuf, &foot);
+  if (hc->is_chunked) {
+    GRN_BULK_REWIND(&head);
+  } else {
+    h_output_header(ctx, hc, GRN_SUCCESS, &header);
+    GRN_TEXT_PUTS(ctx, &header, "Transfer-Encoding: chunked\r\n\r\n");
+    hc->is_chunked = GRN_TRUE;
+  }
+  if (!is_last) {
+    GRN_BULK_REWIND(&foot);
+  }
+  chunk_len = GRN_TEXT_LEN(&head) + GRN_TEXT_LEN(outbuf) + GRN_TEXT_LEN(&foot);
+  if (chunk_len > 0) {
+    grn_text_itoh(ctx, &header, chunk_len, 8);
+    GRN_TEXT_PUTS(ctx, &header, "\r\n");
+    GRN_TEXT_PUTS(ctx, &chunk_footer, "\r\n");
+  }
+  if (is_last) {
+    GRN_TEXT_PUTS(ctx, &chunk_footer, "0\r\n\r\n");
+  }
+  buffers[n_buffers++] = &header;
+  buffers[n_buffers++] = &head;
+  buffers[n_buffers++] = outbuf;
+  buffers[n_buffers++] = &foot;
+  buffers[n_buffers++] = &chunk_footer;
+  h_send_buffers(ctx, fd, buffers, n_buffers);
   GRN_BULK_REWIND(outbuf);
+  GRN_OBJ_FIN(ctx, &chunk_footer);
   GRN_OBJ_FIN(ctx, &foot);
   GRN_OBJ_FIN(ctx, &head);
   GRN_OBJ_FIN(ctx, &header);
 }
 
 static void
-do_htreq_get(grn_ctx *ctx, grn_msg *msg)
+h_output(grn_ctx *ctx, int flags, void *arg)
+{
+  grn_rc expr_rc = ctx->rc;
+  ht_context *hc = (ht_context *)arg;
+  grn_sock fd = hc->msg->u.peer->fd;
+  grn_obj header, head, foot, *outbuf = ctx->impl->outbuf;
+  grn_obj *buffers[H_MAX_N_BUFFERS];
+  /* A cached result that is sent without being copied to outbuf. */
+  grn_obj *ref = ctx->impl->output_ref;
+  size_t ref_len = ref ? GRN_TEXT_LEN(ref) : 0;
+  if (!(flags & GRN_CTX_TAIL)) {
+    if ((flags & GRN_CTX_MORE)) {
+      h_output_chunk(ctx, hc, GRN_FALSE);
+    }
+    return;
+  }
+  if (hc->is_chunked) {
+    h_output_chunk(ctx, hc, GRN_TRUE);
+    hc->is_responded = GRN_TRUE;
+    return;
+  }
+  GRN_TEXT_INIT(&header, 0);
+  GRN_TEXT_INIT(&head, 0);
+  GRN_TEXT_INIT(&foot, 0);
+  output_envelope(ctx, expr_rc, &head, ref_len > 0 ? ref : outbuf, &foot);
+  h_output_header(ctx, hc, expr_rc, &header);
+  GRN_TEXT_PUTS(ctx, &header, "Content-Length: ");
+  grn_text_lltoa(ctx, &header,
+                 GRN_TEXT_LEN(&head) + ref_len + GRN_TEXT_LEN(outbuf) +
+                 GRN_TEXT_LEN(&foot));
+  GRN_TEXT_PUTS(ctx, &header, "\r\n\r\n");
+  buffers[0] = &header;
+  buffers[1] = &head;
+  buffers[2] = ref;
+  buffers[3] = outbuf;
+  buffers[4] = &foot;
+  h_send_buffers(ctx, fd, buffers, 5);
+  GRN_BULK_REWIND(outbuf);
+  grn_ctx_output_ref_clear(ctx);
+  GRN_OBJ_FIN(ctx, &foot);
+  GRN_OBJ_FIN(ctx, &head);
+  GRN_OBJ_FIN(ctx, &header);
+  hc->is_responded = GRN_TRUE;
+}
+
+/* Returns the end of the request header or NULL if it isn't received yet. */
+static const char *
+h_find_header_end(const char *start, const char *end)
+{
+  const char *current;
+  for (current = start; current + 4 <= end; current++) {
+    if (current[0] == '\r' && !memcmp(current, "\r\n\r\n", 4)) {
+      return current + 4;
+    }
+  }
+  return NULL;
+}
+
+static grn_bool
+h_is_http_1_1_request(const char *start, const char *end)
+{
+  const char *line_end;
+  for (line_end = start; line_end < end && line_end[0] != '\n'; line_end++) {
+  }
+  if (line_end > start && line_end[-1] == '\r') {
+    line_end--;
+  }
+  return (line_end - start >= 8 && !strncasecmp(line_end - 8, "HTTP/1.1", 8));
+}
+
+static grn_bool
+h_is_keep_alive_request(const char *start, const char *end)
+{
+  grn_bool is_keep_alive = GRN_FALSE;
+  const char *line, *line_end;
+
+  for (line = start; line < end; line = line_end + 1) {
+    const char *value;
+    int value_length;
+
+    for (line_end = line; line_end < end && line_end[0] != '\n'; line_end++) {
+    }
+    value_length = line_end - line;
+    if (value_length > 0 && line[value_length - 1] == '\r') {
+      value_length--;
+    }
+    if (line == start) {
+      /* HTTP/1.1 keeps the connection alive by default. */
+      is_keep_alive = h_is_http_1_1_request(line, line_end);
+      continue;
+    }
+    if (!(value_length > 11 && !strncasecmp(line, "Connection:", 11))) {
+      continue;
+    }
+    for (value = line + 11, value_length -= 11; value_length > 0;) {
+      int token_length;
+      while (value_length > 0 && (value[0] == ' ' || value[0] == ',')) {
+        value++;
+        value_length--;
+      }
+      for (token_length = 0;
+           token_length < value_length &&
+             value[token_length] != ' ' && value[token_length] != ',';
+           token_length++) {
+      }
+      if (token_length == 5 && !strncasecmp(value, "close", 5)) {
+        is_keep_alive = GRN_FALSE;
+      } else if (token_length == 10 && !strncasecmp(value, "keep-alive", 10)) {
+        is_keep_alive = GRN_TRUE;
+      }
+      value += token_length;
+      value_length -= token_length;
+    }
+  }
+  return is_keep_alive;
+}
+
+static const char *
+do_htreq_get(grn_ctx *ctx, ht_context *hc)
 {
+  grn_msg *msg = hc->msg;
   char *path = NULL;
   char *pathe = GRN_BULK_HEAD((grn_obj *)msg);
   char *e = GRN_BULK_CURR((grn_obj *)msg);
   for (;; pathe++) {
     if (e <= pathe + 6) {
       /* invalid request */
-      return;
+      return NULL;
     }
     if (*pathe == ' ') {
       if (!path) {
@@ -752,6 +1115,7 @@ do_htreq_get(grn_ctx *ctx, grn_msg *msg)
     }
   }
   grn_ctx_send(ctx, path, pathe - path, 0);
+  return h_find_header_end(pathe, e);
 }
 
 typedef struct {
@@ -936,11 +1300,13 @@ do_htreq_post_parse_header(grn_ctx *ctx,
   return GRN_TRUE;
 }
 
-static void
-do_htreq_post(grn_ctx *ctx, grn_msg *msg)
+static const char *
+do_htreq_post(grn_ctx *ctx, ht_context *hc)
 {
-  grn_sock fd = msg->u.fd;
+  grn_msg *msg = hc->msg;
+  grn_sock fd = msg->u.peer->fd;
   const char *end;
+  const char *rest;
   h_post_header header;
 
   header.path_start = NULL;
@@ -954,15 +1320,15 @@ do_htreq_post(grn_ctx *ctx, grn_msg *msg)
                                   GRN_BULK_HEAD((grn_obj *)msg),
                                   end,
                                   &header)) {
-    return;
+    return NULL;
   }
 
   grn_ctx_send(ctx, header.path_start, header.path_length, GRN_CTX_QUIET);
   if (ctx->rc != GRN_SUCCESS) {
-    ht_context context;
-    context.msg = msg;
-    h_output(ctx, GRN_CTX_TAIL, &context);
-    return;
+    /* The body isn't consumed. */
+    hc->is_keep_alive = GRN_FALSE;
+    h_output(ctx, GRN_CTX_TAIL, hc);
+    return NULL;
   }
 
   if (header.have_100_continue) {
@@ -972,10 +1338,16 @@ do_htreq_post(grn_ctx *ctx, grn_msg *msg)
     send_size = send(fd, continue_message, strlen(continue_message), send_flags);
     if (send_size == -1) {
       SERR("send");
-      return;
+      return NULL;
     }
   }
 
+  /* Bytes after the body belong to the next pipelined request. */
+  rest = end;
+  if (header.body_start && end - header.body_start > header.content_length) {
+    rest = header.body_start + header.content_length;
+  }
+
   {
     grn_obj line_buffer;
     int read_content_length = 0;
@@ -989,12 +1361,16 @@ do_htreq_post(grn_ctx *ctx, grn_msg *msg)
 
       if (header.body_start) {
         buffer_start = header.body_start;
-        buffer_end = end;
+        buffer_end = rest;
         header.body_start = NULL;
       } else {
         ssize_t recv_length;
         int recv_flags = 0;
-        recv_length = recv(fd, buffer, POST_BUFFER_SIZE, recv_flags);
+        int recv_size = header.content_length - read_content_length;
+        if (recv_size > POST_BUFFER_SIZE) {
+          recv_size = POST_BUFFER_SIZE;
+        }
+        recv_length = recv(fd, buffer, recv_size, recv_flags);
         if (recv_length == 0) {
           break;
         }
@@ -1032,6 +1408,21 @@ do_htreq_post(grn_ctx *ctx, grn_msg *msg)
         GRN_BULK_REWIND(&line_buffer);
       }
       GRN_TEXT_PUT(ctx, &line_buffer, buffer_start, buffer_end - buffer_start);
+      /* Don't buffer a long line such as a one line load body. */
+      if (GRN_TEXT_LEN(&line_buffer) > POST_BUFFER_SIZE) {
+        const char *line_start = GRN_TEXT_VALUE(&line_buffer);
+        const char *line_end = GRN_BULK_CURR(&line_buffer);
+        const char *partial_end;
+        partial_end = grn_ctx_partial_line_end(ctx, line_start, line_end);
+        if (partial_end > line_start) {
+          grn_ctx_send(ctx, line_start, partial_end - line_start,
+                       GRN_CTX_QUIET);
+          memmove(GRN_BULK_HEAD(&line_buffer),
+                  partial_end, line_end - partial_end);
+          GRN_BULK_REWIND(&line_buffer);
+          GRN_BULK_INCR_LEN(&line_buffer, line_end - partial_end);
+        }
+      }
 #undef POST_BUFFER_SIZE
     }
 
@@ -1043,30 +1434,144 @@ do_htreq_post(grn_ctx *ctx, grn_msg *msg)
     }
 
     GRN_OBJ_FIN(ctx, &line_buffer);
+
+    if (read_content_length < header.content_length) {
+      rest = NULL;
+    }
   }
+
+  return rest;
 }
 
+/*
+ * Makes recv() in a worker fail with EAGAIN when the client sends nothing
+ * for keep_alive_timeout seconds. Otherwise a client that stops in the
+ * middle of a pipelined request header or a POST body holds the worker
+ * forever. The event loop closes connections idle between requests.
+ */
 static void
-do_htreq(grn_ctx *ctx, grn_msg *msg)
+h_set_recv_timeout(grn_ctx *ctx, grn_sock fd)
 {
-  grn_com_header *header = &msg->header;
-  switch (header->qtype) {
-  case 'G' : /* GET */
-    do_htreq_get(ctx, msg);
-    break;
-  case 'P' : /* POST */
-    do_htreq_post(ctx, msg);
-    break;
+#ifdef WIN32
+  DWORD timeout = keep_alive_timeout * 1000;
+#else /* WIN32 */
+  struct timeval timeout;
+  timeout.tv_sec = keep_alive_timeout;
+  timeout.tv_usec = 0;
+#endif /* WIN32 */
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO,
+                 (const char *)&timeout, sizeof(timeout)) == -1) {
+    GRN_LOG(ctx, GRN_LOG_WARNING,
+            "[http][keep-alive] failed to set receive timeout: <%d>: %s",
+            fd, strerror(errno));
+  }
+}
+
+/* Receives the rest of a pipelined request header. */
+static grn_bool
+h_recv_header(grn_ctx *ctx, grn_msg *msg)
+{
+  grn_obj *buf = (grn_obj *)msg;
+  while (!h_find_header_end(GRN_BULK_HEAD(buf), GRN_BULK_CURR(buf))) {
+#define HEADER_BUFFER_SIZE 4096
+    ssize_t recv_length;
+    if (grn_bulk_reserve(ctx, buf, HEADER_BUFFER_SIZE)) {
+      return GRN_FALSE;
+    }
+    recv_length = recv(msg->u.peer->fd, GRN_BULK_CURR(buf),
+                       HEADER_BUFFER_SIZE, 0);
+    if (recv_length == -1 && errno == EINTR) {
+      continue;
+    }
+    if (recv_length == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      GRN_LOG(ctx, GRN_LOG_INFO,
+              "[http][keep-alive] closed an idle connection: <%d>",
+              msg->u.peer->fd);
+      return GRN_FALSE;
+    }
+    if (recv_length <= 0) {
+      return GRN_FALSE;
+    }
+    GRN_BULK_INCR_LEN(buf, recv_length);
+#undef HEADER_BUFFER_SIZE
+  }
+  msg->header.qtype = *GRN_BULK_HEAD(buf);
+  return GRN_TRUE;
+}
+
+static void
+do_htreq(grn_ctx *ctx, ht_context *hc)
+{
+  grn_msg *msg = hc->msg;
+  grn_com *com = msg->u.peer;
+  grn_obj *buf = (grn_obj *)msg;
+  grn_bool is_keep_alive = GRN_FALSE;
+
+  if (com->n_requests == 0 && keep_alive_timeout > 0) {
+    h_set_recv_timeout(ctx, com->fd);
+  }
+  for (;;) {
+    const char *start = GRN_BULK_HEAD(buf);
+    const char *end = GRN_BULK_CURR(buf);
+    const char *header_end;
+    const char *rest = NULL;
+
+    header_end = h_find_header_end(start, end);
+    com->n_requests++;
+    hc->is_keep_alive = (header_end &&
+                         keep_alive_timeout > 0 &&
+                         (max_keep_alive_requests == 0 ||
+                          com->n_requests < max_keep_alive_requests) &&
+                         grn_gctx.stat != GRN_CTX_QUIT &&
+                         h_is_keep_alive_request(start, header_end));
+    hc->is_responded = GRN_FALSE;
+    hc->is_chunked = GRN_FALSE;
+    /* Chunked transfer encoding is available since HTTP/1.1. */
+    ctx->impl->output_chunk_size =
+      (header_end && h_is_http_1_1_request(start, header_end))
+      ? output_chunk_size : 0;
+    if (header_end) {
+      switch (msg->header.qtype) {
+      case 'G' : /* GET */
+        rest = do_htreq_get(ctx, hc);
+        break;
+      case 'P' : /* POST */
+        rest = do_htreq_post(ctx, hc);
+        break;
+      }
+    }
+    ctx->stat = GRN_CTX_QUIT;
+    /* TODO: support a command in multi requests. e.g.: load command */
+    grn_ctx_set_next_expr(ctx, NULL);
+    /* A cached result that h_output didn't send. */
+    grn_ctx_output_ref_clear(ctx);
+    /* if (ctx->rc != GRN_OPERATION_WOULD_BLOCK) {...} */
+    is_keep_alive = (rest && hc->is_keep_alive && hc->is_responded);
+    if (!is_keep_alive || rest == end) {
+      break;
+    }
+    /* pipelined requests */
+    {
+      size_t rest_size = end - rest;
+      memmove(GRN_BULK_HEAD(buf), rest, rest_size);
+      GRN_BULK_REWIND(buf);
+      GRN_BULK_INCR_LEN(buf, rest_size);
+    }
+    if (!h_recv_header(ctx, msg)) {
+      is_keep_alive = GRN_FALSE;
+      break;
+    }
   }
-  /* TODO: support "Connection: keep-alive" */
-  ctx->stat = GRN_CTX_QUIT;
-  /* TODO: support a command in multi requests. e.g.: load command */
-  grn_ctx_set_next_expr(ctx, NULL);
-  /* if (ctx->rc != GRN_OPERATION_WOULD_BLOCK) {...} */
   grn_msg_close(ctx, (grn_obj *)msg);
-  /* if not keep alive connection */
-  grn_sock_close(msg->u.fd);
-  grn_com_event_start_accept(ctx, msg->acceptor->ev);
+  if (is_keep_alive) {
+    grn_timeval now;
+    grn_timeval_now(ctx, &now);
+    com->last_active_time = now.tv_sec;
+  } else {
+    /* The event loop closes it when it reads EOF. */
+    shutdown(com->fd, SHUT_RDWR);
+  }
+  grn_com_event_resume(ctx, com->ev, com);
 }
 
 enum {
@@ -1661,6 +2166,7 @@ h_worker(void *arg)
   grn_ctx_init(ctx, 0);
   grn_ctx_use(ctx, (grn_obj *)arg);
   grn_ctx_recv_handler_set(ctx, h_output, &hc);
+  ctx->impl->output_ref_enabled = GRN_TRUE;
   GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "thread start (%d/%d)", nfthreads, nthreads + 1);
   MUTEX_LOCK(q_mutex);
   do {
@@ -1676,7 +2182,7 @@ h_worker(void *arg)
     nfthreads--;
     MUTEX_UNLOCK(q_mutex);
     hc.msg = (grn_msg *)msg;
-    do_htreq(ctx, (grn_msg *)msg);
+    do_htreq(ctx, &hc);
     MUTEX_LOCK(q_mutex);
   } while (nfthreads < max_nfthreads && grn_gctx.stat != GRN_CTX_QUIT);
 exit :
@@ -1687,19 +2193,44 @@ exit :
   return NULL;
 }
 
+static void * CALLBACK
+h_pool_worker(void *arg)
+{
+  pool_worker *worker = arg;
+  ht_context hc;
+  grn_obj *msg;
+  grn_ctx ctx_, *ctx = &ctx_;
+  grn_ctx_init(ctx, 0);
+  grn_ctx_use(ctx, (grn_obj *)worker->arg);
+  grn_ctx_recv_handler_set(ctx, h_output, &hc);
+  ctx->impl->output_ref_enabled = GRN_TRUE;
+  pool_worker_pin(worker);
+  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "worker start (%u)", worker->id);
+  while ((msg = (grn_obj *)pool_worker_next(worker))) {
+    hc.msg = (grn_msg *)msg;
+    do_htreq(ctx, &hc);
+  }
+  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "worker end (%u)", worker->id);
+  grn_ctx_fin(ctx);
+  return NULL;
+}
+
 static void
 h_handler(grn_ctx *ctx, grn_obj *msg)
 {
   grn_com *com = ((grn_msg *)msg)->u.peer;
-  if (ctx->rc) {
+  if (ctx->rc || GRN_BULK_VSIZE(msg) == 0) {
+    /* An error or EOF: the connection is closed by the peer or do_htreq(). */
     grn_com_close(ctx, com);
     grn_msg_close(ctx, msg);
   } else {
-    grn_sock fd = com->fd;
     void *arg = com->ev->opaque;
-    /* if not keep alive connection */
-    grn_com_event_del(ctx, com->ev, fd);
-    ((grn_msg *)msg)->u.fd = fd;
+    /* The worker resumes it after the response. */
+    grn_com_event_suspend(ctx, com->ev, com);
+    if (n_pool_workers > 0) {
+      pool_enque(ctx, (grn_com_queue_entry *)msg);
+      return;
+    }
     MUTEX_LOCK(q_mutex);
     grn_com_queue_enque(ctx, &ctx_new, (grn_com_queue_entry *)msg);
     if (!nfthreads && nthreads < max_nfthreads) {
@@ -1724,18 +2255,62 @@ h_server(char *path)
   GRN_COM_QUEUE_INIT(&ctx_new);
   GRN_COM_QUEUE_INIT(&ctx_old);
   check_rlimit_nofile(ctx);
-  exit_code = start_service(ctx, path, NULL, h_handler);
+  exit_code = start_service(ctx, path, NULL, h_handler, h_pool_worker);
   grn_ctx_fin(ctx);
   return exit_code;
 }
 
+/* q_mutex must be locked. */
+static void
+g_process_edge(grn_edge *edge)
+{
+  grn_ctx *ctx = &edge->ctx;
+  if (edge->stat == EDGE_DOING) { return; }
+  if (edge->stat == EDGE_WAIT) {
+    edge->stat = EDGE_DOING;
+    while (!GRN_COM_QUEUE_EMPTYP(&edge->recv_new)) {
+      grn_obj *msg;
+      MUTEX_UNLOCK(q_mutex);
+      /* if (edge->flags == GRN_EDGE_WORKER) */
+      while (ctx->stat != GRN_CTX_QUIT &&
+             (edge->msg = (grn_msg *)grn_com_queue_deque(ctx, &edge->recv_new))) {
+        grn_com_header *header = &edge->msg->header;
+        msg = (grn_obj *)edge->msg;
+        switch (header->proto) {
+        case GRN_COM_PROTO_MBREQ :
+          do_mbreq(ctx, edge);
+          break;
+        case GRN_COM_PROTO_GQTP :
+          grn_ctx_send(ctx, GRN_BULK_HEAD(msg), GRN_BULK_VSIZE(msg), header->flags);
+          ERRCLR(ctx);
+          break;
+        default :
+          ctx->stat = GRN_CTX_QUIT;
+          break;
+        }
+        grn_msg_close(ctx, msg);
+      }
+      while ((msg = (grn_obj *)grn_com_queue_deque(ctx, &edge->send_old))) {
+        grn_msg_close(ctx, msg);
+      }
+      MUTEX_LOCK(q_mutex);
+      if (ctx->stat == GRN_CTX_QUIT || edge->stat == EDGE_ABORT) { break; }
+    }
+  }
+  if (ctx->stat == GRN_CTX_QUIT || edge->stat == EDGE_ABORT) {
+    grn_com_queue_enque(&grn_gctx, &ctx_old, (grn_com_queue_entry *)edge);
+    edge->stat = EDGE_ABORT;
+  } else {
+    edge->stat = EDGE_IDLE;
+  }
+}
+
 static void * CALLBACK
 g_worker(void *arg)
 {
   GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "thread start (%d/%d)", nfthreads, nthreads + 1);
   MUTEX_LOCK(q_mutex);
   do {
-    grn_ctx *ctx;
     grn_edge *edge;
     nfthreads++;
     while (!(edge = (grn_edge *)grn_com_queue_deque(&grn_gctx, &ctx_new))) {
@@ -1745,46 +2320,8 @@ g_worker(void *arg)
         goto exit;
       }
     }
-    ctx = &edge->ctx;
     nfthreads--;
-    if (edge->stat == EDGE_DOING) { continue; }
-    if (edge->stat == EDGE_WAIT) {
-      edge->stat = EDGE_DOING;
-      while (!GRN_COM_QUEUE_EMPTYP(&edge->recv_new)) {
-        grn_obj *msg;
-        MUTEX_UNLOCK(q_mutex);
-        /* if (edge->flags == GRN_EDGE_WORKER) */
-        while (ctx->stat != GRN_CTX_QUIT &&
-               (edge->msg = (grn_msg *)grn_com_queue_deque(ctx, &edge->recv_new))) {
-          grn_com_header *header = &edge->msg->header;
-          msg = (grn_obj *)edge->msg;
-          switch (header->proto) {
-          case GRN_COM_PROTO_MBREQ :
-            do_mbreq(ctx, edge);
-            break;
-          case GRN_COM_PROTO_GQTP :
-            grn_ctx_send(ctx, GRN_BULK_HEAD(msg), GRN_BULK_VSIZE(msg), header->flags);
-            ERRCLR(ctx);
-            break;
-          default :
-            ctx->stat = GRN_CTX_QUIT;
-            break;
-          }
-          grn_msg_close(ctx, msg);
-        }
-        while ((msg = (grn_obj *)grn_com_queue_deque(ctx, &edge->send_old))) {
-          grn_msg_close(ctx, msg);
-        }
-        MUTEX_LOCK(q_mutex);
-        if (ctx->stat == GRN_CTX_QUIT || edge->stat == EDGE_ABORT) { break; }
-      }
-    }
-    if (ctx->stat == GRN_CTX_QUIT || edge->stat == EDGE_ABORT) {
-      grn_com_queue_enque(&grn_gctx, &ctx_old, (grn_com_queue_entry *)edge);
-      edge->stat = EDGE_ABORT;
-    } else {
-      edge->stat = EDGE_IDLE;
-    }
+    g_process_edge(edge);
   } while (nfthreads < max_nfthreads && grn_gctx.stat != GRN_CTX_QUIT);
 exit :
   nthreads--;
@@ -1793,10 +2330,32 @@ exit :
   return NULL;
 }
 
+static void * CALLBACK
+g_pool_worker(void *arg)
+{
+  pool_worker *worker = arg;
+  grn_edge *edge;
+  pool_worker_pin(worker);
+  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "worker start (%u)", worker->id);
+  while ((edge = (grn_edge *)pool_worker_next(worker))) {
+    MUTEX_LOCK(q_mutex);
+    g_process_edge(edge);
+    MUTEX_UNLOCK(q_mutex);
+  }
+  GRN_LOG(&grn_gctx, GRN_LOG_NOTICE, "worker end (%u)", worker->id);
+  return NULL;
+}
+
 static void
 g_dispatcher(grn_ctx *ctx, grn_edge *edge)
 {
   MUTEX_LOCK(q_mutex);
+  if (edge->stat == EDGE_IDLE && n_pool_workers > 0) {
+    edge->stat = EDGE_WAIT;
+    MUTEX_UNLOCK(q_mutex);
+    pool_enque(ctx, (grn_com_queue_entry *)edge);
+    return;
+  }
   if (edge->stat == EDGE_IDLE) {
     grn_com_queue_enque(ctx, &ctx_new, (grn_com_queue_entry *)edge);
     edge->stat = EDGE_WAIT;
@@ -1816,16 +2375,40 @@ g_output(grn_ctx *ctx, int flags, void *arg)
   grn_edge *edge = arg;
   grn_com *com = edge->com;
   grn_msg *req = edge->msg, *msg = (grn_msg *)ctx->impl->outbuf;
+  if (!(flags & GRN_CTX_TAIL)) {
+    /* Records are still being output to outbuf. Sends a copy of it. */
+    msg = (grn_msg *)grn_msg_open(ctx, com, &edge->send_old);
+    GRN_TEXT_PUT(ctx, (grn_obj *)msg,
+                 GRN_BULK_HEAD(ctx->impl->outbuf),
+                 GRN_BULK_VSIZE(ctx->impl->outbuf));
+    GRN_BULK_REWIND(ctx->impl->outbuf);
+  }
   msg->edge_id = req->edge_id;
   msg->header.proto = req->header.proto == GRN_COM_PROTO_MBREQ
     ? GRN_COM_PROTO_MBRES : req->header.proto;
-  if (ctx->rc != GRN_SUCCESS && GRN_BULK_VSIZE(ctx->impl->outbuf) == 0) {
+  if (!(flags & GRN_CTX_TAIL)) {
+    if (grn_msg_send(ctx, (grn_obj *)msg, GRN_CTX_MORE)) {
+      edge->stat = EDGE_ABORT;
+    }
+    return;
+  }
+  if (ctx->impl->output_ref) {
+    if (msg->header.proto == GRN_COM_PROTO_GQTP) {
+      msg->ref_body = GRN_TEXT_VALUE(ctx->impl->output_ref);
+      msg->ref_body_size = GRN_TEXT_LEN(ctx->impl->output_ref);
+    } else {
+      grn_ctx_output_ref_flatten(ctx);
+    }
+  }
+  if (ctx->rc != GRN_SUCCESS && GRN_BULK_VSIZE(ctx->impl->outbuf) == 0 &&
+      !msg->ref_body) {
     GRN_TEXT_PUTS(ctx, ctx->impl->outbuf, ctx->errbuf);
   }
   if (grn_msg_send(ctx, (grn_obj *)msg,
                    (flags & GRN_CTX_MORE) ? GRN_CTX_MORE : GRN_CTX_TAIL)) {
     edge->stat = EDGE_ABORT;
   }
+  grn_ctx_output_ref_clear(ctx);
   ctx->impl->outbuf = grn_msg_open(ctx, com, &edge->send_old);
 }
 
@@ -1857,6 +2440,8 @@ g_handler(grn_ctx *ctx, grn_obj *msg)
       GRN_COM_QUEUE_INIT(&edge->send_old);
       grn_ctx_use(&edge->ctx, (grn_obj *)com->ev->opaque);
       grn_ctx_recv_handler_set(&edge->ctx, g_output, edge);
+      edge->ctx.impl->output_ref_enabled = GRN_TRUE;
+      edge->ctx.impl->output_chunk_size = output_chunk_size;
       com->opaque = edge;
       grn_obj_close(&edge->ctx, edge->ctx.impl->outbuf);
       edge->ctx.impl->outbuf = grn_msg_open(&edge->ctx, com, &edge->send_old);
@@ -1885,7 +2470,8 @@ g_server(char *path)
   GRN_COM_QUEUE_INIT(&ctx_new);
   GRN_COM_QUEUE_INIT(&ctx_old);
   check_rlimit_nofile(ctx);
-  exit_code = start_service(ctx, path, g_dispatcher, g_handler);
+  exit_code = start_service(ctx, path, g_dispatcher, g_handler,
+                            g_pool_worker);
   grn_ctx_fin(ctx);
   return exit_code;
 }
@@ -1903,6 +2489,7 @@ enum {
 
 #define MODE_MASK   0x007f
 #define MODE_NEW_DB 0x0100
+#define MODE_PIN_WORKERS 0x0200
 
 static uint32_t
 get_core_number(void)
@@ -2123,6 +2710,11 @@ static const int default_http_port = DEFAULT_HTTP_PORT;
 static const int default_gqtp_port = DEFAULT_GQTP_PORT;
 static grn_encoding default_encoding = GRN_ENC_DEFAULT;
 static uint32_t default_max_num_threads = DEFAULT_MAX_NFTHREADS;
+static const uint32_t default_keep_alive_timeout = DEFAULT_KEEP_ALIVE_TIMEOUT;
+static const uint32_t default_max_keep_alive_requests =
+  DEFAULT_MAX_KEEP_ALIVE_REQUESTS;
+static const uint32_t default_worker_pool_size = 0;
+static const uint32_t default_output_chunk_size = 0;
 static const int default_mode = mode_alone;
 static const int default_log_level = GRN_LOG_DEFAULT_LEVEL;
 static const char * const default_protocol = "gqtp";
@@ -2337,9 +2929,28 @@ show_usage(FILE *output)
           "                                [gqtp|http|memcached] (default: %s)\n"
           "      --document-root <path>:   specify document root path (http only)\n"
           "                                (default: %s)\n"
+          "      --keep-alive-timeout <seconds>:\n"
+          "                                specify how long an idle keep-alive\n"
+          "                                connection is kept. 0 disables\n"
+          "                                keep-alive (http only) (default: %u)\n"
+          "      --max-keep-alive-requests <max requests>:\n"
+          "                                specify max number of requests per\n"
+          "                                keep-alive connection. 0 means\n"
+          "                                unlimited (http only) (default: %u)\n"
+          "      --output-chunk-size <bytes>:\n"
+          "                                send select results in chunks of\n"
+          "                                specified size while they are output.\n"
+          "                                0 disables it (default: %u)\n"
           "      --cache-limit <limit>:    specify max number of cache data (default: %u)\n"
+          "      --cache-base-path <path>: specify base path of persistent cache.\n"
+          "                                cache is kept in memory if omitted\n"
           "  -t, --max-threads <max threads>:\n"
           "                                specify max number of threads (default: %u)\n"
+          "      --worker-pool-size <workers>:\n"
+          "                                spawn specified number of workers at\n"
+          "                                startup instead of threads on demand.\n"
+          "                                0 disables the pool (default: %u)\n"
+          "      --worker-pool-pin-cpus:   pin each pool worker to a CPU\n"
           "      --pid-path <path>:        specify file to write process ID to\n"
           "                                (daemon mode only)\n"
           "\n"
@@ -2376,7 +2987,11 @@ show_usage(FILE *output)
           grn_encoding_to_string(default_encoding),
           default_gqtp_port, default_bind_address,
           default_http_port, default_gqtp_port, default_hostname, default_protocol,
-          default_document_root, default_cache_limit, default_max_num_threads,
+          default_document_root,
+          default_keep_alive_timeout, default_max_keep_alive_requests,
+          default_output_chunk_size,
+          default_cache_limit, default_max_num_threads,
+          default_worker_pool_size,
           default_log_level, default_log_path, default_query_log_path,
           default_config_path, default_default_command_version,
           (long long int)default_default_match_escalation_threshold,
@@ -2394,11 +3009,15 @@ main(int argc, char **argv)
     *default_command_version_arg = NULL,
     *default_match_escalation_threshold_arg = NULL,
     *input_fd_arg = NULL, *output_fd_arg = NULL,
-    *working_directory_arg = NULL;
+    *working_directory_arg = NULL,
+    *keep_alive_timeout_arg = NULL, *max_keep_alive_requests_arg = NULL,
+    *worker_pool_size_arg = NULL, *cache_base_path_arg = NULL,
+    *output_chunk_size_arg = NULL;
   const char *config_path = NULL;
   int exit_code = EXIT_SUCCESS;
   int i, mode = mode_alone;
   uint32_t cache_limit = 0;
+  grn_cache *cache = NULL;
   static grn_str_getopt_opt opts[] = {
     {'p', "port", NULL, 0, GETOPT_OP_NONE},
     {'e', "encoding", NULL, 0, GETOPT_OP_NONE},
@@ -2426,6 +3045,12 @@ main(int argc, char **argv)
     {'\0', "input-fd", NULL, 0, GETOPT_OP_NONE},
     {'\0', "output-fd", NULL, 0, GETOPT_OP_NONE},
     {'\0', "working-directory", NULL, 0, GETOPT_OP_NONE},
+    {'\0', "keep-alive-timeout", NULL, 0, GETOPT_OP_NONE},
+    {'\0', "max-keep-alive-requests", NULL, 0, GETOPT_OP_NONE},
+    {'\0', "worker-pool-size", NULL, 0, GETOPT_OP_NONE},
+    {'\0', "worker-pool-pin-cpus", NULL, MODE_PIN_WORKERS, GETOPT_OP_ON},
+    {'\0', "cache-base-path", NULL, 0, GETOPT_OP_NONE},
+    {'\0', "output-chunk-size", NULL, 0, GETOPT_OP_NONE},
     {'\0', NULL, NULL, 0, 0}
   };
   opts[0].arg = &port_arg;
@@ -2447,6 +3072,11 @@ main(int argc, char **argv)
   opts[23].arg = &input_fd_arg;
   opts[24].arg = &output_fd_arg;
   opts[25].arg = &working_directory_arg;
+  opts[26].arg = &keep_alive_timeout_arg;
+  opts[27].arg = &max_keep_alive_requests_arg;
+  opts[28].arg = &worker_pool_size_arg;
+  opts[30].arg = &cache_base_path_arg;
+  opts[31].arg = &output_chunk_size_arg;
 
   reset_ready_notify_pipe();
 
@@ -2629,6 +3259,65 @@ main(int argc, char **argv)
     max_nfthreads = default_max_num_threads;
   }
 
+  if (keep_alive_timeout_arg) {
+    const char * const end =
+      keep_alive_timeout_arg + strlen(keep_alive_timeout_arg);
+    const char *rest = NULL;
+    const uint32_t value = grn_atoui(keep_alive_timeout_arg, end, &rest);
+    if (end != rest) {
+      fprintf(stderr, "invalid keep-alive timeout: <%s>\n",
+              keep_alive_timeout_arg);
+      return EXIT_FAILURE;
+    }
+    keep_alive_timeout = value;
+  } else {
+    keep_alive_timeout = default_keep_alive_timeout;
+  }
+
+  if (max_keep_alive_requests_arg) {
+    const char * const end =
+      max_keep_alive_requests_arg + strlen(max_keep_alive_requests_arg);
+    const char *rest = NULL;
+    const uint32_t value = grn_atoui(max_keep_alive_requests_arg, end, &rest);
+    if (end != rest) {
+      fprintf(stderr, "invalid max number of keep-alive requests: <%s>\n",
+              max_keep_alive_requests_arg);
+      return EXIT_FAILURE;
+    }
+    max_keep_alive_requests = value;
+  } else {
+    max_keep_alive_requests = default_max_keep_alive_requests;
+  }
+
+  if (worker_pool_size_arg) {
+    const char * const end = worker_pool_size_arg + strlen(worker_pool_size_arg);
+    const char *rest = NULL;
+    const uint32_t value = grn_atoui(worker_pool_size_arg, end, &rest);
+    if (end != rest || value > 100) {
+      fprintf(stderr, "invalid worker pool size: <%s>\n",
+              worker_pool_size_arg);
+      return EXIT_FAILURE;
+    }
+    worker_pool_size = value;
+  } else {
+    worker_pool_size = default_worker_pool_size;
+  }
+  worker_pool_pin_cpus = (mode & MODE_PIN_WORKERS) ? GRN_TRUE : GRN_FALSE;
+
+  if (output_chunk_size_arg) {
+    const char * const end = output_chunk_size_arg + strlen(output_chunk_size_arg);
+    const char *rest = NULL;
+    const uint32_t value = grn_atoui(output_chunk_size_arg, end, &rest);
+    if (end != rest) {
+      fprintf(stderr, "invalid output chunk size: <%s>\n",
+              output_chunk_size_arg);
+      return EXIT_FAILURE;
+    }
+    output_chunk_size = value;
+  } else {
+    output_chunk_size = default_output_chunk_size;
+  }
+
   if (input_path) {
     if (!freopen(input_path, "r", stdin)) {
       fprintf(stderr, "can't open input file: %s (%s)\n",
@@ -2781,10 +3470,21 @@ main(int argc, char **argv)
   grn_set_int_handler();
   grn_set_term_handler();
 
+  if (cache_base_path_arg) {
+    cache = grn_persistent_cache_open(&grn_gctx, cache_base_path_arg);
+    if (!cache) {
+      fprintf(stderr, "failed to open persistent cache: <%s>: %s\n",
+              cache_base_path_arg, grn_gctx.errbuf);
+      grn_fin();
+      return EXIT_FAILURE;
+    }
+    grn_cache_current_set(&grn_gctx, cache);
+  }
+
   if (cache_limit_arg) {
-    grn_cache *cache;
-    cache = grn_cache_current_get(&grn_gctx);
-    grn_cache_set_max_n_entries(&grn_gctx, cache, cache_limit);
+    grn_cache_set_max_n_entries(&grn_gctx,
+                                grn_cache_current_get(&grn_gctx),
+                                cache_limit);
   }
 
   newdb = (mode & MODE_NEW_DB);
@@ -2814,6 +3514,10 @@ main(int argc, char **argv)
   if (output != stdout) {
     fclose(output);
   }
+  if (cache) {
+    grn_cache_current_set(&grn_gctx, NULL);
+    grn_cache_close(&grn_gctx, cache);
+  }
   grn_fin();
   return exit_code;
 }
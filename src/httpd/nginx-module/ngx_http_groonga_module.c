@@ -560,9 +560,12 @@ ngx_http_groonga_handler_validate_post_command(ngx_http_request_t *r,
   return NGX_HTTP_BAD_REQUEST;
 }
 
+#define NGX_HTTP_GROONGA_BODY_BUFFER_SIZE 8192
+
 static ngx_int_t
 ngx_http_groonga_send_lines(grn_ctx *context,
                             ngx_http_request_t *r,
+                            grn_obj *line_buffer,
                             u_char *current,
                             u_char *last)
 {
@@ -575,20 +578,41 @@ ngx_http_groonga_send_lines(grn_ctx *context,
       continue;
     }
 
-    grn_ctx_send(context, (const char *)line_start, current - line_start,
+    GRN_TEXT_PUT(context, line_buffer, line_start, current - line_start);
+    grn_ctx_send(context,
+                 GRN_TEXT_VALUE(line_buffer),
+                 GRN_TEXT_LEN(line_buffer),
                  GRN_NO_FLAGS);
+    GRN_BULK_REWIND(line_buffer);
     rc = ngx_http_groonga_context_check_error(r->connection->log, context);
     if (rc != NGX_OK) {
       return rc;
     }
     line_start = current + 1;
   }
-  if (line_start < current) {
-    grn_ctx_send(context, (const char *)line_start, current - line_start,
-                 GRN_NO_FLAGS);
-    rc = ngx_http_groonga_context_check_error(r->connection->log, context);
-    if (rc != NGX_OK) {
-      return rc;
+  GRN_TEXT_PUT(context, line_buffer, line_start, current - line_start);
+
+  /* Don't join a long line such as a one line load body. */
+  if (GRN_TEXT_LEN(line_buffer) > NGX_HTTP_GROONGA_BODY_BUFFER_SIZE) {
+    const char *buffer_start = GRN_TEXT_VALUE(line_buffer);
+    const char *buffer_end = GRN_BULK_CURR(line_buffer);
+    const char *partial_end;
+
+    partial_end = grn_ctx_partial_line_end(context,
+                                           buffer_start,
+                                           buffer_end);
+    if (partial_end > buffer_start) {
+      grn_ctx_send(context, buffer_start, partial_end - buffer_start,
+                   GRN_CTX_QUIET);
+      ngx_memmove(GRN_BULK_HEAD(line_buffer),
+                  partial_end,
+                  buffer_end - partial_end);
+      GRN_BULK_REWIND(line_buffer);
+      GRN_BULK_INCR_LEN(line_buffer, buffer_end - partial_end);
+      rc = ngx_http_groonga_context_check_error(r->connection->log, context);
+      if (rc != NGX_OK) {
+        return rc;
+      }
     }
   }
 
@@ -596,54 +620,64 @@ ngx_http_groonga_send_lines(grn_ctx *context,
 }
 
 static ngx_int_t
-ngx_http_groonga_join_request_body_chain(ngx_http_request_t *r,
+ngx_http_groonga_send_request_body_chain(grn_ctx *context,
+                                         ngx_http_request_t *r,
                                          ngx_chain_t *chain,
-                                         u_char **out_start,
-                                         u_char **out_end)
+                                         grn_obj *line_buffer)
 {
   ngx_int_t rc;
 
   ngx_log_t *log = r->connection->log;
 
   ngx_chain_t *current;
-  u_char *out;
-  size_t out_size;
-
-  u_char *out_cursor;
   ngx_buf_t *buffer;
-  size_t buffer_size;
+  u_char file_buffer[NGX_HTTP_GROONGA_BODY_BUFFER_SIZE];
 
-  out_size = 0;
-  for (current = chain; current; current = current->next) {
-    out_size += ngx_buf_size(current->buf);
-  }
-  out = ngx_palloc(r->pool, out_size);
-  if (!out) {
-    ngx_log_error(NGX_LOG_ERR, log, 0,
-                  "http_groonga: failed to allocate memory for request body");
-    return NGX_ERROR;
-  }
-
-  out_cursor = out;
   for (current = chain; current; current = current->next) {
     buffer = current->buf;
-    buffer_size = ngx_buf_size(current->buf);
 
-    if (buffer->file) {
-      rc = ngx_read_file(buffer->file, out_cursor, buffer_size, 0);
-      if (rc < 0) {
-        ngx_log_error(NGX_LOG_ERR, log, 0,
-                      "http_groonga: failed to read a request body stored in a file");
-        return rc;
+    if (buffer->in_file) {
+      off_t offset;
+      ssize_t read_size;
+      for (offset = buffer->file_pos;
+           offset < buffer->file_last;
+           offset += read_size) {
+        read_size = ngx_read_file(buffer->file,
+                                  file_buffer,
+                                  ngx_min(buffer->file_last - offset,
+                                          NGX_HTTP_GROONGA_BODY_BUFFER_SIZE),
+                                  offset);
+        if (read_size <= 0) {
+          ngx_log_error(NGX_LOG_ERR, log, 0,
+                        "http_groonga: failed to read a request body stored in a file");
+          return NGX_ERROR;
+        }
+        rc = ngx_http_groonga_send_lines(context, r, line_buffer,
+                                         file_buffer,
+                                         file_buffer + read_size);
+        if (rc != NGX_OK) {
+          return rc;
+        }
       }
     } else {
-      ngx_memcpy(out_cursor, buffer->pos, buffer_size);
+      rc = ngx_http_groonga_send_lines(context, r, line_buffer,
+                                       buffer->pos, buffer->last);
+      if (rc != NGX_OK) {
+        return rc;
+      }
     }
-    out_cursor += buffer_size;
   }
 
-  *out_start = out;
-  *out_end = out + out_size;
+  if (GRN_TEXT_LEN(line_buffer) > 0) {
+    grn_ctx_send(context,
+                 GRN_TEXT_VALUE(line_buffer),
+                 GRN_TEXT_LEN(line_buffer),
+                 GRN_NO_FLAGS);
+    rc = ngx_http_groonga_context_check_error(log, context);
+    if (rc != NGX_OK) {
+      return rc;
+    }
+  }
 
   return NGX_OK;
 }
@@ -657,8 +691,7 @@ ngx_http_groonga_handler_process_body(ngx_http_request_t *r,
   grn_ctx *context;
 
   ngx_buf_t *body;
-  u_char *body_data;
-  u_char *body_data_end;
+  grn_obj line_buffer;
 
   context = &(data->context);
 
@@ -669,16 +702,12 @@ ngx_http_groonga_handler_process_body(ngx_http_request_t *r,
     return NGX_HTTP_BAD_REQUEST;
   }
 
-  rc = ngx_http_groonga_join_request_body_chain(r,
+  GRN_TEXT_INIT(&line_buffer, 0);
+  rc = ngx_http_groonga_send_request_body_chain(context,
+                                                r,
                                                 r->request_body->bufs,
-                                                &body_data,
-                                                &body_data_end);
-  if (rc != NGX_OK) {
-    return rc;
-  }
-
-  rc = ngx_http_groonga_send_lines(context, r, body_data, body_data_end);
-  ngx_pfree(r->pool, body_data);
+                                                &line_buffer);
+  GRN_OBJ_FIN(context, &line_buffer);
 
   return rc;
 }
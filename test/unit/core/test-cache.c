@@ -0,0 +1,295 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright(C) 2014 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <ctx.h>
+#include <ctx_impl.h>
+
+#include <gcutter.h>
+
+#include "../lib/grn-assertions.h"
+
+void test_wait_filled(void);
+void test_wait_canceled(void);
+void test_wait_timeout(void);
+void test_persistent_restart(void);
+void test_persistent_write(void);
+void test_persistent_another_database(void);
+
+#define KEY "select Users"
+#define VALUE "[[[0]]]"
+#define WAIT_TIMEOUT 100
+
+static gchar *tmp_directory;
+
+static grn_ctx *context;
+static grn_ctx *context2;
+static grn_obj *database;
+static grn_cache *cache;
+static grn_cache *persistent_cache;
+static const gchar *persistent_cache_path;
+static grn_obj value;
+static grn_obj dependencies;
+static GThread *thread;
+
+void
+cut_startup(void)
+{
+  tmp_directory = g_build_filename(grn_test_get_tmp_dir(),
+                                   "cache",
+                                   NULL);
+}
+
+void
+cut_shutdown(void)
+{
+  g_free(tmp_directory);
+}
+
+static void
+remove_tmp_directory(void)
+{
+  cut_remove_path(tmp_directory, NULL);
+}
+
+/*
+ * The cache compares modified times in seconds. Cached values are
+ * stamped with the start time of the command.
+ */
+static void
+wait_modified_time(void)
+{
+  g_usleep(1.1 * G_USEC_PER_SEC);
+  grn_timeval_now(context, &(context->impl->tv));
+  grn_timeval_now(context2, &(context2->impl->tv));
+}
+
+void
+cut_setup(void)
+{
+  const gchar *database_path;
+
+  remove_tmp_directory();
+  g_mkdir_with_parents(tmp_directory, 0700);
+
+  context = g_new0(grn_ctx, 1);
+  grn_ctx_init(context, 0);
+  context2 = g_new0(grn_ctx, 1);
+  grn_ctx_init(context2, 0);
+
+  database_path = cut_build_path(tmp_directory, "database.groonga", NULL);
+  database = grn_db_create(context, database_path, NULL);
+  grn_ctx_use(context2, database);
+  assert_send_command("table_create Users TABLE_HASH_KEY ShortText");
+  wait_modified_time();
+
+  cache = grn_cache_open(context);
+  grn_cache_set_wait_timeout(context, cache, WAIT_TIMEOUT);
+
+  GRN_TEXT_INIT(&value, 0);
+  GRN_TEXT_SETS(context, &value, VALUE);
+  GRN_UINT32_INIT(&dependencies, GRN_OBJ_VECTOR);
+  GRN_UINT32_PUT(context, &dependencies,
+                 grn_obj_id(context, grn_ctx_get(context, "Users", -1)));
+
+  persistent_cache = NULL;
+  persistent_cache_path = cut_build_path(tmp_directory, "cache", NULL);
+
+  thread = NULL;
+}
+
+void
+cut_teardown(void)
+{
+  if (thread) {
+    g_thread_join(thread);
+  }
+  GRN_OBJ_FIN(context, &value);
+  GRN_OBJ_FIN(context, &dependencies);
+  if (cache) {
+    grn_cache_close(context, cache);
+  }
+  if (persistent_cache) {
+    grn_cache_close(context, persistent_cache);
+  }
+  if (context2) {
+    grn_ctx_fin(context2);
+    g_free(context2);
+  }
+  if (context) {
+    grn_obj_unlink(context, database);
+    grn_ctx_fin(context);
+    g_free(context);
+  }
+
+  remove_tmp_directory();
+}
+
+static grn_cache_statistics *
+get_statistics(void)
+{
+  static grn_cache_statistics statistics;
+  grn_cache_get_statistics(context, cache, &statistics);
+  return &statistics;
+}
+
+static gpointer
+fill(gpointer data)
+{
+  g_usleep(WAIT_TIMEOUT / 2 * 1000);
+  grn_cache_update(context, cache, KEY, strlen(KEY), &value, &dependencies);
+  return NULL;
+}
+
+static gpointer
+cancel(gpointer data)
+{
+  g_usleep(WAIT_TIMEOUT / 2 * 1000);
+  grn_cache_cancel(context, cache, KEY, strlen(KEY));
+  return NULL;
+}
+
+void
+test_wait_filled(void)
+{
+  grn_obj *cached_value;
+
+  cut_assert_null(grn_cache_fetch(context, cache, KEY, strlen(KEY)));
+  thread = g_thread_create(fill, NULL, TRUE, NULL);
+  cached_value = grn_cache_fetch(context2, cache, KEY, strlen(KEY));
+  cut_assert_not_null(cached_value);
+  cut_assert_equal_substring(VALUE,
+                             GRN_TEXT_VALUE(cached_value),
+                             GRN_TEXT_LEN(cached_value));
+  grn_cache_unref(context2, cache, cached_value);
+  cut_assert_equal_uint(1, get_statistics()->ncoalesced);
+  cut_assert_equal_uint(0, get_statistics()->nwait_timeouts);
+}
+
+void
+test_wait_canceled(void)
+{
+  cut_assert_null(grn_cache_fetch(context, cache, KEY, strlen(KEY)));
+  thread = g_thread_create(cancel, NULL, TRUE, NULL);
+  /* The waiter fills the key instead of the canceled one. */
+  cut_assert_null(grn_cache_fetch(context2, cache, KEY, strlen(KEY)));
+  grn_cache_update(context2, cache, KEY, strlen(KEY), &value, &dependencies);
+  cut_assert_equal_uint(1, get_statistics()->nentries);
+  cut_assert_equal_uint(0, get_statistics()->nwait_timeouts);
+}
+
+void
+test_wait_timeout(void)
+{
+  GTimer *timer;
+  gdouble elapsed;
+  grn_obj *cached_value;
+
+  cut_assert_null(grn_cache_fetch(context, cache, KEY, strlen(KEY)));
+
+  timer = g_timer_new();
+  cut_assert_null(grn_cache_fetch(context2, cache, KEY, strlen(KEY)));
+  elapsed = g_timer_elapsed(timer, NULL);
+  g_timer_destroy(timer);
+  cut_assert_operator_double(elapsed, >=, WAIT_TIMEOUT / 1000.0 * 0.9);
+  cut_assert_operator_double(elapsed, <, 1.0);
+  cut_assert_equal_uint(1, get_statistics()->nwait_timeouts);
+
+  /* The waiter computed the result by itself. It can store it. */
+  grn_cache_update(context2, cache, KEY, strlen(KEY), &value, &dependencies);
+  cut_assert_equal_uint(1, get_statistics()->nentries);
+  grn_cache_cancel(context, cache, KEY, strlen(KEY));
+
+  cached_value = grn_cache_fetch(context2, cache, KEY, strlen(KEY));
+  cut_assert_not_null(cached_value);
+  grn_cache_unref(context2, cache, cached_value);
+  cut_assert_equal_uint(1, get_statistics()->nhits);
+}
+
+static void
+reopen_persistent_cache(void)
+{
+  if (persistent_cache) {
+    grn_cache_close(context, persistent_cache);
+  }
+  persistent_cache = grn_persistent_cache_open(context, persistent_cache_path);
+  grn_test_assert_context(context);
+}
+
+static void
+fill_persistent_cache(void)
+{
+  reopen_persistent_cache();
+  cut_assert_null(grn_cache_fetch(context, persistent_cache,
+                                  KEY, strlen(KEY)));
+  grn_cache_update(context, persistent_cache, KEY, strlen(KEY),
+                   &value, &dependencies);
+}
+
+void
+test_persistent_restart(void)
+{
+  grn_cache_statistics statistics;
+  grn_obj *cached_value;
+
+  fill_persistent_cache();
+  reopen_persistent_cache();
+  cached_value = grn_cache_fetch(context2, persistent_cache, KEY, strlen(KEY));
+  cut_assert_not_null(cached_value);
+  cut_assert_equal_substring(VALUE,
+                             GRN_TEXT_VALUE(cached_value),
+                             GRN_TEXT_LEN(cached_value));
+  grn_cache_unref(context2, persistent_cache, cached_value);
+  grn_cache_get_statistics(context, persistent_cache, &statistics);
+  cut_assert_equal_uint(1, statistics.npersistent_hits);
+}
+
+void
+test_persistent_write(void)
+{
+  fill_persistent_cache();
+  assert_send_command("load --table Users --values '[{\"_key\": \"bob\"}]'");
+  reopen_persistent_cache();
+  cut_assert_null(grn_cache_fetch(context2, persistent_cache,
+                                  KEY, strlen(KEY)));
+  grn_cache_cancel(context2, persistent_cache, KEY, strlen(KEY));
+}
+
+void
+test_persistent_another_database(void)
+{
+  const gchar *another_database_path;
+  grn_obj *another_database;
+
+  another_database_path = cut_build_path(tmp_directory,
+                                         "another-database.groonga",
+                                         NULL);
+  another_database = grn_db_create(context2, another_database_path, NULL);
+  grn_test_assert_context(context2);
+  grn_test_send_command(context2, "table_create Users TABLE_HASH_KEY ShortText");
+  grn_test_send_command(context2,
+                        "load --table Users --values '[{\"_key\": \"bob\"}]'");
+  /* The tables of both databases are older than the cached value. */
+  wait_modified_time();
+
+  fill_persistent_cache();
+  reopen_persistent_cache();
+  cut_assert_null(grn_cache_fetch(context2, persistent_cache,
+                                  KEY, strlen(KEY)));
+  grn_cache_cancel(context2, persistent_cache, KEY, strlen(KEY));
+  grn_obj_close(context2, another_database);
+}
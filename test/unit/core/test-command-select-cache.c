@@ -0,0 +1,210 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright(C) 2014 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <ctx.h>
+
+#include <gcutter.h>
+
+#include "../lib/grn-assertions.h"
+
+void test_unrelated_table(void);
+void test_same_table(void);
+void test_referenced_table(void);
+void test_index_lexicon(void);
+void test_database(void);
+
+static gchar *tmp_directory;
+
+static grn_ctx *context;
+static grn_obj *database;
+static grn_cache *cache;
+static grn_cache *disabled_cache;
+static grn_cache *original_cache;
+
+void
+cut_startup(void)
+{
+  tmp_directory = g_build_filename(grn_test_get_tmp_dir(),
+                                   "command-select-cache",
+                                   NULL);
+}
+
+void
+cut_shutdown(void)
+{
+  g_free(tmp_directory);
+}
+
+static void
+remove_tmp_directory(void)
+{
+  cut_remove_path(tmp_directory, NULL);
+}
+
+void
+cut_setup(void)
+{
+  const gchar *database_path;
+
+  remove_tmp_directory();
+  g_mkdir_with_parents(tmp_directory, 0700);
+
+  context = g_new0(grn_ctx, 1);
+  grn_ctx_init(context, 0);
+
+  database_path = cut_build_path(tmp_directory, "database.groonga", NULL);
+  database = grn_db_create(context, database_path, NULL);
+
+  original_cache = grn_cache_current_get(context);
+  cache = grn_cache_open(context);
+  disabled_cache = grn_cache_open(context);
+  grn_cache_set_max_n_entries(context, disabled_cache, 0);
+  grn_cache_current_set(context, cache);
+
+  assert_send_commands("table_create Groups TABLE_HASH_KEY ShortText\n"
+                       "column_create Groups name COLUMN_SCALAR ShortText\n"
+                       "table_create Users TABLE_HASH_KEY ShortText\n"
+                       "column_create Users group COLUMN_SCALAR Groups\n"
+                       "table_create Logs TABLE_NO_KEY\n"
+                       "column_create Logs message COLUMN_SCALAR ShortText\n"
+                       "table_create Terms TABLE_PAT_KEY ShortText "
+                       "--default_tokenizer TokenBigram "
+                       "--normalizer NormalizerAuto\n"
+                       "column_create Terms users_key "
+                       "COLUMN_INDEX|WITH_POSITION Users _key\n"
+                       "load --table Groups\n"
+                       "[\n"
+                       "{\"_key\": \"groonga\", \"name\": \"Groonga\"}\n"
+                       "]\n"
+                       "load --table Users\n"
+                       "[\n"
+                       "{\"_key\": \"alice\", \"group\": \"groonga\"}\n"
+                       "]");
+  /* The cache compares modified times in seconds. */
+  g_usleep(1.1 * G_USEC_PER_SEC);
+}
+
+void
+cut_teardown(void)
+{
+  if (context) {
+    grn_cache_current_set(context, original_cache);
+    grn_cache_close(context, cache);
+    grn_cache_close(context, disabled_cache);
+    grn_obj_unlink(context, database);
+    grn_ctx_fin(context);
+    g_free(context);
+  }
+
+  remove_tmp_directory();
+}
+
+static uint32_t
+cache_nhits(void)
+{
+  grn_cache_statistics statistics;
+  grn_cache_get_statistics(context, cache, &statistics);
+  return statistics.nhits;
+}
+
+/*
+ * Sends the command with and without the cache. It checks that both
+ * results are the same and whether the cached one hits.
+ */
+static void
+assert_cached_select(gboolean expected_hit, const gchar *command)
+{
+  const gchar *uncached_result;
+  uint32_t nhits;
+
+  grn_cache_current_set(context, disabled_cache);
+  uncached_result = send_command(command);
+  grn_cache_current_set(context, cache);
+
+  nhits = cache_nhits();
+  cut_assert_equal_string(uncached_result, send_command(command));
+  cut_assert_equal_uint(expected_hit ? nhits + 1 : nhits, cache_nhits(),
+                        cut_message("%s", command));
+}
+
+void
+test_unrelated_table(void)
+{
+  const gchar *command = "select Users --output_columns _key,group.name";
+
+  assert_cached_select(FALSE, command);
+  assert_cached_select(TRUE, command);
+  assert_send_command("load --table Logs --values "
+                      "'[{\"message\": \"logged\"}]'");
+  assert_cached_select(TRUE, command);
+}
+
+void
+test_same_table(void)
+{
+  const gchar *command = "select Users --output_columns _key";
+
+  assert_cached_select(FALSE, command);
+  assert_send_command("load --table Users --values '[{\"_key\": \"bob\"}]'");
+  assert_cached_select(FALSE, command);
+  cut_assert_equal_string("[[[2],[[\"_key\",\"ShortText\"]],"
+                          "[\"alice\"],[\"bob\"]]]",
+                          send_command(command));
+}
+
+void
+test_referenced_table(void)
+{
+  const gchar *command = "select Users --output_columns _key,group.name";
+
+  assert_cached_select(FALSE, command);
+  assert_send_command("load --table Groups --values "
+                      "'[{\"_key\": \"groonga\", \"name\": \"groonga.org\"}]'");
+  assert_cached_select(FALSE, command);
+  cut_assert_equal_string("[[[1],"
+                          "[[\"_key\",\"ShortText\"],"
+                          "[\"group.name\",\"ShortText\"]],"
+                          "[\"alice\",\"groonga.org\"]]]",
+                          send_command(command));
+}
+
+void
+test_index_lexicon(void)
+{
+  const gchar *command = "select Terms --output_columns _key";
+
+  assert_cached_select(FALSE, command);
+  assert_cached_select(TRUE, command);
+  assert_send_command("load --table Users --values '[{\"_key\": \"bob\"}]'");
+  assert_cached_select(FALSE, command);
+  cut_assert_equal_string("[[[2],[[\"_key\",\"ShortText\"]],"
+                          "[\"alice\"],[\"bob\"]]]",
+                          send_command(command));
+}
+
+void
+test_database(void)
+{
+  const gchar *command = "select Users --output_columns _key";
+
+  assert_cached_select(FALSE, command);
+  assert_send_command("table_create Tags TABLE_PAT_KEY ShortText");
+  assert_cached_select(TRUE, command);
+  assert_send_command("table_remove Tags");
+  assert_cached_select(FALSE, command);
+}
@@ -0,0 +1,429 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright(C) 2014 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <gcutter.h>
+
+#include "../lib/grn-assertions.h"
+
+void test_all_columns(void);
+void test_fixed_size_columns(void);
+void test_texts(void);
+void test_references_and_vectors(void);
+void test_filtered(void);
+void test_sorted(void);
+void test_expression(void);
+void test_drilldown(void);
+void test_buffers(void);
+
+static gchar *tmp_directory;
+
+static grn_ctx *context;
+static grn_obj *database;
+
+void
+cut_startup(void)
+{
+  tmp_directory = g_build_filename(grn_test_get_tmp_dir(),
+                                   "command-select-columnar",
+                                   NULL);
+}
+
+void
+cut_shutdown(void)
+{
+  g_free(tmp_directory);
+}
+
+static void
+remove_tmp_directory(void)
+{
+  cut_remove_path(tmp_directory, NULL);
+}
+
+void
+cut_setup(void)
+{
+  const gchar *database_path;
+
+  remove_tmp_directory();
+  g_mkdir_with_parents(tmp_directory, 0700);
+
+  context = g_new0(grn_ctx, 1);
+  grn_ctx_init(context, 0);
+
+  database_path = cut_build_path(tmp_directory, "database.groonga", NULL);
+  database = grn_db_create(context, database_path, NULL);
+
+  assert_send_commands("table_create Groups TABLE_HASH_KEY ShortText\n"
+                       "table_create Users TABLE_HASH_KEY ShortText\n"
+                       "column_create Users age COLUMN_SCALAR UInt32\n"
+                       "column_create Users balance COLUMN_SCALAR Int64\n"
+                       "column_create Users active COLUMN_SCALAR Bool\n"
+                       "column_create Users name COLUMN_SCALAR ShortText\n"
+                       "column_create Users group COLUMN_SCALAR Groups\n"
+                       "column_create Users tags COLUMN_VECTOR ShortText\n"
+                       "load --table Users\n"
+                       "[\n"
+                       "{\"_key\": \"alice\", \"age\": 20, \"balance\": -100,"
+                       " \"active\": true, \"name\": \"Alice\","
+                       " \"group\": \"groonga\", \"tags\": [\"a\", \"b\"]},\n"
+                       "{\"_key\": \"bob\", \"age\": 30, \"balance\": 200,"
+                       " \"active\": false, \"name\": \"Bob\","
+                       " \"group\": \"mroonga\", \"tags\": []},\n"
+                       "{\"_key\": \"chris\", \"age\": 40,"
+                       " \"name\": \"\", \"group\": \"groonga\"},\n"
+                       "{\"_key\": \"dave\", \"age\": 50, \"balance\": 0,"
+                       " \"active\": true, \"name\": \"Dave\"}\n"
+                       "]");
+}
+
+void
+cut_teardown(void)
+{
+  if (context) {
+    grn_obj_unlink(context, database);
+    grn_ctx_fin(context);
+    g_free(context);
+  }
+
+  remove_tmp_directory();
+}
+
+typedef struct {
+  const gchar *current;
+  const gchar *end;
+} columnar_reader;
+
+static guint32
+read_uint32(columnar_reader *reader)
+{
+  guint32 value;
+  cut_assert_operator_int(reader->end - reader->current, >=, sizeof(value));
+  memcpy(&value, reader->current, sizeof(value));
+  reader->current += sizeof(value);
+  return value;
+}
+
+static gint64
+read_int64(columnar_reader *reader)
+{
+  gint64 value;
+  cut_assert_operator_int(reader->end - reader->current, >=, sizeof(value));
+  memcpy(&value, reader->current, sizeof(value));
+  reader->current += sizeof(value);
+  return value;
+}
+
+static const gchar *
+read_bytes(columnar_reader *reader, gsize size)
+{
+  const gchar *bytes = reader->current;
+  cut_assert_operator_int(reader->end - reader->current, >=, size);
+  reader->current += size;
+  return bytes;
+}
+
+static void
+append_json_string(GString *json, const gchar *value, gsize value_size)
+{
+  gsize i;
+  g_string_append_c(json, '"');
+  for (i = 0; i < value_size; i++) {
+    if (value[i] == '"' || value[i] == '\\') {
+      g_string_append_c(json, '\\');
+    }
+    g_string_append_c(json, value[i]);
+  }
+  g_string_append_c(json, '"');
+}
+
+static void decode_value(columnar_reader *reader, GString *json);
+
+static void
+decode_record_batch(columnar_reader *reader, GString *json)
+{
+  guint32 nhits, n_rows, n_columns, i, j;
+  GString **rows;
+
+  nhits = read_uint32(reader);
+  n_rows = read_uint32(reader);
+  n_columns = read_uint32(reader);
+  g_string_append_printf(json, "[[%u],[", nhits);
+  rows = g_new0(GString *, n_rows);
+  for (j = 0; j < n_rows; j++) {
+    rows[j] = g_string_new("[");
+  }
+  for (i = 0; i < n_columns; i++) {
+    const gchar *name, *type;
+    guint32 name_size, type_size;
+    gchar layout;
+
+    name_size = read_uint32(reader);
+    name = read_bytes(reader, name_size);
+    type_size = read_uint32(reader);
+    type = read_bytes(reader, type_size);
+    g_string_append_printf(json, "%s[", i == 0 ? "" : ",");
+    append_json_string(json, name, name_size);
+    g_string_append_c(json, ',');
+    if (type_size == 0) {
+      g_string_append(json, "null");
+    } else {
+      append_json_string(json, type, type_size);
+    }
+    g_string_append_c(json, ']');
+
+    layout = *read_bytes(reader, 1);
+    for (j = 0; j < n_rows; j++) {
+      if (i > 0) {
+        g_string_append_c(rows[j], ',');
+      }
+    }
+    switch (layout) {
+    case 'f' :
+      {
+        guint32 value_size = read_uint32(reader);
+        const guint8 *bitmap;
+        const gchar *values;
+        const gchar *type_name = cut_take_printf("%.*s", type_size, type);
+        bitmap = (const guint8 *)read_bytes(reader, (n_rows + 7) / 8);
+        values = read_bytes(reader, value_size * n_rows);
+        for (j = 0; j < n_rows; j++) {
+          const gchar *value = values + value_size * j;
+          cut_assert_true(bitmap[j / 8] & (1 << (j % 8)));
+          if (!strcmp(type_name, "UInt32")) {
+            g_string_append_printf(rows[j], "%u", *((guint32 *)value));
+          } else if (!strcmp(type_name, "Int32")) {
+            g_string_append_printf(rows[j], "%d", *((gint32 *)value));
+          } else if (!strcmp(type_name, "Int64")) {
+            g_string_append_printf(rows[j], "%" G_GINT64_FORMAT,
+                                   *((gint64 *)value));
+          } else if (!strcmp(type_name, "Bool")) {
+            g_string_append(rows[j], *value ? "true" : "false");
+          } else {
+            cut_fail("unexpected fixed size type: <%s>", type_name);
+          }
+        }
+      }
+      break;
+    case 'v' :
+      {
+        const guint32 *offsets;
+        const gchar *data;
+        read_bytes(reader, (n_rows + 7) / 8);
+        offsets = (const guint32 *)read_bytes(reader,
+                                              sizeof(guint32) * (n_rows + 1));
+        data = read_bytes(reader, offsets[n_rows]);
+        for (j = 0; j < n_rows; j++) {
+          append_json_string(rows[j],
+                             data + offsets[j],
+                             offsets[j + 1] - offsets[j]);
+        }
+      }
+      break;
+    case 'o' :
+      for (j = 0; j < n_rows; j++) {
+        decode_value(reader, rows[j]);
+      }
+      break;
+    default :
+      cut_fail("unexpected layout: <%c>", layout);
+      break;
+    }
+  }
+  g_string_append_c(json, ']');
+  for (j = 0; j < n_rows; j++) {
+    g_string_append_c(rows[j], ']');
+    g_string_append_printf(json, ",%s", rows[j]->str);
+    g_string_free(rows[j], TRUE);
+  }
+  g_free(rows);
+  g_string_append_c(json, ']');
+}
+
+static void
+decode_value(columnar_reader *reader, GString *json)
+{
+  gchar tag = *read_bytes(reader, 1);
+  switch (tag) {
+  case 'N' :
+    g_string_append(json, "null");
+    break;
+  case 'T' :
+    g_string_append(json, "true");
+    break;
+  case 'F' :
+    g_string_append(json, "false");
+    break;
+  case 'i' :
+    g_string_append_printf(json, "%" G_GINT64_FORMAT, read_int64(reader));
+    break;
+  case 'u' :
+    g_string_append_printf(json, "%" G_GUINT64_FORMAT,
+                           (guint64)read_int64(reader));
+    break;
+  case 's' :
+    {
+      guint32 size = read_uint32(reader);
+      append_json_string(json, read_bytes(reader, size), size);
+    }
+    break;
+  case '[' :
+    {
+      gboolean is_first = TRUE;
+      g_string_append_c(json, '[');
+      while (*(reader->current) != ']') {
+        if (!is_first) {
+          g_string_append_c(json, ',');
+        }
+        decode_value(reader, json);
+        is_first = FALSE;
+      }
+      read_bytes(reader, 1);
+      g_string_append_c(json, ']');
+    }
+    break;
+  case 'R' :
+    decode_record_batch(reader, json);
+    break;
+  default :
+    cut_fail("unexpected tag: <%c>", tag);
+    break;
+  }
+}
+
+static const gchar *
+send_columnar_command(const gchar *command, gsize *result_size)
+{
+  gchar *result;
+  unsigned int size;
+  int flags;
+
+  grn_ctx_send(context, command, strlen(command), 0);
+  grn_test_assert_context(context);
+  grn_ctx_recv(context, &result, &size, &flags);
+  grn_test_assert_context(context);
+  *result_size = size;
+  return cut_take_memdup(result, size);
+}
+
+/* Converts columnar output to JSON output to compare them. */
+static const gchar *
+columnar_to_json(const gchar *columnar, gsize columnar_size)
+{
+  columnar_reader reader;
+  GString *json;
+
+  reader.current = columnar;
+  reader.end = columnar + columnar_size;
+  json = g_string_new(NULL);
+  decode_value(&reader, json);
+  cut_assert_equal_int(0, reader.end - reader.current);
+  return cut_take_string(g_string_free(json, FALSE));
+}
+
+static void
+assert_same_as_json(const gchar *parameters)
+{
+  const gchar *columnar;
+  gsize columnar_size;
+
+  columnar = send_columnar_command(cut_take_printf("select Users %s "
+                                                   "--output_type columnar",
+                                                   parameters),
+                                   &columnar_size);
+  cut_assert_equal_string(send_command(cut_take_printf("select Users %s",
+                                                       parameters)),
+                          columnar_to_json(columnar, columnar_size));
+}
+
+void
+test_all_columns(void)
+{
+  assert_same_as_json("");
+}
+
+void
+test_fixed_size_columns(void)
+{
+  assert_same_as_json("--output_columns _id,age,balance,active");
+}
+
+void
+test_texts(void)
+{
+  assert_same_as_json("--output_columns _key,name");
+}
+
+void
+test_references_and_vectors(void)
+{
+  assert_same_as_json("--output_columns _key,group,group._key,tags");
+}
+
+void
+test_filtered(void)
+{
+  assert_same_as_json("--filter 'age >= 30' --output_columns _key,age,_score");
+}
+
+void
+test_sorted(void)
+{
+  assert_same_as_json("--sortby -age --offset 1 --limit 2 "
+                      "--output_columns _key,age,balance,name");
+}
+
+void
+test_expression(void)
+{
+  assert_same_as_json("--output_columns '_key,age * 2' --command_version 2");
+}
+
+void
+test_drilldown(void)
+{
+  assert_same_as_json("--output_columns _key --drilldown group,active");
+}
+
+void
+test_buffers(void)
+{
+  const gchar *columnar;
+  gsize columnar_size;
+  const gchar expected[] =
+    "[R"
+    "\x04\x00\x00\x00" "\x04\x00\x00\x00" "\x02\x00\x00\x00"
+    "\x03\x00\x00\x00" "age" "\x06\x00\x00\x00" "UInt32" "f"
+    "\x04\x00\x00\x00" "\x0f"
+    "\x14\x00\x00\x00" "\x1e\x00\x00\x00" "\x28\x00\x00\x00" "\x32\x00\x00\x00"
+    "\x04\x00\x00\x00" "name" "\x09\x00\x00\x00" "ShortText" "v"
+    "\xff"
+    "\x00\x00\x00\x00" "\x05\x00\x00\x00" "\x08\x00\x00\x00"
+    "\x08\x00\x00\x00" "\x0c\x00\x00\x00"
+    "AliceBobDave"
+    "]";
+
+  if (G_BYTE_ORDER != G_LITTLE_ENDIAN) {
+    cut_omit("buffers are in host byte order");
+  }
+  columnar = send_columnar_command("select Users --output_columns age,name "
+                                   "--output_type columnar",
+                                   &columnar_size);
+  cut_assert_equal_memory(expected, sizeof(expected) - 1,
+                          columnar, columnar_size);
+}
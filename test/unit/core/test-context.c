@@ -29,6 +29,9 @@ void test_dynamic_malloc_change(void);
 void test_command_version(void);
 void test_support_zlib(void);
 void test_support_lzo(void);
+void test_partial_line_end(void);
+void test_partial_line_end_comment(void);
+void test_partial_line_end_space(void);
 
 static grn_ctx *context;
 static grn_obj *database;
@@ -159,3 +162,65 @@ test_support_lzo(void)
   cut_assert_false(support_p);
 #endif
 }
+
+#define cut_assert_ensure_load() do                                     \
+{                                                                       \
+  cut_assert_ensure_database();                                         \
+  context->encoding = GRN_ENC_UTF8;                                     \
+  grn_table_create(context, "Users", strlen("Users"), NULL,             \
+                   GRN_OBJ_TABLE_HASH_KEY,                              \
+                   grn_ctx_at(context, GRN_DB_SHORT_TEXT), NULL);       \
+  grn_test_assert_context(context);                                     \
+  grn_ctx_send(context, "load --table Users", strlen("load --table Users"), \
+               GRN_CTX_QUIET);                                          \
+  grn_test_assert_context(context);                                     \
+} while (0)
+
+void
+test_partial_line_end(void)
+{
+  const gchar *line = "[[\"_key\"],[\"あいうえおかきくけこ\"]]";
+  const gchar *end = line + strlen(line);
+  const gchar *partial_end;
+
+  cut_assert_ensure_database();
+  cut_assert_equal_pointer(line,
+                           grn_ctx_partial_line_end(context, line, end));
+
+  cut_assert_ensure_load();
+  partial_end = grn_ctx_partial_line_end(context, line, end);
+  /* The head ends before "こ\"]]". */
+  cut_assert_equal_string("こ\"]]", partial_end);
+
+  grn_ctx_send(context, line, partial_end - line, GRN_CTX_QUIET);
+  grn_test_assert_context(context);
+  cut_assert_equal_string("1", send_command(partial_end));
+  cut_assert_equal_string("[[[1],[[\"_key\",\"ShortText\"]],"
+                          "[\"あいうえおかきくけこ\"]]]",
+                          send_command("select Users --output_columns _key"));
+}
+
+void
+test_partial_line_end_comment(void)
+{
+  const gchar *line = "  # [[\"_key\"],[\"alice\"]]";
+
+  cut_assert_ensure_load();
+  cut_assert_equal_pointer(line,
+                           grn_ctx_partial_line_end(context,
+                                                    line,
+                                                    line + strlen(line)));
+}
+
+void
+test_partial_line_end_space(void)
+{
+  const gchar *line = "[[\"_key\"],                   [\"a\"]]";
+
+  cut_assert_ensure_load();
+  /* The rest must not start with a space. */
+  cut_assert_equal_string(",                   [\"a\"]]",
+                          grn_ctx_partial_line_end(context,
+                                                   line,
+                                                   line + strlen(line)));
+}
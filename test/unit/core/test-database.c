@@ -34,6 +34,9 @@ void test_expression_lifetime_over_database(void);
 void test_get(void);
 void test_at(void);
 void test_open_locked_database_and_unlock(void);
+void test_lock_contention(void);
+void test_lock_timeout(void);
+void test_lock_exclusion(void);
 
 static gchar *tmp_directory;
 
@@ -321,3 +324,130 @@ test_open_locked_database_and_unlock(void)
   grn_obj_unlock(context2, database2, GRN_ID_NIL);
   cut_assert_false(grn_obj_is_locked(context, database));
 }
+
+typedef struct {
+  grn_ctx *context;
+  grn_obj *table;
+  grn_rc rc;
+  volatile gboolean locked;
+  guint n_loops;
+  volatile guint *counter;
+} lock_thread_data;
+
+static gpointer
+lock_thread(gpointer user_data)
+{
+  lock_thread_data *data = user_data;
+  data->rc = grn_obj_lock(data->context, data->table, GRN_ID_NIL, -1);
+  data->locked = TRUE;
+  grn_obj_unlock(data->context, data->table, GRN_ID_NIL);
+  return NULL;
+}
+
+void
+test_lock_contention(void)
+{
+  const gchar *path;
+  grn_obj *users;
+  lock_thread_data data;
+  GThread *thread;
+
+  path = cut_build_path(tmp_directory, "database.groonga", NULL);
+  database = grn_db_create(context, path, NULL);
+  assert_send_command("table_create Users TABLE_HASH_KEY ShortText");
+  users = grn_ctx_get(context, "Users", -1);
+
+  database2 = grn_db_open(context2, path);
+  data.context = context2;
+  data.table = grn_ctx_get(context2, "Users", -1);
+  data.rc = GRN_SUCCESS;
+  data.locked = FALSE;
+
+  grn_test_assert(grn_obj_lock(context, users, GRN_ID_NIL, -1));
+  thread = g_thread_new("locker", lock_thread, &data);
+  g_usleep(100 * 1000);
+  cut_assert_false(data.locked);
+  grn_obj_unlock(context, users, GRN_ID_NIL);
+  g_thread_join(thread);
+
+  grn_test_assert(data.rc);
+  cut_assert_true(data.locked);
+  cut_assert_false(grn_obj_is_locked(context, users));
+  cut_assert_match("\"io_locks\":\\{\"Users\":\\{"
+                   "\"n_locks\":1,\"n_contentions\":1,\"n_waits\":[1-9]",
+                   grn_test_send_command(context2, "status"));
+}
+
+void
+test_lock_timeout(void)
+{
+  const gchar *path;
+  grn_obj *users, *users2;
+
+  path = cut_build_path(tmp_directory, "database.groonga", NULL);
+  database = grn_db_create(context, path, NULL);
+  assert_send_command("table_create Users TABLE_HASH_KEY ShortText");
+  users = grn_ctx_get(context, "Users", -1);
+
+  database2 = grn_db_open(context2, path);
+  users2 = grn_ctx_get(context2, "Users", -1);
+
+  grn_test_assert(grn_obj_lock(context, users, GRN_ID_NIL, -1));
+  grn_test_assert_equal_rc(GRN_RESOURCE_DEADLOCK_AVOIDED,
+                           grn_obj_lock(context2, users2, GRN_ID_NIL, 1));
+  grn_obj_unlock(context, users, GRN_ID_NIL);
+  cut_assert_match("\"io_locks\":\\{\"Users\":\\{"
+                   "\"n_locks\":0,\"n_contentions\":0,\"n_waits\":0,"
+                   "\"n_timeouts\":1,",
+                   grn_test_send_command(context2, "status"));
+}
+
+static gpointer
+increment_thread(gpointer user_data)
+{
+  lock_thread_data *data = user_data;
+  guint i;
+  for (i = 0; i < data->n_loops; i++) {
+    grn_rc rc = grn_obj_lock(data->context, data->table, GRN_ID_NIL, -1);
+    if (rc != GRN_SUCCESS) {
+      data->rc = rc;
+      break;
+    }
+    *(data->counter) = *(data->counter) + 1;
+    grn_obj_unlock(data->context, data->table, GRN_ID_NIL);
+  }
+  return NULL;
+}
+
+void
+test_lock_exclusion(void)
+{
+  const gchar *path;
+  volatile guint counter = 0;
+  lock_thread_data data1, data2;
+  GThread *thread1, *thread2;
+
+  path = cut_build_path(tmp_directory, "database.groonga", NULL);
+  database = grn_db_create(context, path, NULL);
+  assert_send_command("table_create Users TABLE_HASH_KEY ShortText");
+  database2 = grn_db_open(context2, path);
+
+  data1.context = context;
+  data1.table = grn_ctx_get(context, "Users", -1);
+  data1.rc = GRN_SUCCESS;
+  data1.n_loops = 10000;
+  data1.counter = &counter;
+  data2 = data1;
+  data2.context = context2;
+  data2.table = grn_ctx_get(context2, "Users", -1);
+
+  thread1 = g_thread_new("incrementer1", increment_thread, &data1);
+  thread2 = g_thread_new("incrementer2", increment_thread, &data2);
+  g_thread_join(thread1);
+  g_thread_join(thread2);
+
+  grn_test_assert(data1.rc);
+  grn_test_assert(data2.rc);
+  cut_assert_equal_uint(data1.n_loops + data2.n_loops, counter);
+  cut_assert_false(grn_obj_is_locked(context, data1.table));
+}
@@ -44,6 +44,8 @@ void data_add_and_delete(void);
 void test_add_and_delete(gconstpointer data);
 void data_truncate(void);
 void test_truncate(gconstpointer data);
+void data_concurrent_add_and_get(void);
+void test_concurrent_add_and_get(gconstpointer data);
 
 static GArray *ids;
 
@@ -613,3 +615,82 @@ test_truncate(gconstpointer data)
   grn_test_assert(grn_hash_truncate(context, hash));
   cut_assert_equal_uint(0, GRN_HASH_SIZE(hash));
 }
+
+typedef struct {
+  grn_hash *hash;
+  guint n_keys;
+  volatile gboolean done;
+  guint n_found;
+  guint n_inconsistencies;
+} concurrent_reader_data;
+
+static gpointer
+concurrent_reader(gpointer user_data)
+{
+  concurrent_reader_data *data = user_data;
+  grn_ctx reader_context;
+  gboolean last_pass = FALSE;
+
+  grn_ctx_init(&reader_context, 0);
+  while (!last_pass) {
+    uint32_t key;
+    last_pass = data->done;
+    data->n_found = 0;
+    for (key = 1; key <= data->n_keys; key++) {
+      grn_id found_id;
+      uint32_t found_key = 0;
+      found_id = grn_hash_get(&reader_context, data->hash,
+                              &key, sizeof(uint32_t), NULL);
+      if (found_id == GRN_ID_NIL) {
+        continue;
+      }
+      data->n_found++;
+      if (grn_hash_get_key(&reader_context, data->hash, found_id,
+                           &found_key, sizeof(uint32_t)) != sizeof(uint32_t) ||
+          found_key != key) {
+        data->n_inconsistencies++;
+      }
+    }
+  }
+  grn_ctx_fin(&reader_context);
+  return NULL;
+}
+
+void
+data_concurrent_add_and_get(void)
+{
+  cut_add_data("default", NULL, NULL,
+               "tiny", set_tiny_flags, NULL);
+}
+
+void
+test_concurrent_add_and_get(gconstpointer data)
+{
+  const grn_test_set_parameters_func set_parameters = data;
+  concurrent_reader_data reader_data;
+  GThread *reader;
+  uint32_t key;
+
+  if (set_parameters)
+    set_parameters();
+
+  grn_test_hash_factory_set_key_size(factory, sizeof(uint32_t));
+  cut_assert_create_hash();
+
+  reader_data.hash = hash;
+  reader_data.n_keys = 100000;
+  reader_data.done = FALSE;
+  reader_data.n_found = 0;
+  reader_data.n_inconsistencies = 0;
+  reader = g_thread_new("reader", concurrent_reader, &reader_data);
+  for (key = 1; key <= reader_data.n_keys; key++) {
+    grn_test_assert_not_nil(grn_hash_add(context, hash,
+                                         &key, sizeof(uint32_t), NULL, NULL),
+                            cut_message("key: <%u>", key));
+  }
+  reader_data.done = TRUE;
+  g_thread_join(reader);
+
+  cut_assert_equal_uint(0, reader_data.n_inconsistencies);
+  cut_assert_equal_uint(reader_data.n_keys, reader_data.n_found);
+}
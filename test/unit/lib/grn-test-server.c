@@ -17,13 +17,21 @@
 */
 
 #include <errno.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
 
 #include "grn-test-server.h"
 #include "grn-test-utils.h"
 
 #include <gcutter.h>
 
-#define GRN_TEST_SERVER_DEFAULT_PORT 5454
+#define GRN_TEST_SERVER_READY_TIMEOUT 10.0
+#define GRN_TEST_SERVER_READY_INTERVAL (G_USEC_PER_SEC / 100)
 
 #define GRN_TEST_SERVER_GET_PRIVATE(obj)                          \
   (G_TYPE_INSTANCE_GET_PRIVATE((obj), GRN_TYPE_TEST_SERVER,       \
@@ -39,6 +47,7 @@ struct _GrnTestServerPrivate
   gchar *address;
   guint port;
   gchar *encoding;
+  GPtrArray *options;
   gchar *http_uri_base;
   gchar *memcached_address;
 };
@@ -72,8 +81,9 @@ grn_test_server_init(GrnTestServer *factory)
   priv->database_path = NULL;
   priv->custom_database_path = FALSE;
   priv->address = g_strdup("127.0.0.1");
-  priv->port = GRN_TEST_SERVER_DEFAULT_PORT;
+  priv->port = 0;
   priv->encoding = g_strdup("utf8");
+  priv->options = g_ptr_array_new_with_free_func(g_free);
   priv->http_uri_base = NULL;
   priv->memcached_address = NULL;
 }
@@ -115,6 +125,11 @@ dispose(GObject *object)
     priv->encoding = NULL;
   }
 
+  if (priv->options) {
+    g_ptr_array_unref(priv->options);
+    priv->options = NULL;
+  }
+
   if (priv->http_uri_base) {
     g_free(priv->http_uri_base);
     priv->http_uri_base = NULL;
@@ -163,12 +178,101 @@ grn_test_server_ensure_base_directory(GrnTestServer *server, GError **error)
   return TRUE;
 }
 
+static gboolean
+grn_test_server_set_socket_address(GrnTestServer *server,
+                                   struct sockaddr_in *address,
+                                   guint port,
+                                   GError **error)
+{
+  GrnTestServerPrivate *priv;
+
+  priv = GRN_TEST_SERVER_GET_PRIVATE(server);
+  memset(address, 0, sizeof(*address));
+  address->sin_family = AF_INET;
+  address->sin_port = htons(port);
+  if (inet_pton(AF_INET, priv->address, &(address->sin_addr)) != 1) {
+    g_set_error(error,
+                GRN_TEST_SERVER_ERROR,
+                GRN_TEST_SERVER_ERROR_IO,
+                "invalid address: <%s>", priv->address);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Lets the kernel choose a port that is free now. */
+static gboolean
+grn_test_server_ensure_port(GrnTestServer *server, GError **error)
+{
+  GrnTestServerPrivate *priv;
+  struct sockaddr_in address;
+  socklen_t address_size = sizeof(address);
+  int fd;
+
+  priv = GRN_TEST_SERVER_GET_PRIVATE(server);
+  if (priv->port != 0)
+    return TRUE;
+
+  if (!grn_test_server_set_socket_address(server, &address, 0, error))
+    return FALSE;
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1 ||
+      bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+      getsockname(fd, (struct sockaddr *)&address, &address_size) == -1) {
+    g_set_error(error,
+                GRN_TEST_SERVER_ERROR,
+                GRN_TEST_SERVER_ERROR_IO,
+                "failed to find a free port: %s", g_strerror(errno));
+    if (fd != -1)
+      close(fd);
+    return FALSE;
+  }
+  close(fd);
+  priv->port = ntohs(address.sin_port);
+
+  return TRUE;
+}
+
+static gboolean
+grn_test_server_wait_ready(GrnTestServer *server, GError **error)
+{
+  GTimer *timer;
+  GError *connect_error = NULL;
+  gint fd;
+
+  timer = g_timer_new();
+  for (;;) {
+    g_clear_error(&connect_error);
+    fd = grn_test_server_connect(server, &connect_error);
+    if (fd != -1) {
+      close(fd);
+      break;
+    }
+    if (g_timer_elapsed(timer, NULL) > GRN_TEST_SERVER_READY_TIMEOUT) {
+      g_set_error(error,
+                  GRN_TEST_SERVER_ERROR,
+                  GRN_TEST_SERVER_ERROR_TIMEOUT,
+                  "server isn't ready: %s", connect_error->message);
+      g_error_free(connect_error);
+      break;
+    }
+    g_usleep(GRN_TEST_SERVER_READY_INTERVAL);
+  }
+  g_timer_destroy(timer);
+
+  return fd != -1;
+}
+
 gboolean
 grn_test_server_start(GrnTestServer *server, GError **error)
 {
   GrnTestServerPrivate *priv;
   const gchar *database_path;
   gchar *port_string;
+  GArray *command;
+  const gchar *argument;
+  guint i;
 
   priv = GRN_TEST_SERVER_GET_PRIVATE(server);
   if (priv->egg) {
@@ -183,21 +287,40 @@ grn_test_server_start(GrnTestServer *server, GError **error)
   if (!database_path)
     return FALSE;
 
+  if (!grn_test_server_ensure_port(server, error))
+    return FALSE;
+
+#define ADD_ARGUMENT(value) do {                \
+    argument = (value);                         \
+    g_array_append_val(command, argument);      \
+  } while (0)
+
   port_string = g_strdup_printf("%u", priv->port);
-  priv->egg = gcut_egg_new(GROONGA,
-                           "-s",
-                           "-i", priv->address,
-                           "-p", port_string,
-                           "-n", database_path,
-                           "-e", priv->encoding,
-                           NULL);
+  command = g_array_new(TRUE, TRUE, sizeof(const gchar *));
+  ADD_ARGUMENT(GROONGA);
+  ADD_ARGUMENT("-s");
+  ADD_ARGUMENT("-i");
+  ADD_ARGUMENT(priv->address);
+  ADD_ARGUMENT("-p");
+  ADD_ARGUMENT(port_string);
+  ADD_ARGUMENT("-e");
+  ADD_ARGUMENT(priv->encoding);
+  for (i = 0; i < priv->options->len; i++) {
+    ADD_ARGUMENT(g_ptr_array_index(priv->options, i));
+  }
+  if (!g_file_test(database_path, G_FILE_TEST_EXISTS))
+    ADD_ARGUMENT("-n");
+  ADD_ARGUMENT(database_path);
+  priv->egg = gcut_egg_new_array(command);
+  g_array_free(command, TRUE);
   g_free(port_string);
+
+#undef ADD_ARGUMENT
+
   if (!gcut_egg_hatch(priv->egg, error))
     return FALSE;
 
-  g_usleep(1.5 * G_USEC_PER_SEC); /* FIXME: use select */
-
-  return TRUE;
+  return grn_test_server_wait_ready(server, error);
 }
 
 gboolean
@@ -303,6 +426,53 @@ grn_test_server_set_encoding(GrnTestServer *server, const gchar *encoding)
   priv->encoding = g_strdup(encoding);
 }
 
+void
+grn_test_server_add_option(GrnTestServer *server,
+                           const gchar *name,
+                           const gchar *value)
+{
+  GrnTestServerPrivate *priv;
+
+  priv = GRN_TEST_SERVER_GET_PRIVATE(server);
+
+  g_ptr_array_add(priv->options, g_strdup(name));
+  if (value)
+    g_ptr_array_add(priv->options, g_strdup(value));
+}
+
+gint
+grn_test_server_connect(GrnTestServer *server, GError **error)
+{
+  GrnTestServerPrivate *priv;
+  struct sockaddr_in address;
+  int fd;
+
+  priv = GRN_TEST_SERVER_GET_PRIVATE(server);
+  if (!grn_test_server_set_socket_address(server, &address, priv->port,
+                                          error))
+    return -1;
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1) {
+    g_set_error(error,
+                GRN_TEST_SERVER_ERROR,
+                GRN_TEST_SERVER_ERROR_IO,
+                "failed to create socket: %s", g_strerror(errno));
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+    g_set_error(error,
+                GRN_TEST_SERVER_ERROR,
+                GRN_TEST_SERVER_ERROR_IO,
+                "failed to connect to %s:%u: %s",
+                priv->address, priv->port, g_strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
 const gchar *
 grn_test_server_get_http_uri_base(GrnTestServer *server)
 {
@@ -49,7 +49,8 @@ typedef enum
 {
   GRN_TEST_SERVER_ERROR_IO,
   GRN_TEST_SERVER_ERROR_ALREADY_STARTED,
-  GRN_TEST_SERVER_ERROR_NOT_STARTED
+  GRN_TEST_SERVER_ERROR_NOT_STARTED,
+  GRN_TEST_SERVER_ERROR_TIMEOUT
 } GrnTestServerError;
 
 GQuark              grn_test_server_error_quark (void);
@@ -86,6 +87,14 @@ void                grn_test_server_set_encoding
                                              (GrnTestServer *server,
                                               const gchar   *encoding);
 
+void                grn_test_server_add_option
+                                             (GrnTestServer *server,
+                                              const gchar   *name,
+                                              const gchar   *value);
+
+gint                grn_test_server_connect  (GrnTestServer  *server,
+                                              GError        **error);
+
 const gchar        *grn_test_server_get_http_uri_base
                                              (GrnTestServer *server);
 const gchar        *grn_test_server_get_memcached_address
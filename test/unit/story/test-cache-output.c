@@ -0,0 +1,265 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright(C) 2014 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <gcutter.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../lib/grn-assertions.h"
+#include "../lib/grn-test-server.h"
+
+void test_http(void);
+void test_http_keep_alive(void);
+void test_gqtp(void);
+
+#define N_RECORDS 2000
+#define SELECT_PATH "/d/select?table=Users&limit=-1&output_columns=_key,age"
+#define SELECT_COMMAND "select Users --limit -1 --output_columns _key,age"
+/* The same select with another cache key. */
+#define UNCACHED_SELECT_PATH \
+  "/d/select?table=Users&limit=-1&output_columns=_key,%20age&cache=no"
+#define UNCACHED_SELECT_COMMAND \
+  "select Users --limit -1 --output_columns '_key, age' --cache no"
+
+static GrnTestServer *server;
+static grn_ctx *context;
+static grn_obj *database;
+static int client;
+
+void
+cut_setup(void)
+{
+  GString *values;
+  const gchar *database_path;
+  GError *error = NULL;
+  gint i;
+
+  server = grn_test_server_new();
+  context = g_new0(grn_ctx, 1);
+  grn_ctx_init(context, 0);
+  client = -1;
+
+  database_path = grn_test_server_get_database_path(server, &error);
+  gcut_assert_error(error);
+  database = grn_db_create(context, database_path, NULL);
+  assert_send_command("table_create Users TABLE_HASH_KEY ShortText");
+  assert_send_command("column_create Users age COLUMN_SCALAR UInt32");
+  values = g_string_new("load --table Users --values '[");
+  for (i = 0; i < N_RECORDS; i++) {
+    g_string_append_printf(values,
+                           "%s{\"_key\": \"user%d\", \"age\": %d}",
+                           i == 0 ? "" : ",", i, i % 100);
+  }
+  g_string_append(values, "]'");
+  assert_send_command(cut_take_string(g_string_free(values, FALSE)));
+  grn_obj_close(context, database);
+  database = NULL;
+}
+
+void
+cut_teardown(void)
+{
+  if (client != -1) {
+    close(client);
+  }
+  if (context) {
+    grn_ctx_fin(context);
+    g_free(context);
+  }
+  if (server) {
+    g_object_unref(server);
+  }
+}
+
+static void
+start_server(const gchar *protocol)
+{
+  GError *error = NULL;
+
+  grn_test_server_add_option(server, "--protocol", protocol);
+  grn_test_server_start(server, &error);
+  gcut_assert_error(error);
+}
+
+static void
+open_http_client(void)
+{
+  GError *error = NULL;
+
+  client = grn_test_server_connect(server, &error);
+  gcut_assert_error(error);
+}
+
+static void
+send_http_request(const gchar *request)
+{
+  size_t size = strlen(request);
+  cut_assert_equal_int(size, send(client, request, size, 0));
+}
+
+/* Receives until the server closes the connection. */
+static const gchar *
+receive_all(void)
+{
+  GString *response;
+  gchar buffer[4096];
+  ssize_t size;
+
+  response = g_string_new(NULL);
+  while ((size = recv(client, buffer, sizeof(buffer), 0)) > 0) {
+    g_string_append_len(response, buffer, size);
+  }
+  close(client);
+  client = -1;
+  return cut_take_string(g_string_free(response, FALSE));
+}
+
+/* Returns the body of a response without its [status, start, elapsed]. */
+static const gchar *
+extract_body(const gchar *response)
+{
+  const gchar *body;
+
+  body = strstr(response, "\r\n\r\n");
+  cut_assert_not_null(body);
+  body = strstr(body, "],");
+  cut_assert_not_null(body);
+  return cut_take_printf("[%s", body + strlen("],"));
+}
+
+static const gchar *
+http_select(void)
+{
+  open_http_client();
+  send_http_request("GET " SELECT_PATH " HTTP/1.0\r\n\r\n");
+  return extract_body(receive_all());
+}
+
+static const gchar *
+http_select_without_cache(void)
+{
+  open_http_client();
+  send_http_request("GET " UNCACHED_SELECT_PATH " HTTP/1.0\r\n\r\n");
+  return extract_body(receive_all());
+}
+
+static const gchar *
+status_cache_hit_rate(void)
+{
+  const gchar *response;
+  const gchar *hit_rate;
+
+  open_http_client();
+  send_http_request("GET /d/status HTTP/1.0\r\n\r\n");
+  response = receive_all();
+  hit_rate = strstr(response, "\"cache_hit_rate\":");
+  cut_assert_not_null(hit_rate);
+  return cut_take_printf("%.*s",
+                         (int)strcspn(hit_rate, ",}"), hit_rate);
+}
+
+void
+test_http(void)
+{
+  const gchar *missed_body;
+  const gchar *hit_body;
+
+  start_server("http");
+  missed_body = http_select();
+  cut_assert_operator_int(strlen(missed_body), >, 16 * 1024);
+  hit_body = http_select();
+  cut_assert_equal_string(missed_body, hit_body);
+  cut_assert_equal_string("\"cache_hit_rate\":50.0", status_cache_hit_rate());
+  cut_assert_equal_string(missed_body, http_select_without_cache());
+}
+
+void
+test_http_keep_alive(void)
+{
+  const gchar *request = "GET " SELECT_PATH " HTTP/1.1\r\n"
+                         "Host: localhost\r\n"
+                         "\r\n";
+  const gchar *last_request = "GET " SELECT_PATH " HTTP/1.1\r\n"
+                              "Connection: close\r\n"
+                              "\r\n";
+  const gchar *missed_body;
+  const gchar *response;
+  const gchar *next_response;
+  gint n_responses = 0;
+
+  start_server("http");
+  missed_body = http_select();
+
+  open_http_client();
+  send_http_request(request);
+  send_http_request(request);
+  send_http_request(last_request);
+  response = receive_all();
+  while (response) {
+    const gchar *body;
+    next_response = strstr(response + 1, "HTTP/1.1 200 OK\r\n");
+    if (next_response) {
+      response = cut_take_printf("%.*s",
+                                 (int)(next_response - response), response);
+    }
+    body = extract_body(response);
+    cut_assert_equal_string(missed_body, body,
+                            cut_message("response: <%d>", n_responses));
+    n_responses++;
+    response = next_response;
+  }
+  cut_assert_equal_int(3, n_responses);
+}
+
+static const gchar *
+gqtp_select(grn_ctx *client_context, const gchar *command)
+{
+  char *result;
+  unsigned int result_size;
+  int flags;
+
+  grn_ctx_send(client_context, command, strlen(command), 0);
+  grn_test_assert_context(client_context);
+  grn_ctx_recv(client_context, &result, &result_size, &flags);
+  grn_test_assert_context(client_context);
+  return cut_take_printf("%.*s", result_size, result);
+}
+
+void
+test_gqtp(void)
+{
+  grn_ctx client_context;
+  const gchar *missed_body;
+
+  start_server("gqtp");
+  grn_ctx_init(&client_context, 0);
+  grn_test_assert(grn_ctx_connect(&client_context,
+                                  grn_test_server_get_address(server),
+                                  grn_test_server_get_port(server),
+                                  0));
+  missed_body = gqtp_select(&client_context, SELECT_COMMAND);
+  cut_assert_operator_int(strlen(missed_body), >, 16 * 1024);
+  cut_assert_equal_string(missed_body,
+                          gqtp_select(&client_context, SELECT_COMMAND));
+  cut_assert_equal_string(missed_body,
+                          gqtp_select(&client_context,
+                                      UNCACHED_SELECT_COMMAND));
+  grn_ctx_fin(&client_context);
+}
@@ -0,0 +1,191 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright(C) 2014 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <gcutter.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../lib/grn-assertions.h"
+#include "../lib/grn-test-server.h"
+
+void test_sequential_requests(void);
+void test_pipelined_requests(void);
+void test_close_idle_connection(void);
+void test_close_connection_idle_in_request_header(void);
+
+static GrnTestServer *server;
+static int client;
+
+void
+cut_setup(void)
+{
+  GError *error = NULL;
+
+  server = grn_test_server_new();
+  grn_test_server_add_option(server, "--protocol", "http");
+  grn_test_server_add_option(server, "--keep-alive-timeout", "1");
+  grn_test_server_start(server, &error);
+  gcut_assert_error(error);
+
+  client = -1;
+}
+
+void
+cut_teardown(void)
+{
+  if (client != -1) {
+    close(client);
+  }
+  if (server) {
+    g_object_unref(server);
+  }
+}
+
+static void
+open_client(void)
+{
+  GError *error = NULL;
+
+  client = grn_test_server_connect(server, &error);
+  gcut_assert_error(error);
+}
+
+static void
+send_request(const gchar *request)
+{
+  size_t size = strlen(request);
+  cut_assert_equal_int(size, send(client, request, size, 0));
+}
+
+/* Receives until the server closes the connection. */
+static const gchar *
+receive_all(gdouble *elapsed)
+{
+  GString *response;
+  GTimer *timer;
+  gchar buffer[4096];
+  ssize_t size;
+
+  response = g_string_new(NULL);
+  timer = g_timer_new();
+  while ((size = recv(client, buffer, sizeof(buffer), 0)) > 0) {
+    g_string_append_len(response, buffer, size);
+  }
+  if (elapsed) {
+    *elapsed = g_timer_elapsed(timer, NULL);
+  }
+  g_timer_destroy(timer);
+  return cut_take_string(g_string_free(response, FALSE));
+}
+
+/* Receives one response whose body is a JSON array. */
+static const gchar *
+receive_response(void)
+{
+  GString *response;
+  gchar buffer[4096];
+  ssize_t size;
+
+  response = g_string_new(NULL);
+  while (!g_str_has_suffix(response->str, "]") &&
+         (size = recv(client, buffer, sizeof(buffer), 0)) > 0) {
+    g_string_append_len(response, buffer, size);
+  }
+  return cut_take_string(g_string_free(response, FALSE));
+}
+
+static guint
+count_substrings(const gchar *string, const gchar *substring)
+{
+  guint n = 0;
+  while ((string = strstr(string, substring))) {
+    n++;
+    string += strlen(substring);
+  }
+  return n;
+}
+
+void
+test_sequential_requests(void)
+{
+  const gchar *response;
+
+  open_client();
+  send_request("GET /d/status HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  response = receive_response();
+  cut_assert_match("\\AHTTP/1.1 200 OK\r\nConnection: keep-alive\r\n",
+                   response);
+
+  send_request("GET /d/table_list HTTP/1.0\r\n"
+               "Connection: keep-alive\r\n"
+               "\r\n");
+  response = receive_response();
+  cut_assert_match("\\AHTTP/1.1 200 OK\r\nConnection: keep-alive\r\n",
+                   response);
+
+  send_request("GET /d/status HTTP/1.0\r\n\r\n");
+  response = receive_all(NULL);
+  cut_assert_match("\\AHTTP/1.1 200 OK\r\nConnection: close\r\n",
+                   response);
+}
+
+void
+test_pipelined_requests(void)
+{
+  const gchar *response;
+
+  open_client();
+  send_request("GET /d/status HTTP/1.1\r\nHost: localhost\r\n\r\n"
+               "GET /d/table_list HTTP/1.1\r\nHost: localhost\r\n\r\n"
+               "GET /d/status HTTP/1.1\r\nConnection: close\r\n\r\n");
+  response = receive_all(NULL);
+  cut_assert_equal_uint(3, count_substrings(response, "HTTP/1.1 200 OK\r\n"));
+  cut_assert_equal_uint(2, count_substrings(response,
+                                            "Connection: keep-alive\r\n"));
+  cut_assert_equal_uint(1, count_substrings(response,
+                                            "Connection: close\r\n"));
+}
+
+void
+test_close_idle_connection(void)
+{
+  const gchar *response;
+  gdouble elapsed;
+
+  open_client();
+  send_request("GET /d/status HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  response = receive_all(&elapsed);
+  cut_assert_equal_uint(1, count_substrings(response, "HTTP/1.1 200 OK\r\n"));
+  cut_assert_operator_double(elapsed, <, 5.0);
+}
+
+void
+test_close_connection_idle_in_request_header(void)
+{
+  const gchar *response;
+  gdouble elapsed;
+
+  open_client();
+  send_request("GET /d/status HTTP/1.1\r\nHost: localhost\r\n\r\n"
+               "GET /d/status HTTP/1.1\r\nHo");
+  response = receive_all(&elapsed);
+  cut_assert_equal_uint(1, count_substrings(response, "HTTP/1.1 200 OK\r\n"));
+  cut_assert_operator_double(elapsed, <, 5.0);
+}
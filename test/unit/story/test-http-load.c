@@ -0,0 +1,197 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright(C) 2014 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <gcutter.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../lib/grn-assertions.h"
+#include "../lib/grn-test-server.h"
+
+void test_one_line(void);
+void test_lines(void);
+
+#define N_RECORDS 5000
+/* Not a multiple of the size of a multibyte character. */
+#define SEND_SIZE 1001
+
+static GrnTestServer *server;
+static grn_ctx *context;
+static grn_obj *database;
+static int client;
+
+void
+cut_setup(void)
+{
+  const gchar *database_path;
+  GError *error = NULL;
+
+  server = grn_test_server_new();
+  context = g_new0(grn_ctx, 1);
+  grn_ctx_init(context, 0);
+  client = -1;
+
+  database_path = grn_test_server_get_database_path(server, &error);
+  gcut_assert_error(error);
+  database = grn_db_create(context, database_path, NULL);
+  assert_send_command("table_create Users TABLE_HASH_KEY ShortText");
+  assert_send_command("column_create Users name COLUMN_SCALAR ShortText");
+  grn_obj_close(context, database);
+  database = NULL;
+
+  grn_test_server_add_option(server, "--protocol", "http");
+  grn_test_server_start(server, &error);
+  gcut_assert_error(error);
+}
+
+void
+cut_teardown(void)
+{
+  if (client != -1) {
+    close(client);
+  }
+  if (context) {
+    grn_ctx_fin(context);
+    g_free(context);
+  }
+  if (server) {
+    g_object_unref(server);
+  }
+}
+
+static void
+open_http_client(void)
+{
+  GError *error = NULL;
+
+  client = grn_test_server_connect(server, &error);
+  gcut_assert_error(error);
+}
+
+static void
+send_all(const gchar *data, size_t size)
+{
+  cut_assert_equal_int(size, send(client, data, size, 0));
+}
+
+static void
+send_string(const gchar *data)
+{
+  send_all(data, strlen(data));
+}
+
+/* Returns the body of a response without its [status, start, elapsed]. */
+static const gchar *
+receive_result(void)
+{
+  GString *response;
+  gchar buffer[4096];
+  ssize_t size;
+  const gchar *result;
+
+  response = g_string_new(NULL);
+  while ((size = recv(client, buffer, sizeof(buffer), 0)) > 0) {
+    g_string_append_len(response, buffer, size);
+  }
+  close(client);
+  client = -1;
+  result = strstr(cut_take_string(g_string_free(response, FALSE)), "],");
+  cut_assert_not_null(result);
+  result += strlen("],");
+  return cut_take_printf("%.*s", (int)(strlen(result) - 1), result);
+}
+
+/* Sends a body in small pieces to make the server receive it in pieces. */
+static const gchar *
+http_load(const gchar *body)
+{
+  size_t body_size = strlen(body);
+  size_t offset;
+
+  open_http_client();
+  send_string(cut_take_printf("POST /d/load?table=Users HTTP/1.0\r\n"
+                           "Content-Type: application/json\r\n"
+                           "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+                           "\r\n",
+                           body_size));
+  for (offset = 0; offset < body_size; offset += SEND_SIZE) {
+    send_all(body + offset, MIN(SEND_SIZE, body_size - offset));
+    g_usleep(1000);
+  }
+  return receive_result();
+}
+
+static const gchar *
+http_get(const gchar *path)
+{
+  open_http_client();
+  send_string(cut_take_printf("GET %s HTTP/1.0\r\n\r\n", path));
+  return receive_result();
+}
+
+static const gchar *
+generate_values(const gchar *separator)
+{
+  GString *values;
+  gint i;
+
+  values = g_string_new("[");
+  for (i = 0; i < N_RECORDS; i++) {
+    g_string_append_printf(values,
+                           "%s{\"_key\": \"user%d\", \"name\": \"ユーザー%d\"}",
+                           i == 0 ? "" : separator, i, i);
+  }
+  g_string_append(values, "]");
+  return cut_take_string(g_string_free(values, FALSE));
+}
+
+static void
+assert_loaded(void)
+{
+  cut_assert_equal_string(
+    "[[[" G_STRINGIFY(N_RECORDS) "],"
+    "[[\"_key\",\"ShortText\"],[\"name\",\"ShortText\"]],"
+    "[\"user0\",\"ユーザー0\"]]]",
+    http_get("/d/select?table=Users&output_columns=_key,name&limit=1"));
+  cut_assert_equal_string(
+    "[[[1],"
+    "[[\"_key\",\"ShortText\"],[\"name\",\"ShortText\"]],"
+    "[\"user4999\",\"ユーザー4999\"]]]",
+    http_get("/d/select?table=Users&output_columns=_key,name"
+             "&query=_key:user4999"));
+}
+
+void
+test_one_line(void)
+{
+  const gchar *body = generate_values(", ");
+
+  cut_assert_operator_int(strlen(body), >, 8192 * 10);
+  cut_assert_equal_string(G_STRINGIFY(N_RECORDS), http_load(body));
+  assert_loaded();
+}
+
+void
+test_lines(void)
+{
+  cut_assert_equal_string(G_STRINGIFY(N_RECORDS),
+                          http_load(generate_values(",\n")));
+  assert_loaded();
+}
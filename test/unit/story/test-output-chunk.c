@@ -0,0 +1,236 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright(C) 2014 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <gcutter.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../lib/grn-assertions.h"
+#include "../lib/grn-test-server.h"
+
+void test_http_chunked(void);
+void test_http_1_0(void);
+void test_gqtp(void);
+
+#define N_RECORDS 2000
+#define OUTPUT_CHUNK_SIZE "1024"
+#define SELECT_PATH "/d/select?table=Users&limit=-1&output_columns=_key,age"
+#define SELECT_COMMAND "select Users --limit -1 --output_columns _key,age"
+
+static GrnTestServer *server;
+static grn_ctx *context;
+static grn_obj *database;
+static const gchar *expected_result;
+static int client;
+
+void
+cut_setup(void)
+{
+  GString *values;
+  const gchar *database_path;
+  GError *error = NULL;
+  gint i;
+
+  server = grn_test_server_new();
+  context = g_new0(grn_ctx, 1);
+  grn_ctx_init(context, 0);
+  client = -1;
+
+  database_path = grn_test_server_get_database_path(server, &error);
+  gcut_assert_error(error);
+  database = grn_db_create(context, database_path, NULL);
+  assert_send_command("table_create Users TABLE_HASH_KEY ShortText");
+  assert_send_command("column_create Users age COLUMN_SCALAR UInt32");
+  values = g_string_new("load --table Users --values '[");
+  for (i = 0; i < N_RECORDS; i++) {
+    g_string_append_printf(values,
+                           "%s{\"_key\": \"user%d\", \"age\": %d}",
+                           i == 0 ? "" : ",", i, i % 100);
+  }
+  g_string_append(values, "]'");
+  assert_send_command(cut_take_string(g_string_free(values, FALSE)));
+  /* The result that is built in memory without streaming. */
+  expected_result = send_command(SELECT_COMMAND);
+  grn_obj_close(context, database);
+  database = NULL;
+}
+
+void
+cut_teardown(void)
+{
+  if (client != -1) {
+    close(client);
+  }
+  if (context) {
+    grn_ctx_fin(context);
+    g_free(context);
+  }
+  if (server) {
+    g_object_unref(server);
+  }
+}
+
+static void
+start_server(const gchar *protocol)
+{
+  GError *error = NULL;
+
+  grn_test_server_add_option(server, "--protocol", protocol);
+  grn_test_server_add_option(server,
+                             "--output-chunk-size", OUTPUT_CHUNK_SIZE);
+  grn_test_server_start(server, &error);
+  gcut_assert_error(error);
+}
+
+static void
+open_http_client(void)
+{
+  GError *error = NULL;
+
+  client = grn_test_server_connect(server, &error);
+  gcut_assert_error(error);
+}
+
+static const gchar *
+http_request(const gchar *request)
+{
+  GString *response;
+  gchar buffer[4096];
+  ssize_t size;
+
+  open_http_client();
+  cut_assert_equal_int(strlen(request),
+                       send(client, request, strlen(request), 0));
+  response = g_string_new(NULL);
+  while ((size = recv(client, buffer, sizeof(buffer), 0)) > 0) {
+    g_string_append_len(response, buffer, size);
+  }
+  close(client);
+  client = -1;
+  return cut_take_string(g_string_free(response, FALSE));
+}
+
+/* Returns the body of a response without its [status, start, elapsed]. */
+static const gchar *
+extract_result(const gchar *body)
+{
+  const gchar *result;
+
+  result = strstr(body, "],");
+  cut_assert_not_null(result);
+  result += strlen("],");
+  cut_assert_true(g_str_has_suffix(result, "]"));
+  return cut_take_printf("%.*s", (int)(strlen(result) - 1), result);
+}
+
+/* Joins the chunks of a body in chunked transfer encoding. */
+static const gchar *
+decode_chunked_body(const gchar *chunked_body, guint *n_chunks)
+{
+  GString *body;
+
+  body = g_string_new(NULL);
+  *n_chunks = 0;
+  for (;;) {
+    gchar *end;
+    guint64 chunk_size;
+    chunk_size = g_ascii_strtoull(chunked_body, &end, 16);
+    cut_assert_true(end != chunked_body);
+    cut_assert_true(g_str_has_prefix(end, "\r\n"));
+    chunked_body = end + strlen("\r\n");
+    if (chunk_size == 0) {
+      break;
+    }
+    cut_assert_operator_uint(strlen(chunked_body), >=, chunk_size + 2);
+    g_string_append_len(body, chunked_body, chunk_size);
+    chunked_body += chunk_size;
+    cut_assert_true(g_str_has_prefix(chunked_body, "\r\n"));
+    chunked_body += strlen("\r\n");
+    (*n_chunks)++;
+  }
+  cut_assert_equal_string("\r\n", chunked_body);
+  return cut_take_string(g_string_free(body, FALSE));
+}
+
+void
+test_http_chunked(void)
+{
+  const gchar *response;
+  const gchar *body;
+  guint n_chunks;
+
+  start_server("http");
+  response = http_request("GET " SELECT_PATH " HTTP/1.1\r\n"
+                          "Connection: close\r\n"
+                          "\r\n");
+  cut_assert_match("\\AHTTP/1.1 200 OK\r\n", response);
+  cut_assert_match("\r\nTransfer-Encoding: chunked\r\n", response);
+  body = strstr(response, "\r\n\r\n");
+  cut_assert_not_null(body);
+  body = decode_chunked_body(body + strlen("\r\n\r\n"), &n_chunks);
+  cut_assert_operator_uint(n_chunks, >, 1);
+  cut_assert_equal_string(expected_result, extract_result(body));
+}
+
+void
+test_http_1_0(void)
+{
+  const gchar *response;
+  const gchar *body;
+
+  start_server("http");
+  response = http_request("GET " SELECT_PATH " HTTP/1.0\r\n\r\n");
+  cut_assert_match("\r\nContent-Length: ", response);
+  body = strstr(response, "\r\n\r\n");
+  cut_assert_not_null(body);
+  cut_assert_equal_string(expected_result,
+                          extract_result(body + strlen("\r\n\r\n")));
+}
+
+void
+test_gqtp(void)
+{
+  grn_ctx client_context;
+  GString *result;
+  guint n_frames = 0;
+  int flags;
+
+  start_server("gqtp");
+  grn_ctx_init(&client_context, 0);
+  grn_test_assert(grn_ctx_connect(&client_context,
+                                  grn_test_server_get_address(server),
+                                  grn_test_server_get_port(server),
+                                  0));
+  grn_ctx_send(&client_context, SELECT_COMMAND, strlen(SELECT_COMMAND), 0);
+  grn_test_assert_context(&client_context);
+  result = g_string_new(NULL);
+  do {
+    char *frame;
+    unsigned int frame_size;
+    grn_ctx_recv(&client_context, &frame, &frame_size, &flags);
+    grn_test_assert_context(&client_context);
+    g_string_append_len(result, frame, frame_size);
+    n_frames++;
+  } while ((flags & GRN_CTX_MORE));
+  grn_ctx_fin(&client_context);
+  cut_assert_operator_uint(n_frames, >, 1);
+  cut_assert_equal_string(expected_result,
+                          cut_take_string(g_string_free(result, FALSE)));
+}
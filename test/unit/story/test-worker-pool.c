@@ -0,0 +1,198 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright(C) 2014 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <gcutter.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../lib/grn-assertions.h"
+#include "../lib/grn-test-server.h"
+
+void data_http(void);
+void test_http(gconstpointer data);
+void data_gqtp(void);
+void test_gqtp(gconstpointer data);
+
+#define N_CLIENTS 8
+
+#define EXPECTED_RESULT                                                 \
+  "[[[2],"                                                              \
+  "[[\"_id\",\"UInt32\"],[\"_key\",\"ShortText\"],[\"age\",\"UInt32\"]]," \
+  "[1,\"alice\",20],"                                                   \
+  "[2,\"bob\",30]]]"
+
+static GrnTestServer *server;
+static grn_ctx *context;
+static grn_obj *database;
+
+void
+cut_setup(void)
+{
+  const gchar *database_path;
+  GError *error = NULL;
+
+  server = grn_test_server_new();
+  context = g_new0(grn_ctx, 1);
+  grn_ctx_init(context, 0);
+
+  database_path = grn_test_server_get_database_path(server, &error);
+  gcut_assert_error(error);
+  database = grn_db_create(context, database_path, NULL);
+  assert_send_commands("table_create Users TABLE_HASH_KEY ShortText\n"
+                       "column_create Users age COLUMN_SCALAR UInt32\n"
+                       "load --table Users\n"
+                       "[\n"
+                       "{\"_key\": \"alice\", \"age\": 20},\n"
+                       "{\"_key\": \"bob\", \"age\": 30}\n"
+                       "]");
+  grn_obj_close(context, database);
+  database = NULL;
+}
+
+void
+cut_teardown(void)
+{
+  if (context) {
+    grn_ctx_fin(context);
+    g_free(context);
+  }
+  if (server) {
+    g_object_unref(server);
+  }
+}
+
+static void
+start_server(const gchar *protocol, const gchar *worker_pool_size)
+{
+  GError *error = NULL;
+
+  grn_test_server_add_option(server, "--protocol", protocol);
+  grn_test_server_add_option(server, "--worker-pool-size", worker_pool_size);
+  grn_test_server_start(server, &error);
+  gcut_assert_error(error);
+}
+
+static void
+add_worker_pool_size_data(void)
+{
+  cut_add_data("on demand", "0", NULL,
+               "pool", "2", NULL);
+}
+
+void
+data_http(void)
+{
+  add_worker_pool_size_data();
+}
+
+static int
+open_http_client(void)
+{
+  GError *error = NULL;
+  int client;
+
+  client = grn_test_server_connect(server, &error);
+  gcut_assert_error(error);
+  return client;
+}
+
+/* Returns the body of a response without its [status, start, elapsed]. */
+static const gchar *
+receive_http_result(int client)
+{
+  GString *response;
+  gchar buffer[4096];
+  ssize_t size;
+  const gchar *body;
+
+  response = g_string_new(NULL);
+  while ((size = recv(client, buffer, sizeof(buffer), 0)) > 0) {
+    g_string_append_len(response, buffer, size);
+  }
+  close(client);
+  body = cut_take_string(g_string_free(response, FALSE));
+  body = strstr(body, "\r\n\r\n");
+  cut_assert_not_null(body);
+  body = strstr(body, "],");
+  cut_assert_not_null(body);
+  return cut_take_printf("[%s", body + strlen("],"));
+}
+
+void
+test_http(gconstpointer data)
+{
+  const gchar *request = "GET /d/select?table=Users&sortby=_key HTTP/1.0\r\n"
+                         "\r\n";
+  int clients[N_CLIENTS];
+  gint i;
+
+  start_server("http", data);
+  for (i = 0; i < N_CLIENTS; i++) {
+    clients[i] = open_http_client();
+  }
+  for (i = 0; i < N_CLIENTS; i++) {
+    cut_assert_equal_int(strlen(request),
+                         send(clients[i], request, strlen(request), 0));
+  }
+  for (i = 0; i < N_CLIENTS; i++) {
+    cut_assert_equal_string(EXPECTED_RESULT,
+                            receive_http_result(clients[i]),
+                            cut_message("client: <%d>", i));
+  }
+}
+
+void
+data_gqtp(void)
+{
+  add_worker_pool_size_data();
+}
+
+void
+test_gqtp(gconstpointer data)
+{
+  const gchar *command = "select Users --sortby _key";
+  grn_ctx clients[N_CLIENTS];
+  gint i;
+
+  start_server("gqtp", data);
+  for (i = 0; i < N_CLIENTS; i++) {
+    grn_ctx_init(&clients[i], 0);
+    grn_test_assert(grn_ctx_connect(&clients[i],
+                                    grn_test_server_get_address(server),
+                                    grn_test_server_get_port(server),
+                                    0));
+  }
+  for (i = 0; i < N_CLIENTS; i++) {
+    grn_ctx_send(&clients[i], command, strlen(command), 0);
+    grn_test_assert_context(&clients[i]);
+  }
+  for (i = 0; i < N_CLIENTS; i++) {
+    char *result;
+    unsigned int result_size;
+    int flags;
+    grn_ctx_recv(&clients[i], &result, &result_size, &flags);
+    grn_test_assert_context(&clients[i]);
+    cut_assert_equal_substring(EXPECTED_RESULT, result, result_size,
+                               cut_message("client: <%d>", i));
+  }
+  for (i = 0; i < N_CLIENTS; i++) {
+    grn_ctx_fin(&clients[i]);
+  }
+}